@@ -12,6 +12,7 @@
 #include "vr_datapath.h"
 #include "vr_defs.h"
 #include "vr_hash.h"
+#include "vr_btable.h"
 
 #if defined(__linux__) && defined(__KERNEL__)
 extern short vr_bridge_table_major;
@@ -20,13 +21,42 @@ unsigned char *vr_bridge_table_path;
 
 unsigned int vr_bridge_entries = VR_DEF_BRIDGE_ENTRIES;
 unsigned int vr_bridge_oentries = 0;
+/* set by the host if the table memory holds the entries of a previous run */
+bool vr_bridge_table_reattach;
 static vr_htable_t vn_rtable;
+static struct vr_bridge_learn_cpu *vr_bridge_learn_cpus;
+static struct vr_timer *vr_bridge_learn_timer;
+
+/* max entries a VRF can take in the bridge table, 0 for no limit */
+unsigned int vr_bridge_vrf_entries = 0;
+/* learnt MACs not seen for so many seconds are aged out, 0 to never */
+unsigned int vr_bridge_age_secs = 0;
+/*
+ * Last time, in learner ticks, the source MAC of the entry was seen. Kept
+ * by entry index, out of the entries whose layout is shared with agent.
+ * Zero for the entries added by agent, which are neither aged nor evicted.
+ */
+static struct vr_btable *vr_bridge_hits;
+static struct vr_btable *vr_bridge_vrf_stats;
+static unsigned int vr_bridge_max_vrfs;
+static uint32_t vr_bridge_clock = 1;
+static unsigned int vr_bridge_scan_index;
+static uint64_t vr_bridge_evicted, vr_bridge_aged, vr_bridge_limit_drops;
+/*
+ * Serializes the learner, which adds, ages and evicts entries from a timer,
+ * with agent adding and deleting entries
+ */
+static uint8_t vr_bridge_update_lock;
 char vr_bcast_mac[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 
 int bridge_table_init(struct vr_rtable *, struct rtable_fspec *);
 void bridge_table_deinit(struct vr_rtable *, struct rtable_fspec *, bool);
 struct vr_bridge_entry *vr_find_bridge_entry(struct vr_bridge_entry_key *);
 struct vr_bridge_entry *vr_find_free_bridge_entry(unsigned int, char *);
+static int vr_bridge_learn_init(void);
+static void vr_bridge_learn_exit(void);
+static void vr_bridge_pkt_flush(void);
+static void vr_bridge_pkt_forget(unsigned int);
 extern struct vr_vrf_stats *(*vr_inet_vrf_stats)(unsigned short, unsigned int);
 extern l4_pkt_type_t vr_ip_well_known_packet(struct vr_packet *);
 extern l4_pkt_type_t vr_ip6_well_known_packet(struct vr_packet *);
@@ -111,10 +141,115 @@ vr_find_free_bridge_entry(unsigned int vrf_id, char *mac)
     return be;
 }
 
+static inline struct vr_bridge_vrf_stats *
+vr_bridge_vrf_get(unsigned int vrf)
+{
+    if (!vr_bridge_vrf_stats || vrf >= vr_bridge_max_vrfs)
+        return NULL;
+
+    return vr_btable_get(vr_bridge_vrf_stats, vrf);
+}
+
+static void
+vr_bridge_vrf_account(unsigned int vrf, int delta)
+{
+    struct vr_bridge_vrf_stats *bvs;
+
+    bvs = vr_bridge_vrf_get(vrf);
+    if (bvs)
+        (void)vr_sync_add_and_fetch_32u(&bvs->bvs_used, delta);
+
+    return;
+}
+
+static void
+vr_bridge_accounting_reset(void)
+{
+    unsigned int i;
+    uint32_t *hit;
+    struct vr_bridge_vrf_stats *bvs;
+
+    for (i = 0; i < vr_bridge_max_vrfs; i++) {
+        bvs = vr_bridge_vrf_get(i);
+        if (!bvs)
+            break;
+        bvs->bvs_used = 0;
+        bvs->bvs_oldest = VR_BE_INVALID_INDEX;
+    }
+
+    for (i = 0; vr_bridge_hits && i < vr_btable_entries(vr_bridge_hits); i++) {
+        hit = vr_btable_get(vr_bridge_hits, i);
+        if (hit)
+            *hit = 0;
+    }
+
+    return;
+}
+
+static inline uint32_t *
+vr_bridge_hit_get(unsigned int index)
+{
+    if (!vr_bridge_hits)
+        return NULL;
+
+    return vr_btable_get(vr_bridge_hits, index);
+}
+
+/*
+ * vr_bridge_hit - note that the source MAC of a learnt entry was seen. The
+ * stamp is written at most once a tick, so that the cpus do not keep
+ * dirtying the cache line.
+ */
+static inline void
+vr_bridge_hit(struct vr_bridge_entry *be)
+{
+    uint32_t *hit, now = vr_bridge_clock;
+
+    hit = vr_bridge_hit_get(be->be_hentry.hentry_index);
+    if (hit && *hit && *hit != now)
+        *hit = now;
+
+    return;
+}
+
+/* a was seen before b */
+static inline bool
+vr_bridge_hit_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+static inline void
+bridge_update_lock(void)
+{
+    while (vr_sync_lock_test_and_set_8u(&vr_bridge_update_lock, 1))
+        ;
+
+    return;
+}
+
+/* for the learner, that must not spin in the timer context */
+static inline bool
+bridge_update_trylock(void)
+{
+    return !vr_sync_lock_test_and_set_8u(&vr_bridge_update_lock, 1);
+}
+
+static inline void
+bridge_update_unlock(void)
+{
+    vr_sync_synchronize();
+    vr_bridge_update_lock = 0;
+
+    return;
+}
+
 static struct vr_bridge_entry *
 bridge_add(unsigned int router_id, unsigned int vrf,
-        uint8_t *mac, int nh_id)
+        uint8_t *mac, int nh_id, bool learnt)
 {
+    uint32_t *hit;
+
     struct vr_bridge_entry *be;
     struct vr_bridge_entry_key key;
     struct vr_nexthop *old_nh;
@@ -132,10 +267,20 @@ bridge_add(unsigned int router_id, unsigned int vrf,
         be->be_packets = 0;
         be->be_flags = VR_BE_VALID_FLAG;
         be->be_nh_id = -1;
+
+        vr_bridge_vrf_account(vrf, 1);
+        hit = vr_bridge_hit_get(be->be_hentry.hentry_index);
+        if (hit)
+            *hit = learnt ? vr_bridge_clock : 0;
+    } else if (!learnt) {
+        /* agent takes the entry over, it is no longer aged nor evicted */
+        hit = vr_bridge_hit_get(be->be_hentry.hentry_index);
+        if (hit)
+            *hit = 0;
     }
 
     /* Un ref the old nexthop */
-    if (be->be_nh_id != nh_id) {
+    if (be->be_nh_id != nh_id || !be->be_nh) {
         old_nh = be->be_nh;
         be->be_nh = vrouter_get_nexthop(router_id, nh_id);
         if (be->be_nh) {
@@ -164,7 +309,7 @@ __bridge_table_add(struct vr_route_req *rt)
     struct vr_bridge_entry *be;
 
     be = bridge_add(rt->rtr_req.rtr_rid, rt->rtr_req.rtr_vrf_id,
-            rt->rtr_req.rtr_mac, rt->rtr_req.rtr_nh_id);
+            rt->rtr_req.rtr_mac, rt->rtr_req.rtr_nh_id, false);
     if (!be)
         return -ENOMEM;
 
@@ -212,7 +357,9 @@ bridge_table_add(struct vr_rtable * _unused, struct vr_route_req *rt)
     if (!rt->rtr_nh)
         return -ENOENT;
 
+    bridge_update_lock();
     ret = __bridge_table_add(rt);
+    bridge_update_unlock();
     vrouter_put_nexthop(rt->rtr_nh);
     return ret;
 }
@@ -221,12 +368,21 @@ static void
 bridge_table_entry_free(vr_htable_t table, vr_hentry_t *hentry,
         unsigned int index, void *data)
 {
+    uint32_t *hit;
     struct vr_nexthop *nh;
     struct vr_bridge_entry *be = (struct vr_bridge_entry *)hentry;
 
     if (!be)
         return;
 
+    if (be->be_flags & VR_BE_VALID_FLAG)
+        vr_bridge_vrf_account(be->be_key.be_vrf_id, -1);
+
+    hit = vr_bridge_hit_get(be->be_hentry.hentry_index);
+    if (hit)
+        *hit = 0;
+    vr_bridge_pkt_forget(be->be_hentry.hentry_index);
+
     /* Mark this entry as invalid */
     be->be_flags &= ~VR_BE_VALID_FLAG;
 
@@ -258,11 +414,15 @@ bridge_table_delete(struct vr_rtable * _unused, struct vr_route_req *rt)
     VR_MAC_COPY(key.be_mac, rt->rtr_req.rtr_mac);
     key.be_vrf_id = rt->rtr_req.rtr_vrf_id;
 
+    bridge_update_lock();
     be = vr_find_bridge_entry(&key);
+    if (be)
+        bridge_table_entry_free(vn_rtable, (vr_hentry_t *)be, 0, NULL);
+    bridge_update_unlock();
+
     if (!be)
         return -ENOENT;
 
-    bridge_table_entry_free(vn_rtable, (vr_hentry_t *)be, 0, NULL);
     return 0;
 }
 
@@ -285,6 +445,52 @@ bridge_update_route_req(struct vr_bridge_entry *be, struct vr_route_req *rt)
     return;
 }
 
+/*
+ * bridge_entry_restore_nh - resolve the nexthop of an entry reattached after
+ * a restart, once the agent has added the nexthop back
+ */
+static void
+bridge_entry_restore_nh(struct vr_bridge_entry *be)
+{
+    struct vr_nexthop *nh;
+
+    /* the entry might have been updated in the meantime */
+    if (!be->be_nh) {
+        nh = vrouter_get_nexthop(0, be->be_nh_id);
+        if (!nh)
+            return;
+
+        if (!vr_sync_bool_compare_and_swap_p(&be->be_nh, NULL, nh))
+            vrouter_put_nexthop(nh);
+    }
+
+    (void)vr_sync_and_and_fetch_16u(&be->be_flags, ~VR_BE_RESTORED_FLAG);
+
+    return;
+}
+
+/*
+ * bridge_entry_restore - clear the state of a bridge entry persisted by a
+ * previous instance. The nexthop pointer is stale, so it is looked up
+ * again by ID on the first use.
+ */
+static bool
+bridge_entry_restore(vr_htable_t table, vr_hentry_t *hentry, void *data)
+{
+    struct vr_bridge_entry *be = (struct vr_bridge_entry *)hentry;
+
+    if (!(be->be_flags & VR_BE_VALID_FLAG))
+        return false;
+
+    be->be_nh = NULL;
+    be->be_packets = 0;
+    if (be->be_nh_id >= 0)
+        be->be_flags |= VR_BE_RESTORED_FLAG;
+    vr_bridge_vrf_account(be->be_key.be_vrf_id, 1);
+
+    return true;
+}
+
 static struct vr_bridge_entry *
 __bridge_lookup(unsigned int vrf_id, struct vr_route_req *rt)
 {
@@ -303,6 +509,9 @@ __bridge_lookup(unsigned int vrf_id, struct vr_route_req *rt)
         be = vr_find_bridge_entry(&key);
     }
 
+    if (be && vr_unlikely(be->be_flags & VR_BE_RESTORED_FLAG))
+        bridge_entry_restore_nh(be);
+
     return be;
 }
 
@@ -470,16 +679,53 @@ bridge_entry_req_destroy(struct vr_route_req *resp)
         vr_free(resp->rtr_req.rtr_mac, VR_ROUTE_REQ_MAC_OBJECT);
 }
 
+#define BRIDGE_DUMP_CURSOR_KEY(vrf)     (((uint64_t)AF_BRIDGE << 32) | (vrf))
+
+/*
+ * bridge_table_dump_resume - find where the previous chunk of the dump of
+ * the VRF stopped, from the cursor it saved. The cursor holds the index of
+ * the last entry dumped, which still has to be the marker. Returns the
+ * index to continue at, or 0 to search for the marker.
+ */
+static unsigned int
+bridge_table_dump_resume(struct vr_message_dumper *dumper)
+{
+    unsigned int *last;
+    struct vr_bridge_entry *be;
+    struct vr_route_req *req = (struct vr_route_req *)(dumper->dump_req);
+
+    if (dumper->dump_been_to_marker)
+        return 0;
+
+    last = vr_message_dump_cursor_get(VR_ROUTE_OBJECT_ID,
+            BRIDGE_DUMP_CURSOR_KEY(req->rtr_req.rtr_vrf_id), 0,
+            req->rtr_req.rtr_mac, VR_ETHER_ALEN);
+    if (!last)
+        return 0;
+
+    be = (struct vr_bridge_entry *)
+        vr_htable_get_hentry_by_index(vn_rtable, *last);
+    if (!be || !(be->be_flags & VR_BE_VALID_FLAG) ||
+            be->be_key.be_vrf_id != req->rtr_req.rtr_vrf_id ||
+            !VR_MAC_CMP(be->be_key.be_mac, req->rtr_req.rtr_mac))
+        return 0;
+
+    dumper->dump_been_to_marker = 1;
+
+    return *last + 1;
+}
+
 static int
 __bridge_table_dump(struct vr_message_dumper *dumper)
 {
     struct vr_route_req *req = (struct vr_route_req *)(dumper->dump_req);
     struct vr_route_req resp;
     int ret;
-    unsigned int i;
+    unsigned int i, last = VR_BE_INVALID_INDEX;
     struct vr_bridge_entry *be;
 
-    for(i = 0; i < (vr_bridge_entries + vr_bridge_oentries); i++) {
+    for (i = bridge_table_dump_resume(dumper);
+            i < (vr_bridge_entries + vr_bridge_oentries); i++) {
         be = (struct vr_bridge_entry *)
                 vr_htable_get_hentry_by_index(vn_rtable, i);
         if (!be)
@@ -497,8 +743,18 @@ __bridge_table_dump(struct vr_message_dumper *dumper)
                     ret = vr_message_dump_object(dumper, VR_ROUTE_OBJECT_ID, &resp);
                     bridge_entry_req_destroy(&resp);
                     if (ret <= 0) {
+                        /* the next chunk asks for what follows the last MAC */
+                        if (last != VR_BE_INVALID_INDEX) {
+                            be = (struct vr_bridge_entry *)
+                                vr_htable_get_hentry_by_index(vn_rtable, last);
+                            vr_message_dump_cursor_save(VR_ROUTE_OBJECT_ID,
+                                    BRIDGE_DUMP_CURSOR_KEY(be->be_key.be_vrf_id),
+                                    0, be->be_key.be_mac, VR_ETHER_ALEN,
+                                    &last, sizeof(last));
+                        }
                         return ret;
                     }
+                    last = i;
                 }
             }
         }
@@ -571,6 +827,31 @@ vr_bridge_table_data_destroy(vr_bridge_table_data *data)
     return;
 }
 
+/*
+ * vr_bridge_table_fill_stats - report the occupancy of the table and of
+ * the VRF asked for, along with the entries the datapath removed to keep
+ * the VRFs within their limit
+ */
+static void
+vr_bridge_table_fill_stats(vr_bridge_table_data *resp, unsigned short vrf)
+{
+    struct vr_bridge_vrf_stats *bvs;
+
+    resp->btable_vrf = vrf;
+    resp->btable_vrf_limit = vr_bridge_vrf_entries;
+    resp->btable_age_secs = vr_bridge_age_secs;
+    resp->btable_used = vr_bridge_table_used_total_entries(NULL);
+    resp->btable_evicted = vr_bridge_evicted;
+    resp->btable_aged = vr_bridge_aged;
+    resp->btable_limit_drops = vr_bridge_limit_drops;
+
+    bvs = vr_bridge_vrf_get(vrf);
+    if (bvs)
+        resp->btable_vrf_entries = bvs->bvs_used;
+
+    return;
+}
+
 static vr_bridge_table_data *
 vr_bridge_table_data_get(void)
 {
@@ -618,6 +899,7 @@ vr_bridge_table_data_process(void *s_req)
     switch (req->btable_op) {
     case SANDESH_OP_GET:
         resp->btable_size = vr_bridge_table_size(router);
+        vr_bridge_table_fill_stats(resp, req->btable_vrf);
 #if defined(__linux__) && defined(__KERNEL__)
         resp->btable_dev = vr_bridge_table_major;
 #endif
@@ -642,9 +924,53 @@ generate_response:
     return;
 }
 
+static void
+vr_bridge_accounting_exit(void)
+{
+    if (vr_bridge_hits) {
+        vr_btable_free(vr_bridge_hits);
+        vr_bridge_hits = NULL;
+    }
+
+    if (vr_bridge_vrf_stats) {
+        vr_btable_free(vr_bridge_vrf_stats);
+        vr_bridge_vrf_stats = NULL;
+    }
+
+    return;
+}
+
+static int
+vr_bridge_accounting_init(unsigned int max_vrfs)
+{
+    if (vr_bridge_hits && vr_bridge_vrf_stats)
+        return 0;
+
+    vr_bridge_hits = vr_btable_alloc(vr_bridge_entries + vr_bridge_oentries,
+            sizeof(uint32_t));
+    if (!vr_bridge_hits)
+        goto fail;
+
+    vr_bridge_max_vrfs = max_vrfs;
+    vr_bridge_vrf_stats = vr_btable_alloc(max_vrfs,
+            sizeof(struct vr_bridge_vrf_stats));
+    if (!vr_bridge_vrf_stats)
+        goto fail;
+
+    vr_bridge_accounting_reset();
+
+    return 0;
+
+fail:
+    vr_bridge_accounting_exit();
+    return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+            vr_bridge_entries + vr_bridge_oentries);
+}
+
 int
 bridge_table_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
 {
+    int ret;
 
     /* If table already exists, dont create again */
     if (rtable->algo_data)
@@ -652,6 +978,10 @@ bridge_table_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
 
     vr_compute_size_bridge_otable();
 
+    ret = vr_bridge_accounting_init(fs->rtb_max_vrfs);
+    if (ret)
+        return ret;
+
     if (!vr_bridge_table && vr_huge_page_mem_get) {
         vr_bridge_table = vr_huge_page_mem_get((VR_BRIDGE_TABLE_SIZE +
                            VR_BRIDGE_OFLOW_TABLE_SIZE), &vr_bridge_table_path);
@@ -659,15 +989,30 @@ bridge_table_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
             vr_bridge_otable = (unsigned char *)vr_bridge_table + VR_BRIDGE_TABLE_SIZE;
     }
 
-    rtable->algo_data = vr_htable_attach(vrouter_get(0), vr_bridge_entries,
+    if (vr_bridge_table_reattach && vr_bridge_table) {
+        rtable->algo_data = vr_htable_reattach(vrouter_get(0),
+                vr_bridge_entries, vr_bridge_table, vr_bridge_oentries,
+                vr_bridge_otable, sizeof(struct vr_bridge_entry),
+                sizeof(struct vr_bridge_entry_key), 0, bridge_entry_key,
+                bridge_entry_restore, NULL);
+        if (rtable->algo_data)
+            vr_printf("vrouter: %u bridge entries restored\n",
+                    vr_htable_used_total_entries(rtable->algo_data));
+    } else {
+        rtable->algo_data = vr_htable_attach(vrouter_get(0), vr_bridge_entries,
                 vr_bridge_table, vr_bridge_oentries, vr_bridge_otable,
                 sizeof(struct vr_bridge_entry),
                 sizeof(struct vr_bridge_entry_key), 0, bridge_entry_key);
+    }
 
     if (!rtable->algo_data)
         return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
                 vr_bridge_entries);
 
+    ret = vr_bridge_learn_init();
+    if (ret)
+        return ret;
+
     /* Max VRF's does not matter as Bridge table is not per VRF. But
      * still this can be maintained in table
      */
@@ -690,9 +1035,19 @@ bridge_table_deinit(struct vr_rtable *rtable, struct rtable_fspec *fs,
     if (!vn_rtable)
         return;
 
-    vr_htable_reset(vn_rtable, bridge_table_entry_free, NULL);
+    /* the counts are kept when the entries are left in place */
+    vr_bridge_pkt_flush();
+
+    /* leave the entries in place for the next instance to reattach */
+    if (soft_reset || !vr_warm_restart) {
+        bridge_update_lock();
+        vr_htable_reset(vn_rtable, bridge_table_entry_free, NULL);
+        bridge_update_unlock();
+    }
 
     if (!soft_reset) {
+        vr_bridge_learn_exit();
+        vr_bridge_accounting_exit();
         vr_htable_delete(vn_rtable);
         rtable->algo_data = NULL;
         vn_rtable = NULL;
@@ -700,57 +1055,433 @@ bridge_table_deinit(struct vr_rtable *rtable, struct rtable_fspec *fs,
 
 }
 
+/*
+ * vr_bridge_pkt_count - count a packet hitting the bridge entry. The
+ * counter is accumulated per cpu and added to the entry in batches, so the
+ * cpus do not fight for the entry cache line on every packet. The cache
+ * line of the cpu counter is only shared with the learner flushing it.
+ */
 static void
-bridge_table_unlock(struct vr_interface *vif, uint8_t *mac, int cpu)
+vr_bridge_pkt_count(struct vr_bridge_entry *be)
 {
-    uint8_t *bridge_table_lock = vif->vif_bridge_table_lock;
+    unsigned int cpu = vr_get_cpu(), index = be->be_hentry.hentry_index;
+    unsigned int flush, old_flush;
+    uint64_t state, new_state;
+    struct vr_bridge_entry *old_be;
+    struct vr_bridge_pkt_counter *bpc;
+
+    if (!vr_bridge_learn_cpus || cpu >= vr_num_cpus) {
+        vr_sync_fetch_and_add_64u(&be->be_packets, 1);
+        return;
+    }
 
-    if (cpu < 0 || !bridge_table_lock)
+    bpc = &vr_bridge_learn_cpus[cpu].blc_pkts[index &
+        (VR_BRIDGE_PKT_CACHE_SZ - 1)];
+    do {
+        state = *(volatile uint64_t *)&bpc->bpc_state;
+        flush = old_flush = 0;
+        if (VR_BPC_INDEX(state) != index) {
+            /* the slot is taken over, the old count goes to its entry */
+            old_flush = VR_BPC_COUNT(state);
+            new_state = VR_BPC_STATE(index, 1);
+        } else if (VR_BPC_COUNT(state) + 1 >= VR_BRIDGE_PKT_CACHE_FLUSH) {
+            flush = VR_BPC_COUNT(state) + 1;
+            new_state = VR_BPC_STATE(index, 0);
+        } else {
+            new_state = state + 1;
+        }
+    } while (!vr_sync_bool_compare_and_swap_64u(&bpc->bpc_state,
+                state, new_state));
+
+    if (old_flush) {
+        old_be = (struct vr_bridge_entry *)
+            vr_htable_get_hentry_by_index(vn_rtable, VR_BPC_INDEX(state));
+        if (old_be)
+            vr_sync_fetch_and_add_64u(&old_be->be_packets, old_flush);
+    }
+
+    if (flush)
+        vr_sync_fetch_and_add_64u(&be->be_packets, flush);
+
+    return;
+}
+
+/*
+ * vr_bridge_pkt_flush - add the packets cached by all the cpus to the
+ * entries, so the counts read from the table do not lag behind for the
+ * entries that see little traffic
+ */
+static void
+vr_bridge_pkt_flush(void)
+{
+    unsigned int cpu, i;
+    uint64_t state;
+    struct vr_bridge_entry *be;
+    struct vr_bridge_pkt_counter *bpc;
+
+    if (!vr_bridge_learn_cpus || !vn_rtable)
+        return;
+
+    for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+        for (i = 0; i < VR_BRIDGE_PKT_CACHE_SZ; i++) {
+            bpc = &vr_bridge_learn_cpus[cpu].blc_pkts[i];
+            do {
+                state = *(volatile uint64_t *)&bpc->bpc_state;
+                if (!VR_BPC_COUNT(state))
+                    break;
+            } while (!vr_sync_bool_compare_and_swap_64u(&bpc->bpc_state,
+                        state, VR_BPC_STATE(VR_BPC_INDEX(state), 0)));
+
+            if (!VR_BPC_COUNT(state))
+                continue;
+
+            be = (struct vr_bridge_entry *)
+                vr_htable_get_hentry_by_index(vn_rtable, VR_BPC_INDEX(state));
+            if (be)
+                vr_sync_fetch_and_add_64u(&be->be_packets,
+                        VR_BPC_COUNT(state));
+        }
+    }
+
+    return;
+}
+
+/*
+ * vr_bridge_pkt_forget - drop the packets cached for an entry being freed,
+ * so that they are not credited to the next user of the index
+ */
+static void
+vr_bridge_pkt_forget(unsigned int index)
+{
+    unsigned int cpu;
+    uint64_t state;
+    struct vr_bridge_pkt_counter *bpc;
+
+    if (!vr_bridge_learn_cpus)
         return;
 
-    bridge_table_lock[cpu] = 0;
+    for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+        bpc = &vr_bridge_learn_cpus[cpu].blc_pkts[index &
+            (VR_BRIDGE_PKT_CACHE_SZ - 1)];
+        do {
+            state = *(volatile uint64_t *)&bpc->bpc_state;
+            if (VR_BPC_INDEX(state) != index || !VR_BPC_COUNT(state))
+                break;
+        } while (!vr_sync_bool_compare_and_swap_64u(&bpc->bpc_state,
+                    state, VR_BPC_STATE(index, 0)));
+    }
 
     return;
 }
 
+/*
+ * vr_bridge_learn_post - queue a request to learn the MAC for the learner,
+ * with a copy of the packet for the learner to trap to agent. Requests for
+ * the MACs already in the queue of the cpu are filtered out. Must be called
+ * on the cpu that owns the queue. Returns 0 if the MAC is queued or
+ * -ENOSPC if the queue is full.
+ */
 static int
-bridge_table_lock(struct vr_interface *vif, uint8_t *mac)
+vr_bridge_learn_post(struct vr_packet *pkt, unsigned short vrf, uint8_t *mac,
+        int nh_id)
 {
-    uint8_t lock = 1, *bridge_table_lock = vif->vif_bridge_table_lock;
-    uint32_t hash;
-    uint64_t t1s, t1ns, t2s, t2ns, diff;
+    unsigned int cpu = vr_get_cpu();
+    uint32_t hash, *recent;
+    struct vr_bridge_learn_cpu *blc;
+    struct vr_bridge_learn_req *req;
 
-    if (!bridge_table_lock)
+    if (!vr_bridge_learn_cpus || cpu >= vr_num_cpus)
         return -EINVAL;
 
-    hash = vr_hash(mac, VR_ETHER_ALEN, 0);
-    hash %= vr_num_cpus;
+    blc = &vr_bridge_learn_cpus[cpu];
 
-    vr_get_mono_time(&t1s, &t1ns);
-    while (lock) {
-        lock = vr_sync_lock_test_and_set_8u(&bridge_table_lock[hash], lock);
-        if (lock) {
-            vr_get_mono_time(&t2s, &t2ns);
-            if (t2ns >= t1ns) {
-                diff = t2ns - t1ns;
-            } else {
-                diff = 999999999 - t1ns + t2ns;
-            }
+    /* never zero, so it does not match an empty slot */
+    hash = vr_hash(mac, VR_ETHER_ALEN, vrf) | 1;
+    recent = &blc->blc_recent[hash & (VR_BRIDGE_LEARN_RECENT_SZ - 1)];
+    if (*recent == hash)
+        return 0;
+
+    if (blc->blc_head - *(volatile unsigned int *)&blc->blc_tail >=
+            VR_BRIDGE_LEARN_RING_SZ)
+        return -ENOSPC;
 
-            if (diff >= 50000) {
-                return -EINVAL;
+    req = &blc->blc_ring[blc->blc_head & (VR_BRIDGE_LEARN_RING_SZ - 1)];
+    VR_MAC_COPY(req->blr_mac, mac);
+    req->blr_vrf = vrf;
+    req->blr_nh_id = nh_id;
+    req->blr_hash = hash;
+    /* without a copy, the next packet from the MAC is trapped instead */
+    req->blr_pkt = pkt_cow(pkt, 0);
+    *recent = hash;
+
+    /* make the request visible before moving the head */
+    vr_sync_synchronize();
+    blc->blc_head++;
+
+    return 0;
+}
+
+/*
+ * vr_bridge_vrf_make_room - check that the VRF can take one more learnt
+ * MAC. A VRF at its limit gives up its least recently seen learnt MAC, as
+ * found by the age scan. Returns false if there is none to give up.
+ */
+static bool
+vr_bridge_vrf_make_room(unsigned int vrf)
+{
+    unsigned int index;
+    uint32_t *hit;
+    struct vr_bridge_entry *be;
+    struct vr_bridge_vrf_stats *bvs;
+
+    bvs = vr_bridge_vrf_get(vrf);
+    if (!bvs || !vr_bridge_vrf_entries ||
+            bvs->bvs_used < vr_bridge_vrf_entries)
+        return true;
+
+    index = bvs->bvs_oldest;
+    bvs->bvs_oldest = VR_BE_INVALID_INDEX;
+    if (index != VR_BE_INVALID_INDEX) {
+        hit = vr_bridge_hit_get(index);
+        be = (struct vr_bridge_entry *)
+            vr_htable_get_hentry_by_index(vn_rtable, index);
+        if (hit && *hit && be && (be->be_flags & VR_BE_VALID_FLAG) &&
+                be->be_key.be_vrf_id == vrf) {
+            bridge_table_entry_free(vn_rtable, (vr_hentry_t *)be, 0, NULL);
+            vr_bridge_evicted++;
+            return true;
+        }
+    }
+
+    vr_bridge_limit_drops++;
+
+    return false;
+}
+
+/*
+ * vr_bridge_age_scan - look at the next few learnt entries of the table.
+ * The ones not seen for vr_bridge_age_secs are aged out, and the least
+ * recently seen entry of each VRF is kept as its eviction candidate.
+ */
+static void
+vr_bridge_age_scan(void)
+{
+    unsigned int i, index, total;
+    uint32_t *hit, *oldest_hit, age_ticks;
+    struct vr_bridge_entry *be;
+    struct vr_bridge_vrf_stats *bvs;
+
+    total = vr_bridge_entries + vr_bridge_oentries;
+    if (!vr_bridge_hits || !total)
+        return;
+
+    age_ticks = vr_bridge_age_secs * (1000 / VR_BRIDGE_LEARN_INTERVAL_MSEC);
+
+    for (i = 0; i < VR_BRIDGE_AGE_SCAN_ENTRIES; i++) {
+        index = vr_bridge_scan_index;
+        if (++vr_bridge_scan_index >= total)
+            vr_bridge_scan_index = 0;
+
+        hit = vr_bridge_hit_get(index);
+        if (!hit || !*hit)
+            continue;
+
+        be = (struct vr_bridge_entry *)
+            vr_htable_get_hentry_by_index(vn_rtable, index);
+        if (!be || !(be->be_flags & VR_BE_VALID_FLAG)) {
+            *hit = 0;
+            continue;
+        }
+
+        if (age_ticks && (vr_bridge_clock - *hit) >= age_ticks) {
+            bridge_table_entry_free(vn_rtable, (vr_hentry_t *)be, 0, NULL);
+            vr_bridge_aged++;
+            continue;
+        }
+
+        bvs = vr_bridge_vrf_get(be->be_key.be_vrf_id);
+        if (!bvs)
+            continue;
+
+        oldest_hit = NULL;
+        if (bvs->bvs_oldest != VR_BE_INVALID_INDEX)
+            oldest_hit = vr_bridge_hit_get(bvs->bvs_oldest);
+        if (!oldest_hit || !*oldest_hit ||
+                vr_bridge_hit_before(*hit, *oldest_hit))
+            bvs->bvs_oldest = index;
+    }
+
+    return;
+}
+
+/*
+ * vr_bridge_learn_add - add the MAC of a learn request, unless it is there
+ * already, and trap the packet queued with the request to agent
+ */
+static void
+vr_bridge_learn_add(struct vr_bridge_learn_req *req)
+{
+    struct vr_packet *pkt = req->blr_pkt;
+    struct vr_bridge_entry *be = NULL;
+    struct vr_bridge_entry_key key;
+
+    req->blr_pkt = NULL;
+
+    /* added by agent or by an earlier request in the meantime */
+    VR_MAC_COPY(key.be_mac, req->blr_mac);
+    key.be_vrf_id = req->blr_vrf;
+    if (!vr_find_bridge_entry(&key) && vr_bridge_vrf_make_room(req->blr_vrf))
+        be = bridge_add(0, req->blr_vrf, req->blr_mac, req->blr_nh_id, true);
+
+    if (!be) {
+        if (pkt)
+            vr_pfree(pkt, VP_DROP_DISCARD);
+        return;
+    }
+
+    if (!pkt) {
+        /* leave the trap to the next packet from the MAC */
+        (void)vr_sync_fetch_and_or_16u(&be->be_flags,
+                VR_BE_MAC_NEW_FLAG | VR_BE_LEARN_TRAP_FLAG);
+        return;
+    }
+
+    (void)vr_sync_fetch_and_or_16u(&be->be_flags, VR_BE_MAC_NEW_FLAG);
+    vr_trap(pkt, req->blr_vrf, AGENT_TRAP_MAC_LEARN,
+            (void *)&be->be_hentry.hentry_index);
+
+    return;
+}
+
+/*
+ * vr_bridge_learn_timeout - the learner. Adds the MACs queued by all the
+ * cpus to the bridge table in a batch and traps the packets queued with
+ * them to agent.
+ */
+static void
+vr_bridge_learn_timeout(void *arg)
+{
+    unsigned int cpu, head;
+    uint32_t *recent;
+    struct vr_bridge_learn_cpu *blc;
+    struct vr_bridge_learn_req *req;
+
+    if (!vr_bridge_learn_cpus || !vn_rtable)
+        return;
+
+    /* agent is updating the table, try again on the next run */
+    if (!bridge_update_trylock())
+        return;
+
+    /* never zero, which marks the entries that are not learnt */
+    if (!++vr_bridge_clock)
+        vr_bridge_clock = 1;
+
+    for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+        blc = &vr_bridge_learn_cpus[cpu];
+        head = *(volatile unsigned int *)&blc->blc_head;
+        /* read the requests only after the head */
+        vr_sync_synchronize();
+
+        while (blc->blc_tail != head) {
+            req = &blc->blc_ring[blc->blc_tail & (VR_BRIDGE_LEARN_RING_SZ - 1)];
+            vr_bridge_learn_add(req);
+
+            /* let the cpu queue the MAC again, e.g. if the table was full */
+            recent = &blc->blc_recent[req->blr_hash &
+                (VR_BRIDGE_LEARN_RECENT_SZ - 1)];
+            if (*recent == req->blr_hash)
+                *recent = 0;
+
+            vr_sync_synchronize();
+            blc->blc_tail++;
+        }
+    }
+
+    vr_bridge_age_scan();
+
+    if (!(vr_bridge_clock % VR_BRIDGE_PKT_FLUSH_TICKS))
+        vr_bridge_pkt_flush();
+
+    bridge_update_unlock();
+
+    return;
+}
+
+static int
+vr_bridge_learn_init(void)
+{
+    struct vr_timer *vtimer;
+
+    if (!vr_bridge_learn_cpus) {
+        vr_bridge_learn_cpus = vr_zalloc(vr_num_cpus *
+                sizeof(struct vr_bridge_learn_cpu), VR_BRIDGE_LEARN_OBJECT);
+        if (!vr_bridge_learn_cpus)
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+                    vr_num_cpus * sizeof(struct vr_bridge_learn_cpu));
+    }
+
+    if (!vr_bridge_learn_timer) {
+        vtimer = vr_zalloc(sizeof(*vtimer), VR_TIMER_OBJECT);
+        if (!vtimer)
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+                    sizeof(*vtimer));
+
+        vtimer->vt_timer = vr_bridge_learn_timeout;
+        vtimer->vt_vr_arg = NULL;
+        vtimer->vt_msecs = VR_BRIDGE_LEARN_INTERVAL_MSEC;
+        if (vr_create_timer(vtimer)) {
+            vr_free(vtimer, VR_TIMER_OBJECT);
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+        }
+
+        vr_bridge_learn_timer = vtimer;
+    }
+
+    return 0;
+}
+
+static void
+vr_bridge_learn_exit(void)
+{
+    unsigned int cpu;
+    struct vr_bridge_learn_cpu *blc;
+    struct vr_bridge_learn_req *req;
+
+    if (vr_bridge_learn_timer) {
+        vr_delete_timer(vr_bridge_learn_timer);
+        vr_free(vr_bridge_learn_timer, VR_TIMER_OBJECT);
+        vr_bridge_learn_timer = NULL;
+    }
+
+    if (vr_bridge_learn_cpus) {
+        /* the packets still waiting for the learner */
+        for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+            blc = &vr_bridge_learn_cpus[cpu];
+            while (blc->blc_tail != blc->blc_head) {
+                req = &blc->blc_ring[blc->blc_tail &
+                    (VR_BRIDGE_LEARN_RING_SZ - 1)];
+                if (req->blr_pkt) {
+                    vr_pfree(req->blr_pkt, VP_DROP_DISCARD);
+                    req->blr_pkt = NULL;
+                }
+                blc->blc_tail++;
             }
         }
+
+        vr_free(vr_bridge_learn_cpus, VR_BRIDGE_LEARN_OBJECT);
+        vr_bridge_learn_cpus = NULL;
     }
 
-    return hash;
+    return;
 }
 
 mac_learn_t
 vr_bridge_learn(struct vrouter *router, struct vr_packet *pkt,
         struct vr_eth *eth, struct vr_forwarding_md *fmd)
 {
-    int lock, valid_src;
+    int valid_src;
+    unsigned short flags;
     unsigned int trap_reason;
     bool trap = false, root = false;
     mac_learn_t ml_res = MAC_EXISTS;
@@ -785,36 +1516,42 @@ vr_bridge_learn(struct vrouter *router, struct vr_packet *pkt,
         if (!nh)
             return MAC_LEARN_FAILURE;
 
-        lock = bridge_table_lock(pkt->vp_if, eth->eth_smac);
-        if (lock < 0)
+        /* the learner adds the MAC, the packet is flooded meanwhile */
+        if (vr_bridge_learn_post(pkt, fmd->fmd_dvrf, eth->eth_smac,
+                    nh->nh_id))
             return MAC_LEARN_FAILURE;
 
-        be = bridge_add(0, fmd->fmd_dvrf, eth->eth_smac, nh->nh_id);
-        if (be)
-            be->be_flags |= VR_BE_MAC_NEW_FLAG;
-        bridge_table_unlock(pkt->vp_if, eth->eth_smac, lock);
-        if (!be)
-            return MAC_LEARN_FAILURE;
+        return MAC_LEARNT;
+    }
 
-        trap_reason = AGENT_TRAP_MAC_LEARN;
-        trap = true;
-        ml_res = MAC_LEARNT;
-    } else {
-        if (!(be->be_flags & VR_BE_MAC_MOVED_FLAG) && (nh->nh_validate_src)) {
-            valid_src = nh->nh_validate_src(pkt, nh, fmd, NULL);
-            if (valid_src != NH_SOURCE_VALID) {
-                if (!vr_bridge_set_route_flags(be, VR_BE_MAC_MOVED_FLAG)) {
-                    /* trap the packet for mac move */
-                    trap_reason = AGENT_TRAP_MAC_MOVE;
-                    trap = true;
-                }
+    flags = be->be_flags;
+    if (vr_unlikely(flags & VR_BE_LEARN_TRAP_FLAG)) {
+        /*
+         * learnt without a copy of the packet to trap, the cpu clearing
+         * the flag traps this one
+         */
+        if (vr_sync_bool_compare_and_swap_16u(&be->be_flags, flags,
+                    flags & ~VR_BE_LEARN_TRAP_FLAG)) {
+            trap_reason = AGENT_TRAP_MAC_LEARN;
+            trap = true;
+            ml_res = MAC_LEARNT;
+        }
+    } else if (!(flags & VR_BE_MAC_MOVED_FLAG) && (nh->nh_validate_src)) {
+        valid_src = nh->nh_validate_src(pkt, nh, fmd, NULL);
+        if (valid_src != NH_SOURCE_VALID) {
+            if (!vr_bridge_set_route_flags(be, VR_BE_MAC_MOVED_FLAG)) {
+                /* trap the packet for mac move */
+                trap_reason = AGENT_TRAP_MAC_MOVE;
+                trap = true;
             }
         }
-        if (be->be_flags & VR_BE_MAC_MOVED_FLAG)
-            ml_res = MAC_MOVED;
     }
 
-    vr_sync_fetch_and_add_64u(&be->be_packets, 1);
+    if (be->be_flags & VR_BE_MAC_MOVED_FLAG)
+        ml_res = MAC_MOVED;
+
+    vr_bridge_pkt_count(be);
+    vr_bridge_hit(be);
 
     if (trap) {
         pkt_c = pkt_cow(pkt, 0);
@@ -1002,7 +1739,7 @@ vr_bridge_input(struct vrouter *router, struct vr_packet *pkt,
         }
 
         if (be)
-            vr_sync_fetch_and_add_64u(&be->be_packets, 1);
+            vr_bridge_pkt_count(be);
 
         if (nh->nh_type != NH_L2_RCV)
             overlay_len = VROUTER_L2_OVERLAY_LEN;
@@ -57,6 +57,8 @@ void *vr_oflow_table;
  * is set by somebody and passed to agent for it to map
  */
 unsigned char *vr_flow_path;
+/* set by the host if the table memory holds the flows of a previous run */
+bool vr_flow_table_reattach;
 unsigned int vr_flow_hold_limit = VR_DEF_MAX_FLOW_TABLE_HOLD_COUNT;
 
 #if defined(__linux__) && defined(__KERNEL__)
@@ -3209,9 +3211,42 @@ vr_compute_size_oflow_table(void)
     }
 }
 
+/*
+ * vr_flow_restore_entry - clear the state of a flow persisted by a previous
+ * instance that does not survive the restart. The nexthops are referenced
+ * by index, so they resolve again once the agent resyncs. Returns false if
+ * the flow should not be restored.
+ */
+static bool
+vr_flow_restore_entry(vr_htable_t htable, vr_hentry_t *ent, void *data)
+{
+    struct vr_flow_entry *fe = (struct vr_flow_entry *)ent;
+
+    /* pointers to the memory of the previous process */
+    fe->fe_hold_list = NULL;
+    fe->fe_mme = NULL;
+
+    /*
+     * Held flows wait for the agent with the packets we no longer
+     * have, the rest are on the way out anyway
+     */
+    if (!(fe->fe_flags & VR_FLOW_FLAG_ACTIVE) ||
+            (fe->fe_flags & (VR_FLOW_FLAG_EVICTED | VR_FLOW_FLAG_DELETE_MARKED)) ||
+            fe->fe_action == VR_FLOW_ACTION_HOLD) {
+        memset((unsigned char *)fe + sizeof(fe->fe_hentry), 0,
+                sizeof(*fe) - sizeof(fe->fe_hentry));
+        return false;
+    }
+
+    return true;
+}
+
 static int
 vr_flow_table_init(struct vrouter *router)
 {
+    unsigned int i;
+    struct vr_flow_entry *fe;
+
     if (!router->vr_flow_table) {
 
         vr_compute_size_oflow_table();
@@ -3224,9 +3259,27 @@ vr_flow_table_init(struct vrouter *router)
                 vr_oflow_table = (char*)vr_flow_table + VR_FLOW_TABLE_SIZE;
         }
 
-        router->vr_flow_table = vr_htable_attach(router, vr_flow_entries,
-                vr_flow_table, vr_oflow_entries, vr_oflow_table,
-                sizeof(struct vr_flow_entry), 0, 0, vr_flow_get_key);
+        if (vr_flow_table_reattach && vr_flow_table) {
+            router->vr_flow_table = vr_htable_reattach(router,
+                    vr_flow_entries, vr_flow_table, vr_oflow_entries,
+                    vr_oflow_table, sizeof(struct vr_flow_entry), 0, 0,
+                    vr_flow_get_key, vr_flow_restore_entry, router);
+            if (router->vr_flow_table) {
+                /* the bucket locks might have been held at the exit */
+                for (i = 0; i < vr_flow_entries; i++) {
+                    fe = (struct vr_flow_entry *)
+                        __vr_htable_get_hentry_by_index(router->vr_flow_table, i);
+                    if (fe)
+                        fe->fe_bucket_lock = 0;
+                }
+                vr_printf("vrouter: %u flow entries restored\n",
+                        vr_htable_used_total_entries(router->vr_flow_table));
+            }
+        } else {
+            router->vr_flow_table = vr_htable_attach(router, vr_flow_entries,
+                    vr_flow_table, vr_oflow_entries, vr_oflow_table,
+                    sizeof(struct vr_flow_entry), 0, 0, vr_flow_get_key);
+        }
 
         if (!router->vr_flow_table) {
             return vr_module_error(-ENOMEM, __FUNCTION__,
@@ -3288,7 +3341,9 @@ vr_link_local_ports_init(struct vrouter *router)
 void
 vr_flow_exit(struct vrouter *router, bool soft_reset)
 {
-    vr_flow_table_reset(router);
+    /* leave the flows in place for the next instance to reattach */
+    if (soft_reset || !vr_warm_restart)
+        vr_flow_table_reset(router);
     vr_link_local_ports_reset(router);
     if (!soft_reset) {
         vr_flow_table_destroy(router);
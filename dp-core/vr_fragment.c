@@ -23,6 +23,12 @@
  * fragment to search and then to forward the other fragments of the packet,
  * while not forwarding the head itself.
 
+ * Hosts that can tell cheaply whether fragments of a datagram are waiting
+ * in their assembler ('enqueue_head_to_assembler') do not need a clone of
+ * the head at all. They queue just the fragment key, and only when there
+ * is something to flush, since the ports are already in the fragment
+ * metadata table by the time the head is handed over.
+
  * Enqueue to per-cpu queue
  * ------------------------
 
@@ -45,6 +51,12 @@
  * update, if the old head is not the same as the next, next will be updated to
  * NULL.
 
+ * Platforms whose enqueue and assembly for a queue always run on the same
+ * cpu (DPDK forwarding lcores) can instead turn the per-cpu queue into a
+ * single producer single consumer ring (vr_fragment_queue_ring_init()) fed
+ * from a fixed per-cpu element pool, so that no allocation or atomic
+ * operation happens per fragment.
+
  * The Assembler
  * -------------
 
@@ -150,28 +162,111 @@ fragment_entry_set(struct vr_fragment *fe, struct vr_fragment_key *key,
     return;
 }
 
-void
-vr_fragment_queue_free(struct vr_fragment_queue *queue)
+/*
+ * vr_fragment_pool_alloc - allocate a pool of size queue elements. Elements
+ * are taken from and returned to the pool without atomics, so the pool
+ * can only be used by queues whose enqueue, assembly and aging all run on
+ * the same cpu. Returns NULL on allocation failure.
+ */
+struct vr_fragment_pool *
+vr_fragment_pool_alloc(unsigned int size)
 {
-    struct vr_fragment_queue_element *vfqe, *next;
+    unsigned int i;
+    struct vr_fragment_pool *pool;
 
-    vfqe = queue->vfq_tail;
-    queue->vfq_tail = NULL;
-    while (vfqe) {
-        next = vfqe->fqe_next;
-        if (vfqe->fqe_pnode.pl_packet) {
-            PKT_LOG(VP_DROP_MISC, 0, 0, VR_FRAGMENT_C, __LINE__);
-            vr_pfree(vfqe->fqe_pnode.pl_packet, VP_DROP_MISC);
-            vfqe->fqe_pnode.pl_packet = NULL;
-        }
-        vr_free(vfqe, VR_FRAGMENT_QUEUE_ELEMENT_OBJECT);
-        vfqe = next;
+    pool = vr_zalloc(sizeof(*pool) +
+            (size * sizeof(struct vr_fragment_queue_element)),
+            VR_FRAGMENT_QUEUE_OBJECT);
+    if (!pool)
+        return NULL;
+
+    pool->vfp_size = size;
+    for (i = 0; i < size; i++) {
+        pool->vfp_elements[i].fqe_pool = pool;
+        pool->vfp_elements[i].fqe_next = pool->vfp_free;
+        pool->vfp_free = &pool->vfp_elements[i];
     }
 
+    return pool;
+}
+
+void
+vr_fragment_pool_free(struct vr_fragment_pool *pool)
+{
+    if (!pool)
+        return;
+
+    if (pool->vfp_used)
+        vr_printf("Vrouter: freeing fragment pool with %u elements in use\n",
+                pool->vfp_used);
+
+    vr_free(pool, VR_FRAGMENT_QUEUE_OBJECT);
     return;
 }
 
+/*
+ * vr_fragment_queue_ring_init - switch a per-cpu queue from the CAS list to
+ * a single producer single consumer ring of size (a power of 2) slots, with
+ * elements coming from pool. Returns 0 or -ENOMEM.
+ */
+int
+vr_fragment_queue_ring_init(struct vr_fragment_queue *vfq,
+        struct vr_fragment_pool *pool, unsigned int size)
+{
+    vfq->vfq_ring = vr_zalloc(size * sizeof(*vfq->vfq_ring),
+            VR_FRAGMENT_QUEUE_OBJECT);
+    if (!vfq->vfq_ring)
+        return -ENOMEM;
+
+    vfq->vfq_ring_mask = size - 1;
+    vfq->vfq_prod = vfq->vfq_cons = 0;
+    vfq->vfq_pool = pool;
+
+    return 0;
+}
+
+static struct vr_fragment_queue_element *
+vr_fragment_queue_element_get(struct vr_fragment_queue *vfq)
+{
+    struct vr_fragment_queue_element *fqe;
+    struct vr_fragment_pool *pool = vfq->vfq_pool;
+
+    if (!pool) {
+        fqe = vr_malloc(sizeof(*fqe), VR_FRAGMENT_QUEUE_ELEMENT_OBJECT);
+        if (fqe)
+            fqe->fqe_pool = NULL;
+        return fqe;
+    }
+
+    fqe = pool->vfp_free;
+    if (!fqe)
+        return NULL;
+
+    pool->vfp_free = fqe->fqe_next;
+    pool->vfp_used++;
+
+    return fqe;
+}
+
 static void
+vr_fragment_queue_element_put(struct vr_fragment_queue_element *fqe)
+{
+    struct vr_fragment_pool *pool = fqe->fqe_pool;
+
+    if (!pool) {
+        vr_free(fqe, VR_FRAGMENT_QUEUE_ELEMENT_OBJECT);
+        return;
+    }
+
+    fqe->fqe_pnode.pl_packet = NULL;
+    fqe->fqe_next = pool->vfp_free;
+    pool->vfp_free = fqe;
+    pool->vfp_used--;
+
+    return;
+}
+
+void
 vr_fragment_queue_element_free(struct vr_fragment_queue_element *vfqe,
         unsigned int drop_reason)
 {
@@ -180,12 +275,41 @@ vr_fragment_queue_element_free(struct vr_fragment_queue_element *vfqe,
         vr_pfree(vfqe->fqe_pnode.pl_packet, drop_reason);
     }
 
-    vr_free(vfqe, VR_FRAGMENT_QUEUE_ELEMENT_OBJECT);
+    vr_fragment_queue_element_put(vfqe);
     return;
 }
 
-static void
-fragment_free_frag(struct vr_fragment *frag)
+void
+vr_fragment_queue_free(struct vr_fragment_queue *queue)
+{
+    struct vr_fragment_queue_element *vfqe, *next;
+
+    if (queue->vfq_ring) {
+        while (queue->vfq_cons != queue->vfq_prod) {
+            vfqe = queue->vfq_ring[queue->vfq_cons & queue->vfq_ring_mask];
+            queue->vfq_cons++;
+            vr_fragment_queue_element_free(vfqe, VP_DROP_MISC);
+        }
+
+        vr_free(queue->vfq_ring, VR_FRAGMENT_QUEUE_OBJECT);
+        queue->vfq_ring = NULL;
+        queue->vfq_pool = NULL;
+    }
+
+    vfqe = queue->vfq_tail;
+    queue->vfq_tail = NULL;
+    while (vfqe) {
+        next = vfqe->fqe_next;
+        vr_fragment_queue_element_free(vfqe, VP_DROP_MISC);
+        vfqe = next;
+    }
+
+    return;
+}
+
+/* Drop all the fragments still waiting in an assembler entry */
+void
+vr_fragment_drop_queued(struct vr_fragment *frag)
 {
     struct vr_fragment_queue_element *fqe;
 
@@ -194,6 +318,13 @@ fragment_free_frag(struct vr_fragment *frag)
         vr_fragment_queue_element_free(fqe, VP_DROP_FRAGMENTS);
     }
 
+    return;
+}
+
+static void
+fragment_free_frag(struct vr_fragment *frag)
+{
+    vr_fragment_drop_queued(frag);
     vr_free(frag, VR_FRAGMENT_OBJECT);
     return;
 }
@@ -316,6 +447,121 @@ exit_flush:
     return;
 }
 
+/*
+ * vr_fragment_assemble_key - fill the assembler key of a queued fragment.
+ * Returns true if the fragment is the (cloned) head fragment or a head
+ * notification.
+ */
+bool
+vr_fragment_assemble_key(struct vr_fragment_queue_element *vfqe,
+        struct vr_fragment_key *vfk)
+{
+    uint64_t *v6_addr;
+    struct vr_ip *ip;
+    struct vr_ip6 *ip6;
+    struct vr_ip6_frag *v6_frag;
+    struct vr_packet_node *pnode = &vfqe->fqe_pnode;
+
+    if (!pnode->pl_packet) {
+        memcpy(vfk, &vfqe->fqe_key, sizeof(*vfk));
+        return true;
+    }
+
+    ip = (struct vr_ip *)pkt_network_header(pnode->pl_packet);
+    if (vr_ip_is_ip6(ip)) {
+        ip6 = (struct vr_ip6 *)ip;
+        v6_frag = (struct vr_ip6_frag *)(ip6 + 1);
+        v6_addr = (uint64_t *)(ip6->ip6_src);
+        __fragment_key(vfk, pnode->pl_vrf, *v6_addr, *(v6_addr + 1),
+                *(v6_addr + 2), *(v6_addr + 3), v6_frag->ip6_frag_id,
+                pnode->pl_custom);
+    } else {
+        __fragment_key(vfk, pnode->pl_vrf, 0, pnode->pl_inner_src_ip,
+            0, pnode->pl_inner_dst_ip, ip->ip_id, pnode->pl_custom);
+    }
+
+    return !!(pnode->pl_flags & PN_FLAG_FRAGMENT_HEAD);
+}
+
+/*
+ * vr_fragment_assemble_bypass - if a non-head fragment arrives after its
+ * head fragment has already created the fragment metadata entry, it does
+ * not need the assembler. Flushes (re-injects) such a fragment for regular
+ * processing and returns true.
+ */
+bool
+vr_fragment_assemble_bypass(struct vr_fragment_queue_element *vfqe,
+        bool frag_head)
+{
+    struct vr_ip *ip;
+    struct vr_packet_node *pnode = &vfqe->fqe_pnode;
+
+    if (frag_head)
+        return false;
+
+    ip = (struct vr_ip *)pkt_network_header(pnode->pl_packet);
+    if (!vr_fragment_get(vfqe->fqe_router, pnode->pl_vrf, ip,
+                pnode->pl_custom))
+        return false;
+
+    vr_fragment_flush_queue_element(vfqe);
+    return true;
+}
+
+/*
+ * vr_fragment_assemble_entry - add a fragment to its assembler entry. A
+ * non-head fragment is appended to the entry, while the head fragment only
+ * validates the port information and is freed. Once the port information
+ * is valid, every queued fragment is flushed for regular processing.
+ * Returns true if the entry is done with and the caller has to remove it
+ * from its table.
+ */
+bool
+vr_fragment_assemble_entry(struct vr_fragment *frag,
+        struct vr_fragment_queue_element *vfqe, bool frag_head)
+{
+    struct vr_fragment_queue_element *fqe;
+
+    /* If the packet is non a fragment head,
+     * append the packet to the end of the fragment
+     * queue entry of the assembler bucket
+     */
+    if (!frag_head) {
+        vfqe->fqe_next = NULL;
+        fqe = frag->f_qe;
+        if (!fqe) {
+            frag->f_qe = vfqe;
+        } else {
+            while (fqe->fqe_next)
+                fqe = fqe->fqe_next;
+
+            fqe->fqe_next = vfqe;
+        }
+    } else {
+        /* If the packet is a fragment head, make the port
+         * info as valid since it contains a valid transport
+         * header. Also, free the cloned head-fragment
+         */
+        frag->f_port_info_valid = true;
+        vr_fragment_queue_element_free(vfqe, VP_DROP_CLONED_ORIGINAL);
+    }
+
+    /* If a head fragment arrives after the non-head
+     * fragments, it means that we have the valid port info.
+     * In this case, flush the non-head fragments and
+     * re-inject them for normal packet processing
+     */
+    if (!frag->f_port_info_valid)
+        return false;
+
+    while ((fqe = frag->f_qe)) {
+        frag->f_qe = fqe->fqe_next;
+        vr_fragment_flush_queue_element(fqe);
+    }
+
+    return true;
+}
+
 /* Main assembler function to process fragments from per-cpu queue to
  * assembler_table
  * - Create a head fragment entry if head fragment arrives
@@ -335,42 +581,14 @@ vr_fragment_assemble(struct vr_fragment **head_p,
     int ret = 0;
     uint64_t sec, nsec;
     unsigned int list_length = 0, drop_reason;
-    bool found = false, frag_head = false;
-    uint64_t *v6_addr;
+    bool found = false, frag_head;
 
-    struct vrouter *router;
-    struct vr_ip *ip;
-    struct vr_ip6 *ip6;
-    struct vr_ip6_frag *v6_frag;
     struct vr_packet *pkt;
-    struct vr_packet_node *pnode;
-    struct vr_fragment *frag, *frag_flow, **prev = NULL;
-    struct vr_fragment_queue_element *fqe;
+    struct vr_fragment *frag, **prev = NULL;
     struct vr_fragment_key vfk;
 
-
-    router = vfqe->fqe_router;
-    pnode = &vfqe->fqe_pnode;
-
-    /* Is it head fragment? */
-    if (pnode->pl_flags & PN_FLAG_FRAGMENT_HEAD)
-        frag_head = true;
-
-    pkt = pnode->pl_packet;
-    ip = (struct vr_ip *)pkt_network_header(pkt);
-
-    /* Get hash of the fragment key */
-    if (vr_ip_is_ip6(ip)) {
-       ip6 = (struct vr_ip6 *)ip;
-       v6_frag = (struct vr_ip6_frag *)(ip6 + 1);
-       v6_addr = (uint64_t *)(ip6->ip6_src);
-        __fragment_key(&vfk, pnode->pl_vrf, *v6_addr, *(v6_addr + 1),
-                *(v6_addr +2 ), *(v6_addr + 3), v6_frag->ip6_frag_id,
-                pnode->pl_custom);
-    } else {
-        __fragment_key(&vfk, pnode->pl_vrf, 0, pnode->pl_inner_src_ip,
-            0, pnode->pl_inner_dst_ip, ip->ip_id, pnode->pl_custom);
-    }
+    pkt = vfqe->fqe_pnode.pl_packet;
+    frag_head = vr_fragment_assemble_key(vfqe, &vfk);
 
     /* Check if the fragment with the same key is found
      * in the assembler bucket
@@ -388,17 +606,8 @@ vr_fragment_assemble(struct vr_fragment **head_p,
         frag = frag->f_next;
     }
 
-    /* If its a non-head fragment and the head fragment has
-     * already arrived, just flush (re-inject) it for regular
-     * packet processing
-     */
-    if (!frag_head) {
-        frag_flow = vr_fragment_get(router, pnode->pl_vrf, ip, pnode->pl_custom);
-        if (frag_flow) {
-            vr_fragment_flush_queue_element(vfqe);
-            return 0;
-        }
-    }
+    if (vr_fragment_assemble_bypass(vfqe, frag_head))
+        return 0;
 
     /* If fragment entry is not found */
     if (!found) {
@@ -447,48 +656,8 @@ vr_fragment_assemble(struct vr_fragment **head_p,
         *head_p = frag;
     }
 
-    /* If the packet is non a fragment head,
-     * append the packet to the end of the fragment
-     * queue entry of the assembler bucket
-     */
-    if (!frag_head) {
-        vfqe->fqe_next = NULL;
-        fqe = frag->f_qe;
-        if (!fqe) {
-            frag->f_qe = vfqe;
-        } else {
-            while (fqe) {
-                if (fqe->fqe_next) {
-                    fqe = fqe->fqe_next;
-                } else {
-                    break;
-                }
-            }
-
-            fqe->fqe_next = vfqe;
-        }
-    } else {
-        /* If the packet is a fragment head, make the port
-         * info as valid since it contains a valid transport
-         * header. Also, free the cloned head-fragment
-         */
-        frag->f_port_info_valid = true;
-        PKT_LOG(VP_DROP_CLONED_ORIGINAL, pkt, 0, VR_FRAGMENT_C, __LINE__);
-        vr_fragment_queue_element_free(vfqe, VP_DROP_CLONED_ORIGINAL);
-    }
-
-    /* If a head fragment arrives after the non-head
-     * fragments, it means that we have the valid port info.
-     * In this case, flush the non-head fragments and
-     * re-inject them for normal packet processing
-     */
-    if (frag->f_port_info_valid) {
-        while ((fqe = frag->f_qe)) {
-            frag->f_qe = fqe->fqe_next;
-            vr_fragment_flush_queue_element(fqe);
-        }
-
-        /* After flushing, remove the fragment entries from assembler table */
+    /* After flushing, remove the fragment entries from assembler table */
+    if (vr_fragment_assemble_entry(frag, vfqe, frag_head)) {
         fragment_unlink_frag(prev, frag);
         fragment_free_frag(frag);
     }
@@ -503,9 +672,28 @@ exit_assembly:
 void
 vr_fragment_assemble_queue(struct vr_fragment_queue *vfq)
 {
+    unsigned int cons;
     struct vr_packet_node *pnode;
     struct vr_fragment_queue_element *tail, *tail_n, *tail_p, *tail_pn;
 
+    if (vfq->vfq_ring) {
+        for (cons = vfq->vfq_cons; cons != vfq->vfq_prod; cons++) {
+            /* the slot must be read only after the producer published it */
+            vr_sync_synchronize();
+            tail = vfq->vfq_ring[cons & vfq->vfq_ring_mask];
+            vr_sync_synchronize();
+            vfq->vfq_cons = cons + 1;
+
+            if (tail->fqe_pnode.pl_packet ||
+                    (tail->fqe_pnode.pl_flags & PN_FLAG_FRAGMENT_HEAD))
+                vr_fragment_sync_assemble(tail);
+            else
+                vr_fragment_queue_element_put(tail);
+        }
+
+        return;
+    }
+
     tail = vr_sync_lock_test_and_set_p(&vfq->vfq_tail, NULL);
     if (!tail) {
         return;
@@ -587,13 +775,20 @@ vr_fragment_enqueue(struct vrouter *router,
         struct vr_packet *pkt, struct vr_forwarding_md *fmd)
 {
     bool swapped = false;
-    unsigned int i;
+    unsigned int i, prod = 0;
 
     struct vr_packet_node *pnode;
     struct vr_fragment_queue_element *fqe = NULL, *tail, **tailp;
 
     tailp = &vfq->vfq_tail;
-    if (*tailp == NULL) {
+    if (vfq->vfq_ring) {
+        /* single producer: only this cpu ever moves vfq_prod */
+        prod = vfq->vfq_prod;
+        if ((prod - vfq->vfq_cons) > vfq->vfq_ring_mask) {
+            PKT_LOG(VP_DROP_FRAGMENTS, pkt, 0, VR_FRAGMENT_C, __LINE__);
+            goto fail;
+        }
+    } else if (*tailp == NULL) {
         vfq->vfq_length = 0;
     } else {
         if ((vfq->vfq_length + 1) > VR_MAX_FRAGMENTS_PER_CPU_QUEUE) {
@@ -603,14 +798,14 @@ vr_fragment_enqueue(struct vrouter *router,
     }
 
     /* Check if the total number of fragmented packets across
-     * all cores exceeded. */
-    if (vrouter_host->hos_is_frag_limit_exceeded &&
+     * all cores exceeded. A pool bounds the number by itself. */
+    if (!vfq->vfq_pool && vrouter_host->hos_is_frag_limit_exceeded &&
             vrouter_host->hos_is_frag_limit_exceeded()) {
             PKT_LOG(VP_DROP_FRAGMENTS, pkt, 0, VR_FRAGMENT_C, __LINE__);
             goto fail;
     }
 
-    fqe = vr_malloc(sizeof(*fqe), VR_FRAGMENT_QUEUE_ELEMENT_OBJECT);
+    fqe = vr_fragment_queue_element_get(vfq);
     if (!fqe) {
         PKT_LOG(VP_DROP_FRAGMENTS, pkt, 0, VR_FRAGMENT_C, __LINE__);
         goto fail;
@@ -623,6 +818,14 @@ vr_fragment_enqueue(struct vrouter *router,
     pnode = &fqe->fqe_pnode;
     vr_flow_fill_pnode(pnode, pkt, fmd);
 
+    if (vfq->vfq_ring) {
+        vfq->vfq_ring[prod & vfq->vfq_ring_mask] = fqe;
+        /* publish the slot before the new producer index */
+        vr_sync_synchronize();
+        vfq->vfq_prod = prod + 1;
+        return 0;
+    }
+
     /*
      * we are actually competing with an existing assembler work that must
      * be in the process of dequeueing the list from the per-cpu queue.
@@ -654,12 +857,108 @@ vr_fragment_enqueue(struct vrouter *router,
 
 fail:
     if (fqe)
-        vr_free(fqe, VR_FRAGMENT_QUEUE_ELEMENT_OBJECT);
+        vr_fragment_queue_element_put(fqe);
 
     vr_pfree(pkt, VP_DROP_FRAGMENTS);
     return -1;
 }
 
+/*
+ * vr_fragment_head_key - fill the assembler key of a head fragment that is
+ * still being forwarded, the same way vr_fragment_assemble_key() would for
+ * its clone.
+ */
+void
+vr_fragment_head_key(struct vr_packet *pkt, struct vr_forwarding_md *fmd,
+        struct vr_fragment_key *vfk)
+{
+    uint64_t *v6_addr;
+    struct vr_ip *ip, *inner_ip;
+    struct vr_ip6 *ip6;
+    struct vr_ip6_frag *v6_frag;
+
+    ip = (struct vr_ip *)pkt_network_header(pkt);
+    if (vr_ip_is_ip6(ip)) {
+        ip6 = (struct vr_ip6 *)ip;
+        v6_frag = (struct vr_ip6_frag *)(ip6 + 1);
+        v6_addr = (uint64_t *)(ip6->ip6_src);
+        __fragment_key(vfk, fmd->fmd_dvrf, *v6_addr, *(v6_addr + 1),
+                *(v6_addr + 2), *(v6_addr + 3), v6_frag->ip6_frag_id, 0);
+    } else {
+        inner_ip = (struct vr_ip *)pkt_inner_network_header(pkt);
+        if (!inner_ip)
+            inner_ip = ip;
+        __fragment_key(vfk, fmd->fmd_dvrf, 0, inner_ip->ip_saddr,
+                0, inner_ip->ip_daddr, ip->ip_id, 0);
+    }
+
+    return;
+}
+
+/*
+ * vr_fragment_enqueue_head - queue a head notification, i.e. an element
+ * with just the fragment key and no packet, to a ring queue. Returns 0,
+ * -EINVAL if the queue is not a ring or -ENOSPC if it is full.
+ */
+int
+vr_fragment_enqueue_head(struct vrouter *router, struct vr_fragment_queue *vfq,
+        struct vr_fragment_key *vfk)
+{
+    unsigned int prod;
+    struct vr_fragment_queue_element *fqe;
+
+    if (!vfq->vfq_ring)
+        return -EINVAL;
+
+    prod = vfq->vfq_prod;
+    if ((prod - vfq->vfq_cons) > vfq->vfq_ring_mask)
+        return -ENOSPC;
+
+    fqe = vr_fragment_queue_element_get(vfq);
+    if (!fqe)
+        return -ENOSPC;
+
+    fqe->fqe_router = router;
+    fqe->fqe_next = NULL;
+    memcpy(&fqe->fqe_key, vfk, sizeof(*vfk));
+    fqe->fqe_pnode.pl_flags = PN_FLAG_FRAGMENT_HEAD;
+    fqe->fqe_pnode.pl_packet = NULL;
+
+    vfq->vfq_ring[prod & vfq->vfq_ring_mask] = fqe;
+    vr_sync_synchronize();
+    vfq->vfq_prod = prod + 1;
+
+    return 0;
+}
+
+/*
+ * vr_fragment_head_to_assembler - tell the assembler that the head of a
+ * fragmented datagram has arrived, so that the fragments waiting for it
+ * get flushed. The head is not consumed. Returns 0, or -ENOMEM if the
+ * head had to be cloned and the clone failed.
+ */
+int
+vr_fragment_head_to_assembler(struct vrouter *router, struct vr_packet *pkt,
+        struct vr_forwarding_md *fmd)
+{
+    struct vr_packet *pkt_c;
+
+    if (vr_enqueue_head_to_assembler) {
+        vr_enqueue_head_to_assembler(router, pkt, fmd);
+        return 0;
+    }
+
+    if (!vr_enqueue_to_assembler)
+        return 0;
+
+    pkt_c = vr_pclone(pkt);
+    if (!pkt_c)
+        return -ENOMEM;
+
+    vr_enqueue_to_assembler(router, pkt_c, fmd);
+    return 0;
+}
+
 
 /* Delete fragment from the fragment hash table */
 void
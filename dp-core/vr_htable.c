@@ -673,15 +673,159 @@ vr_htable_get_address(vr_htable_t htable, uint64_t offset)
     return vr_btable_get_address(btable, offset);
 }
 
-vr_htable_t
+static void
+vr_htable_init_entries(struct vr_htable *table)
+{
+    unsigned int i;
+    vr_hentry_t *ent, *prev;
+
+    for (i = 0; i < table->ht_hentries; i++) {
+        ent = vr_btable_get(table->ht_htable, i);
+        ent->hentry_index = i;
+        ent->hentry_next_index = VR_INVALID_HENTRY_INDEX;
+    }
+
+
+    prev = NULL;
+    for (i = 0; i < table->ht_oentries; i++) {
+        ent = vr_btable_get(table->ht_otable, i);
+        ent->hentry_index = table->ht_hentries + i;
+        ent->hentry_next_index = VR_INVALID_HENTRY_INDEX;
+        if (i == 0)
+            table->ht_free_oentry_head = ent;
+        else
+            prev->hentry_next = ent;
+
+        ent->hentry_flags |= VR_HENTRY_FLAG_IN_FREE_LIST;
+        prev = ent;
+    }
+
+    return;
+}
+
+/*
+ * vr_htable_restore_drop - drop a persisted entry. The payload is cleared
+ * as well, since the agent maps the table and would otherwise still see
+ * the entry.
+ */
+static void
+vr_htable_restore_drop(struct vr_htable *table, vr_hentry_t *ent)
+{
+    ent->hentry_flags = 0;
+    memset((unsigned char *)ent + sizeof(vr_hentry_t), 0,
+            table->ht_entry_size - sizeof(vr_hentry_t));
+
+    return;
+}
+
+/*
+ * vr_htable_restore_entries - rebuild the table state from the entries
+ * persisted by a previous instance. The overflow chains are rebuilt from
+ * the entry indexes, since the pointers are stale. Entries under deletion
+ * and entries rejected by the restore callback are dropped. Overflow
+ * entries not reached from a valid chain are dropped and put back to the
+ * free list.
+ */
+static void
+vr_htable_restore_entries(struct vr_htable *table,
+        htable_restore_cb restore_cb, void *data)
+{
+    unsigned int i, index, steps;
+    vr_hentry_t *ent, *prev, *tail;
+
+    for (i = 0; i < table->ht_hentries; i++) {
+        ent = vr_btable_get(table->ht_htable, i);
+        ent->hentry_index = i;
+        ent->hentry_next = NULL;
+        if (!(ent->hentry_flags & VR_HENTRY_FLAG_VALID)) {
+            ent->hentry_flags = 0;
+            continue;
+        }
+
+        if (!(ent->hentry_flags & VR_HENTRY_FLAG_UNDER_DELETION) &&
+                restore_cb((vr_htable_t)table, ent, data)) {
+            ent->hentry_flags = VR_HENTRY_FLAG_VALID;
+            table->ht_used_entries++;
+        } else {
+            vr_htable_restore_drop(table, ent);
+        }
+    }
+
+    /* mark all the overflow entries free until reached from a chain */
+    for (i = 0; i < table->ht_oentries; i++) {
+        ent = vr_btable_get(table->ht_otable, i);
+        ent->hentry_index = table->ht_hentries + i;
+        ent->hentry_next = NULL;
+        ent->hentry_flags |= VR_HENTRY_FLAG_IN_FREE_LIST;
+    }
+
+    for (i = 0; i < table->ht_hentries; i++) {
+        tail = vr_btable_get(table->ht_htable, i);
+        index = tail->hentry_next_index;
+        tail->hentry_next_index = VR_INVALID_HENTRY_INDEX;
+
+        /* the walk is bounded in case the persisted chain has a loop */
+        for (steps = 0; steps < table->ht_oentries; steps++) {
+            if (index < table->ht_hentries ||
+                    index >= table->ht_hentries + table->ht_oentries)
+                break;
+
+            ent = vr_btable_get(table->ht_otable, index - table->ht_hentries);
+            /* already linked to some chain */
+            if (!(ent->hentry_flags & VR_HENTRY_FLAG_IN_FREE_LIST))
+                break;
+
+            index = ent->hentry_next_index;
+            if ((ent->hentry_flags & VR_HENTRY_FLAG_UNDER_DELETION) ||
+                    !(ent->hentry_flags & VR_HENTRY_FLAG_VALID) ||
+                    ent->hentry_bucket_index != i ||
+                    !restore_cb((vr_htable_t)table, ent, data)) {
+                /* keeps the free list mark, so it is cleared below */
+                ent->hentry_flags &= ~VR_HENTRY_FLAG_VALID;
+                continue;
+            }
+
+            ent->hentry_flags = VR_HENTRY_FLAG_VALID;
+            ent->hentry_next_index = VR_INVALID_HENTRY_INDEX;
+            tail->hentry_next = ent;
+            tail->hentry_next_index = ent->hentry_index;
+            tail = ent;
+            table->ht_used_oentries++;
+            table->ht_used_entries++;
+        }
+    }
+
+    /* put the rest of the overflow entries to the free list */
+    prev = NULL;
+    for (i = 0; i < table->ht_oentries; i++) {
+        ent = vr_btable_get(table->ht_otable, i);
+        if (!(ent->hentry_flags & VR_HENTRY_FLAG_IN_FREE_LIST))
+            continue;
+
+        /* not reached from any chain, the payload is stale */
+        vr_htable_restore_drop(table, ent);
+        ent->hentry_flags = VR_HENTRY_FLAG_IN_FREE_LIST;
+        ent->hentry_bucket_index = VR_INVALID_HENTRY_INDEX;
+        ent->hentry_next_index = VR_INVALID_HENTRY_INDEX;
+        if (!prev)
+            table->ht_free_oentry_head = ent;
+        else
+            prev->hentry_next = ent;
+        prev = ent;
+    }
+
+    return;
+}
+
+static vr_htable_t
 __vr_htable_create(struct vrouter *router, unsigned int entries,
         void *htable, unsigned int oentries, void *otable,
         unsigned int entry_size, unsigned int key_size,
-        unsigned int bucket_size, get_hentry_key get_entry_key)
+        unsigned int bucket_size, get_hentry_key get_entry_key,
+        htable_restore_cb restore_cb, void *data)
 {
     int i;
     struct vr_htable *table;
-    vr_hentry_t *ent, *prev;
     struct iovec iov;
 
     if (!entry_size || !entries || !get_entry_key)
@@ -744,27 +888,6 @@ __vr_htable_create(struct vrouter *router, unsigned int entries,
         }
     }
 
-    for (i = 0; i < entries; i++) {
-        ent = vr_btable_get(table->ht_htable, i);
-        ent->hentry_index = i;
-        ent->hentry_next_index = VR_INVALID_HENTRY_INDEX;
-    }
-
-
-    prev = NULL;
-    for (i = 0; i < oentries; i++) {
-        ent = vr_btable_get(table->ht_otable, i);
-        ent->hentry_index = entries + i;
-        ent->hentry_next_index = VR_INVALID_HENTRY_INDEX;
-        if (i == 0)
-            table->ht_free_oentry_head = ent;
-        else
-            prev->hentry_next = ent;
-
-        ent->hentry_flags |= VR_HENTRY_FLAG_IN_FREE_LIST;
-        prev = ent;
-    }
-
     table->ht_hentries = entries;
     table->ht_oentries = oentries;
     table->ht_entry_size = entry_size;
@@ -774,6 +897,11 @@ __vr_htable_create(struct vrouter *router, unsigned int entries,
     table->ht_router = router;
     table->ht_used_oentries = 0;
 
+    if (restore_cb)
+        vr_htable_restore_entries(table, restore_cb, data);
+    else
+        vr_htable_init_entries(table);
+
     return (vr_htable_t)table;
 
 exit:
@@ -793,7 +921,29 @@ vr_htable_attach(struct vrouter *router, unsigned int entries,
     }
 
     return __vr_htable_create(router, entries, htable, oentries, otable,
-            entry_size, key_size, bucket_size, get_entry_key);
+            entry_size, key_size, bucket_size, get_entry_key, NULL, NULL);
+}
+
+/*
+ * vr_htable_reattach - attach to the table memory that holds the entries
+ * of a previous instance and keep the valid entries. restore_cb is called
+ * for every valid persisted entry and should clear the stale state of the
+ * entry. It returns false to drop the entry.
+ */
+vr_htable_t
+vr_htable_reattach(struct vrouter *router, unsigned int entries,
+        void *htable, unsigned int oentries, void *otable,
+        unsigned int entry_size, unsigned int key_size,
+        unsigned int bucket_size, get_hentry_key get_entry_key,
+        htable_restore_cb restore_cb, void *data)
+{
+    if (!entries || !htable || (oentries && !otable) || !restore_cb) {
+        return NULL;
+    }
+
+    return __vr_htable_create(router, entries, htable, oentries, otable,
+            entry_size, key_size, bucket_size, get_entry_key,
+            restore_cb, data);
 }
 
 void
@@ -824,7 +974,7 @@ vr_htable_create(struct vrouter *router, unsigned int entries,
         unsigned int bucket_size, get_hentry_key get_entry_key)
 {
     return __vr_htable_create(router, entries, NULL, oentries, NULL,
-            entry_size, key_size, bucket_size, get_entry_key);
+            entry_size, key_size, bucket_size, get_entry_key, NULL, NULL);
 }
 
 vr_hentry_t *vr_htable_get_bucket(vr_htable_t htable, void *key,
@@ -14,12 +14,61 @@
 #include <machine/stdarg.h>
 #endif
 
+#define VR_ITABLE_PHASH_GROUP_KEYS  4
+/* slots per key of the perfect hash, a load of 4/5 */
+#define VR_ITABLE_PHASH_SLOTS(cnt)  ((cnt) + ((cnt) >> 2) + 1)
+#define VR_ITABLE_PHASH_MAX_DISP    0xffff
+#define VR_ITABLE_PHASH_SEEDS       8
+#define VR_ITABLE_GOLDEN            0x9e3779b9
+/* indices that may be added to the trie alone before the copy is rebuilt */
+#define VR_ITABLE_PENDING_MIN       16
+#define VR_ITABLE_PENDING_SHIFT     3
+
+struct vr_itbl_entry {
+    unsigned int ite_index;
+    void *ite_data;
+};
+
+/* the lookup copy of the trie, see vr_index_table.h */
+struct vr_itbl_fast {
+    unsigned int itf_backend;
+    /* flat: the index of itf_flat[0] */
+    unsigned int itf_base;
+    /* flat: slots of itf_flat, perfect hash: slots of itf_slots */
+    unsigned int itf_size;
+    /* perfect hash: groups the keys are first hashed to, and their seed */
+    unsigned int itf_groups;
+    unsigned int itf_seed;
+    void **itf_flat;
+    /* perfect hash: displacement of each group, picking its keys' slots */
+    uint16_t *itf_disp;
+    /* perfect hash: a slot with no data is free for the index it hashes */
+    struct vr_itbl_entry *itf_slots;
+    /* indices added since the build, which only the trie has */
+    unsigned int itf_pending;
+};
+
 struct vr_itbl {
     unsigned int stride_cnt;
     unsigned int index_len;
     unsigned int *stride_len;
     unsigned int *stride_shift;
     void **data;
+    unsigned int index_mask;
+    unsigned int backend;
+    struct vrouter *router;
+    struct vr_itbl_fast *fast;
+    /*
+     * the copy could not be built, and lookups stay in the trie until
+     * vr_itable_set_backend asks for it again
+     */
+    bool fast_off;
+};
+
+struct vr_itbl_collect {
+    unsigned int itc_cnt;
+    unsigned int itc_max;
+    struct vr_itbl_entry *itc_entries;
 };
 
 void vr_print_table_struct(vr_itable_t);
@@ -186,6 +235,421 @@ __vr_itable_exit(struct vr_itbl *table, vr_itable_del_cb_t func,
     vr_free(ptr, VR_ITABLE_OBJECT);
 }
 
+static inline unsigned int
+__vr_itable_mix(unsigned int key, unsigned int seed)
+{
+    key ^= seed;
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+
+    return key;
+}
+
+/* maps a 32 bit hash to [0, range) without a division */
+static inline unsigned int
+__vr_itable_range(unsigned int hash, unsigned int range)
+{
+    return (unsigned int)(((uint64_t)hash * range) >> 32);
+}
+
+static inline unsigned int
+__vr_itable_phash_slot(struct vr_itbl_fast *fast, unsigned int index,
+        unsigned int disp)
+{
+    return __vr_itable_range(__vr_itable_mix(index,
+                fast->itf_seed ^ ((disp + 1) * VR_ITABLE_GOLDEN)),
+            fast->itf_size);
+}
+
+/* the only slot of the perfect hash that index can be in */
+static inline struct vr_itbl_entry *
+__vr_itable_phash_entry(struct vr_itbl_fast *fast, unsigned int index)
+{
+    unsigned int group;
+
+    group = __vr_itable_range(__vr_itable_mix(index, fast->itf_seed),
+            fast->itf_groups);
+    return &fast->itf_slots[__vr_itable_phash_slot(fast, index,
+            fast->itf_disp[group])];
+}
+
+static inline void **
+__vr_itable_fast_lookup(struct vr_itbl_fast *fast, unsigned int index)
+{
+    struct vr_itbl_entry *entry;
+
+    if (fast->itf_backend == VR_ITABLE_BACKEND_FLAT) {
+        if ((index - fast->itf_base) >= fast->itf_size)
+            return NULL;
+
+        return &fast->itf_flat[index - fast->itf_base];
+    }
+
+    entry = __vr_itable_phash_entry(fast, index);
+    if (entry->ite_index != index)
+        return NULL;
+
+    return &entry->ite_data;
+}
+
+static int
+__vr_itable_collect(unsigned int index, void *data, void *udata)
+{
+    struct vr_itbl_collect *collect = (struct vr_itbl_collect *)udata;
+
+    if (collect->itc_entries) {
+        if (collect->itc_cnt >= collect->itc_max)
+            return 0;
+
+        collect->itc_entries[collect->itc_cnt].ite_index = index;
+        collect->itc_entries[collect->itc_cnt].ite_data = data;
+    }
+    collect->itc_cnt++;
+
+    return 1;
+}
+
+static struct vr_itbl_fast *
+__vr_itable_flat_build(struct vr_itbl_entry *entries, unsigned int cnt)
+{
+    unsigned int i, size = 1, span = 0;
+    struct vr_itbl_fast *fast;
+
+    if (cnt)
+        span = entries[cnt - 1].ite_index - entries[0].ite_index + 1;
+
+    /* leave room for the space to grow without a rebuild each time */
+    while ((size < span) && (size < VR_ITABLE_FLAT_MAX))
+        size <<= 1;
+
+    fast = vr_zalloc(sizeof(*fast) + size * sizeof(void *), VR_ITABLE_OBJECT);
+    if (!fast)
+        return NULL;
+
+    fast->itf_backend = VR_ITABLE_BACKEND_FLAT;
+    fast->itf_base = cnt ? entries[0].ite_index : 0;
+    fast->itf_size = size;
+    fast->itf_flat = (void **)(fast + 1);
+    for (i = 0; i < cnt; i++)
+        fast->itf_flat[entries[i].ite_index - fast->itf_base] =
+            entries[i].ite_data;
+
+    return fast;
+}
+
+/*
+ * __vr_itable_phash_place - find the displacement that puts the cnt keys of
+ * entries listed in keys in free slots of fast, distinct from each other,
+ * and take the slots. Returns 0, or -ENOSPC if there is none.
+ */
+static int
+__vr_itable_phash_place(struct vr_itbl_fast *fast,
+        struct vr_itbl_entry *entries, unsigned int *keys, unsigned int cnt,
+        bool *taken, unsigned int *slots, unsigned int group)
+{
+    unsigned int d, i, j;
+
+    for (d = 0; d <= VR_ITABLE_PHASH_MAX_DISP; d++) {
+        for (i = 0; i < cnt; i++) {
+            slots[i] = __vr_itable_phash_slot(fast,
+                    entries[keys[i]].ite_index, d);
+            if (taken[slots[i]])
+                break;
+
+            for (j = 0; j < i; j++) {
+                if (slots[j] == slots[i])
+                    break;
+            }
+            if (j < i)
+                break;
+        }
+
+        if (i < cnt)
+            continue;
+
+        for (i = 0; i < cnt; i++) {
+            taken[slots[i]] = true;
+            fast->itf_slots[slots[i]] = entries[keys[i]];
+        }
+        fast->itf_disp[group] = d;
+
+        return 0;
+    }
+
+    return -ENOSPC;
+}
+
+/*
+ * __vr_itable_phash_build - build a perfect hash of the cnt entries, by
+ * hashing keys to groups and then, biggest group first, finding for each
+ * group the displacement of a second hash that sends its keys to free
+ * slots. There are a few more slots than keys, as the last groups to be
+ * placed would find no displacement otherwise once the table is large.
+ * Returns NULL if no seed worked or memory ran out.
+ */
+static struct vr_itbl_fast *
+__vr_itable_phash_build(struct vr_itbl_entry *entries, unsigned int cnt)
+{
+    int ret = -ENOMEM;
+    unsigned int i, g, seed, groups, size, max_size, pos, nslots;
+    unsigned int *group_of = NULL, *start = NULL, *members = NULL;
+    unsigned int *order = NULL, *slots = NULL;
+    bool *taken = NULL;
+    struct vr_itbl_fast *fast;
+
+    groups = (cnt + VR_ITABLE_PHASH_GROUP_KEYS - 1) /
+        VR_ITABLE_PHASH_GROUP_KEYS;
+    if (!groups)
+        groups = 1;
+    nslots = VR_ITABLE_PHASH_SLOTS(cnt);
+
+    fast = vr_zalloc(sizeof(*fast) + groups * sizeof(uint16_t) +
+            sizeof(void *) + nslots * sizeof(struct vr_itbl_entry),
+            VR_ITABLE_OBJECT);
+    if (!fast)
+        return NULL;
+
+    fast->itf_backend = VR_ITABLE_BACKEND_PHASH;
+    fast->itf_size = nslots;
+    fast->itf_groups = groups;
+    fast->itf_disp = (uint16_t *)(fast + 1);
+    fast->itf_slots = (struct vr_itbl_entry *)
+        (((unsigned long)(fast->itf_disp + groups) + sizeof(void *) - 1) &
+         ~(sizeof(void *) - 1));
+    if (!cnt)
+        return fast;
+
+    group_of = vr_zalloc(cnt * sizeof(unsigned int), VR_ITABLE_OBJECT);
+    start = vr_zalloc((groups + 1) * sizeof(unsigned int), VR_ITABLE_OBJECT);
+    members = vr_zalloc(cnt * sizeof(unsigned int), VR_ITABLE_OBJECT);
+    order = vr_zalloc(groups * sizeof(unsigned int), VR_ITABLE_OBJECT);
+    slots = vr_zalloc(cnt * sizeof(unsigned int), VR_ITABLE_OBJECT);
+    taken = vr_zalloc(nslots * sizeof(bool), VR_ITABLE_OBJECT);
+    if (!group_of || !start || !members || !order || !slots || !taken)
+        goto exit_build;
+
+    for (seed = 0; seed < VR_ITABLE_PHASH_SEEDS; seed++) {
+        fast->itf_seed = __vr_itable_mix(seed, VR_ITABLE_GOLDEN);
+        memset(start, 0, (groups + 1) * sizeof(unsigned int));
+        memset(taken, 0, nslots * sizeof(bool));
+        memset(fast->itf_slots, 0, nslots * sizeof(struct vr_itbl_entry));
+
+        /* list the keys of each group, group g at members[start[g]] */
+        for (i = 0; i < cnt; i++) {
+            group_of[i] = __vr_itable_range(__vr_itable_mix(
+                        entries[i].ite_index, fast->itf_seed), groups);
+            start[group_of[i] + 1]++;
+        }
+
+        max_size = 0;
+        for (g = 0; g < groups; g++) {
+            if (start[g + 1] > max_size)
+                max_size = start[g + 1];
+            start[g + 1] += start[g];
+        }
+
+        memset(slots, 0, cnt * sizeof(unsigned int));
+        for (i = 0; i < cnt; i++) {
+            g = group_of[i];
+            members[start[g] + slots[g]++] = i;
+        }
+
+        /* biggest groups first, while most slots are free */
+        pos = 0;
+        for (size = max_size; size > 0; size--) {
+            for (g = 0; g < groups; g++) {
+                if (start[g + 1] - start[g] == size)
+                    order[pos++] = g;
+            }
+        }
+
+        ret = 0;
+        for (i = 0; i < pos; i++) {
+            g = order[i];
+            ret = __vr_itable_phash_place(fast, entries, &members[start[g]],
+                    start[g + 1] - start[g], taken, slots, g);
+            if (ret)
+                break;
+        }
+
+        if (!ret)
+            break;
+    }
+
+exit_build:
+    if (group_of)
+        vr_free(group_of, VR_ITABLE_OBJECT);
+    if (start)
+        vr_free(start, VR_ITABLE_OBJECT);
+    if (members)
+        vr_free(members, VR_ITABLE_OBJECT);
+    if (order)
+        vr_free(order, VR_ITABLE_OBJECT);
+    if (slots)
+        vr_free(slots, VR_ITABLE_OBJECT);
+    if (taken)
+        vr_free(taken, VR_ITABLE_OBJECT);
+
+    if (ret) {
+        vr_free(fast, VR_ITABLE_OBJECT);
+        return NULL;
+    }
+
+    return fast;
+}
+
+static void
+__vr_itable_fast_free_cb(struct vrouter *router, void *data)
+{
+    struct vr_defer_data *vdd = (struct vr_defer_data *)data;
+
+    if (!vdd)
+        return;
+
+    vr_free(vdd->vdd_data, VR_ITABLE_OBJECT);
+    return;
+}
+
+static void
+__vr_itable_fast_swap(struct vr_itbl *table, struct vr_itbl_fast *fast)
+{
+    struct vr_defer_data *defer;
+    struct vr_itbl_fast *old = table->fast;
+
+    /* the copy has to be complete before the datapath can see it */
+    vr_sync_synchronize();
+    table->fast = fast;
+    if (!old)
+        return;
+
+    defer = vr_get_defer_data(sizeof(*defer));
+    if (!defer) {
+        vr_delay_op();
+        vr_free(old, VR_ITABLE_OBJECT);
+        return;
+    }
+
+    defer->vdd_data = old;
+    vr_defer(table->router, __vr_itable_fast_free_cb, (void *)defer);
+
+    return;
+}
+
+/*
+ * __vr_itable_fast_rebuild - rebuild the lookup copy of the trie with the
+ * backend of the table, or with a flat array if no perfect hash could be
+ * found. If that fails too, lookups go to the trie until the backend is
+ * set again, rather than every change trying another rebuild.
+ */
+static void
+__vr_itable_fast_rebuild(struct vr_itbl *table)
+{
+    unsigned int span, backend = table->backend;
+    struct vr_itbl_collect collect;
+    struct vr_itbl_fast *fast = NULL;
+
+    memset(&collect, 0, sizeof(collect));
+    __vr_itable_dump(table, __vr_itable_collect, table->data, 0, 0, 0,
+            &collect);
+    if (collect.itc_cnt) {
+        collect.itc_max = collect.itc_cnt;
+        collect.itc_entries = vr_zalloc(collect.itc_max *
+                sizeof(struct vr_itbl_entry), VR_ITABLE_OBJECT);
+        if (!collect.itc_entries)
+            goto swap;
+
+        collect.itc_cnt = 0;
+        __vr_itable_dump(table, __vr_itable_collect, table->data, 0, 0, 0,
+                &collect);
+    }
+
+    /* the trie is walked in index order */
+    span = 0;
+    if (collect.itc_cnt)
+        span = collect.itc_entries[collect.itc_cnt - 1].ite_index -
+            collect.itc_entries[0].ite_index + 1;
+
+    if (backend == VR_ITABLE_BACKEND_AUTO) {
+        backend = VR_ITABLE_BACKEND_PHASH;
+        if (span <= (collect.itc_cnt * VR_ITABLE_FLAT_DENSITY))
+            backend = VR_ITABLE_BACKEND_FLAT;
+    }
+
+    if ((backend == VR_ITABLE_BACKEND_FLAT) && (span > VR_ITABLE_FLAT_MAX))
+        backend = VR_ITABLE_BACKEND_PHASH;
+
+    if (backend == VR_ITABLE_BACKEND_FLAT) {
+        fast = __vr_itable_flat_build(collect.itc_entries, collect.itc_cnt);
+    } else {
+        fast = __vr_itable_phash_build(collect.itc_entries, collect.itc_cnt);
+        if (!fast && (span <= VR_ITABLE_FLAT_MAX))
+            fast = __vr_itable_flat_build(collect.itc_entries,
+                    collect.itc_cnt);
+    }
+
+swap:
+    if (collect.itc_entries)
+        vr_free(collect.itc_entries, VR_ITABLE_OBJECT);
+
+    if (!fast)
+        table->fast_off = true;
+    __vr_itable_fast_swap(table, fast);
+    return;
+}
+
+/*
+ * __vr_itable_fast_update - set the data of index in the lookup copy, if
+ * the copy has room for it, a perfect hash taking a new index in the slot
+ * it hashes to if that slot is free. An index it has no room for is left
+ * to the trie, where lookups that miss the copy go, until enough of them
+ * have been added for a rebuild to be worth it. Returns false if the copy
+ * has to be rebuilt.
+ */
+static bool
+__vr_itable_fast_update(struct vr_itbl *table, unsigned int index, void *data)
+{
+    void **slot;
+    struct vr_itbl_entry *entry;
+    struct vr_itbl_fast *fast = table->fast;
+
+    if (!fast)
+        return false;
+
+    index &= table->index_mask;
+    slot = __vr_itable_fast_lookup(fast, index);
+    if (slot) {
+        *slot = data;
+        return true;
+    }
+
+    if (!data)
+        return true;
+
+    if (fast->itf_backend == VR_ITABLE_BACKEND_PHASH) {
+        entry = __vr_itable_phash_entry(fast, index);
+        if (!entry->ite_data) {
+            /* the old index of the slot has no data either */
+            entry->ite_index = index;
+            vr_sync_synchronize();
+            entry->ite_data = data;
+            return true;
+        }
+    }
+
+    if (fast->itf_pending >= VR_ITABLE_PENDING_MIN +
+            (fast->itf_size >> VR_ITABLE_PENDING_SHIFT))
+        return false;
+
+    /* the trie has the index already */
+    vr_sync_synchronize();
+    fast->itf_pending++;
+
+    return true;
+}
+
 void
 vr_print_table_struct(vr_itable_t t)
 {
@@ -237,6 +701,9 @@ vr_itable_del(vr_itable_t t, unsigned int index)
 
     __vr_itable_del(table, index, table->data, 0, &old);
 
+    if (old && table->fast && !__vr_itable_fast_update(table, index, NULL))
+        __vr_itable_fast_rebuild(table);
+
     /* Return the deleted value */
     return old;
 }
@@ -249,10 +716,23 @@ vr_itable_get(vr_itable_t t, unsigned int index)
     unsigned int i;
     unsigned int id;
 
+    void **slot;
+    struct vr_itbl_fast *fast;
+
     if (!table) {
         return NULL;
     }
 
+    fast = table->fast;
+    if (fast) {
+        slot = __vr_itable_fast_lookup(fast, index & table->index_mask);
+        if (slot)
+            return *slot;
+
+        if (!fast->itf_pending)
+            return NULL;
+    }
+
     /* Go till last stride as long as data exists */
     for (i = 0, ptr = table->data; (i < table->stride_cnt) && ptr; i++) {
         id = (index >> table->stride_shift[i]) & (table->stride_len[i] - 1);
@@ -317,6 +797,11 @@ vr_itable_set(vr_itable_t t, unsigned int index, void *data)
     /* Return the old data */
     old = ptr[id];
     ptr[id] = data;
+
+    if ((table->backend != VR_ITABLE_BACKEND_TRIE) && !table->fast_off &&
+            !__vr_itable_fast_update(table, index, data))
+        __vr_itable_fast_rebuild(table);
+
     return old;
 }
 
@@ -336,6 +821,9 @@ vr_itable_delete(vr_itable_t t, vr_itable_del_cb_t func)
     /* Delete all entries and strides */
     __vr_itable_exit(table, func, table->data, 0, 0);
 
+    if (table->fast)
+        vr_free(table->fast, VR_ITABLE_OBJECT);
+
     /* Free the table itself */
     vr_free(table->stride_len, VR_ITABLE_OBJECT);
     vr_free(table->stride_shift, VR_ITABLE_OBJECT);
@@ -344,6 +832,51 @@ vr_itable_delete(vr_itable_t t, vr_itable_del_cb_t func)
     return;
 }
 
+/*
+ * Have vr_itable_get read a copy of the table kept with the given
+ * backend. router is where the old copies are handed for freeing.
+ * Returns 0, or -EINVAL.
+ */
+int
+vr_itable_set_backend(vr_itable_t t, struct vrouter *router,
+        unsigned int backend)
+{
+    struct vr_itbl *table = (struct vr_itbl *)t;
+
+    if (!table || (backend > VR_ITABLE_BACKEND_AUTO) ||
+            ((backend != VR_ITABLE_BACKEND_TRIE) && !router)) {
+        return -EINVAL;
+    }
+
+    if (router)
+        table->router = router;
+    table->backend = backend;
+    table->fast_off = false;
+    if (backend == VR_ITABLE_BACKEND_TRIE) {
+        __vr_itable_fast_swap(table, NULL);
+    } else {
+        __vr_itable_fast_rebuild(table);
+    }
+
+    return 0;
+}
+
+/*
+ * The backend vr_itable_get reads now, VR_ITABLE_BACKEND_TRIE if the table
+ * has no copy.
+ */
+unsigned int
+vr_itable_get_backend(vr_itable_t t)
+{
+    struct vr_itbl *table = (struct vr_itbl *)t;
+    struct vr_itbl_fast *fast;
+
+    if (!table || !(fast = table->fast))
+        return VR_ITABLE_BACKEND_TRIE;
+
+    return fast->itf_backend;
+}
+
 /*
  * index_len - How many bits does index consist of. Max is 32 and any length
  * of bits can be used.
@@ -417,6 +950,10 @@ vr_itable_create(unsigned int index_len, unsigned int stride_cnt, ...)
         goto fail;
     }
 
+    table->index_mask = 0xffffffff;
+    if (table->index_len < (sizeof(unsigned int) * 8))
+        table->index_mask = (0x1 << table->index_len) - 1;
+
     return (vr_itable_t)table;
 
 fail:
@@ -18,12 +18,16 @@
 #include "vr_ip_mtrie.h"
 #include "vr_offloads_dp.h"
 #include "vr_hash.h"
+#include "vr_stats.h"
+#include "vr_stats_shm.h"
 
 unsigned int vr_interfaces = VR_MAX_INTERFACES;
 
 volatile bool agent_alive = false;
 
 static struct vr_host_interface_ops *hif_ops;
+static struct vr_timer *vif_policer_timer_h;
+static unsigned int vif_policer_users;
 
 static int vm_srx(struct vr_interface *, struct vr_packet *, unsigned short);
 static int vm_rx(struct vr_interface *, struct vr_packet *, unsigned short);
@@ -133,6 +137,261 @@ vif_drop_pkt(struct vr_interface *vif, struct vr_packet *pkt, bool input)
     return;
 }
 
+/*
+ * vif_policer_conform - charge a packet of len bytes to the buckets of
+ * this cpu. Only the owning cpu writes vvb_used and vvb_demand, and only
+ * the refill timer writes vvg_grant, so there is nothing to lock. Returns
+ * true if the packet conforms.
+ */
+static inline bool
+vif_policer_conform(struct vr_vif_policer *pol, unsigned short cpu,
+        unsigned int len)
+{
+    struct vr_vif_bucket *bytes, *pkts;
+    struct vr_vif_grant *bytes_grant, *pkts_grant;
+
+    cpu &= VR_CPU_MASK;
+    bytes = VIF_POLICER_BUCKET(pol, cpu, VIF_POLICER_BYTES);
+    pkts = VIF_POLICER_BUCKET(pol, cpu, VIF_POLICER_PKTS);
+    bytes_grant = VIF_POLICER_GRANT(pol, cpu, VIF_POLICER_BYTES);
+    pkts_grant = VIF_POLICER_GRANT(pol, cpu, VIF_POLICER_PKTS);
+
+    bytes->vvb_demand += len;
+    pkts->vvb_demand++;
+
+    /*
+     * the timer may have computed the grant from a stale vvb_used, and
+     * hence the signed compare
+     */
+    if (pol->vvp_tb[VIF_POLICER_BYTES].vvt_rate &&
+            ((int64_t)(bytes_grant->vvg_grant - bytes->vvb_used) <
+             (int64_t)len))
+        return false;
+
+    if (pol->vvp_tb[VIF_POLICER_PKTS].vvt_rate &&
+            ((int64_t)(pkts_grant->vvg_grant - pkts->vvb_used) < 1))
+        return false;
+
+    bytes->vvb_used += len;
+    pkts->vvb_used++;
+
+    return true;
+}
+
+/*
+ * vif_policer_tb_refill - hand out the tokens of the last interval to the
+ * cpus, in proportion to the demand each cpu saw. A cpu that saw none gets
+ * an even share, capped at the floor depth.
+ */
+static void
+vif_policer_tb_refill(struct vr_vif_policer *pol, unsigned int unit)
+{
+    unsigned int cpu;
+    uint64_t refill, share, depth, grant, demand, total = 0;
+    struct vr_vif_tb *tb = &pol->vvp_tb[unit];
+    struct vr_vif_bucket *bucket;
+    struct vr_vif_grant *vg;
+
+    if (!tb->vvt_rate)
+        return;
+
+    refill = (tb->vvt_rate * VIF_POLICER_INTERVAL_MSEC) + tb->vvt_frac;
+    tb->vvt_frac = refill % 1000;
+    refill /= 1000;
+
+    for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+        bucket = VIF_POLICER_BUCKET(pol, cpu, unit);
+        vg = VIF_POLICER_GRANT(pol, cpu, unit);
+        demand = bucket->vvb_demand;
+        vg->vvg_delta = demand - vg->vvg_seen;
+        vg->vvg_seen = demand;
+        total += vg->vvg_delta;
+    }
+
+    for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+        bucket = VIF_POLICER_BUCKET(pol, cpu, unit);
+        vg = VIF_POLICER_GRANT(pol, cpu, unit);
+        if (total) {
+            share = (refill * vg->vvg_delta) / total;
+            depth = (tb->vvt_burst * vg->vvg_delta) / total;
+        } else {
+            share = refill / vr_num_cpus;
+            depth = 0;
+        }
+
+        if (depth < tb->vvt_floor)
+            depth = tb->vvt_floor;
+
+        grant = vg->vvg_grant + share;
+        if ((int64_t)(grant - bucket->vvb_used) > (int64_t)depth)
+            grant = bucket->vvb_used + depth;
+        vg->vvg_grant = grant;
+    }
+
+    return;
+}
+
+static void
+vif_policer_timer(void *arg)
+{
+    unsigned int i, dir;
+    struct vr_interface *vif;
+    struct vr_vif_policer *pol;
+    struct vrouter *router = (struct vrouter *)arg;
+
+    if (!vif_policer_users || !router || !router->vr_interfaces)
+        return;
+
+    for (i = 0; i < router->vr_max_interfaces; i++) {
+        if (!(vif = router->vr_interfaces[i]))
+            continue;
+
+        for (dir = 0; dir < VIF_POLICER_DIRS; dir++) {
+            if (!(pol = vif->vif_policer[dir]))
+                continue;
+
+            vif_policer_tb_refill(pol, VIF_POLICER_BYTES);
+            vif_policer_tb_refill(pol, VIF_POLICER_PKTS);
+        }
+    }
+
+    return;
+}
+
+static void
+vif_policer_tb_init(struct vr_vif_policer *pol, unsigned int unit,
+        uint64_t rate, uint64_t burst, uint64_t min_burst)
+{
+    unsigned int cpu;
+    struct vr_vif_tb *tb = &pol->vvp_tb[unit];
+
+    tb->vvt_rate = rate;
+    if (!rate)
+        return;
+
+    if (!burst)
+        burst = (rate * VIF_POLICER_DEF_BURST_MSEC) / 1000;
+    /* a bucket shallower than one refill would throw tokens away */
+    if (burst < (rate * VIF_POLICER_INTERVAL_MSEC) / 1000)
+        burst = (rate * VIF_POLICER_INTERVAL_MSEC) / 1000;
+    if (burst < min_burst)
+        burst = min_burst;
+    tb->vvt_burst = burst;
+
+    tb->vvt_floor = burst / vr_num_cpus;
+    if (tb->vvt_floor < min_burst)
+        tb->vvt_floor = min_burst;
+
+    for (cpu = 0; cpu < vr_num_cpus; cpu++)
+        VIF_POLICER_GRANT(pol, cpu, unit)->vvg_grant = tb->vvt_floor;
+
+    return;
+}
+
+static void
+vif_policer_free_defer_cb(struct vrouter *router, void *data)
+{
+    struct vr_defer_data *vdd = (struct vr_defer_data *)data;
+
+    if (!vdd || !vdd->vdd_data)
+        return;
+
+    vr_free(vdd->vdd_data, VR_INTERFACE_POLICER_OBJECT);
+    return;
+}
+
+static void
+vif_policer_free(struct vr_interface *vif, unsigned int dir, bool defer)
+{
+    struct vr_defer_data *vdd;
+    struct vr_vif_policer *pol = vif->vif_policer[dir];
+
+    if (!pol)
+        return;
+
+    vif->vif_policer[dir] = NULL;
+    (void)vr_sync_sub_and_fetch_32u(&vif_policer_users, 1);
+
+    if (defer && (vdd = vr_get_defer_data(sizeof(*vdd)))) {
+        vdd->vdd_data = (void *)pol;
+        vr_defer(vif->vif_router, vif_policer_free_defer_cb, vdd);
+        return;
+    }
+
+    if (defer)
+        vr_delay_op();
+    vr_free(pol, VR_INTERFACE_POLICER_OBJECT);
+
+    return;
+}
+
+/*
+ * vif_policer_set - (re)configure the policer of one direction. Rates are
+ * in bits and packets per second, bursts in bytes and packets, and zero
+ * rates remove the policer. Returns 0 or -ENOMEM.
+ */
+static int
+vif_policer_set(struct vr_interface *vif, unsigned int dir, uint64_t bps,
+        uint64_t pps, uint64_t burst_bytes, uint64_t burst_pkts)
+{
+    unsigned int size;
+    unsigned long mem;
+    struct vr_vif_policer *pol = vif->vif_policer[dir];
+
+    if (pol && (pol->vvp_bps == bps) && (pol->vvp_pps == pps) &&
+            (pol->vvp_burst_bytes == burst_bytes) &&
+            (pol->vvp_burst_pkts == burst_pkts))
+        return 0;
+
+    vif_policer_free(vif, dir, true);
+    if (!bps && !pps)
+        return 0;
+
+    size = sizeof(*pol) + VIF_POLICER_ALIGN +
+        (vr_num_cpus * sizeof(struct vr_vif_cpu_buckets)) +
+        (vr_num_cpus * VIF_POLICER_UNITS * sizeof(struct vr_vif_grant));
+    pol = vr_zalloc(size, VR_INTERFACE_POLICER_OBJECT);
+    if (!pol)
+        return -ENOMEM;
+
+    mem = ((unsigned long)pol->vvp_mem + VIF_POLICER_ALIGN - 1) &
+        ~((unsigned long)VIF_POLICER_ALIGN - 1);
+    pol->vvp_cpu = (struct vr_vif_cpu_buckets *)mem;
+    pol->vvp_grant = (struct vr_vif_grant *)(pol->vvp_cpu + vr_num_cpus);
+
+    pol->vvp_bps = bps;
+    pol->vvp_pps = pps;
+    pol->vvp_burst_bytes = burst_bytes;
+    pol->vvp_burst_pkts = burst_pkts;
+    vif_policer_tb_init(pol, VIF_POLICER_BYTES,
+            bps ? ((bps >= 8) ? (bps / 8) : 1) : 0, burst_bytes,
+            VIF_POLICER_MIN_BURST_BYTES);
+    vif_policer_tb_init(pol, VIF_POLICER_PKTS, pps, burst_pkts,
+            VIF_POLICER_MIN_BURST_PKTS);
+
+    vr_sync_synchronize();
+    vif->vif_policer[dir] = pol;
+    (void)vr_sync_add_and_fetch_32u(&vif_policer_users, 1);
+
+    return 0;
+}
+
+static int
+vif_policer_config(struct vr_interface *vif, vr_interface_req *req)
+{
+    int ret;
+
+    ret = vif_policer_set(vif, VIF_POLICER_IN, req->vifr_in_bps,
+            req->vifr_in_pps, req->vifr_in_burst_bytes,
+            req->vifr_in_burst_pkts);
+    if (ret)
+        return ret;
+
+    return vif_policer_set(vif, VIF_POLICER_OUT, req->vifr_out_bps,
+            req->vifr_out_pps, req->vifr_out_burst_bytes,
+            req->vifr_out_burst_pkts);
+}
+
 /*
  * in the rewrite case, we will assume the positive case of caller
  * passing us valid rewrite ptr and len and will not check for those
@@ -1357,6 +1616,7 @@ vm_rx(struct vr_interface *vif, struct vr_packet *pkt,
 {
     struct vr_forwarding_md fmd;
     struct vr_interface *sub_vif = NULL;
+    struct vr_vif_policer *policer;
     struct vr_interface_stats *stats = vif_get_stats(vif, pkt->vp_cpu);
     struct vr_eth *eth = (struct vr_eth *)pkt_data(pkt);
 
@@ -1392,6 +1652,14 @@ vm_rx(struct vr_interface *vif, struct vr_packet *pkt,
     stats->vis_ibytes += pkt_len(pkt);
     stats->vis_ipackets++;
 
+    policer = vif->vif_policer[VIF_POLICER_IN];
+    if (policer && !vif_policer_conform(policer, pkt->vp_cpu, pkt_len(pkt))) {
+        stats->vis_ierrors++;
+        PKT_LOG(VP_DROP_VIF_POLICER_IN, pkt, 0, VR_INTERFACE_C, __LINE__);
+        vr_pfree(pkt, VP_DROP_VIF_POLICER_IN);
+        return 0;
+    }
+
     vr_offload_packet_parse(pkt);
 
     return vr_virtual_input(vif->vif_vrf, vif, pkt, &fmd, vlan_id);
@@ -1598,6 +1866,7 @@ eth_tx(struct vr_interface *vif, struct vr_packet *pkt,
     bool stats_count = true, from_subvif = false, force_tag = true;
     int ret, handled;
     uint16_t vlan_id;
+    struct vr_vif_policer *policer;
 
     struct vr_interface_stats *stats = vif_get_stats(vif, pkt->vp_cpu);
 
@@ -1637,6 +1906,19 @@ eth_tx(struct vr_interface *vif, struct vr_packet *pkt,
     if (stats_count) {
         stats->vis_obytes += pkt_len(pkt);
         stats->vis_opackets++;
+
+        /*
+         * packets that are not counted were already charged, either
+         * as the GRO original or on the sub-interface
+         */
+        policer = vif->vif_policer[VIF_POLICER_OUT];
+        if (policer &&
+                !vif_policer_conform(policer, pkt->vp_cpu, pkt_len(pkt))) {
+            stats->vis_oerrors++;
+            PKT_LOG(VP_DROP_VIF_POLICER_OUT, pkt, 0, VR_INTERFACE_C, __LINE__);
+            vr_pfree(pkt, VP_DROP_VIF_POLICER_OUT);
+            return 0;
+        }
     }
 
     ret = hif_ops->hif_tx(vif, pkt);
@@ -1816,14 +2098,15 @@ vif_free(struct vr_interface *vif)
     if (!vif)
         return;
 
-    for (i = 0; i < vr_num_cpus; i++) {
+    for (i = 0; vif->vif_stats && i < vr_num_cpus; i++) {
         if (vif->vif_stats[i].vis_queue_ierrors_to_lcore) {
             vr_free(vif->vif_stats[i].vis_queue_ierrors_to_lcore,
                 VR_INTERFACE_TO_LCORE_ERRORS_OBJECT);
         }
     }
 
-    if (vif->vif_stats)
+    if (vif->vif_stats &&
+            !vr_stats_shm_put(VR_STATS_SHM_VIF, vif->vif_stats))
         vr_free(vif->vif_stats, VR_INTERFACE_STATS_OBJECT);
 
     if (vif->vif_vrf_table) {
@@ -1840,12 +2123,6 @@ vif_free(struct vr_interface *vif)
         vif_bridge_deinit(vif);
     }
 
-    if (vif->vif_bridge_table_lock) {
-        vr_free(vif->vif_bridge_table_lock,
-                VR_INTERFACE_BRIDGE_LOCK_OBJECT);
-        vif->vif_bridge_table_lock = NULL;
-    }
-
     if (vif->vif_hw_queues) {
         vr_free(vif->vif_hw_queues, VR_INTERFACE_QUEUE_OBJECT);
         vif->vif_hw_queues = NULL;
@@ -1897,7 +2174,8 @@ vif_free(struct vr_interface *vif)
     }
 
     if (vif->vif_drop_stats) {
-        vr_free(vif->vif_drop_stats, VR_DROP_STATS_OBJECT);
+        if (!vr_stats_shm_put(VR_STATS_SHM_VIF_DROP, vif->vif_drop_stats))
+            vr_free(vif->vif_drop_stats, VR_DROP_STATS_OBJECT);
         vif->vif_drop_stats = NULL;
     }
 
@@ -1906,6 +2184,9 @@ vif_free(struct vr_interface *vif)
         vif->vif_pcpu_drop_stats = NULL;
     }
 
+    for (i = 0; i < VIF_POLICER_DIRS; i++)
+        vif_policer_free(vif, i, false);
+
     vr_free(vif, VR_INTERFACE_OBJECT);
 
     return;
@@ -2323,47 +2604,9 @@ del_fail:
     return ret;
 }
 
-static void
-vif_free_bridge_table_lock(struct vrouter *router, void *data)
-{
-   struct vr_defer_data *vdd = (struct vr_defer_data *)data;
-
-    if (!vdd)
-        return;
-
-    vr_free(vdd->vdd_data, VR_INTERFACE_BRIDGE_LOCK_OBJECT);
-
-    return;
-}
-
 static int
 vif_set_flags(struct vr_interface *vif, vr_interface_req *req)
 {
-    void *mem;
-    struct vr_defer_data *vdd;
-
-    if ((req->vifr_flags & VIF_FLAG_MAC_LEARN) || (vif_is_fabric(vif))) {
-        if (!vif->vif_bridge_table_lock) {
-            vif->vif_bridge_table_lock =
-                vr_zalloc(vr_num_cpus * sizeof(uint8_t),
-                        VR_INTERFACE_BRIDGE_LOCK_OBJECT);
-            if (!vif->vif_bridge_table_lock) {
-                return -ENOMEM;
-            }
-        }
-    } else if (vif->vif_flags & VIF_FLAG_MAC_LEARN) {
-        if (vif->vif_bridge_table_lock) {
-            vdd = vr_get_defer_data(sizeof(*vdd));
-            if (vdd) {
-                mem = vif->vif_bridge_table_lock;
-                vif->vif_bridge_table_lock = NULL;
-                vdd->vdd_data = mem;
-                vr_defer(vif->vif_router, vif_free_bridge_table_lock,
-                        (void *)vdd);
-            }
-        }
-    }
-
     vif->vif_flags = (vif->vif_flags & VIF_VR_CAP_MASK) |
                      (req->vifr_flags & ~VIF_VR_CAP_MASK);
 
@@ -2502,6 +2745,10 @@ vr_interface_change(struct vr_interface *vif, vr_interface_req *req)
     if (ret)
         return ret;
 
+    ret = vif_policer_config(vif, req);
+    if (ret)
+        return ret;
+
     if ((ret = vif_fat_flow_add(vif, req)))
         return ret;
 
@@ -2607,8 +2854,11 @@ vr_interface_add(vr_interface_req *req, bool need_response)
         goto error;
     }
 
-    vif->vif_stats = vr_zalloc(vr_num_cpus *
-            sizeof(struct vr_interface_stats), VR_INTERFACE_STATS_OBJECT);
+    /* in the shared counter region, if the counters are exported */
+    vif->vif_stats = vr_stats_shm_get(VR_STATS_SHM_VIF, req->vifr_idx);
+    if (!vif->vif_stats)
+        vif->vif_stats = vr_zalloc(vr_num_cpus *
+                sizeof(struct vr_interface_stats), VR_INTERFACE_STATS_OBJECT);
     if (!vif->vif_stats) {
         ret = -ENOMEM;
         goto error;
@@ -2637,8 +2887,11 @@ vr_interface_add(vr_interface_req *req, bool need_response)
      * 64 bit counter atomically. This results in decreasing the delay
      * as well decresing the memory requirement
      */
-    vif->vif_drop_stats = vr_zalloc((VP_DROP_MAX * sizeof(uint64_t)),
-                                               VR_DROP_STATS_OBJECT);
+    vif->vif_drop_stats = vr_stats_shm_get(VR_STATS_SHM_VIF_DROP,
+            req->vifr_idx);
+    if (!vif->vif_drop_stats)
+        vif->vif_drop_stats = vr_zalloc((VP_DROP_MAX * sizeof(uint64_t)),
+                                                   VR_DROP_STATS_OBJECT);
     if (!vif->vif_drop_stats) {
         ret = -ENOMEM;
         goto error;
@@ -2683,6 +2936,10 @@ vr_interface_add(vr_interface_req *req, bool need_response)
     if (ret)
         goto error;
 
+    ret = vif_policer_config(vif, req);
+    if (ret)
+        goto error;
+
     if (req->vifr_mac) {
         if (req->vifr_mac_size != sizeof(vif->vif_mac)) {
             vr_printf("Vrouter: %s:%d Incorrect mac size %d\n", __func__, __LINE__, req->vifr_mac_size);
@@ -2816,9 +3073,11 @@ vr_interface_add_response(vr_interface_req *req,
     req->vifr_port_ierrors += stats->vis_port_ierrors;
     req->vifr_port_isyscalls += stats->vis_port_isyscalls;
     req->vifr_port_inombufs += stats->vis_port_inombufs;
+    req->vifr_port_ioffloads += stats->vis_port_ioffloads;
     req->vifr_port_opackets += stats->vis_port_opackets;
     req->vifr_port_oerrors += stats->vis_port_oerrors;
     req->vifr_port_osyscalls += stats->vis_port_osyscalls;
+    req->vifr_port_ooffloads += stats->vis_port_ooffloads;
 
     req->vifr_dev_ibytes += stats->vis_dev_ibytes;
     req->vifr_dev_ipackets += stats->vis_dev_ipackets;
@@ -2969,6 +3228,7 @@ __vr_interface_make_req(vr_interface_req *req, struct vr_interface *intf,
     struct vr_interface_settings settings;
     struct vr_interface_bond_info bond_info;
     struct vr_interface_vlan_info vlan_info;
+    struct vr_vif_policer *policer;
 
     req->vifr_core = core;
     req->vifr_type = intf->vif_type;
@@ -3054,6 +3314,17 @@ __vr_interface_make_req(vr_interface_req *req, struct vr_interface *intf,
     }
     req->vifr_vhostuser_mode = intf->vif_vhostuser_mode;
 
+    policer = intf->vif_policer[VIF_POLICER_IN];
+    req->vifr_in_bps = policer ? policer->vvp_bps : 0;
+    req->vifr_in_pps = policer ? policer->vvp_pps : 0;
+    req->vifr_in_burst_bytes = policer ? policer->vvp_burst_bytes : 0;
+    req->vifr_in_burst_pkts = policer ? policer->vvp_burst_pkts : 0;
+    policer = intf->vif_policer[VIF_POLICER_OUT];
+    req->vifr_out_bps = policer ? policer->vvp_bps : 0;
+    req->vifr_out_pps = policer ? policer->vvp_pps : 0;
+    req->vifr_out_burst_bytes = policer ? policer->vvp_burst_bytes : 0;
+    req->vifr_out_burst_pkts = policer ? policer->vvp_burst_pkts : 0;
+
     /* vif counters */
     req->vifr_ibytes = 0;
     req->vifr_ipackets = 0;
@@ -3073,9 +3344,11 @@ __vr_interface_make_req(vr_interface_req *req, struct vr_interface *intf,
     req->vifr_port_ierrors = 0;
     req->vifr_port_isyscalls = 0;
     req->vifr_port_inombufs = 0;
+    req->vifr_port_ioffloads = 0;
     req->vifr_port_opackets = 0;
     req->vifr_port_oerrors = 0;
     req->vifr_port_osyscalls = 0;
+    req->vifr_port_ooffloads = 0;
     /* device counters */
     req->vifr_dev_ibytes = 0;
     req->vifr_dev_ipackets = 0;
@@ -5417,6 +5690,12 @@ vr_interface_exit(struct vrouter *router, bool soft_reset)
     if (!soft_reset) {
         vr_host_interface_exit();
         hif_ops = NULL;
+
+        if (vif_policer_timer_h) {
+            vr_delete_timer(vif_policer_timer_h);
+            vr_free(vif_policer_timer_h, VR_TIMER_OBJECT);
+            vif_policer_timer_h = NULL;
+        }
     }
 
     if (!soft_reset && router->vr_interfaces) {
@@ -5433,6 +5712,7 @@ vr_interface_init(struct vrouter *router)
 {
     int ret = 0;
     unsigned int table_memory = 0;
+    struct vr_timer *vtimer;
 
     if (!router->vr_interfaces) {
         router->vr_max_interfaces = vr_interfaces;
@@ -5453,6 +5733,25 @@ vr_interface_init(struct vrouter *router)
         }
     }
 
+    if (!vif_policer_timer_h) {
+        vtimer = vr_zalloc(sizeof(*vtimer), VR_TIMER_OBJECT);
+        if (!vtimer && (ret = -ENOMEM)) {
+            vr_module_error(ret, __FUNCTION__, __LINE__, sizeof(*vtimer));
+            goto cleanup;
+        }
+
+        vtimer->vt_timer = vif_policer_timer;
+        vtimer->vt_vr_arg = router;
+        vtimer->vt_msecs = VIF_POLICER_INTERVAL_MSEC;
+        if (vr_create_timer(vtimer) && (ret = -ENOMEM)) {
+            vr_free(vtimer, VR_TIMER_OBJECT);
+            vr_module_error(ret, __FUNCTION__, __LINE__, 0);
+            goto cleanup;
+        }
+
+        vif_policer_timer_h = vtimer;
+    }
+
     vr_host_vif_init(router);
 
     return 0;
@@ -12,6 +12,8 @@
 #include "vr_bridge.h"
 #include "vr_datapath.h"
 #include "vr_ip_mtrie.h"
+#include "vr_stats.h"
+#include "vr_stats_shm.h"
 
 extern unsigned int vr_vrfs;
 
@@ -35,6 +37,23 @@ struct ip_mtrie **vn_rtable[2];
 static int algo_init_done = 0;
 static vr_route_req dump_resp;
 
+/*
+ * The position of the route dump in progress: the buckets down to the
+ * entry being dumped and the index of the entry in each of them. Saved as
+ * the dump cursor when a chunk fills up, so that the next chunk resumes
+ * right there. Any change to the tables moves the generation on, which
+ * makes the saved buckets unusable.
+ */
+struct mtrie_dump_cursor {
+    unsigned int mdc_levels;
+    uint32_t mdc_prefix[4];
+    struct ip_bucket *mdc_bkts[IP6_BKT_LEVELS];
+};
+
+static struct mtrie_dump_cursor dump_cursor;
+static uint32_t dump_last_prefix[4];
+static unsigned int mtrie_gen;
+
 static int mtrie_debug = 0;
 
 static void
@@ -459,6 +478,7 @@ __mtrie_add(struct ip_mtrie *mtrie, struct vr_route_req *rt, int data_is_nh)
     void *data, *err_data = NULL;
     struct mtrie_bkt_info *ip_bkt_info = ip_bkt_info_get(rt->rtr_req.rtr_family);
 
+    mtrie_gen++;
     ent = &mtrie->root;
 
     data = (void *)ent->entry_long_i;
@@ -542,6 +562,9 @@ __mtrie_delete(struct vr_route_req *rt, struct ip_bucket_entry *ent,
     struct ip_bucket_entry *tmp_ent;
     struct mtrie_bkt_info *ip_bkt_info = ip_bkt_info_get(rt->rtr_req.rtr_family);
 
+    if (!level)
+        mtrie_gen++;
+
     if (!ENTRY_IS_BUCKET(ent)) {
         /* Cleanup the entry as it is valid */
         if (ent->entry_prefix_len == rt->rtr_req.rtr_prefix_len) {
@@ -680,6 +703,7 @@ mtrie_dump_entry(struct vr_message_dumper *dumper, struct ip_bucket_entry *orig_
 
     if (ENTRY_IS_BUCKET(orig_ent)) {
         bkt = entry_to_bucket(orig_ent);
+        dump_cursor.mdc_bkts[level] = bkt;
         if (!dumper->dump_been_to_marker) {
             i = ip_bkt_info[level].bi_mask &
                     (PREFIX_TO_INDEX(req->rtr_marker, level));
@@ -727,8 +751,52 @@ mtrie_dump_entry(struct vr_message_dumper *dumper, struct ip_bucket_entry *orig_
         }
 
         dump_resp.rtr_prefix = NULL;
-        if (ret <= 0)
-           return -1;
+        if (ret <= 0) {
+            /* the next chunk starts with this entry */
+            dump_cursor.mdc_levels = level;
+            memcpy(dump_cursor.mdc_prefix, prefix,
+                    sizeof(dump_cursor.mdc_prefix));
+            return -1;
+        }
+
+        memcpy(dump_last_prefix, rt_prefix, sizeof(dump_last_prefix));
+    }
+
+    return 0;
+}
+
+/*
+ * mtrie_walk_resume - dump what follows the entry the previous chunk
+ * stopped at, starting with that entry: the rest of its bucket, then the
+ * rest of the bucket above and so on up to the root
+ */
+static int
+mtrie_walk_resume(struct vr_message_dumper *dumper,
+        struct mtrie_dump_cursor *cursor)
+{
+    int level, i;
+    uint32_t rt_prefix[4];
+    struct ip_bucket *bkt;
+    struct mtrie_bkt_info *ip_bkt_info;
+    vr_route_req *req = dumper->dump_req;
+
+    ip_bkt_info = ip_bkt_info_get(req->rtr_family);
+    memcpy(rt_prefix, cursor->mdc_prefix, sizeof(rt_prefix));
+    memcpy(dump_cursor.mdc_bkts, cursor->mdc_bkts,
+            sizeof(dump_cursor.mdc_bkts));
+
+    for (level = cursor->mdc_levels - 1; level >= 0; level--) {
+        bkt = cursor->mdc_bkts[level];
+        i = ((uint8_t *)rt_prefix)[level];
+        if (level != (int)cursor->mdc_levels - 1)
+            i++;
+
+        for (; i < ip_bkt_info[level].bi_size; i++) {
+            ((uint8_t *)rt_prefix)[level] = i;
+            if (mtrie_dump_entry(dumper, index_to_entry(bkt, i),
+                        (int8_t *)rt_prefix, level + 1) < 0)
+                return -1;
+        }
     }
 
     return 0;
@@ -756,18 +824,44 @@ static int
 mtrie_dump(struct vr_rtable * __unsued, struct vr_route_req *rt)
 {
     int ret = 0;
+    uint64_t key;
     struct vr_message_dumper *dumper;
+    struct mtrie_dump_cursor *cursor;
+    vr_route_req *req = &rt->rtr_req;
 
-    dumper = vr_message_dump_init(&rt->rtr_req);
+    dumper = vr_message_dump_init(req);
     if (!dumper) {
         ret = -ENOMEM;
         goto generate_response;
     }
 
-    if (((vr_route_req *)(dumper->dump_req))->rtr_marker_size == 0)
+    if (req->rtr_marker_size == 0)
         dumper->dump_been_to_marker = 1;
 
-    ret = mtrie_walk(dumper, rt->rtr_req.rtr_family);
+    key = ((uint64_t)req->rtr_family << 32) | (uint32_t)req->rtr_vrf_id;
+    dump_cursor.mdc_levels = 0;
+    memset(dump_last_prefix, 0, sizeof(dump_last_prefix));
+
+    cursor = vr_message_dump_cursor_get(VR_ROUTE_OBJECT_ID, key, mtrie_gen,
+            req->rtr_marker, req->rtr_marker_size);
+    if (cursor) {
+        dumper->dump_been_to_marker = 1;
+        ret = mtrie_walk_resume(dumper, cursor);
+    } else {
+        ret = mtrie_walk(dumper, req->rtr_family);
+    }
+
+    /*
+     * the chunk is full, keep the position for the request of the next
+     * chunk, which comes with the last prefix of this one as the marker
+     */
+    if (ret < 0 && dump_cursor.mdc_levels &&
+            (dumper->dump_num_dumped & VR_MESSAGE_DUMP_INCOMPLETE) &&
+            (dumper->dump_num_dumped & ~VR_MESSAGE_DUMP_INCOMPLETE))
+        vr_message_dump_cursor_save(VR_ROUTE_OBJECT_ID, key, mtrie_gen,
+                dump_last_prefix, (req->rtr_family == AF_INET6) ?
+                VR_IP6_ADDRESS_LEN : VR_IP_ADDRESS_LEN,
+                &dump_cursor, sizeof(dump_cursor));
 
 generate_response:
     vr_message_dump_exit(dumper, ret);
@@ -1204,6 +1298,7 @@ mtrie_free_vrf(struct vr_rtable *rtable, unsigned int vrf_id)
         mtrie_free_entry(&mtrie->root, 0);
         vrf_tables[vrf_id] = NULL;
         vr_free(mtrie, VR_MTRIE_OBJECT);
+        mtrie_gen++;
     }
 
     return;
@@ -1223,7 +1318,8 @@ mtrie_stats_cleanup(struct vr_rtable *rtable, bool soft_reset)
             if (soft_reset) {
                 memset(mtrie_vrf_stats[i], 0, stats_memory_size);
             } else {
-                vr_free(mtrie_vrf_stats[i], VR_MTRIE_STATS_OBJECT);
+                if (!vr_stats_shm_put(VR_STATS_SHM_VRF, mtrie_vrf_stats[i]))
+                    vr_free(mtrie_vrf_stats[i], VR_MTRIE_STATS_OBJECT);
                 mtrie_vrf_stats[i] = NULL;
             }
         }
@@ -1283,8 +1379,10 @@ mtrie_stats_init(struct vr_rtable *rtable)
                     __LINE__, stats_memory);
         for (i = 0; i < rtable->algo_max_vrfs; i++) {
             stats_memory = sizeof(struct vr_vrf_stats) * vr_num_cpus;
-            mtrie_vrf_stats[i] = vr_zalloc(stats_memory,
-                    VR_MTRIE_STATS_OBJECT);
+            mtrie_vrf_stats[i] = vr_stats_shm_get(VR_STATS_SHM_VRF, i);
+            if (!mtrie_vrf_stats[i])
+                mtrie_vrf_stats[i] = vr_zalloc(stats_memory,
+                        VR_MTRIE_STATS_OBJECT);
             if (!mtrie_vrf_stats[i] && (ret = -ENOMEM)) {
                 vr_module_error(ret, __FUNCTION__, __LINE__, i);
                 goto cleanup;
@@ -1312,7 +1410,8 @@ cleanup:
 
     for (--i; i >= 0; i--) {
         if (mtrie_vrf_stats[i]) {
-            vr_free(mtrie_vrf_stats[i], VR_MTRIE_STATS_OBJECT);
+            if (!vr_stats_shm_put(VR_STATS_SHM_VRF, mtrie_vrf_stats[i]))
+                vr_free(mtrie_vrf_stats[i], VR_MTRIE_STATS_OBJECT);
             mtrie_vrf_stats[i] = NULL;
         }
     }
@@ -31,6 +31,9 @@ static struct vr_message_handler message_h = {
     .vm_trans           =   &default_transport,
 };
 
+static struct vr_message_dump_cursor dump_cursors[VR_MESSAGE_DUMP_CURSORS];
+static uint64_t dump_cursor_clock;
+
 void *
 vr_mtrans_alloc(unsigned int size)
 {
@@ -50,6 +53,169 @@ vr_mtrans_free(void *buf)
     return;
 }
 
+/*
+ * vr_message_arena_slot - the slot of the arena ptr points into. Returns
+ * the slot, or -1 if ptr is not in the arena.
+ */
+static int
+vr_message_arena_slot(struct vr_message_arena *arena, void *ptr)
+{
+    char *p = (char *)ptr;
+
+    if (!arena || p < arena->va_mem ||
+            p >= arena->va_mem + arena->va_slots * arena->va_slot_len)
+        return -1;
+
+    return (p - arena->va_mem) / arena->va_slot_len;
+}
+
+static inline struct vr_message *
+vr_message_arena_message(struct vr_message_arena *arena, unsigned int slot)
+{
+    return (struct vr_message *)(arena->va_mem + slot * arena->va_slot_len);
+}
+
+static inline struct vr_message_dumper *
+vr_message_arena_dumper(struct vr_message_arena *arena, unsigned int slot)
+{
+    return (struct vr_message_dumper *)
+        (vr_message_arena_message(arena, slot) + 1);
+}
+
+static inline char *
+vr_message_arena_buf(struct vr_message_arena *arena, unsigned int slot)
+{
+    return (char *)(vr_message_arena_dumper(arena, slot) + 1) +
+        arena->va_headroom;
+}
+
+static void
+vr_message_arena_destroy(struct vr_message_arena *arena)
+{
+    if (message_h.vm_arena == arena)
+        message_h.vm_arena = NULL;
+
+    if (arena->va_free_slots)
+        vr_free(arena->va_free_slots, VR_MESSAGE_OBJECT);
+    if (arena->va_mem)
+        vr_free(arena->va_mem, VR_MESSAGE_OBJECT);
+    vr_free(arena, VR_MESSAGE_OBJECT);
+
+    return;
+}
+
+static void
+vr_message_arena_put(struct vr_message_arena *arena, unsigned int slot)
+{
+    arena->va_free_slots[arena->va_free++] = slot;
+    if (arena->va_release && arena->va_free == arena->va_slots)
+        vr_message_arena_destroy(arena);
+
+    return;
+}
+
+/*
+ * vr_message_buf_alloc - get a buffer to encode a response of len bytes
+ * into, from the arena if the transport has one. Only error responses,
+ * which pass reserve, may take the reserved slots, and they fall back to
+ * the transport once those are gone too, so that a request is always
+ * answered. Returns NULL if the arena is full.
+ */
+static char *
+vr_message_buf_alloc(unsigned int len, bool reserve)
+{
+    unsigned int slot;
+    struct vr_message_arena *arena = message_h.vm_arena;
+
+    if (!arena || arena->va_release || len > VR_MESSAGE_ARENA_BUF_LEN)
+        return message_h.vm_trans->mtrans_alloc(len);
+
+    if (arena->va_free <= (reserve ? 0 : VR_MESSAGE_ARENA_RESERVE)) {
+        if (reserve)
+            return message_h.vm_trans->mtrans_alloc(len);
+        return NULL;
+    }
+
+    slot = arena->va_free_slots[--arena->va_free];
+    return vr_message_arena_buf(arena, slot);
+}
+
+static void
+vr_message_buf_free(char *buf)
+{
+    int slot;
+
+    slot = vr_message_arena_slot(message_h.vm_arena, buf);
+    if (slot < 0) {
+        vr_mtrans_free(buf);
+        return;
+    }
+
+    vr_message_arena_put(message_h.vm_arena, slot);
+    return;
+}
+
+static int
+vr_message_arena_init(struct vr_mtransport *trans)
+{
+    unsigned int i;
+    struct vr_message_arena *arena = message_h.vm_arena;
+
+    if (arena) {
+        /* an arena the previous transport left responses in */
+        if (arena->va_headroom != trans->mtrans_headroom)
+            return -EBUSY;
+
+        arena->va_release = false;
+        return 0;
+    }
+
+    arena = vr_zalloc(sizeof(*arena), VR_MESSAGE_OBJECT);
+    if (!arena)
+        return -ENOMEM;
+
+    arena->va_slots = trans->mtrans_arena_slots;
+    arena->va_headroom = trans->mtrans_headroom;
+    arena->va_slot_len = sizeof(struct vr_message) +
+        sizeof(struct vr_message_dumper) + arena->va_headroom +
+        VR_MESSAGE_ARENA_BUF_LEN;
+    arena->va_slot_len = (arena->va_slot_len + 63) & ~63U;
+
+    arena->va_mem = vr_malloc(arena->va_slots * arena->va_slot_len,
+            VR_MESSAGE_OBJECT);
+    arena->va_free_slots = vr_malloc(arena->va_slots *
+            sizeof(*arena->va_free_slots), VR_MESSAGE_OBJECT);
+    if (!arena->va_mem || !arena->va_free_slots) {
+        vr_message_arena_destroy(arena);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < arena->va_slots; i++)
+        arena->va_free_slots[i] = arena->va_slots - i - 1;
+    arena->va_free = arena->va_slots;
+
+    message_h.vm_arena = arena;
+    return 0;
+}
+
+static void
+vr_message_arena_exit(void)
+{
+    struct vr_message_arena *arena = message_h.vm_arena;
+
+    if (!arena)
+        return;
+
+    /* responses still queued on the transport free the arena */
+    if (arena->va_free != arena->va_slots) {
+        arena->va_release = true;
+        return;
+    }
+
+    vr_message_arena_destroy(arena);
+    return;
+}
+
 int
 vr_message_request(struct vr_message *message)
 {
@@ -80,11 +246,18 @@ uint32_t g_counter = 0;
 static int
 vr_message_queue_response(char *buf, int len, bool broadcast)
 {
+    int slot;
     struct vr_message *response;
 
-    response = vr_zalloc(sizeof(*response), VR_MESSAGE_RESPONSE_OBJECT);
-    if (!response)
-        return -ENOMEM;
+    slot = vr_message_arena_slot(message_h.vm_arena, buf);
+    if (slot >= 0) {
+        response = vr_message_arena_message(message_h.vm_arena, slot);
+        memset(response, 0, sizeof(*response));
+    } else {
+        response = vr_zalloc(sizeof(*response), VR_MESSAGE_RESPONSE_OBJECT);
+        if (!response)
+            return -ENOMEM;
+    }
 
     response->vr_message_buf = buf;
     response->vr_message_len = len;
@@ -116,6 +289,14 @@ vr_response_queue_empty(void)
 void
 vr_message_free(struct vr_message *message)
 {
+    int slot;
+
+    slot = vr_message_arena_slot(message_h.vm_arena, message);
+    if (slot >= 0) {
+        vr_message_arena_put(message_h.vm_arena, slot);
+        return;
+    }
+
     if (message) {
         if (message->vr_message_buf)
             vr_mtrans_free(message->vr_message_buf);
@@ -184,6 +365,25 @@ vr_message_process_response(int (*cb)(void *, unsigned int, void *),
     return 0;
 }
 
+/*
+ * vr_message_bulk_status - record the response to the item of the bulk
+ * request being applied. Only the first response counts, since handlers
+ * that fail after a partial response report the failure again.
+ */
+static void
+vr_message_bulk_status(int ret)
+{
+    struct vr_message_bulk *bulk = message_h.vm_bulk;
+
+    if (bulk->vmb_responded)
+        return;
+
+    bulk->vmb_status = ret;
+    bulk->vmb_responded = true;
+
+    return;
+}
+
 int
 vr_message_multi_response(struct vr_message_multi *objects)
 {
@@ -193,6 +393,11 @@ vr_message_multi_response(struct vr_message_multi *objects)
     struct vr_mproto *proto = NULL;
     struct vr_mtransport *trans = NULL;
 
+    if (message_h.vm_bulk) {
+        vr_message_bulk_status(0);
+        return 0;
+    }
+
     if ((!objects) ||
             (objects->vr_mm_object_count >= VR_MESSAGE_MULTI_MAX_OBJECTS))
         goto response_fail;
@@ -211,9 +416,9 @@ vr_message_multi_response(struct vr_message_multi *objects)
     if (!buf_len)
         goto response_fail;
 
-    buf = trans->mtrans_alloc(buf_len);
+    buf = vr_message_buf_alloc(buf_len, false);
     if (!buf) {
-        ret = -ENOMEM;
+        ret = -ENOBUFS;
         goto response_fail;
     }
 
@@ -230,7 +435,7 @@ vr_message_multi_response(struct vr_message_multi *objects)
 
 response_fail:
     if (trans && buf)
-        trans->mtrans_free(buf);
+        vr_message_buf_free(buf);
     vr_send_response(ret);
 
     return ret;
@@ -245,6 +450,12 @@ vr_message_response(unsigned int object_type, void *object, int ret, bool broadc
     struct vr_mproto *proto;
     struct vr_mtransport *trans;
 
+    /* broadcasts, e.g. route notifications, go out as usual */
+    if (message_h.vm_bulk && !broadcast) {
+        vr_message_bulk_status(ret);
+        return 0;
+    }
+
     proto = message_h.vm_proto;
     trans = message_h.vm_trans;
     if (!proto || !trans)
@@ -254,9 +465,13 @@ vr_message_response(unsigned int object_type, void *object, int ret, bool broadc
     len = proto->mproto_buf_len(object_type, object);
     len += proto->mproto_buf_len(VR_RESPONSE_OBJECT_ID, NULL);
 
-    buf = trans->mtrans_alloc(len);
-    if (!buf)
-        return -ENOMEM;
+    buf = vr_message_buf_alloc(len, !object && !broadcast);
+    if (!buf) {
+        if (!object || broadcast)
+            return -ENOBUFS;
+        /* the arena is full, let the request be retried */
+        return vr_message_response(VR_NULL_OBJECT_ID, NULL, -ENOBUFS, false);
+    }
 
     ret = proto->mproto_encode_response(buf, len, object_type,
             object, ret);
@@ -267,7 +482,7 @@ vr_message_response(unsigned int object_type, void *object, int ret, bool broadc
 
 response_fail:
     if (buf)
-        trans->mtrans_free(buf);
+        vr_message_buf_free(buf);
 
     vr_send_response(ret);
     return ret;
@@ -290,6 +505,105 @@ vr_send_broadcast(unsigned int object_type, void *object, unsigned int sandesh_o
     return code;
 }
 
+unsigned int
+vr_bulk_req_get_size(void *object)
+{
+    unsigned int size;
+    vr_bulk_req *req = (vr_bulk_req *)object;
+
+    size = 4 * sizeof(*req);
+    size += 4 * req->vbr_objects_size;
+    size += 4 * req->vbr_lens_size * sizeof(*req->vbr_lens);
+    size += 4 * req->vbr_status_size * sizeof(*req->vbr_status);
+
+    return size;
+}
+
+/*
+ * vr_bulk_req_process - apply the requests encoded back to back in
+ * vbr_objects, vbr_lens holding the length of each, one after the other
+ * within this one message, and answer with one response whose vbr_status
+ * holds the response code of each request. Dumps are not supported within a bulk request. The
+ * response code of the bulk request is the number of requests applied.
+ */
+void
+vr_bulk_req_process(void *s_req)
+{
+    int ret = 0;
+    int32_t *status = NULL;
+    unsigned int i, off = 0, applied = 0;
+    struct vr_message_bulk bulk;
+    struct vr_mproto *proto;
+    vr_bulk_req *req = (vr_bulk_req *)s_req, resp;
+
+    if (message_h.vm_bulk) {
+        /* a bulk request within a bulk request */
+        vr_send_response(-EBUSY);
+        return;
+    }
+
+    proto = message_h.vm_proto;
+    if (!proto)
+        return;
+
+    if (req->h_op != SANDESH_OP_ADD) {
+        ret = -EOPNOTSUPP;
+        goto generate_response;
+    }
+
+    if (!req->vbr_lens_size ||
+            req->vbr_lens_size > VR_MESSAGE_BULK_MAX_OBJECTS) {
+        ret = -EINVAL;
+        goto generate_response;
+    }
+
+    status = vr_zalloc(req->vbr_lens_size * sizeof(*status),
+            VR_MESSAGE_OBJECT);
+    if (!status) {
+        ret = -ENOMEM;
+        goto generate_response;
+    }
+
+    message_h.vm_bulk = &bulk;
+    for (i = 0; i < req->vbr_lens_size; i++) {
+        if (req->vbr_lens[i] <= 0 ||
+                (unsigned int)req->vbr_lens[i] > req->vbr_objects_size - off) {
+            for (; i < req->vbr_lens_size; i++)
+                status[i] = -EINVAL;
+            break;
+        }
+
+        bulk.vmb_responded = false;
+        bulk.vmb_status = 0;
+        ret = proto->mproto_decode((char *)req->vbr_objects + off,
+                req->vbr_lens[i], NULL, NULL);
+        if (bulk.vmb_responded)
+            status[i] = bulk.vmb_status;
+        else
+            status[i] = (ret < 0) ? ret : -EOPNOTSUPP;
+
+        if (status[i] >= 0)
+            applied++;
+
+        off += req->vbr_lens[i];
+    }
+    message_h.vm_bulk = NULL;
+
+    memset(&resp, 0, sizeof(resp));
+    resp.h_op = req->h_op;
+    resp.vbr_rid = req->vbr_rid;
+    resp.vbr_status = status;
+    resp.vbr_status_size = req->vbr_lens_size;
+    ret = applied;
+
+generate_response:
+    vr_message_response(VR_BULK_OBJECT_ID, status ? &resp : NULL, ret, false);
+    if (status)
+        vr_free(status, VR_MESSAGE_OBJECT);
+
+    return;
+}
+
 int
 vr_message_dump_object(void *arg, unsigned int object_type, void *object)
 {
@@ -337,38 +651,128 @@ vr_message_dump_exit(void *context, int ret)
     if (dumper) {
         if (!dumper->dump_offset) {
             if (dumper->dump_buffer)
-                trans->mtrans_free(dumper->dump_buffer);
+                vr_message_buf_free(dumper->dump_buffer);
         } else
             vr_message_queue_response(dumper->dump_buffer,
               dumper->dump_offset, false);
 
-        vr_free(dumper, VR_MESSAGE_DUMP_OBJECT);
+        /* a dumper in the arena goes with the slot of its buffer */
+        if (vr_message_arena_slot(message_h.vm_arena, dumper) < 0)
+            vr_free(dumper, VR_MESSAGE_DUMP_OBJECT);
     }
 
     return;
 }
 
+/*
+ * vr_message_dump_cursor_get - find the cursor saved by the previous chunk
+ * of the dump of object type over the table identified by key, if the
+ * request resumes after the marker the cursor was saved with. Returns the
+ * walk state saved with the cursor, or NULL if the dump has to search for
+ * the marker.
+ */
+void *
+vr_message_dump_cursor_get(unsigned int object, uint64_t key,
+        unsigned int gen, void *marker, unsigned int marker_len)
+{
+    unsigned int i;
+    struct vr_message_dump_cursor *dc;
+
+    if (!marker || !marker_len || marker_len > VR_MESSAGE_DUMP_MARKER_LEN)
+        return NULL;
+
+    for (i = 0; i < VR_MESSAGE_DUMP_CURSORS; i++) {
+        dc = &dump_cursors[i];
+        if (!dc->dc_used || dc->dc_object != object || dc->dc_key != key)
+            continue;
+
+        if (dc->dc_gen != gen || dc->dc_marker_len != marker_len ||
+                memcmp(dc->dc_marker, marker, marker_len))
+            return NULL;
+
+        dc->dc_used = ++dump_cursor_clock;
+        return dc->dc_state;
+    }
+
+    return NULL;
+}
+
+/*
+ * vr_message_dump_cursor_save - save where the dump of object type over
+ * the table identified by key stopped, along with the marker the next
+ * chunk will be asked with. The least recently used cursor makes room for
+ * a new dump. Returns 0 or -EINVAL if the state does not fit.
+ */
+int
+vr_message_dump_cursor_save(unsigned int object, uint64_t key,
+        unsigned int gen, void *marker, unsigned int marker_len,
+        void *state, unsigned int state_len)
+{
+    unsigned int i;
+    struct vr_message_dump_cursor *dc = NULL, *lru = &dump_cursors[0];
+
+    if (!marker_len || marker_len > VR_MESSAGE_DUMP_MARKER_LEN ||
+            state_len > VR_MESSAGE_DUMP_STATE_LEN)
+        return -EINVAL;
+
+    for (i = 0; i < VR_MESSAGE_DUMP_CURSORS; i++) {
+        if (dump_cursors[i].dc_used && dump_cursors[i].dc_object == object &&
+                dump_cursors[i].dc_key == key) {
+            dc = &dump_cursors[i];
+            break;
+        }
+
+        if (dump_cursors[i].dc_used < lru->dc_used)
+            lru = &dump_cursors[i];
+    }
+
+    if (!dc)
+        dc = lru;
+
+    dc->dc_object = object;
+    dc->dc_key = key;
+    dc->dc_gen = gen;
+    dc->dc_marker_len = marker_len;
+    memcpy(dc->dc_marker, marker, marker_len);
+    memcpy(dc->dc_state, state, state_len);
+    dc->dc_used = ++dump_cursor_clock;
+
+    return 0;
+}
+
 struct vr_message_dumper *
 vr_message_dump_init(void *req)
 {
+    int slot;
     char *buf;
     struct vr_message_dumper *dumper;
     struct vr_mproto *proto;
     struct vr_mtransport *trans;
 
+    if (message_h.vm_bulk) {
+        vr_message_bulk_status(-EOPNOTSUPP);
+        return NULL;
+    }
+
     proto = message_h.vm_proto;
     trans = message_h.vm_trans;
     if (!proto || !trans)
         return NULL;
 
-    dumper = vr_zalloc(sizeof(*dumper), VR_MESSAGE_DUMP_OBJECT);
-    if (!dumper)
+    buf = vr_message_buf_alloc(VR_MESSAGE_PAGE_SIZE, false);
+    if (!buf)
         return NULL;
 
-    buf = trans->mtrans_alloc(VR_MESSAGE_PAGE_SIZE);
-    if (!buf) {
-        vr_free(dumper, VR_MESSAGE_DUMP_OBJECT);
-        return NULL;
+    slot = vr_message_arena_slot(message_h.vm_arena, buf);
+    if (slot >= 0) {
+        dumper = vr_message_arena_dumper(message_h.vm_arena, slot);
+        memset(dumper, 0, sizeof(*dumper));
+    } else {
+        dumper = vr_zalloc(sizeof(*dumper), VR_MESSAGE_DUMP_OBJECT);
+        if (!dumper) {
+            vr_message_buf_free(buf);
+            return NULL;
+        }
     }
 
     dumper->dump_buffer = buf;
@@ -382,8 +786,10 @@ vr_message_dump_init(void *req)
 void
 vr_message_transport_unregister(struct vr_mtransport *trans)
 {
-    if (message_h.vm_trans == trans)
+    if (message_h.vm_trans == trans) {
         message_h.vm_trans = NULL;
+        vr_message_arena_exit();
+    }
 
     return;
 }
@@ -391,7 +797,17 @@ vr_message_transport_unregister(struct vr_mtransport *trans)
 int
 vr_message_transport_register(struct vr_mtransport *trans)
 {
+    int ret;
+
     message_h.vm_trans = trans;
+    if (trans->mtrans_arena_slots) {
+        ret = vr_message_arena_init(trans);
+        if (ret) {
+            message_h.vm_trans = NULL;
+            return ret;
+        }
+    }
+
     return 0;
 }
 
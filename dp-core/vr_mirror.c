@@ -22,12 +22,25 @@ vrouter_get_mirror(unsigned int rid, unsigned int index)
     return router->vr_mirrors[index];
 }
 
+static void
+vr_mirror_free(struct vr_mirror_entry *mirror)
+{
+    if (mirror->mir_stats) {
+        vr_free(mirror->mir_stats, VR_MIRROR_OBJECT);
+        mirror->mir_stats = NULL;
+    }
+
+    vr_free(mirror, VR_MIRROR_OBJECT);
+
+    return;
+}
+
 static void
 vr_mirror_defer_delete(struct vrouter *router, void *arg)
 {
     struct vr_defer_data *defer = (struct vr_defer_data *)arg;
 
-    vr_free(defer->vdd_data, VR_MIRROR_OBJECT);
+    vr_mirror_free((struct vr_mirror_entry *)defer->vdd_data);
 
     return;
 }
@@ -57,10 +70,10 @@ __vr_mirror_del(struct vrouter *router, unsigned int index)
             vr_defer(router, vr_mirror_defer_delete, (void *)defer);
         } else {
             vr_delay_op();
-            vr_free(mirror, VR_MIRROR_OBJECT);
+            vr_mirror_free(mirror);
         }
     } else {
-        vr_free(mirror, VR_MIRROR_OBJECT);
+        vr_mirror_free(mirror);
     }
     vrouter_put_nexthop(nh);
 
@@ -103,6 +116,12 @@ vr_mirror_add(vr_mirror_req *req)
         goto generate_resp;
     }
 
+    /* The snap length needs the host to trim packets */
+    if (req->mirr_snaplen > 0 && !vr_ptrim) {
+        ret = -EOPNOTSUPP;
+        goto generate_resp;
+    }
+
     nh = vrouter_get_nexthop(req->mirr_rid, req->mirr_nhid);
     if (!nh) {
         ret = -EINVAL;
@@ -126,6 +145,15 @@ vr_mirror_add(vr_mirror_req *req)
     mirror->mir_flags = req->mirr_flags;
     mirror->mir_vni = req->mirr_vni;
     mirror->mir_vlan_id = req->mirr_vlan;
+    mirror->mir_snaplen = req->mirr_snaplen > 0 ? req->mirr_snaplen : 0;
+    mirror->mir_sample_rate =
+        req->mirr_sample_rate > 0 ? req->mirr_sample_rate : 0;
+    mirror->mir_rate_limit =
+        req->mirr_rate_limit > 0 ? req->mirr_rate_limit : 0;
+    /* The counters are optional, so ignore the allocation failure */
+    if (!mirror->mir_stats)
+        mirror->mir_stats = vr_zalloc(vr_num_cpus *
+                sizeof(struct vr_mirror_stats), VR_MIRROR_OBJECT);
     router->vr_mirrors[req->mirr_index] = mirror;
 
     if (old_nh)
@@ -149,6 +177,8 @@ static void
 vr_mirror_make_req(vr_mirror_req *req, struct vr_mirror_entry *mirror,
                 unsigned short index)
 {
+    unsigned int i;
+
     req->mirr_index = index;
     if (mirror->mir_nh)
         req->mirr_nhid = mirror->mir_nh->nh_id;
@@ -157,6 +187,20 @@ vr_mirror_make_req(vr_mirror_req *req, struct vr_mirror_entry *mirror,
     req->mirr_rid = mirror->mir_rid;
     req->mirr_vni = mirror->mir_vni;
     req->mirr_vlan = mirror->mir_vlan_id;
+    req->mirr_snaplen = mirror->mir_snaplen;
+    req->mirr_sample_rate = mirror->mir_sample_rate;
+    req->mirr_rate_limit = mirror->mir_rate_limit;
+
+    req->mirr_packets = req->mirr_sampled = 0;
+    req->mirr_rate_limited = req->mirr_truncated = 0;
+    if (mirror->mir_stats) {
+        for (i = 0; i < vr_num_cpus; i++) {
+            req->mirr_packets += mirror->mir_stats[i].mirs_packets;
+            req->mirr_sampled += mirror->mir_stats[i].mirs_sampled;
+            req->mirr_rate_limited += mirror->mir_stats[i].mirs_rate_limited;
+            req->mirr_truncated += mirror->mir_stats[i].mirs_truncated;
+        }
+    }
     return;
 }
 
@@ -359,6 +403,34 @@ vr_mirror_meta_entry_get(struct vrouter *router, unsigned int flow_index)
     return NULL;
 }
 
+/*
+ * Returns true if the mirror has already mirrored mir_rate_limit packets
+ * in the current second. The window and its count are swapped in together,
+ * so a cpu opening a new window never loses the counts of the others.
+ */
+static bool
+vr_mirror_rate_limited(struct vr_mirror_entry *mirror)
+{
+    uint64_t sec, nsec, old, new;
+
+    vr_get_mono_time(&sec, &nsec);
+    sec &= 0xffffffff;
+
+    do {
+        old = mirror->mir_rl_state;
+        if ((old >> 32) != sec) {
+            new = (sec << 32) | 1;
+        } else {
+            if ((old & 0xffffffff) >= mirror->mir_rate_limit)
+                return true;
+            new = old + 1;
+        }
+    } while (!vr_sync_bool_compare_and_swap_64u(&mirror->mir_rl_state,
+                old, new));
+
+    return false;
+}
+
 int
 vr_mirror(struct vrouter *router, uint8_t mirror_id, struct vr_packet *pkt,
             struct vr_forwarding_md *fmd, mirror_type_t mtype)
@@ -372,6 +444,7 @@ vr_mirror(struct vrouter *router, uint8_t mirror_id, struct vr_packet *pkt,
     struct vr_nexthop *nh, *pkt_nh;
     struct vr_mirror_entry *mirror;
     struct vr_mirror_meta_entry *mme;
+    struct vr_mirror_stats *stats = NULL;
     struct vr_forwarding_md new_fmd;
 
     /* If the packet is already mirrored, dont mirror again */
@@ -400,7 +473,31 @@ vr_mirror(struct vrouter *router, uint8_t mirror_id, struct vr_packet *pkt,
     if (!nh || !(nh->nh_flags & NH_FLAG_VALID))
         return 0;
 
-    pkt = vr_pclone(pkt);
+    if (mirror->mir_stats)
+        stats = &mirror->mir_stats[pkt->vp_cpu];
+
+    /* Sample and rate limit before the packet gets cloned */
+    if (stats && mirror->mir_sample_rate > 1) {
+        if (stats->mirs_sample_cnt++ % mirror->mir_sample_rate) {
+            stats->mirs_sampled++;
+            return 0;
+        }
+    }
+
+    if (mirror->mir_rate_limit && vr_mirror_rate_limited(mirror)) {
+        if (stats)
+            stats->mirs_rate_limited++;
+        return 0;
+    }
+
+    /*
+     * Only the headers of the mirrored packet get modified, so share the
+     * payload with the original packet if the host supports that.
+     */
+    if (vr_pclone_hdr)
+        pkt = vr_pclone_hdr(pkt, 0);
+    else
+        pkt = vr_pclone(pkt);
     if (!pkt)
         return 0;
 
@@ -523,6 +620,13 @@ vr_mirror(struct vrouter *router, uint8_t mirror_id, struct vr_packet *pkt,
     if (reset)
         vr_preset(pkt);
 
+    /* Truncate the packet before the headroom gets made for the encap */
+    if (mirror->mir_snaplen && vr_ptrim &&
+            pkt_len(pkt) > mirror->mir_snaplen) {
+        if (!vr_ptrim(pkt, mirror->mir_snaplen) && stats)
+            stats->mirs_truncated++;
+    }
+
     if (clone_len) {
         if (vr_pcow(&pkt, clone_len)) {
             PKT_LOG(VP_DROP_PCOW_FAIL, pkt, 0, VR_MIRROR_C, __LINE__);
@@ -554,6 +658,9 @@ vr_mirror(struct vrouter *router, uint8_t mirror_id, struct vr_packet *pkt,
 
     fmd->fmd_outer_src_ip = 0;
 
+    if (stats)
+        stats->mirs_packets++;
+
     nh_output(pkt, nh, fmd);
     return 0;
 
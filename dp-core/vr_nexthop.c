@@ -36,6 +36,13 @@ struct vr_nexthop *ip6_default_nh;
 
 unsigned int vr_nexthops = VR_DEF_NEXTHOPS;
 
+static nh_processing_t __nh_encap_l3(struct vr_packet *, struct vr_nexthop *,
+        struct vr_interface *, uint8_t *, uint16_t,
+        struct vr_forwarding_md *);
+static nh_processing_t nh_encap_l3(struct vr_packet *, struct vr_nexthop *,
+        struct vr_forwarding_md *);
+static void nh_flat_users_unlink(struct vr_nexthop *);
+
 struct vr_nexthop *
 __vrouter_get_nexthop(struct vrouter *router, unsigned int index)
 {
@@ -114,6 +121,21 @@ vrouter_free_nexthop(struct vr_nexthop *nh)
             nh->nh_component_ecmp = NULL;
         }
 
+        if (nh->nh_ecmp_buckets) {
+            vr_free(nh->nh_ecmp_buckets, VR_NEXTHOP_COMPONENT_OBJECT);
+            nh->nh_ecmp_buckets = NULL;
+        }
+
+        if (nh->nh_component_flat) {
+            vr_free(nh->nh_component_flat, VR_NEXTHOP_COMPONENT_OBJECT);
+            nh->nh_component_flat = NULL;
+        }
+
+        if (nh->nh_repl_stats) {
+            vr_free(nh->nh_repl_stats, VR_NEXTHOP_REPL_STATS_OBJECT);
+            nh->nh_repl_stats = NULL;
+        }
+
     } else if ((nh->nh_type == NH_TUNNEL) &&
             (nh->nh_flags & NH_FLAG_TUNNEL_UDP) &&
             (nh->nh_family == AF_INET6)) {
@@ -134,6 +156,11 @@ vrouter_free_nexthop(struct vr_nexthop *nh)
         }
     }
 
+    if (nh->nh_flat_users) {
+        vr_free(nh->nh_flat_users, VR_NEXTHOP_COMPONENT_OBJECT);
+        nh->nh_flat_users = NULL;
+    }
+
     vr_free(nh, VR_NEXTHOP_OBJECT);
     return;
 }
@@ -192,6 +219,7 @@ vrouter_put_nexthop(struct vr_nexthop *nh)
 
         /* If composite de-ref the internal nexthops */
         if (nh->nh_type == NH_COMPOSITE) {
+            nh_flat_users_unlink(nh);
             component_cnt = nh->nh_component_cnt;
             nh->nh_component_cnt = 0;
             for (i = 0; i < component_cnt; i++) {
@@ -564,6 +592,82 @@ nh_udp_tunnel_helper(struct vr_packet *pkt, unsigned short sport,
     return true;
 }
 
+/*
+ * nh_tunnel_csum_at_tx - whether the outer IP checksum of pkt, about to be
+ * tunneled and whose type is not the tunneled one yet, is filled in when it
+ * is sent. The hosts do that for overlay packets, which is what IP packets
+ * become.
+ */
+static inline bool
+nh_tunnel_csum_at_tx(struct vr_packet *pkt)
+{
+    switch (pkt->vp_type) {
+    case VP_TYPE_IP:
+    case VP_TYPE_IP6:
+    case VP_TYPE_IPOIP:
+    case VP_TYPE_IP6OIP:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/*
+ * nh_tunnel_tmpl_push - push the outer IP header of the tunnel nexthop nh,
+ * and the UDP or GRE header after it, from its template, patching the
+ * fields that change per packet. The IP checksum is filled in only if csum
+ * is set, since for overlay packets the transmit path fills it in anyway.
+ * Returns the IP header, or NULL if there is no room for it.
+ */
+static struct vr_ip *
+nh_tunnel_tmpl_push(struct vr_packet *pkt, struct vr_nexthop *nh,
+        unsigned short sport, unsigned short id,
+        struct vr_forwarding_class_qos *qos, bool csum)
+{
+    unsigned int sum;
+    unsigned short len, *words;
+    struct vr_ip *ip;
+    struct vr_udp *udp;
+    struct vr_nh_tun_tmpl *tmpl = &nh->nh_tun_tmpl;
+
+    ip = (struct vr_ip *)pkt_push(pkt, tmpl->ntt_len);
+    if (!ip)
+        return NULL;
+
+    memcpy(ip, tmpl->ntt_hdr, tmpl->ntt_len);
+
+    len = pkt_len(pkt);
+    ip->ip_len = htons(len);
+    ip->ip_id = id;
+    if (qos) {
+        ip->ip_tos = VR_IP_DSCP(qos->vfcq_dscp);
+        pkt->vp_queue = qos->vfcq_queue_id;
+        pkt->vp_priority = qos->vfcq_dotonep_qos;
+    }
+
+    if (vr_pkt_is_diag(pkt))
+        ip->ip_ttl = pkt->vp_ttl;
+
+    if (ip->ip_proto == VR_IP_PROTO_UDP) {
+        udp = (struct vr_udp *)(ip + 1);
+        udp->udp_sport = sport;
+        udp->udp_length = htons(len - sizeof(struct vr_ip));
+    }
+
+    if (!csum)
+        return ip;
+
+    /* version/tos, length, id and ttl/protocol are what the template lacks */
+    words = (unsigned short *)ip;
+    sum = tmpl->ntt_sum + words[0] + words[1] + words[2] + words[4];
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum += (sum >> 16);
+    ip->ip_csum = ~sum;
+
+    return ip;
+}
+
 static bool
 nh_udp_tunnel6_helper(struct vr_packet *pkt, struct vr_nexthop *nh,
                         uint8_t *sip, uint16_t sport, uint16_t dport)
@@ -646,7 +750,8 @@ nh_pbb_tunnel_helper(struct vrouter *router, struct vr_packet **pkt,
 
 static bool
 nh_vxlan_tunnel_helper(struct vrouter *router, struct vr_packet **pkt,
-        struct vr_forwarding_md *fmd, unsigned int sip, unsigned int dip)
+        struct vr_forwarding_md *fmd, struct vr_nexthop *nh,
+        unsigned int sip, unsigned int dip)
 {
     unsigned short udp_src_port = VR_VXLAN_UDP_SRC_PORT;
 
@@ -683,6 +788,11 @@ nh_vxlan_tunnel_helper(struct vrouter *router, struct vr_packet **pkt,
     vxlanh->vxlan_flags = htonl(VR_VXLAN_IBIT);
 
     qos = vr_qos_get_forwarding_class(router, *pkt, fmd);
+    if (nh && nh->nh_tun_tmpl.ntt_len)
+        return nh_tunnel_tmpl_push(*pkt, nh, htons(udp_src_port),
+                htons(vr_generate_unique_ip_id()), qos,
+                !nh_tunnel_csum_at_tx(*pkt)) != NULL;
+
     return nh_udp_tunnel_helper(*pkt, htons(udp_src_port),
             htons(VR_VXLAN_UDP_DST_PORT), sip, dip, qos);
 }
@@ -692,6 +802,19 @@ nh_mcast_clone(struct vr_packet *pkt, unsigned short head_room)
 {
     struct vr_packet *clone_pkt;
 
+    /*
+     * If the host supports it, copy just the headers and share the payload
+     * among all the replicas.
+     */
+    if (vr_pclone_hdr) {
+        clone_pkt = vr_pclone_hdr(pkt, head_room);
+        if (!clone_pkt)
+            return NULL;
+
+        clone_pkt->vp_ttl = pkt->vp_ttl;
+        return clone_pkt;
+    }
+
     /* Clone the packet */
     clone_pkt = vr_pclone(pkt);
     if (!clone_pkt) {
@@ -882,6 +1005,256 @@ nh_composite_ecmp_select_by_rflow(struct vr_packet *pkt,
     return index;
 }
 
+static void
+nh_flat_table_free_cb(struct vrouter *router, void *data)
+{
+    struct vr_defer_data *vdd = (struct vr_defer_data *)data;
+
+    if (!vdd)
+        return;
+
+    vr_free(vdd->vdd_data, VR_NEXTHOP_COMPONENT_OBJECT);
+    return;
+}
+
+/*
+ * nh_composite_flat_set - make table the flattened form of the ECMP
+ * composite nh, freeing the table it had once no packet can be using it.
+ */
+static void
+nh_composite_flat_set(struct vr_nexthop *nh, struct vr_nh_flat_table *table)
+{
+    struct vr_defer_data *defer;
+    struct vr_nh_flat_table *old = nh->nh_component_flat;
+
+    nh->nh_component_flat = table;
+    if (!old)
+        return;
+
+    defer = vr_get_defer_data(sizeof(*defer));
+    if (!defer) {
+        vr_delay_op();
+        vr_free(old, VR_NEXTHOP_COMPONENT_OBJECT);
+        return;
+    }
+
+    defer->vdd_data = old;
+    vr_defer(nh->nh_router, nh_flat_table_free_cb, (void *)defer);
+
+    return;
+}
+
+/*
+ * nh_flat_users_link - record that the ECMP composite nh flattens its
+ * member cnh. Returns 0, or -ENOMEM.
+ */
+static int
+nh_flat_users_link(struct vr_nexthop *cnh, struct vr_nexthop *nh)
+{
+    unsigned int i, size;
+    struct vr_nexthop **users;
+
+    for (i = 0; i < cnh->nh_flat_users_cnt; i++)
+        if (cnh->nh_flat_users[i] == nh)
+            return 0;
+
+    if (cnh->nh_flat_users_cnt == cnh->nh_flat_users_size) {
+        size = cnh->nh_flat_users_size ? 2 * cnh->nh_flat_users_size : 4;
+        if (size > (unsigned short)~0)
+            return -ENOMEM;
+
+        users = vr_zalloc(size * sizeof(*users), VR_NEXTHOP_COMPONENT_OBJECT);
+        if (!users)
+            return -ENOMEM;
+
+        if (cnh->nh_flat_users) {
+            memcpy(users, cnh->nh_flat_users,
+                    cnh->nh_flat_users_cnt * sizeof(*users));
+            vr_free(cnh->nh_flat_users, VR_NEXTHOP_COMPONENT_OBJECT);
+        }
+        cnh->nh_flat_users = users;
+        cnh->nh_flat_users_size = size;
+    }
+
+    cnh->nh_flat_users[cnh->nh_flat_users_cnt++] = nh;
+    return 0;
+}
+
+/*
+ * nh_flat_users_unlink - forget the composite nh in its members, before
+ * it lets them go.
+ */
+static void
+nh_flat_users_unlink(struct vr_nexthop *nh)
+{
+    unsigned int i, j;
+    struct vr_nexthop *cnh;
+
+    if (!nh->nh_component_nh)
+        return;
+
+    for (i = 0; i < nh->nh_component_cnt; i++) {
+        cnh = nh->nh_component_nh[i].cnh;
+        if (!cnh)
+            continue;
+
+        for (j = 0; j < cnh->nh_flat_users_cnt; j++) {
+            if (cnh->nh_flat_users[j] == nh) {
+                cnh->nh_flat_users[j] =
+                    cnh->nh_flat_users[--cnh->nh_flat_users_cnt];
+                break;
+            }
+        }
+    }
+
+    return;
+}
+
+/*
+ * nh_composite_flat_build - build the flattened form of the members of the
+ * ECMP composite nh. A member is flattened if it is a valid nexthop that
+ * is not indirect, the others are left to nh_output. Failing to allocate
+ * only leaves the composite, or the member, on the regular path.
+ */
+static void
+nh_composite_flat_build(struct vr_nexthop *nh)
+{
+    unsigned int i, cnt = nh->nh_component_cnt;
+    unsigned long mem;
+    struct vr_nexthop *cnh;
+    struct vr_nh_flat *flat;
+    struct vr_nh_flat_table *table = NULL;
+
+    if (!(nh->nh_flags & NH_FLAG_COMPOSITE_ECMP) || !cnt ||
+            !nh->nh_component_nh)
+        goto set_table;
+
+    table = vr_zalloc(sizeof(*table) + NH_FLAT_ALIGN +
+            cnt * sizeof(struct vr_nh_flat), VR_NEXTHOP_COMPONENT_OBJECT);
+    if (!table)
+        goto set_table;
+
+    mem = ((unsigned long)table->nft_mem + NH_FLAT_ALIGN - 1) &
+        ~((unsigned long)NH_FLAT_ALIGN - 1);
+    table->nft_flat = (struct vr_nh_flat *)mem;
+    table->nft_cnt = cnt;
+
+    for (i = 0; i < cnt; i++) {
+        cnh = nh->nh_component_nh[i].cnh;
+        /* even the members left out, to be told when they become valid */
+        if (!cnh || nh_flat_users_link(cnh, nh))
+            continue;
+
+        if (!(cnh->nh_flags & NH_FLAG_VALID) ||
+                (cnh->nh_flags & NH_FLAG_INDIRECT) || !cnh->nh_reach_nh)
+            continue;
+
+        flat = &table->nft_flat[i];
+        flat->nf_label = nh->nh_component_nh[i].cnh_label;
+        flat->nf_flow_lookup = !!(cnh->nh_flags &
+                (NH_FLAG_POLICY_ENABLED | NH_FLAG_FLOW_LOOKUP));
+        if ((cnh->nh_reach_nh == nh_encap_l3) && cnh->nh_dev) {
+            flat->nf_dev = cnh->nh_dev;
+            flat->nf_data = cnh->nh_data;
+            flat->nf_encap_len = cnh->nh_encap_len;
+        }
+        flat->nf_nh = cnh;
+        flat->nf_reach_nh = cnh->nh_reach_nh;
+    }
+
+set_table:
+    nh_composite_flat_set(nh, table);
+    return;
+}
+
+/*
+ * nh_flat_invalidate - stop the flattened ECMP composites that have nh as
+ * a member from using its records, while nh is changed in place.
+ */
+static void
+nh_flat_invalidate(struct vr_nexthop *nh)
+{
+    unsigned int i, j;
+    struct vr_nexthop *cnh;
+    struct vr_nh_flat_table *table;
+
+    for (i = 0; i < nh->nh_flat_users_cnt; i++) {
+        cnh = nh->nh_flat_users[i];
+        if (!(table = cnh->nh_component_flat))
+            continue;
+
+        for (j = 0; j < table->nft_cnt; j++) {
+            if (table->nft_flat[j].nf_nh == nh)
+                table->nft_flat[j].nf_reach_nh = NULL;
+        }
+    }
+
+    return;
+}
+
+/*
+ * nh_flat_refresh - rebuild the flattened ECMP composites that have the
+ * changed nexthop nh as a member. Their members stay the same, so that
+ * nh_flat_users of nh does not change while it is walked.
+ */
+static void
+nh_flat_refresh(struct vr_nexthop *nh)
+{
+    unsigned int i;
+
+    for (i = 0; i < nh->nh_flat_users_cnt; i++)
+        nh_composite_flat_build(nh->nh_flat_users[i]);
+
+    return;
+}
+
+/*
+ * nh_composite_flat_output - forward the packet to the ECMP member chosen
+ * in fmd through its flattened form. Returns false, leaving the packet
+ * alone, if that member has to go through nh_output.
+ */
+static bool
+nh_composite_flat_output(struct vr_packet *pkt, struct vr_nexthop *nh,
+        struct vr_forwarding_md *fmd)
+{
+    int index = fmd->fmd_ecmp_nh_index;
+    nh_processing_t ret, (*reach_nh)(struct vr_packet *, struct vr_nexthop *,
+            struct vr_forwarding_md *);
+    struct vr_nh_flat *flat;
+    struct vr_nh_flat_table *table = nh->nh_component_flat;
+
+    if (!table || (index < 0) || ((unsigned int)index >= table->nft_cnt))
+        return false;
+
+    flat = &table->nft_flat[index];
+    reach_nh = flat->nf_reach_nh;
+    if (!reach_nh)
+        return false;
+
+    /* what nh_output would do otherwise */
+    if (!pkt->vp_ttl)
+        return false;
+
+    if (flat->nf_flow_lookup && !(pkt->vp_flags & VP_FLAG_FLOW_SET) &&
+            ((pkt->vp_type == VP_TYPE_IP) || (pkt->vp_type == VP_TYPE_IP6)))
+        return false;
+
+    if (!(nh->nh_flags & NH_FLAG_COMPOSITE_LU_ECMP))
+        vr_fmd_set_label(fmd, flat->nf_label, VR_LABEL_TYPE_UNKNOWN);
+
+    pkt->vp_nh = flat->nf_nh;
+    if (flat->nf_dev)
+        ret = __nh_encap_l3(pkt, flat->nf_nh, flat->nf_dev, flat->nf_data,
+                flat->nf_encap_len, fmd);
+    else
+        ret = reach_nh(pkt, flat->nf_nh, fmd);
+
+    if (ret != NH_PROCESSING_COMPLETE)
+        vr_pfree(pkt, VP_DROP_INVALID_NH);
+
+    return true;
+}
+
 static int
 nh_composite_ecmp_select_nh(struct vr_packet *pkt, struct vr_nexthop *nh,
         struct vr_forwarding_md *fmd)
@@ -894,9 +1267,9 @@ nh_composite_ecmp_select_nh(struct vr_packet *pkt, struct vr_nexthop *nh,
     struct vr_flow_entry *fe = NULL;
     struct vr_nexthop *cnh = NULL;
     struct vr_component_nh *cnhp = nh->nh_component_nh;
+    struct vr_nh_ecmp_buckets *buckets = nh->nh_ecmp_buckets;
     struct vr_ip *ip;
     struct vr_ip6 *ip6;
-    struct vr_packet *pkt_c;
 
     if (!nh || !fmd || (!nh->nh_component_cnt))
         return ret;
@@ -936,18 +1309,14 @@ nh_composite_ecmp_select_nh(struct vr_packet *pkt, struct vr_nexthop *nh,
                 case 0:
                     /*
                      * Handle head fragmented packets
-                     * - If this is a head fragment, clone it and enqueue it to the assembler
+                     * - If this is a head fragment, hand it over to the assembler
                      *   which would result in flushing of non-head fragments which
                      *   were queued earlier. The addition of head fragment to the fragment
                      *   hash table is taken care of in the get_flow_key().
                      */
-                    if (vr_ip_fragment_head(ip) && vr_enqueue_to_assembler) {
-                        pkt_c = vr_pclone(pkt);
-                        if (pkt_c) {
-                            vr_enqueue_to_assembler(nh->nh_router, pkt_c, fmd);
-                        } else {
-                            pkt_drop_stats(pkt->vp_if, VP_DROP_CLONE_FAIL, pkt->vp_cpu);
-                        }
+                    if (vr_ip_fragment_head(ip) &&
+                            vr_fragment_head_to_assembler(nh->nh_router, pkt, fmd)) {
+                        pkt_drop_stats(pkt->vp_if, VP_DROP_CLONE_FAIL, pkt->vp_cpu);
                     }
                     break;
 
@@ -977,13 +1346,9 @@ nh_composite_ecmp_select_nh(struct vr_packet *pkt, struct vr_nexthop *nh,
                                      fmd->fmd_vlan, flowp, hash, 0);
             switch (ret) {
                 case 0:
-                    if (vr_ip6_fragment_head(ip6) && vr_enqueue_to_assembler) {
-                        pkt_c = vr_pclone(pkt);
-                        if (pkt_c) {
-                            vr_enqueue_to_assembler(nh->nh_router, pkt_c, fmd);
-                        } else {
-                            pkt_drop_stats(pkt->vp_if, VP_DROP_CLONE_FAIL, pkt->vp_cpu);
-                        }
+                    if (vr_ip6_fragment_head(ip6) &&
+                            vr_fragment_head_to_assembler(nh->nh_router, pkt, fmd)) {
+                        pkt_drop_stats(pkt->vp_if, VP_DROP_CLONE_FAIL, pkt->vp_cpu);
                     }
                     break;
 
@@ -1014,7 +1379,13 @@ nh_composite_ecmp_select_nh(struct vr_packet *pkt, struct vr_nexthop *nh,
     if (ecmp_index == -1) {
         if (!hash_computed)
             hash_ecmp = vr_hash(flowp, flowp->flow_key_len, 0);
-        hash = hash_ecmp % count;
+        if (buckets) {
+            hash = buckets->neb_bucket[hash_ecmp & buckets->neb_mask];
+            if (hash >= count)
+                hash = hash_ecmp % count;
+        } else {
+            hash = hash_ecmp % count;
+        }
         ecmp_index = cnhp[hash].cnh_ecmp_index;
         cnh = cnhp[hash].cnh;
         if (!cnh) {
@@ -1056,6 +1427,9 @@ nh_composite_ecmp(struct vr_packet *pkt, struct vr_nexthop *nh,
             stats->vrf_ecmp_composites++;
     }
 
+    if (nh_composite_flat_output(pkt, nh, fmd))
+        return NH_PROCESSING_COMPLETE;
+
     if ((fmd->fmd_ecmp_nh_index >= 0) &&
             (fmd->fmd_ecmp_nh_index < nh->nh_component_cnt)) {
         member_nh = nh->nh_component_nh[fmd->fmd_ecmp_nh_index].cnh;
@@ -1078,6 +1452,9 @@ nh_composite_ecmp(struct vr_packet *pkt, struct vr_nexthop *nh,
                  goto drop;
         }
 
+        if (nh_composite_flat_output(pkt, nh, fmd))
+            return NH_PROCESSING_COMPLETE;
+
         member_nh = nh->nh_component_nh[fmd->fmd_ecmp_nh_index].cnh;
         if (!member_nh)
             goto drop;
@@ -1371,6 +1748,8 @@ nh_composite_mcast(struct vr_packet *pkt, struct vr_nexthop *nh,
     struct vr_nexthop *dir_nh;
     struct vr_packet *new_pkt;
     struct vr_vrf_stats *stats = NULL;
+    struct vr_nh_repl_stats *repl_stats = NULL;
+    int ret;
     // Context for the flag:
     // For 5.1, mcast source is outside contrail and only <*,G> is supported.
     // Until such a time when source can be inside contrail, multicast data
@@ -1385,6 +1764,30 @@ nh_composite_mcast(struct vr_packet *pkt, struct vr_nexthop *nh,
         goto drop;
     }
 
+    if (nh->nh_repl_stats)
+        repl_stats = &nh->nh_repl_stats[pkt->vp_cpu];
+
+    /*
+     * The host might hand the whole fan-out over to a replication stage,
+     * so the forwarding of other packets is not stalled by large fan-outs.
+     * The packet then comes back here on the replication cpu.
+     */
+    if (vr_repl_enqueue) {
+        ret = vr_repl_enqueue(pkt, nh, fmd);
+        if (!ret) {
+            if (repl_stats)
+                repl_stats->nrs_deferred++;
+            return NH_PROCESSING_COMPLETE;
+        } else if (ret == -ENOSPC) {
+            /* The replication stage is overloaded */
+            if (repl_stats)
+                repl_stats->nrs_drops++;
+            drop_reason = VP_DROP_REPL_RING_FULL;
+            PKT_LOG(drop_reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
+            goto drop;
+        }
+    }
+
     if (vr_inet_vrf_stats) {
         stats = vr_inet_vrf_stats(fmd->fmd_dvrf, pkt->vp_cpu);
         if (stats)
@@ -1516,6 +1919,8 @@ nh_composite_mcast(struct vr_packet *pkt, struct vr_nexthop *nh,
     }
 
     label = fmd->fmd_label;
+    if (repl_stats)
+        repl_stats->nrs_packets++;
 
     for (i = 0; i < nh->nh_component_cnt; i++) {
         clone_size = 0;
@@ -1634,6 +2039,8 @@ nh_composite_mcast(struct vr_packet *pkt, struct vr_nexthop *nh,
             continue;
         }
 
+        if (repl_stats)
+            repl_stats->nrs_replicas++;
         nh_output(new_pkt, dir_nh, fmd);
     }
 
@@ -2014,7 +2421,7 @@ nh_composite_fabric(struct vr_packet *pkt, struct vr_nexthop *nh,
                     }
                 }
                 if (nh_vxlan_tunnel_helper(nh->nh_router, &new_pkt,
-                                        fmd, sip, dip) == false) {
+                                        fmd, NULL, sip, dip) == false) {
                     PKT_LOG(VP_DROP_PUSH, pkt, 0, VR_NEXTHOP_C, __LINE__);
                     vr_pfree(new_pkt, VP_DROP_PUSH);
                     break;
@@ -2171,7 +2578,13 @@ nh_udp_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
             sport = ntohs(nh->nh_udp_tun_sport);
 
         qos = vr_qos_get_forwarding_class(nh->nh_router, pkt, fmd);
-        if (nh_udp_tunnel_helper(pkt, htons(sport),
+        if (nh->nh_tun_tmpl.ntt_len && (sip == nh->nh_udp_tun_sip)) {
+            if (!nh_tunnel_tmpl_push(pkt, nh, htons(sport),
+                        htons(vr_generate_unique_ip_id()), qos, true)) {
+                PKT_LOG(VP_DROP_PUSH, pkt, flowp, VR_NEXTHOP_C, __LINE__);
+                goto send_fail;
+            }
+        } else if (nh_udp_tunnel_helper(pkt, htons(sport),
                     nh->nh_udp_tun_dport, sip,
                     nh->nh_udp_tun_dip, qos) == false) {
             PKT_LOG(VP_DROP_PUSH, pkt, flowp, VR_NEXTHOP_C, __LINE__);
@@ -2317,8 +2730,8 @@ nh_vxlan_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
         }
     }
 
-    if (nh_vxlan_tunnel_helper(nh->nh_router, &pkt, fmd, nh->nh_vxlan_tun_sip,
-                nh->nh_vxlan_tun_dip) == false)
+    if (nh_vxlan_tunnel_helper(nh->nh_router, &pkt, fmd, nh,
+                nh->nh_vxlan_tun_sip, nh->nh_vxlan_tun_dip) == false)
         goto send_fail;
 
     pkt_set_network_header(pkt, pkt->vp_data);
@@ -2615,7 +3028,15 @@ nh_mpls_udp_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
     else
         pkt->vp_type = VP_TYPE_IP;
 
-    if (nh_udp_tunnel_helper(pkt, htons(udp_src_port),
+    /* with vr_mudp the nexthop is a GRE one and its template is for GRE */
+    if (!vr_mudp && nh->nh_tun_tmpl.ntt_len) {
+        if (!nh_tunnel_tmpl_push(pkt, nh, htons(udp_src_port),
+                    htons(vr_generate_unique_ip_id()), qos,
+                    !vr_pkt_type_is_overlay(pkt->vp_type))) {
+            PKT_LOG(reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
+            goto send_fail;
+        }
+    } else if (nh_udp_tunnel_helper(pkt, htons(udp_src_port),
                              htons(VR_MPLS_OVER_UDP_DST_PORT),
                              tun_sip, tun_dip, qos) == false) {
         PKT_LOG(reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
@@ -2678,6 +3099,7 @@ static nh_processing_t
 nh_gre_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
               struct vr_forwarding_md *fmd)
 {
+    bool tmpl;
     int overhead_len, gre_head_space;
     unsigned short drop_reason = VP_DROP_INVALID_NH;
     unsigned int id;
@@ -2808,21 +3230,57 @@ nh_gre_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
             goto send_fail;
     }
 
-    gre_hdr = (struct vr_gre *)pkt_push(pkt, sizeof(struct vr_gre));
-    if (!gre_hdr) {
-        drop_reason = VP_DROP_PUSH;
-        PKT_LOG(drop_reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
-        goto send_fail;
-    }
+    tmpl = (nh->nh_tun_tmpl.ntt_len != 0);
+    if (tmpl) {
+        ip = nh_tunnel_tmpl_push(pkt, nh, 0, id, qos,
+                !nh_tunnel_csum_at_tx(pkt));
+        if (!ip) {
+            drop_reason = VP_DROP_PUSH;
+            PKT_LOG(drop_reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
+            goto send_fail;
+        }
+    } else {
+        gre_hdr = (struct vr_gre *)pkt_push(pkt, sizeof(struct vr_gre));
+        if (!gre_hdr) {
+            drop_reason = VP_DROP_PUSH;
+            PKT_LOG(drop_reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
+            goto send_fail;
+        }
 
-    gre_hdr->gre_flags = 0;
-    gre_hdr->gre_proto = VR_GRE_PROTO_MPLS_NO;
+        gre_hdr->gre_flags = 0;
+        gre_hdr->gre_proto = VR_GRE_PROTO_MPLS_NO;
 
-    ip = (struct vr_ip *)pkt_push(pkt, sizeof(struct vr_ip));
-    if (!ip) {
-        drop_reason = VP_DROP_PUSH;
-        PKT_LOG(drop_reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
-        goto send_fail;
+        ip = (struct vr_ip *)pkt_push(pkt, sizeof(struct vr_ip));
+        if (!ip) {
+            drop_reason = VP_DROP_PUSH;
+            PKT_LOG(drop_reason, pkt, 0, VR_NEXTHOP_C, __LINE__);
+            goto send_fail;
+        }
+
+        ip->ip_version = 4;
+        ip->ip_hl = 5;
+        if (qos) {
+            ip->ip_tos = VR_IP_DSCP(qos->vfcq_dscp);
+            pkt->vp_queue = qos->vfcq_queue_id;
+            pkt->vp_priority = qos->vfcq_dotonep_qos;
+        } else {
+            ip->ip_tos = 0;
+        }
+
+        ip->ip_id = id;
+        ip->ip_frag_off = 0;
+
+        if (vr_pkt_is_diag(pkt)) {
+            ip->ip_ttl = pkt->vp_ttl;
+        } else {
+            ip->ip_ttl = 64;
+        }
+
+        ip->ip_proto = VR_IP_PROTO_GRE;
+        ip->ip_saddr = nh->nh_gre_tun_sip;
+        ip->ip_daddr = nh->nh_gre_tun_dip;
+        ip->ip_len = htons(pkt_len(pkt));
+        ip->ip_csum = 0;
     }
     pkt_set_network_header(pkt, pkt->vp_data);
 
@@ -2838,31 +3296,11 @@ nh_gre_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
     else
         pkt->vp_type = VP_TYPE_IP;
 
-    ip->ip_version = 4;
-    ip->ip_hl = 5;
-    if (qos) {
-        ip->ip_tos = VR_IP_DSCP(qos->vfcq_dscp);
-        pkt->vp_queue = qos->vfcq_queue_id;
-        pkt->vp_priority = qos->vfcq_dotonep_qos;
-    } else {
-        ip->ip_tos = 0;
-    }
-
-    ip->ip_id = id;
-    ip->ip_frag_off = 0;
-
-    if (vr_pkt_is_diag(pkt)) {
-        ip->ip_ttl = pkt->vp_ttl;
-    } else {
-        ip->ip_ttl = 64;
-    }
-
-    ip->ip_proto = VR_IP_PROTO_GRE;
-    ip->ip_saddr = nh->nh_gre_tun_sip;
-    ip->ip_daddr = nh->nh_gre_tun_dip;
-    ip->ip_len = htons(pkt_len(pkt));
-    /* checksum will be calculated for tunneled packet in linux_xmit_segment */
-    if (!vr_pkt_type_is_overlay(pkt->vp_type)) {
+    /*
+     * checksum will be calculated for tunneled packet in linux_xmit_segment.
+     * The template path has already filled it in for the others.
+     */
+    if (!tmpl && !vr_pkt_type_is_overlay(pkt->vp_type)) {
         ip->ip_csum = 0;
         ip->ip_csum = vr_ip_csum(ip);
     }
@@ -3146,21 +3584,20 @@ drop:
 }
 
 static nh_processing_t
-nh_encap_l3(struct vr_packet *pkt, struct vr_nexthop *nh,
-                    struct vr_forwarding_md *fmd)
+__nh_encap_l3(struct vr_packet *pkt, struct vr_nexthop *nh,
+        struct vr_interface *vif, uint8_t *encap, uint16_t encap_len,
+        struct vr_forwarding_md *fmd)
 {
     int rewrite_len;
     unsigned short *proto_p;
 
     struct vr_ip *ip;
-    struct vr_interface *vif;
     struct vr_vrf_stats *stats = NULL;
     struct vr_forwarding_class_qos *qos = NULL;
 
     if (vr_inet_vrf_stats)
         stats = vr_inet_vrf_stats(fmd->fmd_dvrf, pkt->vp_cpu);
 
-    vif = nh->nh_dev;
     if (!vif) {
         PKT_LOG(VP_DROP_INVALID_IF, pkt, 0, VR_NEXTHOP_C, __LINE__);
         vr_pfree(pkt, VP_DROP_INVALID_IF);
@@ -3214,7 +3651,7 @@ nh_encap_l3(struct vr_packet *pkt, struct vr_nexthop *nh,
      */
     vr_pkt_unset_gro(pkt);
 
-    rewrite_len = vif->vif_set_rewrite(vif, &pkt, fmd, nh->nh_data, nh->nh_encap_len);
+    rewrite_len = vif->vif_set_rewrite(vif, &pkt, fmd, encap, encap_len);
     if (rewrite_len < 0) {
         PKT_LOG(VP_DROP_REWRITE_FAIL, pkt, 0, VR_NEXTHOP_C, __LINE__);
         vr_pfree(pkt, VP_DROP_REWRITE_FAIL);
@@ -3222,7 +3659,7 @@ nh_encap_l3(struct vr_packet *pkt, struct vr_nexthop *nh,
     }
 
     if (rewrite_len) {
-        proto_p = (unsigned short *)(pkt_data(pkt) + nh->nh_encap_len - 2);
+        proto_p = (unsigned short *)(pkt_data(pkt) + encap_len - 2);
         if (pkt->vp_type == VP_TYPE_IP6)
             *proto_p = htons(VR_ETH_PROTO_IP6);
         else
@@ -3248,6 +3685,14 @@ nh_encap_l3(struct vr_packet *pkt, struct vr_nexthop *nh,
     return NH_PROCESSING_COMPLETE;
 }
 
+static nh_processing_t
+nh_encap_l3(struct vr_packet *pkt, struct vr_nexthop *nh,
+                    struct vr_forwarding_md *fmd)
+{
+    return __nh_encap_l3(pkt, nh, nh->nh_dev, nh->nh_data, nh->nh_encap_len,
+            fmd);
+}
+
 static int
 vr_nexthop_delete(vr_nexthop_req *req)
 {
@@ -3420,12 +3865,24 @@ nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
     unsigned int i, j = 0, active = 0;
     struct vr_nexthop *tmp_nh;
     struct vr_component_nh *component_nh = NULL, *component_ecmp = NULL;
+    struct vr_nh_ecmp_buckets *buckets = NULL;
 
     if (req->nhr_nh_list_size != req->nhr_label_list_size) {
         ret = -EINVAL;
         goto exit_add;
     }
 
+    if (req->nhr_weight_list_size &&
+            (req->nhr_weight_list_size != req->nhr_nh_list_size)) {
+        ret = -EINVAL;
+        goto exit_add;
+    }
+
+    if (req->nhr_nh_list_size > NH_ECMP_BUCKET_INVALID) {
+        ret = -EINVAL;
+        goto exit_add;
+    }
+
     if (req->nhr_nh_list_size) {
         component_nh = vr_zalloc(req->nhr_nh_list_size *
                 sizeof(struct vr_component_nh), VR_NEXTHOP_COMPONENT_OBJECT);
@@ -3438,6 +3895,15 @@ nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
             component_nh[i].cnh = vrouter_get_nexthop(req->nhr_rid,
                     req->nhr_nh_list[i]);
             component_nh[i].cnh_label = req->nhr_label_list[i];
+            component_nh[i].cnh_weight = NH_ECMP_WEIGHT_DEFAULT;
+            if (req->nhr_weight_list_size) {
+                if (req->nhr_weight_list[i] < 0) {
+                    ret = -EINVAL;
+                    goto exit_add;
+                }
+                component_nh[i].cnh_weight = req->nhr_weight_list[i];
+            }
+
             if (component_nh[i].cnh)
                 active++;
 
@@ -3472,12 +3938,22 @@ nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
                     /* nh->nh_component_ecmp[j++].cnh_ecmp_index = i */
                 }
             }
+
+            if ((req->nhr_flags & NH_FLAG_COMPOSITE_RESILIENT) ||
+                    req->nhr_weight_list_size) {
+                ret = vr_nh_ecmp_buckets_build(nh,
+                        (req->nhr_ecmp_buckets > 0) ? req->nhr_ecmp_buckets : 0,
+                        component_nh, req->nhr_nh_list_size, &buckets);
+                if (ret)
+                    goto exit_add;
+            }
         }
     }
 
     nh->nh_validate_src = NULL;
     /* Delete the old nexthops first */
     if (nh->nh_component_cnt && nh->nh_component_nh) {
+        nh_flat_users_unlink(nh);
         for (i = 0; i < nh->nh_component_cnt; i++) {
             if (nh->nh_component_nh[i].cnh)
                 vrouter_put_nexthop(nh->nh_component_nh[i].cnh);
@@ -3493,6 +3969,11 @@ nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
         }
     }
 
+    if (nh->nh_ecmp_buckets) {
+        vr_free(nh->nh_ecmp_buckets, VR_NEXTHOP_COMPONENT_OBJECT);
+        nh->nh_ecmp_buckets = NULL;
+    }
+
     /* Nh list of size 0 is valid */
     if (req->nhr_nh_list_size == 0)
         goto exit_add;
@@ -3501,11 +3982,17 @@ nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
     if (component_ecmp) {
         nh->nh_component_ecmp = component_ecmp;
     }
+    nh->nh_ecmp_buckets = buckets;
     nh->nh_component_cnt = req->nhr_nh_list_size;
 
 exit_add:
     /* This needs to be the last */
     if (req->nhr_flags & NH_FLAG_MCAST) {
+        /* The counters are optional, so ignore the allocation failure */
+        if (!nh->nh_repl_stats)
+            nh->nh_repl_stats = vr_zalloc(vr_num_cpus *
+                    sizeof(struct vr_nh_repl_stats),
+                    VR_NEXTHOP_REPL_STATS_OBJECT);
         nh->nh_reach_nh = nh_composite_mcast;
         nh->nh_validate_src = nh_composite_mcast_validate_src;
     } else if (req->nhr_flags & NH_FLAG_COMPOSITE_ECMP) {
@@ -3525,6 +4012,8 @@ exit_add:
         nh->nh_reach_nh = nh_composite_tor;
     }
 
+    nh_composite_flat_build(nh);
+
     if (ret) {
         if (component_nh) {
             for (i = 0; i < req->nhr_nh_list_size; i++) {
@@ -3539,11 +4028,58 @@ exit_add:
         if (component_ecmp) {
             vr_free(component_ecmp, VR_NEXTHOP_COMPONENT_OBJECT);
         }
+
+        if (buckets) {
+            vr_free(buckets, VR_NEXTHOP_COMPONENT_OBJECT);
+        }
     }
 
     return ret;
 }
 
+/*
+ * nh_tunnel_tmpl_build - build the outer header template of the IPv4
+ * tunnel nexthop nh, for IP protocol proto and, for UDP, destination port
+ * dport.
+ */
+static void
+nh_tunnel_tmpl_build(struct vr_nexthop *nh, unsigned int sip,
+        unsigned int dip, unsigned char proto, unsigned short dport)
+{
+    unsigned short *words;
+    struct vr_ip *ip;
+    struct vr_udp *udp;
+    struct vr_gre *gre;
+    struct vr_nh_tun_tmpl *tmpl = &nh->nh_tun_tmpl;
+
+    tmpl->ntt_len = 0;
+    memset(tmpl->ntt_hdr, 0, sizeof(tmpl->ntt_hdr));
+
+    ip = (struct vr_ip *)tmpl->ntt_hdr;
+    ip->ip_version = 4;
+    ip->ip_hl = 5;
+    ip->ip_ttl = 64;
+    ip->ip_proto = proto;
+    ip->ip_saddr = sip;
+    ip->ip_daddr = dip;
+
+    if (proto == VR_IP_PROTO_UDP) {
+        udp = (struct vr_udp *)(ip + 1);
+        udp->udp_dport = dport;
+    } else {
+        gre = (struct vr_gre *)(ip + 1);
+        gre->gre_proto = VR_GRE_PROTO_MPLS_NO;
+    }
+
+    /* all but version/tos, length, id, ttl/protocol and the checksum */
+    words = (unsigned short *)ip;
+    tmpl->ntt_sum = words[3] + words[6] + words[7] + words[8] + words[9];
+    tmpl->ntt_len = sizeof(struct vr_ip) + ((proto == VR_IP_PROTO_UDP) ?
+            sizeof(struct vr_udp) : sizeof(struct vr_gre));
+
+    return;
+}
+
 static inline void
 nh_tunnel_set_reach_nh(struct vr_nexthop *nh)
 {
@@ -3605,6 +4141,8 @@ nh_tunnel_add(struct vr_nexthop *nh, vr_nexthop_req *req)
 
     /* Reset the nh valid underlay vif count on every add or update*/
     nh->nh_valid_underlay_dev_count = 0;
+    /* the fast path falls back to building headers until it is rebuilt */
+    nh->nh_tun_tmpl.ntt_len = 0;
 
     if (nh->nh_flags & NH_FLAG_TUNNEL_UNDERLAY_ECMP) {
         for (i = 0; i < VR_MAX_PHY_INF; i++) {
@@ -3655,6 +4193,9 @@ nh_tunnel_add(struct vr_nexthop *nh, vr_nexthop_req *req)
         if (nh->nh_flags & NH_FLAG_TUNNEL_MPLS_O_MPLS) {
             nh->nh_gre_tun_label = req->nhr_transport_label;
         }
+
+        nh_tunnel_tmpl_build(nh, nh->nh_gre_tun_sip, nh->nh_gre_tun_dip,
+                VR_IP_PROTO_GRE, 0);
     } else if (nh->nh_flags & NH_FLAG_TUNNEL_UDP) {
         if (req->nhr_family == AF_INET) {
             nh->nh_udp_tun_sip = req->nhr_tun_sip;
@@ -3662,6 +4203,8 @@ nh_tunnel_add(struct vr_nexthop *nh, vr_nexthop_req *req)
             nh->nh_udp_tun_sport = req->nhr_tun_sport;
             nh->nh_udp_tun_dport = req->nhr_tun_dport;
             nh->nh_udp_tun_encap_len = req->nhr_encap_size;
+            nh_tunnel_tmpl_build(nh, nh->nh_udp_tun_sip, nh->nh_udp_tun_dip,
+                    VR_IP_PROTO_UDP, nh->nh_udp_tun_dport);
         } else if (req->nhr_family == AF_INET6) {
             if (!nh->nh_udp_tun6_sip) {
                 nh->nh_udp_tun6_sip = vr_malloc(VR_IP6_ADDRESS_LEN,
@@ -3720,6 +4263,9 @@ nh_tunnel_add(struct vr_nexthop *nh, vr_nexthop_req *req)
         if (nh->nh_flags & NH_FLAG_TUNNEL_MPLS_O_MPLS) {
             nh->nh_udp_tun_label = req->nhr_transport_label;
         }
+
+        nh_tunnel_tmpl_build(nh, nh->nh_udp_tun_sip, nh->nh_udp_tun_dip,
+                VR_IP_PROTO_UDP, htons(VR_MPLS_OVER_UDP_DST_PORT));
     } else if (nh->nh_flags & NH_FLAG_TUNNEL_VXLAN) {
         if (!(vif[0] || vif[1] || vif[2])) {
             ret = -ENODEV;
@@ -3750,6 +4296,9 @@ nh_tunnel_add(struct vr_nexthop *nh, vr_nexthop_req *req)
             }
             VR_MAC_COPY(nh->nh_vxlan_tun_l3_mac, req->nhr_rw_dst_mac);
         }
+
+        nh_tunnel_tmpl_build(nh, nh->nh_vxlan_tun_sip, nh->nh_vxlan_tun_dip,
+                VR_IP_PROTO_UDP, htons(VR_VXLAN_UDP_DST_PORT));
     } else if (nh->nh_flags & NH_FLAG_TUNNEL_PBB) {
         if (!(nh->nh_flags & NH_FLAG_INDIRECT)) {
             ret = -EINVAL;
@@ -3977,6 +4526,8 @@ vr_nexthop_add(vr_nexthop_req *req)
         nh->nh_data_size = len - sizeof(struct vr_nexthop);
     } else {
         change = true;
+        /* flattened composites stop using it until they are rebuilt */
+        nh_flat_invalidate(nh);
         /*
          * If modification of old_nh change the action to discard and ensure
          * everybody sees that
@@ -4097,6 +4648,9 @@ error:
         nh->nh_destructor(nh);
 
 generate_resp:
+    if (change)
+        nh_flat_refresh(nh);
+
     ret = vr_send_response(ret);
 
     return ret;
@@ -4116,6 +4670,9 @@ vr_nexthop_req_get_size(void *req_p)
     if (req->nhr_label_list_size)
         size += (4 * req->nhr_label_list_size);
 
+    if (req->nhr_weight_list_size)
+        size += (4 * req->nhr_weight_list_size);
+
     if (req->nhr_encap_oif_id_size)
         size += (4 * req->nhr_encap_oif_id_size);
 
@@ -4191,6 +4748,17 @@ vr_nexthop_make_req(vr_nexthop_req *req, struct vr_nexthop *nh)
         req->nhr_ecmp_config_hash = nh->nh_ecmp_config_hash &
                                          NH_ECMP_CONFIG_HASH_MASK;
 
+        req->nhr_repl_packets = req->nhr_repl_replicas = 0;
+        req->nhr_repl_deferred = req->nhr_repl_drops = 0;
+        if (nh->nh_repl_stats) {
+            for (i = 0; i < vr_num_cpus; i++) {
+                req->nhr_repl_packets += nh->nh_repl_stats[i].nrs_packets;
+                req->nhr_repl_replicas += nh->nh_repl_stats[i].nrs_replicas;
+                req->nhr_repl_deferred += nh->nh_repl_stats[i].nrs_deferred;
+                req->nhr_repl_drops += nh->nh_repl_stats[i].nrs_drops;
+            }
+        }
+
         if (nh->nh_component_cnt) {
             req->nhr_nh_list =
                 vr_zalloc(req->nhr_nh_list_size * sizeof(unsigned int),
@@ -4214,6 +4782,20 @@ vr_nexthop_make_req(vr_nexthop_req *req, struct vr_nexthop *nh)
 
                 req->nhr_label_list[i] = nh->nh_component_nh[i].cnh_label;
             }
+
+            if (nh->nh_ecmp_buckets) {
+                req->nhr_ecmp_buckets = nh->nh_ecmp_buckets->neb_mask + 1;
+                req->nhr_weight_list_size = req->nhr_nh_list_size;
+                req->nhr_weight_list =
+                    vr_zalloc(req->nhr_weight_list_size * sizeof(int16_t),
+                            VR_NEXTHOP_REQ_LIST_OBJECT);
+                if (!req->nhr_weight_list)
+                    return -ENOMEM;
+
+                for (i = 0; i < req->nhr_weight_list_size; i++)
+                    req->nhr_weight_list[i] =
+                        nh->nh_component_nh[i].cnh_weight;
+            }
         }
 
         break;
@@ -4463,6 +5045,12 @@ vr_nexthop_req_destroy(vr_nexthop_req *req)
         req->nhr_label_list_size = 0;
     }
 
+    if (req->nhr_weight_list_size && req->nhr_weight_list) {
+        vr_free(req->nhr_weight_list, VR_NEXTHOP_REQ_LIST_OBJECT);
+        req->nhr_weight_list = NULL;
+        req->nhr_weight_list_size = 0;
+    }
+
     if (req->nhr_tun_sip6) {
         vr_free(req->nhr_tun_sip6, VR_NETWORK_ADDRESS_OBJECT);
         req->nhr_tun_sip6 = NULL;
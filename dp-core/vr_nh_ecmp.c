@@ -0,0 +1,184 @@
+/*
+ * vr_nh_ecmp.c -- bucket tables of resilient ECMP composite nexthops
+ *
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+#include <vr_os.h>
+#include <vr_types.h>
+#include <vr_packet.h>
+#include <vr_nexthop.h>
+
+static unsigned int
+vr_nh_ecmp_buckets_size(struct vr_nexthop *nh, unsigned int want,
+        unsigned int cnt)
+{
+    unsigned int size = NH_ECMP_BUCKETS_MIN;
+
+    if (!want) {
+        want = 4 * cnt;
+        /* do not shrink a table that the user did not size */
+        if (nh->nh_ecmp_buckets && (nh->nh_ecmp_buckets->neb_mask + 1 > want))
+            want = nh->nh_ecmp_buckets->neb_mask + 1;
+    }
+
+    while ((size < want) && (size < NH_ECMP_BUCKETS_MAX))
+        size <<= 1;
+
+    return size;
+}
+
+/*
+ * vr_nh_ecmp_buckets_build - the bucket table of a resilient ECMP composite
+ * whose new components are component_nh, built from the table that nh has
+ * now. want is the number of buckets the user asked for, or 0 to size the
+ * table after the components. Each active component gets a share of the
+ * buckets in proportion to its weight. A bucket keeps the component it
+ * named if that component is still there and is under its share, and the
+ * buckets left are dealt out among the components that are short of
+ * theirs. Returns 0, with *table NULL if no component can take traffic,
+ * or -ENOMEM.
+ */
+int
+vr_nh_ecmp_buckets_build(struct vr_nexthop *nh, unsigned int want,
+        struct vr_component_nh *component_nh, unsigned int cnt,
+        struct vr_nh_ecmp_buckets **table)
+{
+    int ret = 0;
+    unsigned int i, k, b, size, active = 0, assigned = 0;
+    unsigned int old_cnt = nh->nh_component_cnt;
+    uint64_t weight = 0;
+    uint16_t *map = NULL;
+    unsigned int *share = NULL, *held = NULL;
+    bool *taken = NULL;
+
+    struct vr_nh_ecmp_buckets *buckets = NULL, *old = nh->nh_ecmp_buckets;
+    struct vr_component_nh *old_nh = nh->nh_component_nh;
+
+    *table = NULL;
+
+    for (i = 0; i < cnt; i++) {
+        if (component_nh[i].cnh && component_nh[i].cnh_weight) {
+            weight += component_nh[i].cnh_weight;
+            active++;
+        }
+    }
+
+    if (!active)
+        return 0;
+
+    size = vr_nh_ecmp_buckets_size(nh, want, cnt);
+    buckets = vr_zalloc(sizeof(*buckets) + size * sizeof(uint16_t),
+            VR_NEXTHOP_COMPONENT_OBJECT);
+    share = vr_zalloc(cnt * sizeof(*share), VR_NEXTHOP_COMPONENT_OBJECT);
+    taken = vr_zalloc(cnt * sizeof(*taken), VR_NEXTHOP_COMPONENT_OBJECT);
+    if (!buckets || !share || !taken) {
+        ret = -ENOMEM;
+        goto exit_build;
+    }
+    buckets->neb_mask = size - 1;
+
+    if (old && old_cnt && old_nh) {
+        map = vr_zalloc(old_cnt * sizeof(*map), VR_NEXTHOP_COMPONENT_OBJECT);
+        held = vr_zalloc(cnt * sizeof(*held), VR_NEXTHOP_COMPONENT_OBJECT);
+        if (!map || !held) {
+            ret = -ENOMEM;
+            goto exit_build;
+        }
+
+        /* a component stays the same if its nexthop and label do */
+        for (k = 0; k < old_cnt; k++) {
+            map[k] = NH_ECMP_BUCKET_INVALID;
+            if (!old_nh[k].cnh)
+                continue;
+
+            for (i = 0; i < cnt; i++) {
+                if (taken[i] || !component_nh[i].cnh)
+                    continue;
+                if ((component_nh[i].cnh->nh_id == old_nh[k].cnh->nh_id) &&
+                        (component_nh[i].cnh_label == old_nh[k].cnh_label)) {
+                    taken[i] = true;
+                    map[k] = i;
+                    break;
+                }
+            }
+        }
+
+        /* the buckets each component would keep */
+        for (b = 0; b < size; b++) {
+            k = old->neb_bucket[b & old->neb_mask];
+            if ((k < old_cnt) && (map[k] != NH_ECMP_BUCKET_INVALID))
+                held[map[k]]++;
+        }
+    }
+
+    for (i = 0; i < cnt; i++) {
+        if (!component_nh[i].cnh || !component_nh[i].cnh_weight)
+            continue;
+        share[i] = ((uint64_t)size * component_nh[i].cnh_weight) / weight;
+        assigned += share[i];
+    }
+
+    /*
+     * what the rounding left goes first to the components that hold more
+     * buckets than their share, so that reordering the components moves
+     * none, and then to the first components
+     */
+    for (i = 0; held && (i < cnt) && (assigned < size); i++) {
+        if (held[i] > share[i]) {
+            share[i]++;
+            assigned++;
+        }
+    }
+
+    for (i = 0; (i < cnt) && (assigned < size); i++) {
+        if (!component_nh[i].cnh || !component_nh[i].cnh_weight)
+            continue;
+        share[i]++;
+        assigned++;
+    }
+
+    for (b = 0; b < size; b++) {
+        buckets->neb_bucket[b] = NH_ECMP_BUCKET_INVALID;
+        if (!map)
+            continue;
+
+        k = old->neb_bucket[b & old->neb_mask];
+        if ((k >= old_cnt) || (map[k] == NH_ECMP_BUCKET_INVALID))
+            continue;
+
+        i = map[k];
+        if (share[i]) {
+            share[i]--;
+            buckets->neb_bucket[b] = i;
+        }
+    }
+
+    for (b = 0, i = 0; b < size; b++) {
+        if (buckets->neb_bucket[b] != NH_ECMP_BUCKET_INVALID)
+            continue;
+
+        while (!share[i])
+            i = (i + 1) % cnt;
+
+        share[i]--;
+        buckets->neb_bucket[b] = i;
+        i = (i + 1) % cnt;
+    }
+
+    *table = buckets;
+    buckets = NULL;
+
+exit_build:
+    if (buckets)
+        vr_free(buckets, VR_NEXTHOP_COMPONENT_OBJECT);
+    if (share)
+        vr_free(share, VR_NEXTHOP_COMPONENT_OBJECT);
+    if (taken)
+        vr_free(taken, VR_NEXTHOP_COMPONENT_OBJECT);
+    if (map)
+        vr_free(map, VR_NEXTHOP_COMPONENT_OBJECT);
+    if (held)
+        vr_free(held, VR_NEXTHOP_COMPONENT_OBJECT);
+
+    return ret;
+}
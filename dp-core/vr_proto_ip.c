@@ -1088,7 +1088,6 @@ vr_inet_flow_lookup(struct vrouter *router, struct vr_packet *pkt,
     bool lookup = false;
     struct vr_flow flow, *flow_p = &flow;
     struct vr_ip *ip = (struct vr_ip *)pkt_network_header(pkt);
-    struct vr_packet *pkt_c;
 
     /*
      * if the packet has already done one round of flow lookup, there
@@ -1157,12 +1156,7 @@ vr_inet_flow_lookup(struct vrouter *router, struct vr_packet *pkt,
             PKT_LOG(VP_DROP_NO_MEMORY, pkt, flow_p, VR_PROTO_IP_C, __LINE__);
             return FLOW_DROP;
         }
-        if (vr_enqueue_to_assembler) {
-            pkt_c = vr_pclone(pkt);
-            if (pkt_c) {
-                vr_enqueue_to_assembler(router, pkt_c, fmd);
-            }
-        }
+        vr_fragment_head_to_assembler(router, pkt, fmd);
     }
 
     return vr_flow_lookup(router, flow_p, pkt, fmd);
@@ -474,7 +474,6 @@ vr_inet6_flow_lookup(struct vrouter *router, struct vr_packet *pkt,
     bool lookup = false;
     struct vr_flow flow, *flow_p = &flow;
     struct vr_ip6 *ip6 = (struct vr_ip6 *)pkt_network_header(pkt);
-    struct vr_packet *pkt_c;
 
     /*
      * if the packet has already done one round of flow lookup, there
@@ -519,12 +518,7 @@ vr_inet6_flow_lookup(struct vrouter *router, struct vr_packet *pkt,
                 flow_p->flow6_dport, 0);
         if (ret < 0)
             return -VP_DROP_NO_MEMORY;
-        if (vr_enqueue_to_assembler){
-            pkt_c = vr_pclone(pkt);
-            if (pkt_c) {
-                vr_enqueue_to_assembler(router, pkt_c, fmd);
-            }
-        }
+        vr_fragment_head_to_assembler(router, pkt, fmd);
     }
 
     return vr_flow_lookup(router, flow_p, pkt, fmd);
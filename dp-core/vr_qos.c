@@ -479,6 +479,38 @@ vr_fc_map_get_fc(struct vrouter *router, unsigned int i)
     return &router->vr_fc_table[i];
 }
 
+struct vr_qos_sched_tc *
+vr_qos_sched_get(struct vrouter *router, unsigned int queue_id)
+{
+    return &router->vr_qos_sched[queue_id % VR_QOS_SCHED_NUM_TC];
+}
+
+static void
+vr_qos_sched_reset(struct vrouter *router)
+{
+    unsigned int i;
+
+    for (i = 0; i < VR_QOS_SCHED_NUM_TC; i++) {
+        router->vr_qos_sched[i].vqst_rate = 0;
+        router->vr_qos_sched[i].vqst_weight = VR_QOS_SCHED_DEF_WEIGHT;
+    }
+    router->vr_qos_sched_gen++;
+
+    return;
+}
+
+static void
+vr_fc_map_fill_sched(struct vrouter *router, struct vr_forwarding_class *fc_p,
+        vr_fc_map_req *resp)
+{
+    struct vr_qos_sched_tc *tc = vr_qos_sched_get(router, fc_p->vfc_queue_id);
+
+    resp->fmr_sched_weight[0] = tc->vqst_weight;
+    resp->fmr_sched_rate[0] = tc->vqst_rate;
+
+    return;
+}
+
 static void
 vr_fc_map_req_destroy(vr_fc_map_req *req)
 {
@@ -510,6 +542,16 @@ vr_fc_map_req_destroy(vr_fc_map_req *req)
         req->fmr_queue_id_size = 0;
     }
 
+    if (req->fmr_sched_weight) {
+        vr_free(req->fmr_sched_weight, VR_FC_OBJECT);
+        req->fmr_sched_weight_size = 0;
+    }
+
+    if (req->fmr_sched_rate) {
+        vr_free(req->fmr_sched_rate, VR_FC_OBJECT);
+        req->fmr_sched_rate_size = 0;
+    }
+
     vr_free(req, VR_FC_OBJECT);
     return;
 }
@@ -553,6 +595,19 @@ vr_fc_map_req_get(unsigned int entries)
     }
     req->fmr_queue_id_size = entries;
 
+    req->fmr_sched_weight = vr_zalloc(entries, VR_FC_OBJECT);
+    if (!req->fmr_sched_weight) {
+        goto error;
+    }
+    req->fmr_sched_weight_size = entries;
+
+    req->fmr_sched_rate = vr_zalloc(entries * sizeof(*req->fmr_sched_rate),
+            VR_FC_OBJECT);
+    if (!req->fmr_sched_rate) {
+        goto error;
+    }
+    req->fmr_sched_rate_size = entries;
+
     return req;
 
 error:
@@ -631,6 +686,7 @@ vr_fc_map_dump(vr_fc_map_req *req)
         resp->fmr_mpls_qos[0] = fc_p->vfc_mpls_qos;
         resp->fmr_dotonep[0] = fc_p->vfc_dotonep_qos;
         resp->fmr_queue_id[0] = fc_p->vfc_queue_id;
+        vr_fc_map_fill_sched(router, fc_p, resp);
 
         (void)vr_offload_fc_map_get(resp);
 
@@ -681,6 +737,7 @@ vr_fc_map_get(vr_fc_map_req *req)
     resp->fmr_mpls_qos[0] = fc_p->vfc_mpls_qos;
     resp->fmr_dotonep[0] = fc_p->vfc_dotonep_qos;
     resp->fmr_queue_id[0] = fc_p->vfc_queue_id;
+    vr_fc_map_fill_sched(router, fc_p, resp);
 
     /* Debug comparison to check if matching entry is programmed on NIC */
     (void)vr_offload_fc_map_get(resp);
@@ -701,6 +758,7 @@ vr_fc_map_add(vr_fc_map_req *req)
 
     struct vrouter *router = vrouter_get(req->fmr_rid);
     struct vr_forwarding_class *fc_p;
+    struct vr_qos_sched_tc *tc;
 
     if (!req->fmr_id || !req->fmr_id_size ||
             !req->fmr_dscp || !req->fmr_dscp_size ||
@@ -736,6 +794,24 @@ vr_fc_map_add(vr_fc_map_req *req)
         }
     }
 
+    /*
+     * Scheduling parameters are optional and apply to the traffic class
+     * the forwarding class is queued to, so they are shared by all the
+     * forwarding classes with the same queue id.
+     */
+    if (!ret && req->fmr_sched_weight &&
+            req->fmr_sched_weight_size == req->fmr_id_size &&
+            req->fmr_sched_rate &&
+            req->fmr_sched_rate_size == req->fmr_id_size) {
+        for (i = 0; i < req->fmr_id_size; i++) {
+            tc = vr_qos_sched_get(router, req->fmr_queue_id[i]);
+            tc->vqst_weight = req->fmr_sched_weight[i];
+            tc->vqst_rate = req->fmr_sched_rate[i];
+        }
+        vr_sync_synchronize();
+        router->vr_qos_sched_gen++;
+    }
+
 generate_response:
     vr_send_response(ret);
     return;
@@ -833,6 +909,7 @@ vr_qos_exit(struct vrouter *router, bool soft_reset)
         if (router->vr_fc_table) {
             memset(router->vr_fc_table, 0, size);
         }
+        vr_qos_sched_reset(router);
     } else {
         if (router->vr_qos_map) {
             for (i = 0; i < vr_qos_map_entries; i++) {
@@ -875,5 +952,7 @@ vr_qos_init(struct vrouter *router)
         }
     }
 
+    vr_qos_sched_reset(router);
+
     return 0;
 }
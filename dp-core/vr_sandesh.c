@@ -108,6 +108,11 @@ struct sandesh_object_md sandesh_md[] = {
         .obj_len                =       4 * sizeof(vr_vrf_req),
         .obj_type_string        =       "vr_vrf_req",
     },
+    [VR_BULK_OBJECT_ID]         =   {
+        .obj_len                =       4 * sizeof(vr_bulk_req),
+        .obj_get_size           =       vr_bulk_req_get_size,
+        .obj_type_string        =       "vr_bulk_req",
+    },
 };
 
 static unsigned int
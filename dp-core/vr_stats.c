@@ -10,6 +10,17 @@
 #include <vr_offloads_dp.h>
 #include "vr_message.h"
 #include "vr_btable.h"
+#include "vr_route.h"
+#include "vr_stats.h"
+#include "vr_stats_shm.h"
+
+#define VR_STATS_SHM_ROUNDUP(len) \
+    (((len) + VR_STATS_SHM_ALIGN - 1) & ~(VR_STATS_SHM_ALIGN - 1))
+
+extern unsigned int vr_interfaces, vr_vrfs;
+
+/* set by the host, before vrouter_init, to export the counters */
+struct vr_stats_shm_hdr *vr_stats_shm;
 
 void vr_stats_exit(struct vrouter *, bool);
 int vr_stats_init(struct vrouter *);
@@ -78,6 +89,9 @@ vr_drop_stats_make_response(vr_drop_stats_req *response, uint64_t *stats)
     response->vds_icmp_error += stats[VP_DROP_ICMP_ERROR];
     response->vds_clone_fail += stats[VP_DROP_CLONE_FAIL];
     response->vds_invalid_underlay_ecmp += stats[VP_DROP_INVALID_UNDERLAY_ECMP];
+    response->vds_vif_policer_in += stats[VP_DROP_VIF_POLICER_IN];
+    response->vds_vif_policer_out += stats[VP_DROP_VIF_POLICER_OUT];
+    response->vds_repl_ring_full += stats[VP_DROP_REPL_RING_FULL];
     return;
 }
 
@@ -272,9 +286,6 @@ vr_mem_stats_get(void)
                 stats_block[VR_HTABLE_OBJECT].ms_free);
         response->vms_interface_object += (stats_block[VR_INTERFACE_OBJECT].ms_alloc -
                 stats_block[VR_INTERFACE_OBJECT].ms_free);
-        response->vms_interface_bridge_lock_object +=
-            (stats_block[VR_INTERFACE_BRIDGE_LOCK_OBJECT].ms_alloc -
-                stats_block[VR_INTERFACE_BRIDGE_LOCK_OBJECT].ms_free);
         response->vms_interface_req_bridge_id_object +=
             (stats_block[VR_INTERFACE_REQ_BRIDGE_ID_OBJECT].ms_alloc -
                 stats_block[VR_INTERFACE_REQ_BRIDGE_ID_OBJECT].ms_free);
@@ -373,6 +384,15 @@ vr_mem_stats_get(void)
         response->vms_interface_fat_flow_ipv6_exclude_list_object +=
             (stats_block[VR_INTERFACE_FAT_FLOW_IPV6_EXCLUDE_LIST_OBJECT].ms_alloc -
              stats_block[VR_INTERFACE_FAT_FLOW_IPV6_EXCLUDE_LIST_OBJECT].ms_free);
+        response->vms_nexthop_repl_stats_object +=
+            (stats_block[VR_NEXTHOP_REPL_STATS_OBJECT].ms_alloc -
+             stats_block[VR_NEXTHOP_REPL_STATS_OBJECT].ms_free);
+        response->vms_bridge_learn_object +=
+            (stats_block[VR_BRIDGE_LEARN_OBJECT].ms_alloc -
+             stats_block[VR_BRIDGE_LEARN_OBJECT].ms_free);
+        response->vms_interface_policer_object +=
+            (stats_block[VR_INTERFACE_POLICER_OBJECT].ms_alloc -
+             stats_block[VR_INTERFACE_POLICER_OBJECT].ms_free);
         for (i = 0; i < VR_VROUTER_MAX_OBJECT; i++) {
             alloced += stats_block[i].ms_alloc;
             freed += stats_block[i].ms_free;
@@ -492,6 +512,140 @@ vr_malloc_stats_init(struct vrouter *router)
     return 0;
 }
 
+static void
+vr_stats_shm_section_init(struct vr_stats_shm_section *sec, uint64_t *off,
+        unsigned int entries, unsigned int copies, unsigned int cpus,
+        unsigned int cpu_stride, unsigned int counters)
+{
+    unsigned int blocks = entries * copies;
+
+    sec->vsc_blocks = blocks;
+    sec->vsc_copies = copies;
+    sec->vsc_cpus = cpus;
+    sec->vsc_cpu_stride = cpu_stride;
+    sec->vsc_counters = counters;
+    sec->vsc_block_size = VR_STATS_SHM_ROUNDUP(cpus * cpu_stride);
+
+    sec->vsc_gen_offset = *off;
+    *off += VR_STATS_SHM_ROUNDUP(blocks * sizeof(uint32_t));
+    sec->vsc_offset = *off;
+    *off += (uint64_t)blocks * sec->vsc_block_size;
+
+    return;
+}
+
+/*
+ * vr_stats_shm_layout - lay the sections of the shared counter region out
+ * in hdr, for the number of cpus, interfaces and VRFs the vrouter is about
+ * to be initialized with. The host calls it before vrouter_init, to size
+ * the region, and writes vss_magic itself. Returns the size of the region.
+ */
+uint64_t
+vr_stats_shm_layout(struct vr_stats_shm_hdr *hdr)
+{
+    uint64_t off;
+    unsigned int drop_size = VP_DROP_MAX * sizeof(uint64_t);
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->vss_version = VR_STATS_SHM_VERSION;
+    hdr->vss_hdr_size = sizeof(*hdr);
+    hdr->vss_cpus = vr_num_cpus;
+    hdr->vss_sections = VR_STATS_SHM_MAX_SECTIONS;
+
+    off = VR_STATS_SHM_ROUNDUP(sizeof(*hdr));
+    /* all but the queue errors pointer at the end are counters */
+    vr_stats_shm_section_init(&hdr->vss_section[VR_STATS_SHM_VIF], &off,
+            vr_interfaces, 2, vr_num_cpus, sizeof(struct vr_interface_stats),
+            (sizeof(struct vr_interface_stats) - sizeof(uint64_t *)) /
+            sizeof(uint64_t));
+    vr_stats_shm_section_init(&hdr->vss_section[VR_STATS_SHM_VIF_DROP],
+            &off, vr_interfaces, 2, 1, drop_size, VP_DROP_MAX);
+    /* VRF and vrouter counters go away only with the vrouter */
+    vr_stats_shm_section_init(&hdr->vss_section[VR_STATS_SHM_VRF], &off,
+            vr_vrfs, 1, vr_num_cpus, sizeof(struct vr_vrf_stats),
+            sizeof(struct vr_vrf_stats) / sizeof(uint64_t));
+    /* the per-core drop counters were cache line apart on the heap too */
+    vr_stats_shm_section_init(&hdr->vss_section[VR_STATS_SHM_DROP], &off,
+            1, 1, vr_num_cpus, VR_STATS_SHM_ROUNDUP(drop_size), VP_DROP_MAX);
+
+    hdr->vss_size = off;
+
+    return off;
+}
+
+/*
+ * vr_stats_shm_get - take a free counter block of index in section of the
+ * shared region, zeroed, and give it a generation above that of the other
+ * copies of index. Returns NULL if the counters are not exported, if index
+ * is out of the section or if all its copies are still with previous
+ * owners, whose free waits for the datapath to let go of them, in which
+ * case the counters have to live on the heap.
+ */
+void *
+vr_stats_shm_get(unsigned int section, unsigned int index)
+{
+    unsigned int i, first, block = ~0U;
+    uint32_t *gen, top = 0;
+    struct vr_stats_shm_section *sec;
+
+    if (!vr_stats_shm || section >= vr_stats_shm->vss_sections)
+        return NULL;
+
+    sec = &vr_stats_shm->vss_section[section];
+    if (index >= sec->vsc_blocks / sec->vsc_copies)
+        return NULL;
+
+    first = index * sec->vsc_copies;
+    for (i = first; i < first + sec->vsc_copies; i++) {
+        gen = vr_stats_shm_gen(vr_stats_shm, section, i);
+        if (!(*gen & 1) && (block == ~0U))
+            block = i;
+        if ((int32_t)(*gen - top) > 0)
+            top = *gen;
+    }
+
+    if (block == ~0U)
+        return NULL;
+
+    memset(vr_stats_shm_block(vr_stats_shm, section, block), 0,
+            sec->vsc_block_size);
+    vr_sync_synchronize();
+    /* the lowest odd generation above all of them */
+    *vr_stats_shm_gen(vr_stats_shm, section, block) = (top | 1) + 2 * (top & 1);
+
+    return vr_stats_shm_block(vr_stats_shm, section, block);
+}
+
+/*
+ * vr_stats_shm_put - give back a block taken with vr_stats_shm_get.
+ * Returns false if block is not in section, and so is to be freed by the
+ * caller.
+ */
+bool
+vr_stats_shm_put(unsigned int section, void *block)
+{
+    uint8_t *start;
+    unsigned long off;
+    struct vr_stats_shm_section *sec;
+
+    if (!vr_stats_shm || !block || section >= vr_stats_shm->vss_sections)
+        return false;
+
+    sec = &vr_stats_shm->vss_section[section];
+    start = vr_stats_shm_block(vr_stats_shm, section, 0);
+    if ((uint8_t *)block < start)
+        return false;
+
+    off = (uint8_t *)block - start;
+    if (off >= (unsigned long)sec->vsc_blocks * sec->vsc_block_size)
+        return false;
+
+    vr_sync_synchronize();
+    (*vr_stats_shm_gen(vr_stats_shm, section, off / sec->vsc_block_size))++;
+
+    return true;
+}
+
 static void
 vr_pkt_drop_stats_exit(struct vrouter *router)
 {
@@ -500,6 +654,11 @@ vr_pkt_drop_stats_exit(struct vrouter *router)
     if (!router->vr_pdrop_stats)
         return;
 
+    if (vr_stats_shm_put(VR_STATS_SHM_DROP, router->vr_pdrop_stats[0])) {
+        for (i = 0; i < vr_num_cpus; i++)
+            router->vr_pdrop_stats[i] = NULL;
+    }
+
     for (i = 0; i < vr_num_cpus; i++) {
         if (!router->vr_pdrop_stats[i])
             break;
@@ -521,6 +680,7 @@ vr_pkt_drop_stats_init(struct vrouter *router)
 {
     unsigned int i = 0;
     unsigned int size = 0;
+    uint8_t *block;
 
     if (router->vr_pdrop_stats)
         return 0;
@@ -533,6 +693,15 @@ vr_pkt_drop_stats_init(struct vrouter *router)
         goto cleanup;
     }
 
+    block = vr_stats_shm_get(VR_STATS_SHM_DROP, 0);
+    if (block) {
+        size = vr_stats_shm->vss_section[VR_STATS_SHM_DROP].vsc_cpu_stride;
+        for (i = 0; i < vr_num_cpus; i++)
+            router->vr_pdrop_stats[i] = (uint64_t *)(block + i * size);
+
+        goto log_init;
+    }
+
     size = VP_DROP_MAX * sizeof(uint64_t);
     for (i = 0; i < vr_num_cpus; i++) {
         router->vr_pdrop_stats[i] = vr_zalloc(size, VR_DROP_STATS_OBJECT);
@@ -543,6 +712,7 @@ vr_pkt_drop_stats_init(struct vrouter *router)
         }
     }
 
+log_init:
     vr_pkt_drop_log_init(router);
 
     return 0;
@@ -298,6 +298,10 @@ vr_vxlan_init(struct vrouter *router)
             vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
             return -ENOMEM;
         }
+
+        /* look VNIDs up in a flat array or a perfect hash, as they fit */
+        vr_itable_set_backend(router->vr_vxlan_table, router,
+                VR_ITABLE_BACKEND_AUTO);
     }
     return 0;
 }
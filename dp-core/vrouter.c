@@ -53,6 +53,11 @@ extern unsigned int vr_uncond_close_flow_on_tcp_rst;
 void vrouter_exit(bool);
 
 volatile bool vr_not_ready = true;
+/*
+ * Set by the host if the flow and bridge tables outlive the process. The
+ * tables are not reset on exit then, so the next instance can reattach.
+ */
+bool vr_warm_restart = false;
 
 /* Below hugepage req recv and resp variables are added for debug purpose */
 int vr_hpage_req_recv = 0;
@@ -57,6 +57,8 @@ enum vr_opt_index {
     VERSION_OPT_INDEX,
 #define MEMPOOL_SIZE_OPT        "vr_mempool_sz"
     MEMPOOL_SIZE_OPT_INDEX,
+#define NODE_MEMPOOL_SIZE_OPT   "vr_node_mempool_sz"
+    NODE_MEMPOOL_SIZE_OPT_INDEX,
 #define DPDK_TXD_SIZE_OPT       "dpdk_txd_sz"
     DPDK_TXD_SIZE_OPT_INDEX,
 #define DPDK_RXD_SIZE_OPT       "dpdk_rxd_sz"
@@ -83,6 +85,10 @@ enum vr_opt_index {
     BRIDGE_ENTRIES_OPT_INDEX,
 #define BRIDGE_OENTRIES_OPT     "vr_bridge_oentries"
     BRIDGE_OENTRIES_OPT_INDEX,
+#define BRIDGE_VRF_ENTRIES_OPT  "vr_bridge_vrf_entries"
+    BRIDGE_VRF_ENTRIES_OPT_INDEX,
+#define BRIDGE_AGE_SECS_OPT     "vr_bridge_age_secs"
+    BRIDGE_AGE_SECS_OPT_INDEX,
 #define FLOW_ENTRIES_OPT        "vr_flow_entries"
     FLOW_ENTRIES_OPT_INDEX,
 #define OFLOW_ENTRIES_OPT       "vr_oflow_entries"
@@ -111,6 +117,18 @@ enum vr_opt_index {
     VR_DPDK_TX_RING_SZ_OPT_INDEX,
 #define VR_DPDK_YIELD_OPT           "yield_option"
     VR_DPDK_YIELD_OPT_INDEX,
+#define VR_DPDK_TAP_QUEUES_OPT      "vr_dpdk_tap_queues"
+    VR_DPDK_TAP_QUEUES_OPT_INDEX,
+#define VR_DPDK_REPL_LCORES_OPT     "vr_dpdk_repl_lcores"
+    VR_DPDK_REPL_LCORES_OPT_INDEX,
+#define VR_DPDK_REPL_RATE_OPT       "vr_dpdk_repl_rate"
+    VR_DPDK_REPL_RATE_OPT_INDEX,
+#define VR_WARM_RESTART_OPT         "vr_warm_restart"
+    VR_WARM_RESTART_OPT_INDEX,
+#define VR_STATS_SHM_OPT            "vr_stats_shm"
+    VR_STATS_SHM_OPT_INDEX,
+#define VR_DPDK_QOS_SCHED_RATE_OPT  "vr_dpdk_qos_sched_rate"
+    VR_DPDK_QOS_SCHED_RATE_OPT_INDEX,
 #define VR_DPDK_LOG_LEVEL        "log-level"
     VR_DPDK_LOG_OPT_INDEX,
 #define VR_SERVICE_CORE_MASK_OPT    "service_core_mask"
@@ -131,6 +149,8 @@ enum vr_opt_index {
 /* dp-core parameters */
 extern unsigned int vr_bridge_entries;
 extern unsigned int vr_bridge_oentries;
+extern unsigned int vr_bridge_vrf_entries;
+extern unsigned int vr_bridge_age_secs;
 extern unsigned int vr_mpls_labels;
 extern unsigned int vr_nexthops;
 extern unsigned int vr_vrfs;
@@ -143,6 +163,10 @@ unsigned int vr_dpdk_tx_ring_sz = VR_DPDK_TX_RING_SZ;
 unsigned int vr_service_core_mask = 0;
 unsigned int vr_dpdk_ctrl_thread_mask = 0;
 unsigned int vr_dpdk_yield_option = VR_DPDK_YIELD_NO_PACKETS;
+unsigned int vr_dpdk_tapdev_nb_queues = VR_DPDK_TAPDEV_DEF_QUEUES;
+unsigned int vr_dpdk_repl_lcores = 0;
+unsigned int vr_dpdk_repl_rate = 0;
+bool vr_dpdk_stats_shm = false;
 bool vr_no_load_balance = false;
 char service_core_mask_str[VR_DPDK_STR_BUF_SZ];
 char dpdk_ctrl_thread_mask_str[VR_DPDK_STR_BUF_SZ];
@@ -159,6 +183,7 @@ int no_rx_mrgbuf = 0;
 #define DPDK_LOG_FILE_SZ 512
 char dpdk_log_file[512] = "/var/log/contrail/contrail-vrouter-dpdk.log";
 unsigned int vr_mempool_sz = VR_DEF_MEMPOOL_SZ;
+unsigned int vr_node_mempool_sz = VR_DEF_NODE_MEMPOOL_SZ;
 unsigned int vr_rxd_sz = VR_DPDK_NB_RXD;
 unsigned int vr_txd_sz = VR_DPDK_NB_TXD;
 unsigned int vr_packet_sz = VR_DEF_MAX_PACKET_SZ;
@@ -218,6 +243,9 @@ dpdk_mempools_create(void)
     unsigned int rss_mempool_sz = vr_mempool_sz;
     unsigned int frag_direct_mempool_sz = VR_DPDK_FRAG_DIRECT_MEMPOOL_SZ;
     unsigned int frag_indirect_mempool_sz = VR_DPDK_FRAG_INDIRECT_MEMPOOL_SZ;
+    unsigned int lcore_id, socket_id;
+    bool node_failed[RTE_MAX_NUMA_NODES] = { false };
+    char mempool_name[RTE_MEMPOOL_NAMESIZE];
 
     /* Create the mbuf pool used for RSS */
     vr_dpdk.rss_mempool = rte_mempool_create("rss_mempool",
@@ -231,6 +259,39 @@ dpdk_mempools_create(void)
             rte_strerror(rte_errno), rte_errno);
         return -rte_errno;
     }
+    vr_dpdk.rss_mempools[rte_socket_id()] = vr_dpdk.rss_mempool;
+
+    /*
+     * Create an RSS mbuf pool on each other NUMA node with forwarding
+     * lcores, so the lcores and the NIC queues allocate local mbufs. These
+     * are an optimization only: a node without one uses the pool above.
+     */
+    RTE_LCORE_FOREACH(lcore_id) {
+        socket_id = rte_lcore_to_socket_id(lcore_id);
+        if (!vr_node_mempool_sz || lcore_id < VR_DPDK_FWD_LCORE_ID ||
+                socket_id >= RTE_MAX_NUMA_NODES ||
+                vr_dpdk.rss_mempools[socket_id] != NULL ||
+                node_failed[socket_id])
+            continue;
+
+        snprintf(mempool_name, sizeof(mempool_name), "rss_mempool_%u",
+                socket_id);
+        vr_dpdk.rss_mempools[socket_id] = rte_mempool_create(mempool_name,
+                vr_node_mempool_sz,
+                VR_DPDK_MBUF_HDR_SZ + vr_packet_sz, VR_DPDK_RSS_MEMPOOL_CACHE_SZ,
+                sizeof(struct rte_pktmbuf_pool_private),
+                vr_dpdk_pktmbuf_pool_init, NULL, vr_dpdk_pktmbuf_init, NULL,
+                socket_id, 0);
+        if (vr_dpdk.rss_mempools[socket_id] == NULL) {
+            RTE_LOG(WARNING, VROUTER, "Error creating RSS mempool on socket %u: %s (%d),"
+                " using the socket %u one\n", socket_id, rte_strerror(rte_errno),
+                rte_errno, rte_socket_id());
+            node_failed[socket_id] = true;
+            continue;
+        }
+        RTE_LOG(INFO, VROUTER, "Allocated RSS mempool on socket %u\n",
+                socket_id);
+    }
 
     /* Create the mbuf pool used for IP fragmentation (direct mbufs) */
     vr_dpdk.frag_direct_mempool = rte_mempool_create("frag_direct_mempool",
@@ -255,6 +316,58 @@ dpdk_mempools_create(void)
         return -rte_errno;
     }
 
+    /* Create the mbuf pool used for packet clones (indirect mbufs) */
+    vr_dpdk.clone_mempool = rte_mempool_create("clone_mempool",
+            VR_DPDK_CLONE_MEMPOOL_SZ, VR_DPDK_CLONE_MBUF_SZ,
+            VR_DPDK_CLONE_MEMPOOL_CACHE_SZ,
+            sizeof(struct rte_pktmbuf_pool_private),
+            vr_dpdk_pktmbuf_pool_init, NULL, vr_dpdk_pktmbuf_init, NULL,
+            rte_socket_id(), 0);
+    if (vr_dpdk.clone_mempool == NULL) {
+        RTE_LOG(CRIT, VROUTER, "Error creating CLONE mempool: %s (%d)\n",
+            rte_strerror(rte_errno), rte_errno);
+        return -rte_errno;
+    }
+
+    /* Create the mbuf pool used for multicast replica headers */
+    vr_dpdk.hdr_mempool = rte_mempool_create("hdr_mempool",
+            VR_DPDK_HDR_MEMPOOL_SZ, VR_DPDK_HDR_MBUF_SZ,
+            VR_DPDK_HDR_MEMPOOL_CACHE_SZ,
+            sizeof(struct rte_pktmbuf_pool_private),
+            vr_dpdk_pktmbuf_pool_init, NULL, vr_dpdk_pktmbuf_init, NULL,
+            rte_socket_id(), 0);
+    if (vr_dpdk.hdr_mempool == NULL) {
+        RTE_LOG(CRIT, VROUTER, "Error creating HDR mempool: %s (%d)\n",
+            rte_strerror(rte_errno), rte_errno);
+        return -rte_errno;
+    }
+
+    /* Create the mbuf pool used for monitoring copies */
+    vr_dpdk.copy_mempool = rte_mempool_create("copy_mempool",
+            VR_DPDK_COPY_MEMPOOL_SZ, VR_DPDK_MBUF_HDR_SZ + vr_packet_sz,
+            VR_DPDK_COPY_MEMPOOL_CACHE_SZ,
+            sizeof(struct rte_pktmbuf_pool_private),
+            vr_dpdk_pktmbuf_pool_init, NULL, vr_dpdk_pktmbuf_init, NULL,
+            rte_socket_id(), 0);
+    if (vr_dpdk.copy_mempool == NULL) {
+        RTE_LOG(CRIT, VROUTER, "Error creating COPY mempool: %s (%d)\n",
+            rte_strerror(rte_errno), rte_errno);
+        return -rte_errno;
+    }
+
+    /* Create the pool of multicast fan-outs for replication lcores */
+    if (vr_dpdk.nb_repl_lcores) {
+        vr_dpdk.repl_mempool = rte_mempool_create("repl_mempool",
+                VR_DPDK_REPL_MEMPOOL_SZ, sizeof(struct vr_dpdk_repl_elem),
+                VR_DPDK_REPL_MEMPOOL_CACHE_SZ, 0, NULL, NULL, NULL, NULL,
+                rte_socket_id(), 0);
+        if (vr_dpdk.repl_mempool == NULL) {
+            RTE_LOG(CRIT, VROUTER, "Error creating REPL mempool: %s (%d)\n",
+                rte_strerror(rte_errno), rte_errno);
+            return -rte_errno;
+        }
+    }
+
 #if VR_DPDK_USE_HW_FILTERING
     int ret, i;
     char mempool_name[RTE_MEMPOOL_NAMESIZE];
@@ -649,6 +762,14 @@ dpdk_argv_update(void)
             old_core_bit_mask, new_core_bit_mask);
     }
 
+    /* the last forwarding lcores also replicate large multicast fan-outs */
+    vr_dpdk.nb_repl_lcores = vr_dpdk_repl_lcores;
+    if (vr_dpdk.nb_repl_lcores >= vr_dpdk.nb_fwd_lcores) {
+        RTE_LOG(INFO, VROUTER, "Adjusting number of replication lcores: %u -> %u\n",
+            vr_dpdk.nb_repl_lcores, vr_dpdk.nb_fwd_lcores - 1);
+        vr_dpdk.nb_repl_lcores = vr_dpdk.nb_fwd_lcores - 1;
+    }
+
     io_core_mask_str = dpdk_shared_io_core_mask_stringify(core_mask);
     if (io_core_mask_str == NULL)
         return -1;
@@ -719,6 +840,10 @@ dpdk_argv_update(void)
                 vr_bridge_entries);
     RTE_LOG(INFO, VROUTER, "Bridge Table overflow limit: %" PRIu32 "\n",
                 vr_bridge_oentries);
+    RTE_LOG(INFO, VROUTER, "Bridge Table VRF limit:      %" PRIu32 "\n",
+                vr_bridge_vrf_entries);
+    RTE_LOG(INFO, VROUTER, "Bridge Table aging (secs):   %" PRIu32 "\n",
+                vr_bridge_age_secs);
     RTE_LOG(INFO, VROUTER, "Flow Table limit:            %" PRIu32 "\n",
                 vr_flow_entries);
     RTE_LOG(INFO, VROUTER, "Flow Table overflow limit:   %" PRIu32 "\n",
@@ -731,6 +856,8 @@ dpdk_argv_update(void)
                 vr_vrfs);
     RTE_LOG(INFO, VROUTER, "Packet pool size:            %" PRIu32 "\n",
                 rss_mempool_sz);
+    RTE_LOG(INFO, VROUTER, "Per node packet pool size:   %" PRIu32 "\n",
+                vr_node_mempool_sz);
     RTE_LOG(INFO, VROUTER, "PMD Tx Descriptor size:      %" PRIu32 "\n",
                 vr_txd_sz);
     RTE_LOG(INFO, VROUTER, "PMD Rx Descriptor size:      %" PRIu32 "\n",
@@ -745,6 +872,18 @@ dpdk_argv_update(void)
                 vr_dpdk_tx_ring_sz);
     RTE_LOG(INFO, VROUTER, "VR_DPDK_YIELD_OPTION:        %" PRIu32 "\n",
                 vr_dpdk_yield_option);
+    RTE_LOG(INFO, VROUTER, "VR_DPDK_TAP_QUEUES:          %" PRIu32 "\n",
+                vr_dpdk_tapdev_nb_queues);
+    RTE_LOG(INFO, VROUTER, "VR_DPDK_REPL_LCORES:         %" PRIu32 "\n",
+                vr_dpdk_repl_lcores);
+    RTE_LOG(INFO, VROUTER, "VR_DPDK_REPL_RATE:           %" PRIu32 "\n",
+                vr_dpdk_repl_rate);
+    RTE_LOG(INFO, VROUTER, "Warm restart:                %s\n",
+        vr_warm_restart ? "Enable" : "Disable");
+    RTE_LOG(INFO, VROUTER, "Shared memory stats:         %s\n",
+        vr_dpdk_stats_shm ? "Enable" : "Disable");
+    RTE_LOG(INFO, VROUTER, "VR_DPDK_QOS_SCHED_RATE:      %" PRIu32 " Mbps\n",
+                vr_dpdk_qos_sched_rate);
     RTE_LOG(INFO, VROUTER, "VR_DPDK_LOG_LEVEL:           %s\n",
                 vr_dpdk_log_level);
     RTE_LOG(INFO, VROUTER, "VR_SERVICE_CORE_MASK:        0x%x\n",
@@ -897,7 +1036,7 @@ dpdk_init(void)
 static void
 dpdk_exit(void)
 {
-    int i;
+    int i, q;
 
     vr_dpdk_if_lock();
     RTE_LOG(INFO, VROUTER, "Releasing KNI devices...\n");
@@ -911,7 +1050,10 @@ dpdk_exit(void)
     RTE_LOG(INFO, VROUTER, "Releasing TAP devices...\n");
     for (i = 0; i < VR_DPDK_MAX_TAP_INTERFACES; i++) {
         if (vr_dpdk.tapdevs[i].tapdev_fd > 0) {
-            close(vr_dpdk.tapdevs[i].tapdev_fd);
+            for (q = 0; q < vr_dpdk.tapdevs[i].tapdev_nb_queues; q++) {
+                close(vr_dpdk.tapdevs[i].tapdev_queue_fds[q]);
+                vr_dpdk.tapdevs[i].tapdev_queue_fds[q] = -1;
+            }
             vr_dpdk.tapdevs[i].tapdev_fd = -1;
         }
     }
@@ -1037,6 +1179,8 @@ static struct option long_options[] = {
                                                     NULL,                   0},
     [MEMPOOL_SIZE_OPT_INDEX]        =   {MEMPOOL_SIZE_OPT,      required_argument,
                                                     NULL,                   0},
+    [NODE_MEMPOOL_SIZE_OPT_INDEX]   =   {NODE_MEMPOOL_SIZE_OPT, required_argument,
+                                                    NULL,                   0},
     [DPDK_TXD_SIZE_OPT_INDEX]        =  {DPDK_TXD_SIZE_OPT,     required_argument,
                                                     NULL,                   0},
     [DPDK_RXD_SIZE_OPT_INDEX]        =  {DPDK_RXD_SIZE_OPT,     required_argument,
@@ -1063,6 +1207,10 @@ static struct option long_options[] = {
                                                     NULL,                   0},
     [BRIDGE_OENTRIES_OPT_INDEX]     =   {BRIDGE_OENTRIES_OPT,   required_argument,
                                                     NULL,                   0},
+    [BRIDGE_VRF_ENTRIES_OPT_INDEX]  =   {BRIDGE_VRF_ENTRIES_OPT, required_argument,
+                                                    NULL,                   0},
+    [BRIDGE_AGE_SECS_OPT_INDEX]     =   {BRIDGE_AGE_SECS_OPT,   required_argument,
+                                                    NULL,                   0},
     [FLOW_ENTRIES_OPT_INDEX]        =   {FLOW_ENTRIES_OPT,      required_argument,
                                                     NULL,                   0},
     [OFLOW_ENTRIES_OPT_INDEX]       =   {OFLOW_ENTRIES_OPT,     required_argument,
@@ -1091,6 +1239,18 @@ static struct option long_options[] = {
                                                     NULL,                   0},
     [VR_DPDK_YIELD_OPT_INDEX]       =   {VR_DPDK_YIELD_OPT, required_argument,
                                                     NULL,                   0},
+    [VR_DPDK_TAP_QUEUES_OPT_INDEX]  =   {VR_DPDK_TAP_QUEUES_OPT, required_argument,
+                                                    NULL,                   0},
+    [VR_DPDK_REPL_LCORES_OPT_INDEX] =   {VR_DPDK_REPL_LCORES_OPT, required_argument,
+                                                    NULL,                   0},
+    [VR_DPDK_REPL_RATE_OPT_INDEX]   =   {VR_DPDK_REPL_RATE_OPT, required_argument,
+                                                    NULL,                   0},
+    [VR_WARM_RESTART_OPT_INDEX]     =   {VR_WARM_RESTART_OPT,   no_argument,
+                                                    NULL,                   0},
+    [VR_STATS_SHM_OPT_INDEX]        =   {VR_STATS_SHM_OPT,      no_argument,
+                                                    NULL,                   0},
+    [VR_DPDK_QOS_SCHED_RATE_OPT_INDEX] = {VR_DPDK_QOS_SCHED_RATE_OPT, required_argument,
+                                                    NULL,                   0},
     [VR_DPDK_LOG_OPT_INDEX]       =   {VR_DPDK_LOG_LEVEL, required_argument,
                                                     NULL,                   0},
     [VR_SERVICE_CORE_MASK_OPT_INDEX]=   {VR_SERVICE_CORE_MASK_OPT, required_argument,
@@ -1132,6 +1292,8 @@ Usage(void)
         "\n"
         "    --"BRIDGE_ENTRIES_OPT" NUM   Bridge table limit\n"
         "    --"BRIDGE_OENTRIES_OPT" NUM  Bridge table overflow limit\n"
+        "    --"BRIDGE_VRF_ENTRIES_OPT" NUM Bridge table limit per VRF\n"
+        "    --"BRIDGE_AGE_SECS_OPT" NUM  Age out learnt MACs idle for NUM seconds\n"
         "    --"FLOW_ENTRIES_OPT" NUM     Flow table limit\n"
         "    --"OFLOW_ENTRIES_OPT" NUM    Flow overflow table limit\n"
         "    --"MPLS_LABELS_OPT" NUM      MPLS table limit\n"
@@ -1139,6 +1301,8 @@ Usage(void)
         "    --"VRFS_OPT" NUM             VRF tables limit\n"
         "    --"MEMORY_ALLOC_CHECKS_OPT"  Enable memory checks\n"
         "    --"MEMPOOL_SIZE_OPT" NUM     Main packet pool size\n"
+        "    --"NODE_MEMPOOL_SIZE_OPT" NUM Packet pool size on each other NUMA\n"
+        "                         node with forwarding lcores (0 - no pools)\n"
         "    --"DPDK_TXD_SIZE_OPT" NUM    DPDK PMD Tx Descriptor size\n"
         "    --"DPDK_RXD_SIZE_OPT" NUM    DPDK PMD Rx Descriptor size\n"
         "    --"PACKET_SIZE_OPT" NUM      Maximum packet size\n"
@@ -1146,6 +1310,14 @@ Usage(void)
         "    --"VR_DPDK_RX_RING_SZ_OPT" NUM Configure vr_dpdk_rx_ring_sz value\n"
         "    --"VR_DPDK_TX_RING_SZ_OPT" NUM Configure vr_dpd_tx_ring_sz value\n"
         "    --"VR_DPDK_YIELD_OPT" NUM      Configurable parameter to disable yield\n"
+        "    --"VR_DPDK_TAP_QUEUES_OPT" NUM Number of vhost0 TAP queues\n"
+        "    --"VR_DPDK_REPL_LCORES_OPT" NUM Number of multicast replication lcores\n"
+        "    --"VR_DPDK_REPL_RATE_OPT" NUM Replicas per second each replication\n"
+        "                         lcore makes of queued fan-outs (0 - no limit)\n"
+        "    --"VR_WARM_RESTART_OPT"  Keep flow and bridge tables across restarts\n"
+        "    --"VR_STATS_SHM_OPT"     Keep interface, VRF and drop counters in a\n"
+        "                         shared memory file under the socket directory\n"
+        "    --"VR_DPDK_QOS_SCHED_RATE_OPT" NUM Fabric egress scheduler rate in Mbps\n"
         "    --"VR_DPDK_LOG_LEVEL" NUM  Set log level\n"
         "    --"VR_NO_LOAD_BALANCE_OPT"    Disable s/w load-balancing\n"
         "    --"VR_DPDK_DDP_OPT"        Enable DDP feature\n"
@@ -1189,6 +1361,13 @@ parse_long_opts(int opt_flow_index, char *optarg)
         }
         break;
 
+    case NODE_MEMPOOL_SIZE_OPT_INDEX:
+        vr_node_mempool_sz = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_node_mempool_sz = VR_DEF_NODE_MEMPOOL_SZ;
+        }
+        break;
+
     case DPDK_RXD_SIZE_OPT_INDEX:
         vr_rxd_sz = (unsigned int)strtoul(optarg, NULL, 0);
         if (errno != 0) {
@@ -1261,6 +1440,20 @@ parse_long_opts(int opt_flow_index, char *optarg)
         }
         break;
 
+    case BRIDGE_VRF_ENTRIES_OPT_INDEX:
+        vr_bridge_vrf_entries = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_bridge_vrf_entries = 0;
+        }
+        break;
+
+    case BRIDGE_AGE_SECS_OPT_INDEX:
+        vr_bridge_age_secs = (unsigned int)strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_bridge_age_secs = 0;
+        }
+        break;
+
     case FLOW_ENTRIES_OPT_INDEX:
         vr_flow_entries = (unsigned int)strtoul(optarg, NULL, 0);
         if (errno != 0) {
@@ -1330,6 +1523,42 @@ parse_long_opts(int opt_flow_index, char *optarg)
         }
         break;
 
+    case VR_DPDK_TAP_QUEUES_OPT_INDEX:
+        vr_dpdk_tapdev_nb_queues = (unsigned int) strtoul(optarg, NULL, 0);
+        if (errno != 0 || vr_dpdk_tapdev_nb_queues == 0) {
+            vr_dpdk_tapdev_nb_queues = VR_DPDK_TAPDEV_DEF_QUEUES;
+        }
+        break;
+
+    case VR_DPDK_REPL_LCORES_OPT_INDEX:
+        vr_dpdk_repl_lcores = (unsigned int) strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_dpdk_repl_lcores = 0;
+        }
+        break;
+
+    case VR_DPDK_REPL_RATE_OPT_INDEX:
+        vr_dpdk_repl_rate = (unsigned int) strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_dpdk_repl_rate = 0;
+        }
+        break;
+
+    case VR_WARM_RESTART_OPT_INDEX:
+        vr_warm_restart = true;
+        break;
+
+    case VR_STATS_SHM_OPT_INDEX:
+        vr_dpdk_stats_shm = true;
+        break;
+
+    case VR_DPDK_QOS_SCHED_RATE_OPT_INDEX:
+        vr_dpdk_qos_sched_rate = (unsigned int) strtoul(optarg, NULL, 0);
+        if (errno != 0) {
+            vr_dpdk_qos_sched_rate = 0;
+        }
+        break;
+
     case VR_DPDK_LOG_OPT_INDEX:
         vr_dpdk_log_level = optarg;
         if (errno != 0) {
@@ -1463,6 +1692,8 @@ parse_no_arg_cli(int opt_flow_index, int optind, char *argv[])
         opt_flow_index == VTEST_VLAN_OPT_INDEX ||
         opt_flow_index == VR_DPDK_LOG_OPT_INDEX ||
         opt_flow_index == VR_DPDK_DDP_OPT_INDEX ||
+        opt_flow_index == VR_WARM_RESTART_OPT_INDEX ||
+        opt_flow_index == VR_STATS_SHM_OPT_INDEX ||
         opt_flow_index == VR_NO_LOAD_BALANCE_OPT_INDEX) {
             if(argv[optind] && argv[optind][0] != '-') {
                 printf("No arguments required \n");
@@ -1593,6 +1824,7 @@ main(int argc, char *argv[])
     dpdk_fragment_assembler_exit();
     dpdk_netlink_exit();
     vr_dpdk_host_exit();
+    vr_dpdk_table_mem_exit();
     dpdk_exit();
 
     rte_exit(ret, "vRouter/DPDK is stopped.\n");
@@ -0,0 +1,749 @@
+/*
+ * vr_dpdk_capture.c -- filtered packet capture to a pcapng file
+ *
+ * Copyright (c) 2014, Juniper Networks Private Inc.,
+ * All rights reserved
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "vr_dpdk.h"
+#include "vr_dpdk_capture.h"
+#include "nl_util.h"
+
+#include <rte_cycles.h>
+#include <rte_malloc.h>
+
+#define VR_PCAPNG_SHB               0x0A0D0D0A
+#define VR_PCAPNG_IDB               0x00000001
+#define VR_PCAPNG_EPB               0x00000006
+#define VR_PCAPNG_BYTE_ORDER        0x1A2B3C4D
+#define VR_PCAPNG_LINKTYPE_ETHERNET 1
+
+#define VR_PCAPNG_OPT_END           0
+#define VR_PCAPNG_OPT_COMMENT       1
+#define VR_PCAPNG_IF_NAME           2
+#define VR_PCAPNG_IF_TSRESOL        9
+#define VR_PCAPNG_EPB_FLAGS         2
+#define VR_PCAPNG_EPB_INBOUND       1
+#define VR_PCAPNG_EPB_OUTBOUND      2
+
+#define VR_PCAPNG_PAD(len)          (((len) + 3) & ~3U)
+/* block header and trailer, EPB fields, and room for the options */
+#define VR_PCAPNG_BLOCK_MAX         (128 + VR_DPDK_CAPTURE_MAX_SNAPLEN)
+
+/* microseconds the capture thread sleeps for when the rings are empty */
+#define VR_DPDK_CAPTURE_IDLE_US     1000
+#define VR_DPDK_CAPTURE_NO_VIF      0xffff
+#define NSEC_PER_SEC                1000000000ULL
+
+struct vr_dpdk_capture_rec {
+    uint64_t cr_tsc;
+    uint32_t cr_len;
+    uint16_t cr_caplen;
+    uint16_t cr_vif;
+    uint16_t cr_reason;
+    uint8_t cr_dir;
+    uint8_t cr_pad[5];
+    uint8_t cr_data[0];
+};
+
+/* a ring of records of a single lcore, emptied by the capture thread */
+struct vr_dpdk_capture_ring {
+    /* written by the lcore only */
+    uint32_t rg_head;
+    uint64_t rg_captured;
+    uint64_t rg_lost;
+    /* written by the capture thread only */
+    uint32_t rg_tail __rte_cache_aligned;
+    uint32_t rg_slot_size;
+    uint8_t rg_slots[0] __rte_cache_aligned;
+};
+
+struct vr_dpdk_capture {
+    struct vr_dpdk_capture_filter vdc_filter;
+    struct vr_dpdk_capture_ring *vdc_rings[RTE_MAX_LCORE];
+    char vdc_path[VR_UNIX_PATH_MAX];
+    FILE *vdc_file;
+    pthread_t vdc_thread;
+    /* set once the lcores no longer see the capture */
+    volatile bool vdc_stop;
+    /* pcapng interface id + 1 of each vif, 0 until its IDB is written */
+    uint32_t *vdc_if_ids;
+    uint32_t vdc_nb_ifs;
+    uint64_t vdc_hz;
+    uint64_t vdc_tsc;
+    uint64_t vdc_ns;
+    uint64_t vdc_written;
+    uint8_t vdc_block[VR_PCAPNG_BLOCK_MAX];
+};
+
+extern unsigned int vr_interfaces;
+
+struct vr_dpdk_capture *vr_dpdk_capture;
+
+static const char *vr_dpdk_capture_drop_rsn[] = {
+    DROP_RSN_MAP(string)
+};
+
+static inline struct vr_dpdk_capture_rec *
+vr_dpdk_capture_rec(struct vr_dpdk_capture_ring *ring, uint32_t idx)
+{
+    return (struct vr_dpdk_capture_rec *)(ring->rg_slots +
+            (idx & (VR_DPDK_CAPTURE_RING_SZ - 1)) * ring->rg_slot_size);
+}
+
+/*
+ * vr_dpdk_capture_key_get - the 5-tuple of the Ethernet frame of len bytes
+ * at data, in key. Whatever is not there is left zero.
+ */
+static inline void
+vr_dpdk_capture_key_get(uint8_t *data, unsigned int len,
+        struct vr_dpdk_capture_key *key)
+{
+    unsigned int off = VR_ETHER_HLEN;
+    uint16_t eth_proto, *ports;
+    struct vr_ip *iph;
+    struct vr_ip6 *ip6h;
+
+    key->ck_words[0] = key->ck_words[1] = 0;
+    if (len < VR_ETHER_HLEN)
+        return;
+
+    eth_proto = ((struct vr_eth *)data)->eth_proto;
+    while (eth_proto == rte_cpu_to_be_16(VR_ETH_PROTO_VLAN)) {
+        if (len < off + VR_VLAN_HLEN)
+            return;
+        eth_proto = *(uint16_t *)(data + off + 2);
+        off += VR_VLAN_HLEN;
+    }
+
+    if (eth_proto == rte_cpu_to_be_16(VR_ETH_PROTO_IP)) {
+        if (len < off + sizeof(struct vr_ip))
+            return;
+        iph = (struct vr_ip *)(data + off);
+        key->ck_ip4 = 1;
+        key->ck_sip = iph->ip_saddr;
+        key->ck_dip = iph->ip_daddr;
+        key->ck_proto = iph->ip_proto;
+        if (!vr_ip_transport_header_valid(iph))
+            return;
+        off += iph->ip_hl * 4;
+    } else if (eth_proto == rte_cpu_to_be_16(VR_ETH_PROTO_IP6)) {
+        if (len < off + sizeof(struct vr_ip6))
+            return;
+        ip6h = (struct vr_ip6 *)(data + off);
+        key->ck_proto = ip6h->ip6_nxt;
+        off += sizeof(struct vr_ip6);
+    } else {
+        return;
+    }
+
+    if (key->ck_proto != VR_IP_PROTO_TCP && key->ck_proto != VR_IP_PROTO_UDP &&
+            key->ck_proto != VR_IP_PROTO_SCTP)
+        return;
+
+    if (len < off + 2 * sizeof(uint16_t))
+        return;
+
+    ports = (uint16_t *)(data + off);
+    key->ck_sport = ports[0];
+    key->ck_dport = ports[1];
+
+    return;
+}
+
+static inline bool
+vr_dpdk_capture_match(struct vr_dpdk_capture_filter *filter,
+        struct vr_interface *vif, uint8_t *data, unsigned int len)
+{
+    struct vr_dpdk_capture_key key;
+
+    if (filter->cf_vif != VR_DPDK_CAPTURE_ANY &&
+            (!vif || vif->vif_idx != (unsigned int)filter->cf_vif))
+        return false;
+
+    if (filter->cf_vrf != VR_DPDK_CAPTURE_ANY &&
+            (!vif || vif->vif_vrf != filter->cf_vrf))
+        return false;
+
+    if (!filter->cf_match_tuple)
+        return true;
+
+    vr_dpdk_capture_key_get(data, len, &key);
+    if ((key.ck_words[0] & filter->cf_mask.ck_words[0]) ==
+                filter->cf_value.ck_words[0] &&
+            (key.ck_words[1] & filter->cf_mask.ck_words[1]) ==
+                filter->cf_value.ck_words[1])
+        return true;
+
+    /* the other direction of the same flow */
+    return (key.ck_words[0] & filter->cf_rmask.ck_words[0]) ==
+                filter->cf_rvalue.ck_words[0] &&
+            (key.ck_words[1] & filter->cf_rmask.ck_words[1]) ==
+                filter->cf_rvalue.ck_words[1];
+}
+
+/*
+ * vr_dpdk_capture_put - copy at most snaplen bytes of the packet of len
+ * bytes, whose first head_len bytes are at data in m and whose rest is in
+ * the segments after m, to the slot at head of ring. Returns 1, or 0 if
+ * the ring is full.
+ */
+static inline unsigned int
+vr_dpdk_capture_put(struct vr_dpdk_capture_ring *ring, uint32_t head,
+        unsigned int snaplen, struct vr_interface *vif, struct rte_mbuf *m,
+        uint8_t *data, unsigned int head_len, unsigned int len,
+        unsigned int dir, unsigned short reason, uint64_t tsc)
+{
+    unsigned int caplen, copy, copied;
+    struct vr_dpdk_capture_rec *rec;
+
+    if (head - __atomic_load_n(&ring->rg_tail, __ATOMIC_ACQUIRE) >=
+            VR_DPDK_CAPTURE_RING_SZ) {
+        ring->rg_lost++;
+        return 0;
+    }
+
+    rec = vr_dpdk_capture_rec(ring, head);
+    caplen = RTE_MIN(len, snaplen);
+    copy = RTE_MIN(caplen, head_len);
+    rte_memcpy(rec->cr_data, data, copy);
+    for (copied = copy, m = m->next; m && copied < caplen; m = m->next) {
+        copy = RTE_MIN(caplen - copied, m->data_len);
+        rte_memcpy(rec->cr_data + copied, rte_pktmbuf_mtod(m, uint8_t *),
+                copy);
+        copied += copy;
+    }
+
+    rec->cr_tsc = tsc;
+    rec->cr_len = len;
+    rec->cr_caplen = copied;
+    rec->cr_vif = vif ? vif->vif_idx : VR_DPDK_CAPTURE_NO_VIF;
+    rec->cr_dir = dir;
+    rec->cr_reason = reason;
+    ring->rg_captured++;
+
+    return 1;
+}
+
+static inline struct vr_dpdk_capture_ring *
+vr_dpdk_capture_ring_get(struct vr_dpdk_capture *cap)
+{
+    unsigned int lcore_id = rte_lcore_id();
+
+    /* threads that are not lcores have no ring */
+    if (lcore_id >= RTE_MAX_LCORE)
+        return NULL;
+
+    return cap->vdc_rings[lcore_id];
+}
+
+void
+__vr_dpdk_capture_burst(struct vr_dpdk_capture *cap, struct vr_interface *vif,
+        struct rte_mbuf **pkts, unsigned int nb_pkts, unsigned int dir)
+{
+    unsigned int i;
+    uint32_t head;
+    uint64_t tsc;
+    uint8_t *data;
+    struct rte_mbuf *m;
+    struct vr_dpdk_capture_ring *ring;
+    struct vr_dpdk_capture_filter *filter = &cap->vdc_filter;
+
+    if (!(filter->cf_dirs & dir))
+        return;
+
+    ring = vr_dpdk_capture_ring_get(cap);
+    if (!ring)
+        return;
+
+    head = ring->rg_head;
+    tsc = rte_rdtsc();
+    for (i = 0; i < nb_pkts; i++) {
+        m = pkts[i];
+        data = rte_pktmbuf_mtod(m, uint8_t *);
+        if (!vr_dpdk_capture_match(filter, vif, data, m->data_len))
+            continue;
+
+        head += vr_dpdk_capture_put(ring, head, filter->cf_snaplen, vif, m,
+                data, m->data_len, m->pkt_len, dir, 0, tsc);
+    }
+
+    /* the records of the whole burst are handed over at once */
+    if (head != ring->rg_head)
+        __atomic_store_n(&ring->rg_head, head, __ATOMIC_RELEASE);
+
+    return;
+}
+
+void
+__vr_dpdk_capture_drop(struct vr_dpdk_capture *cap, struct vr_packet *pkt,
+        unsigned short reason)
+{
+    uint32_t head;
+    uint8_t *data = pkt_data(pkt);
+    struct vr_dpdk_capture_ring *ring;
+    struct vr_dpdk_capture_filter *filter = &cap->vdc_filter;
+
+    if (!(filter->cf_dirs & VR_DPDK_CAPTURE_DROP))
+        return;
+
+    ring = vr_dpdk_capture_ring_get(cap);
+    if (!ring)
+        return;
+
+    if (!vr_dpdk_capture_match(filter, pkt->vp_if, data, pkt_head_len(pkt)))
+        return;
+
+    head = ring->rg_head;
+    if (vr_dpdk_capture_put(ring, head, filter->cf_snaplen, pkt->vp_if,
+                vr_dpdk_pkt_to_mbuf(pkt), data, pkt_head_len(pkt),
+                pkt_len(pkt), VR_DPDK_CAPTURE_DROP, reason, rte_rdtsc()))
+        __atomic_store_n(&ring->rg_head, head + 1, __ATOMIC_RELEASE);
+
+    return;
+}
+
+static unsigned int
+vr_pcapng_opt(uint8_t *buf, uint16_t code, const void *val, uint16_t len)
+{
+    *(uint16_t *)buf = code;
+    *(uint16_t *)(buf + 2) = len;
+    if (len)
+        memcpy(buf + 4, val, len);
+    memset(buf + 4 + len, 0, VR_PCAPNG_PAD(len) - len);
+
+    return 4 + VR_PCAPNG_PAD(len);
+}
+
+/* vr_pcapng_write - close the block of len bytes in buf and write it */
+static int
+vr_pcapng_write(struct vr_dpdk_capture *cap, uint8_t *buf, unsigned int len)
+{
+    len += vr_pcapng_opt(buf + len, VR_PCAPNG_OPT_END, NULL, 0);
+    len += sizeof(uint32_t);
+    *(uint32_t *)(buf + 4) = len;
+    *(uint32_t *)(buf + len - sizeof(uint32_t)) = len;
+
+    if (fwrite(buf, len, 1, cap->vdc_file) != 1)
+        return -errno;
+
+    return 0;
+}
+
+static int
+vr_pcapng_write_shb(struct vr_dpdk_capture *cap)
+{
+    uint8_t *buf = cap->vdc_block;
+
+    *(uint32_t *)buf = VR_PCAPNG_SHB;
+    *(uint32_t *)(buf + 8) = VR_PCAPNG_BYTE_ORDER;
+    *(uint16_t *)(buf + 12) = 1;
+    *(uint16_t *)(buf + 14) = 0;
+    /* section length not known */
+    *(uint64_t *)(buf + 16) = (uint64_t)-1;
+
+    return vr_pcapng_write(cap, buf, 24);
+}
+
+/*
+ * vr_pcapng_if_id - the pcapng interface id of vif, writing the interface
+ * description block of vif first if it is the first packet of vif.
+ */
+static int
+vr_pcapng_if_id(struct vr_dpdk_capture *cap, unsigned int vif_idx,
+        uint32_t *if_id)
+{
+    int ret, len;
+    char name[VR_INTERFACE_NAME_LEN];
+    uint8_t tsresol = 9, *buf = cap->vdc_block;
+    unsigned int slot;
+
+    /* packets dropped before they had an interface share the last id */
+    slot = vif_idx < vr_interfaces ? vif_idx : vr_interfaces;
+    if (cap->vdc_if_ids[slot]) {
+        *if_id = cap->vdc_if_ids[slot] - 1;
+        return 0;
+    }
+
+    if (slot == vr_interfaces)
+        len = snprintf(name, sizeof(name), "none");
+    else
+        len = snprintf(name, sizeof(name), "vif0/%u", vif_idx);
+
+    *(uint32_t *)buf = VR_PCAPNG_IDB;
+    *(uint16_t *)(buf + 8) = VR_PCAPNG_LINKTYPE_ETHERNET;
+    *(uint16_t *)(buf + 10) = 0;
+    *(uint32_t *)(buf + 12) = cap->vdc_filter.cf_snaplen;
+    len = 16 + vr_pcapng_opt(buf + 16, VR_PCAPNG_IF_NAME, name, len);
+    /* nanoseconds */
+    len += vr_pcapng_opt(buf + len, VR_PCAPNG_IF_TSRESOL, &tsresol, 1);
+
+    ret = vr_pcapng_write(cap, buf, len);
+    if (ret)
+        return ret;
+
+    cap->vdc_if_ids[slot] = ++cap->vdc_nb_ifs;
+    *if_id = cap->vdc_nb_ifs - 1;
+
+    return 0;
+}
+
+static int
+vr_pcapng_write_epb(struct vr_dpdk_capture *cap,
+        struct vr_dpdk_capture_rec *rec)
+{
+    int ret;
+    uint32_t if_id, flags;
+    uint64_t delta, ns;
+    unsigned int len;
+    const char *reason;
+    uint8_t *buf = cap->vdc_block;
+
+    ret = vr_pcapng_if_id(cap, rec->cr_vif, &if_id);
+    if (ret)
+        return ret;
+
+    /* the TSCs of the lcores may be a few cycles apart */
+    delta = rec->cr_tsc > cap->vdc_tsc ? rec->cr_tsc - cap->vdc_tsc : 0;
+    ns = cap->vdc_ns + (delta / cap->vdc_hz) * NSEC_PER_SEC +
+        (delta % cap->vdc_hz) * NSEC_PER_SEC / cap->vdc_hz;
+
+    *(uint32_t *)buf = VR_PCAPNG_EPB;
+    *(uint32_t *)(buf + 8) = if_id;
+    *(uint32_t *)(buf + 12) = ns >> 32;
+    *(uint32_t *)(buf + 16) = (uint32_t)ns;
+    *(uint32_t *)(buf + 20) = rec->cr_caplen;
+    *(uint32_t *)(buf + 24) = rec->cr_len;
+    memcpy(buf + 28, rec->cr_data, rec->cr_caplen);
+    memset(buf + 28 + rec->cr_caplen, 0,
+            VR_PCAPNG_PAD(rec->cr_caplen) - rec->cr_caplen);
+    len = 28 + VR_PCAPNG_PAD(rec->cr_caplen);
+
+    if (rec->cr_dir == VR_DPDK_CAPTURE_DROP) {
+        reason = rec->cr_reason < VP_DROP_MAX ?
+            vr_dpdk_capture_drop_rsn[rec->cr_reason] : "VP_DROP_UNKNOWN";
+        len += vr_pcapng_opt(buf + len, VR_PCAPNG_OPT_COMMENT, reason,
+                strlen(reason));
+    } else {
+        flags = rec->cr_dir == VR_DPDK_CAPTURE_IN ?
+            VR_PCAPNG_EPB_INBOUND : VR_PCAPNG_EPB_OUTBOUND;
+        len += vr_pcapng_opt(buf + len, VR_PCAPNG_EPB_FLAGS, &flags,
+                sizeof(flags));
+    }
+
+    return vr_pcapng_write(cap, buf, len);
+}
+
+/*
+ * vr_dpdk_capture_drain - write the records of ring to the file. Returns
+ * the number of records.
+ */
+static unsigned int
+vr_dpdk_capture_drain(struct vr_dpdk_capture *cap,
+        struct vr_dpdk_capture_ring *ring)
+{
+    unsigned int nb_recs;
+    uint32_t head, tail = ring->rg_tail;
+
+    head = __atomic_load_n(&ring->rg_head, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return 0;
+
+    for (; tail != head; tail++) {
+        if (!vr_pcapng_write_epb(cap, vr_dpdk_capture_rec(ring, tail)))
+            cap->vdc_written++;
+    }
+    nb_recs = tail - ring->rg_tail;
+    __atomic_store_n(&ring->rg_tail, tail, __ATOMIC_RELEASE);
+
+    return nb_recs;
+}
+
+static void
+vr_dpdk_capture_free(struct vr_dpdk_capture *cap)
+{
+    unsigned int i;
+
+    for (i = 0; i < RTE_MAX_LCORE; i++)
+        rte_free(cap->vdc_rings[i]);
+
+    if (cap->vdc_file)
+        fclose(cap->vdc_file);
+
+    rte_free(cap->vdc_if_ids);
+    rte_free(cap);
+
+    return;
+}
+
+static void *
+vr_dpdk_capture_thread(void *arg)
+{
+    bool stop;
+    unsigned int i, nb_recs;
+    struct vr_dpdk_capture *cap = (struct vr_dpdk_capture *)arg;
+
+    for (;;) {
+        /* once stopped, the rings are emptied one last time */
+        stop = cap->vdc_stop;
+        rte_smp_rmb();
+
+        nb_recs = 0;
+        for (i = 0; i < RTE_MAX_LCORE; i++) {
+            if (cap->vdc_rings[i])
+                nb_recs += vr_dpdk_capture_drain(cap, cap->vdc_rings[i]);
+        }
+
+        if (nb_recs)
+            continue;
+
+        if (stop)
+            break;
+
+        fflush(cap->vdc_file);
+        usleep(VR_DPDK_CAPTURE_IDLE_US);
+    }
+
+    RTE_LOG(INFO, VROUTER, "Capture to %s stopped, %" PRIu64 " packets\n",
+            cap->vdc_path, cap->vdc_written);
+    vr_dpdk_capture_free(cap);
+
+    return NULL;
+}
+
+/* vr_dpdk_capture_compile - the masks and values the 5-tuple is matched by */
+static void
+vr_dpdk_capture_compile(struct vr_dpdk_capture_filter *filter)
+{
+    struct vr_dpdk_capture_key *tuple = &filter->cf_tuple;
+    struct vr_dpdk_capture_key *mask = &filter->cf_mask;
+    struct vr_dpdk_capture_key *rmask = &filter->cf_rmask;
+
+    memset(mask, 0, sizeof(*mask));
+    mask->ck_sip = tuple->ck_sip ? 0xffffffff : 0;
+    mask->ck_dip = tuple->ck_dip ? 0xffffffff : 0;
+    mask->ck_sport = tuple->ck_sport ? 0xffff : 0;
+    mask->ck_dport = tuple->ck_dport ? 0xffff : 0;
+    mask->ck_proto = tuple->ck_proto ? 0xff : 0;
+    /* an address only matches IPv4 packets */
+    if (tuple->ck_sip || tuple->ck_dip) {
+        mask->ck_ip4 = 0xff;
+        tuple->ck_ip4 = 1;
+    }
+
+    filter->cf_value = *tuple;
+    filter->cf_value.ck_words[0] &= mask->ck_words[0];
+    filter->cf_value.ck_words[1] &= mask->ck_words[1];
+
+    *rmask = *mask;
+    rmask->ck_sip = mask->ck_dip;
+    rmask->ck_dip = mask->ck_sip;
+    rmask->ck_sport = mask->ck_dport;
+    rmask->ck_dport = mask->ck_sport;
+    filter->cf_rvalue = filter->cf_value;
+    filter->cf_rvalue.ck_sip = filter->cf_value.ck_dip;
+    filter->cf_rvalue.ck_dip = filter->cf_value.ck_sip;
+    filter->cf_rvalue.ck_sport = filter->cf_value.ck_dport;
+    filter->cf_rvalue.ck_dport = filter->cf_value.ck_sport;
+
+    filter->cf_match_tuple = mask->ck_words[0] || mask->ck_words[1];
+
+    return;
+}
+
+/*
+ * vr_dpdk_capture_open - create the capture file name in the socket
+ * directory. The vrouter runs as root, so name may not lead out of the
+ * directory, and neither an existing file nor a link is written to.
+ * Returns 0 or -errno.
+ */
+static int
+vr_dpdk_capture_open(struct vr_dpdk_capture *cap, const char *name)
+{
+    int fd, ret;
+
+    if (!name[0] || strchr(name, '/') || strstr(name, ".."))
+        return -EINVAL;
+
+    ret = snprintf(cap->vdc_path, sizeof(cap->vdc_path), "%s/%s",
+            vr_socket_dir, name);
+    if (ret >= (int)sizeof(cap->vdc_path))
+        return -ENAMETOOLONG;
+
+    fd = open(cap->vdc_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW |
+            O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+    if (fd < 0)
+        return -errno;
+
+    cap->vdc_file = fdopen(fd, "w");
+    if (!cap->vdc_file) {
+        ret = -errno;
+        close(fd);
+        unlink(cap->vdc_path);
+        return ret;
+    }
+
+    return 0;
+}
+
+/*
+ * vr_dpdk_capture_start - start capturing the packets filter matches to
+ * the new pcapng file name in the socket directory. Returns 0, or -EBUSY
+ * if a capture is running, or -errno.
+ */
+int
+vr_dpdk_capture_start(struct vr_dpdk_capture_filter *filter, const char *name)
+{
+    int ret;
+    unsigned int lcore_id;
+    size_t slot_size;
+    struct timespec now;
+    struct vr_dpdk_capture *cap;
+
+    if (vr_dpdk_capture)
+        return -EBUSY;
+
+    if (!filter->cf_dirs)
+        return -EINVAL;
+
+    if (!filter->cf_snaplen)
+        filter->cf_snaplen = VR_DPDK_CAPTURE_DEF_SNAPLEN;
+    else if (filter->cf_snaplen > VR_DPDK_CAPTURE_MAX_SNAPLEN)
+        filter->cf_snaplen = VR_DPDK_CAPTURE_MAX_SNAPLEN;
+
+    cap = rte_zmalloc("vr_dpdk_capture", sizeof(*cap), RTE_CACHE_LINE_SIZE);
+    if (!cap)
+        return -ENOMEM;
+
+    cap->vdc_filter = *filter;
+    vr_dpdk_capture_compile(&cap->vdc_filter);
+
+    cap->vdc_if_ids = rte_zmalloc("vr_dpdk_capture_ifs",
+            (vr_interfaces + 1) * sizeof(uint32_t), 0);
+    if (!cap->vdc_if_ids) {
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    /* each ring on the socket of its lcore */
+    slot_size = RTE_CACHE_LINE_ROUNDUP(sizeof(struct vr_dpdk_capture_rec) +
+            cap->vdc_filter.cf_snaplen);
+    RTE_LCORE_FOREACH(lcore_id) {
+        cap->vdc_rings[lcore_id] = rte_zmalloc_socket("vr_dpdk_capture_ring",
+                sizeof(struct vr_dpdk_capture_ring) +
+                VR_DPDK_CAPTURE_RING_SZ * slot_size, RTE_CACHE_LINE_SIZE,
+                rte_lcore_to_socket_id(lcore_id));
+        if (!cap->vdc_rings[lcore_id]) {
+            ret = -ENOMEM;
+            goto error;
+        }
+        cap->vdc_rings[lcore_id]->rg_slot_size = slot_size;
+    }
+
+    ret = vr_dpdk_capture_open(cap, name);
+    if (ret)
+        goto error;
+
+    ret = vr_pcapng_write_shb(cap);
+    if (ret)
+        goto error;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    cap->vdc_hz = rte_get_tsc_hz();
+    cap->vdc_tsc = rte_rdtsc();
+    cap->vdc_ns = (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+
+    ret = -pthread_create(&cap->vdc_thread, NULL, vr_dpdk_capture_thread,
+            cap);
+    if (ret)
+        goto error;
+    pthread_detach(cap->vdc_thread);
+
+    rte_smp_wmb();
+    vr_dpdk_capture = cap;
+
+    RTE_LOG(INFO, VROUTER, "Capturing to %s, snaplen %u\n", cap->vdc_path,
+            cap->vdc_filter.cf_snaplen);
+
+    return 0;
+
+error:
+    /* a file that got nothing is in the way of starting again */
+    if (cap->vdc_file)
+        unlink(cap->vdc_path);
+    vr_dpdk_capture_free(cap);
+    return ret;
+}
+
+static void
+vr_dpdk_capture_stop_cb(struct vrouter *router, void *data)
+{
+    struct vr_defer_data *defer = (struct vr_defer_data *)data;
+    struct vr_dpdk_capture *cap = (struct vr_dpdk_capture *)defer->vdd_data;
+
+    /* the thread drains the rings a last time and frees the capture */
+    cap->vdc_stop = true;
+
+    return;
+}
+
+/*
+ * vr_dpdk_capture_stop - stop the capture. The file is complete once the
+ * lcores are past the capture. Returns 0 or -ENOENT if no capture runs.
+ */
+int
+vr_dpdk_capture_stop(void)
+{
+    struct vr_defer_data *defer;
+    struct vr_dpdk_capture *cap = vr_dpdk_capture;
+
+    if (!cap)
+        return -ENOENT;
+
+    defer = vr_get_defer_data(sizeof(*defer));
+    if (!defer)
+        return -ENOMEM;
+
+    vr_dpdk_capture = NULL;
+    defer->vdd_data = cap;
+    vr_defer(vrouter_get(0), vr_dpdk_capture_stop_cb, (void *)defer);
+
+    return 0;
+}
+
+/*
+ * vr_dpdk_capture_stats - the file and the filter of the running capture,
+ * with the packets captured, lost to full rings and written so far.
+ * Returns 0 or -ENOENT if no capture runs.
+ */
+int
+vr_dpdk_capture_stats(char *path, unsigned int path_len,
+        struct vr_dpdk_capture_filter *filter, uint64_t *captured,
+        uint64_t *lost, uint64_t *written)
+{
+    unsigned int i;
+    struct vr_dpdk_capture *cap = vr_dpdk_capture;
+
+    if (!cap)
+        return -ENOENT;
+
+    snprintf(path, path_len, "%s", cap->vdc_path);
+    *filter = cap->vdc_filter;
+    *captured = *lost = 0;
+    for (i = 0; i < RTE_MAX_LCORE; i++) {
+        if (!cap->vdc_rings[i])
+            continue;
+        *captured += cap->vdc_rings[i]->rg_captured;
+        *lost += cap->vdc_rings[i]->rg_lost;
+    }
+    *written = cap->vdc_written;
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * vr_dpdk_capture.h -- filtered packet capture to a pcapng file
+ *
+ * Copyright (c) 2014, Juniper Networks Private Inc.,
+ * All rights reserved
+ */
+#ifndef __VR_DPDK_CAPTURE_H__
+#define __VR_DPDK_CAPTURE_H__
+
+#include <rte_mbuf.h>
+
+/*
+ * While a capture runs, the lcores match each packet they receive from,
+ * send to or drop on an interface against the capture filter, and copy at
+ * most snaplen bytes of the packets that match to a ring of their own,
+ * a burst at a time. A capture thread empties the rings into a pcapng
+ * file, with the vif, the direction and the drop reason of each packet.
+ * Packets that do not match are neither copied nor cloned, so a narrow
+ * capture costs the lcores a few compares per packet.
+ *
+ * The filter is matched where the lcores meet the packet, before any
+ * lookup: the VRF is that of the interface the packet is received on, sent
+ * to or dropped on, and the 5-tuple is read from the outermost IP header,
+ * that of the tunnel for overlay packets on the fabric. The file is
+ * created in the socket directory, and never overwrites one.
+ */
+#define VR_DPDK_CAPTURE_IN              0x1
+#define VR_DPDK_CAPTURE_OUT             0x2
+#define VR_DPDK_CAPTURE_DROP            0x4
+#define VR_DPDK_CAPTURE_ALL             0x7
+
+#define VR_DPDK_CAPTURE_ANY             (-1)
+#define VR_DPDK_CAPTURE_DEF_SNAPLEN     128
+#define VR_DPDK_CAPTURE_MAX_SNAPLEN     2048
+/* packets each lcore may have copied and the thread not written yet */
+#define VR_DPDK_CAPTURE_RING_SZ         1024
+
+/*
+ * The part of the packet the filter looks at. The 5-tuple words are
+ * matched under a mask, in both directions, so that a single compare per
+ * word and direction tells whether a packet matches. Only IPv4 addresses
+ * are matched: an IPv6 packet matches a filter that names no address.
+ */
+struct vr_dpdk_capture_key {
+    union {
+        struct {
+            uint32_t ck_sip;
+            uint32_t ck_dip;
+            uint16_t ck_sport;
+            uint16_t ck_dport;
+            uint8_t ck_proto;
+            uint8_t ck_ip4;
+            uint16_t ck_pad;
+        };
+        uint64_t ck_words[2];
+    };
+};
+
+struct vr_dpdk_capture_filter {
+    /* VR_DPDK_CAPTURE_* directions to capture */
+    unsigned int cf_dirs;
+    /* or VR_DPDK_CAPTURE_ANY */
+    int cf_vif;
+    int cf_vrf;
+    unsigned int cf_snaplen;
+    /* the 5-tuple, as given */
+    struct vr_dpdk_capture_key cf_tuple;
+    /* the 5-tuple, compiled */
+    bool cf_match_tuple;
+    struct vr_dpdk_capture_key cf_mask;
+    struct vr_dpdk_capture_key cf_value;
+    /* the same, source and destination swapped */
+    struct vr_dpdk_capture_key cf_rmask;
+    struct vr_dpdk_capture_key cf_rvalue;
+};
+
+struct vr_dpdk_capture;
+extern struct vr_dpdk_capture *vr_dpdk_capture;
+
+void __vr_dpdk_capture_burst(struct vr_dpdk_capture *, struct vr_interface *,
+        struct rte_mbuf **, unsigned int, unsigned int);
+void __vr_dpdk_capture_drop(struct vr_dpdk_capture *, struct vr_packet *,
+        unsigned short);
+int vr_dpdk_capture_start(struct vr_dpdk_capture_filter *, const char *);
+int vr_dpdk_capture_stop(void);
+int vr_dpdk_capture_stats(char *, unsigned int,
+        struct vr_dpdk_capture_filter *, uint64_t *, uint64_t *, uint64_t *);
+
+/*
+ * vr_dpdk_capture_burst - capture the nb_pkts packets at pkts, whose data
+ * starts at the mbuf data offset, received from or sent to vif.
+ */
+static inline void
+vr_dpdk_capture_burst(struct vr_interface *vif, struct rte_mbuf **pkts,
+        unsigned int nb_pkts, unsigned int dir)
+{
+    struct vr_dpdk_capture *cap = vr_dpdk_capture;
+
+    if (likely(!cap))
+        return;
+
+    __vr_dpdk_capture_burst(cap, vif, pkts, nb_pkts, dir);
+    return;
+}
+
+/* vr_dpdk_capture_drop - capture pkt, about to be dropped for reason */
+static inline void
+vr_dpdk_capture_drop(struct vr_packet *pkt, unsigned short reason)
+{
+    struct vr_dpdk_capture *cap = vr_dpdk_capture;
+
+    if (likely(!cap))
+        return;
+
+    __vr_dpdk_capture_drop(cap, pkt, reason);
+    return;
+}
+
+#endif /* __VR_DPDK_CAPTURE_H__ */
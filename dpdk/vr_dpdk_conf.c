@@ -13,10 +13,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <arpa/inet.h>
 #include <rte_log.h>
 #include <rte_eal.h>
 
 #include "vr_dpdk.h"
+#include "vr_dpdk_capture.h"
 #include "vrouter.h"
 
 struct rte_log_dynamic_type {
@@ -170,3 +172,172 @@ dpdk_conf_log_list(VR_INFO_ARGS)
     VI_PRINTF("\n");
     return 0;
 }
+
+#define VR_DPDK_CAPTURE_CMD_LEN 512
+
+static int
+dpdk_conf_capture_dirs(char *val, unsigned int *dirs)
+{
+    char *dir, *saveptr;
+
+    *dirs = 0;
+    for (dir = strtok_r(val, ",", &saveptr); dir;
+            dir = strtok_r(NULL, ",", &saveptr)) {
+        if (strcmp(dir, "in") == 0)
+            *dirs |= VR_DPDK_CAPTURE_IN;
+        else if (strcmp(dir, "out") == 0)
+            *dirs |= VR_DPDK_CAPTURE_OUT;
+        else if (strcmp(dir, "drop") == 0)
+            *dirs |= VR_DPDK_CAPTURE_DROP;
+        else if (strcmp(dir, "all") == 0)
+            *dirs |= VR_DPDK_CAPTURE_ALL;
+        else
+            return -EINVAL;
+    }
+
+    return *dirs ? 0 : -EINVAL;
+}
+
+/*
+ * dpdk_conf_capture_parse - the file and the filter of the capture the
+ * key=value arguments at args start. Returns 0 or -EINVAL.
+ */
+static int
+dpdk_conf_capture_parse(char *args, struct vr_dpdk_capture_filter *filter,
+        char **path)
+{
+    char *arg, *val, *saveptr;
+    struct vr_dpdk_capture_key *tuple = &filter->cf_tuple;
+
+    memset(filter, 0, sizeof(*filter));
+    filter->cf_dirs = VR_DPDK_CAPTURE_ALL;
+    filter->cf_vif = VR_DPDK_CAPTURE_ANY;
+    filter->cf_vrf = VR_DPDK_CAPTURE_ANY;
+    *path = NULL;
+
+    for (arg = strtok_r(args, " ", &saveptr); arg;
+            arg = strtok_r(NULL, " ", &saveptr)) {
+        val = strchr(arg, '=');
+        if (!val || !val[1])
+            return -EINVAL;
+        *val++ = '\0';
+
+        if (strcmp(arg, "file") == 0) {
+            *path = val;
+        } else if (strcmp(arg, "vif") == 0) {
+            filter->cf_vif = atoi(val);
+        } else if (strcmp(arg, "vrf") == 0) {
+            filter->cf_vrf = atoi(val);
+        } else if (strcmp(arg, "snaplen") == 0) {
+            filter->cf_snaplen = atoi(val);
+        } else if (strcmp(arg, "proto") == 0) {
+            if (strcmp(val, "tcp") == 0)
+                tuple->ck_proto = VR_IP_PROTO_TCP;
+            else if (strcmp(val, "udp") == 0)
+                tuple->ck_proto = VR_IP_PROTO_UDP;
+            else if (strcmp(val, "icmp") == 0)
+                tuple->ck_proto = VR_IP_PROTO_ICMP;
+            else
+                tuple->ck_proto = atoi(val);
+        } else if (strcmp(arg, "src") == 0) {
+            if (inet_pton(AF_INET, val, &tuple->ck_sip) != 1)
+                return -EINVAL;
+        } else if (strcmp(arg, "dst") == 0) {
+            if (inet_pton(AF_INET, val, &tuple->ck_dip) != 1)
+                return -EINVAL;
+        } else if (strcmp(arg, "sport") == 0) {
+            tuple->ck_sport = htons(atoi(val));
+        } else if (strcmp(arg, "dport") == 0) {
+            tuple->ck_dport = htons(atoi(val));
+        } else if (strcmp(arg, "dir") == 0) {
+            if (dpdk_conf_capture_dirs(val, &filter->cf_dirs))
+                return -EINVAL;
+        } else {
+            return -EINVAL;
+        }
+    }
+
+    return *path ? 0 : -EINVAL;
+}
+
+int
+dpdk_conf_capture(VR_INFO_ARGS)
+{
+    VR_INFO_BUF_INIT();
+    int ret;
+    char *cmd, *args, *path, *saveptr;
+    char buf[VR_DPDK_CAPTURE_CMD_LEN];
+    char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+    uint64_t captured, lost, written;
+    struct vr_dpdk_capture_filter filter;
+
+    if (!msg_req->inbuf || !msg_req->inbuf_len ||
+            msg_req->inbuf_len >= sizeof(buf)) {
+        VI_PRINTF("Invalid capture command\n\n");
+        return 0;
+    }
+
+    /* the command is not NUL terminated */
+    memcpy(buf, msg_req->inbuf, msg_req->inbuf_len);
+    buf[msg_req->inbuf_len] = '\0';
+
+    cmd = strtok_r(buf, " ", &saveptr);
+    args = strtok_r(NULL, "", &saveptr);
+    if (!cmd) {
+        VI_PRINTF("Invalid capture command\n\n");
+        return 0;
+    }
+
+    if (strcmp(cmd, "start") == 0) {
+        if (!args || dpdk_conf_capture_parse(args, &filter, &path)) {
+            VI_PRINTF("Invalid capture arguments\n\n");
+            return 0;
+        }
+
+        ret = vr_dpdk_capture_start(&filter, path);
+        if (ret == -EBUSY) {
+            VI_PRINTF("A capture is already running\n\n");
+        } else if (ret) {
+            VI_PRINTF("Starting capture to %s failed: %s\n\n", path,
+                    strerror(-ret));
+        } else {
+            VI_PRINTF("Capturing to %s\n\n", path);
+        }
+    } else if (strcmp(cmd, "stop") == 0) {
+        ret = vr_dpdk_capture_stop();
+        if (ret == -ENOENT) {
+            VI_PRINTF("No capture is running\n\n");
+        } else if (ret) {
+            VI_PRINTF("Stopping capture failed: %s\n\n", strerror(-ret));
+        } else {
+            VI_PRINTF("Capture stopped\n\n");
+        }
+    } else if (strcmp(cmd, "show") == 0) {
+        ret = vr_dpdk_capture_stats(buf, sizeof(buf), &filter, &captured,
+                &lost, &written);
+        if (ret) {
+            VI_PRINTF("No capture is running\n\n");
+            return 0;
+        }
+
+        inet_ntop(AF_INET, &filter.cf_tuple.ck_sip, src, sizeof(src));
+        inet_ntop(AF_INET, &filter.cf_tuple.ck_dip, dst, sizeof(dst));
+        VI_PRINTF("Capturing to %s\n", buf);
+        VI_PRINTF("\tdir %s%s%s vif %d vrf %d snaplen %u\n",
+                filter.cf_dirs & VR_DPDK_CAPTURE_IN ? "in " : "",
+                filter.cf_dirs & VR_DPDK_CAPTURE_OUT ? "out " : "",
+                filter.cf_dirs & VR_DPDK_CAPTURE_DROP ? "drop" : "",
+                filter.cf_vif, filter.cf_vrf, filter.cf_snaplen);
+        VI_PRINTF("\tproto %u src %s:%u dst %s:%u\n",
+                filter.cf_tuple.ck_proto, src,
+                ntohs(filter.cf_tuple.ck_sport), dst,
+                ntohs(filter.cf_tuple.ck_dport));
+        VI_PRINTF("\tcaptured %lu lost %lu written %lu\n\n",
+                (unsigned long)captured, (unsigned long)lost,
+                (unsigned long)written);
+    } else {
+        VI_PRINTF("Invalid capture command %s\n\n", cmd);
+    }
+
+    return 0;
+}
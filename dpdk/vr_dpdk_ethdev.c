@@ -331,6 +331,15 @@ vr_dpdk_ethdev_tx_queue_init(unsigned lcore_id, struct vr_interface *vif,
     tx_queue_params->qp_ethdev.queue_id = tx_queue_id;
     tx_queue_params->qp_ethdev.port_id = port_id;
 
+    /* queue the fabric traffic through the egress scheduler */
+    if (vr_dpdk_qos_sched_rate && vif_is_fabric(vif)) {
+        if (vr_dpdk_qos_sched_attach(lcore_id, tx_queue, tx_queue_id) < 0) {
+            RTE_LOG(ERR, VROUTER, "    error attaching egress scheduler to "
+                    "eth device %" PRIu8 " TX queue %" PRIu16 "\n",
+                    port_id, tx_queue_id);
+        }
+    }
+
     /* for the queue 0 add queue params to the list of bonds to TX */
     if (ethdev->ethdev_nb_slaves > 0 && tx_queue_id == 0) {
         /* make sure queue params have been stored */
@@ -445,6 +454,8 @@ dpdk_ethdev_queues_setup(struct vr_dpdk_ethdev *ethdev,
 {
     int ret, i;
     uint8_t port_id = ethdev->ethdev_port_id;
+    /* the NUMA node of the NIC or SOCKET_ID_ANY if unknown */
+    int socket_id = rte_eth_dev_socket_id(port_id);
     struct rte_mempool *mempool;
 
     /* configure RX queues */
@@ -454,7 +465,8 @@ dpdk_ethdev_queues_setup(struct vr_dpdk_ethdev *ethdev,
 
     for (i = 0; i < VR_DPDK_MAX_NB_RX_QUEUES; i++) {
         if (i < ethdev->ethdev_nb_rss_queues) {
-            mempool = vr_dpdk.rss_mempool;
+            /* receive to the mbufs local to the NIC */
+            mempool = vr_dpdk_rss_mempool_get(socket_id);
             ethdev->ethdev_queue_states[i] = VR_DPDK_QUEUE_RSS_STATE;
         } else if (i < ethdev->ethdev_nb_rx_queues) {
             if (vr_dpdk.nb_free_mempools == 0) {
@@ -471,10 +483,10 @@ dpdk_ethdev_queues_setup(struct vr_dpdk_ethdev *ethdev,
         }
 
         ret = rte_eth_rx_queue_setup(port_id, i, vr_rxd_sz,
-            SOCKET_ID_ANY, rx_conf ? rx_conf : &default_rx_queue_conf, mempool);
+            socket_id, rx_conf ? rx_conf : &default_rx_queue_conf, mempool);
         if (ret < 0) {
             /* return mempool to the list */
-            if (mempool != vr_dpdk.rss_mempool)
+            if (i >= ethdev->ethdev_nb_rss_queues)
                 vr_dpdk.nb_free_mempools++;
             RTE_LOG(ERR, VROUTER, "    error setting up eth device %" PRIu8 " RX queue %d"
                     ": %s (%d)\n", port_id, i, rte_strerror(-ret), -ret);
@@ -493,7 +505,7 @@ dpdk_ethdev_queues_setup(struct vr_dpdk_ethdev *ethdev,
     /* configure TX queues */
     for (i = 0; i < ethdev->ethdev_nb_tx_queues; i++) {
         ret = rte_eth_tx_queue_setup(port_id, i, vr_txd_sz,
-            SOCKET_ID_ANY, tx_conf ? tx_conf : &default_tx_queue_conf);
+            socket_id, tx_conf ? tx_conf : &default_tx_queue_conf);
         if (ret < 0) {
             RTE_LOG(ERR, VROUTER, "    error setting up eth device %" PRIu8 " TX queue %d"
                     ": %s (%d)\n", port_id, i, rte_strerror(-ret), -ret);
@@ -6,26 +6,55 @@
 #include <vr_fragment.h>
 #include <vr_os.h>
 #include <vr_packet.h>
+#include "vr_hash.h"
 
 /**
  * @name Private variables
  * @{
  */
 
-/* Hash table buckets used by the assembler */
-struct fragment_bucket {
-    struct vr_fragment *frag_list;
+/*
+ * Assembler entry: a datagram whose non-head fragments wait for the head.
+ * Entries never move, so they can be linked in the timer wheel while the
+ * open addressed index that points to them is reshuffled on deletes.
+ */
+struct fragment_entry {
+    struct vr_fragment fe_frag;
+    /* timer wheel linkage, fe_wpprev is NULL for a free entry */
+    struct fragment_entry *fe_wnext;
+    struct fragment_entry **fe_wpprev;
+    uint64_t fe_deadline;
+    uint32_t fe_hash;
 };
-static struct fragment_bucket **assembler_table;
 
-/* Per CPU queues used to enqueue packets for the assembler */
-struct per_cpu_fragment_queue {
-    struct vr_fragment_queue queue;
+/* Slot of the open addressed index, fi_entry is the entry index + 1 */
+struct fragment_index {
+    uint32_t fi_hash;
+    uint32_t fi_entry;
 };
-static struct per_cpu_fragment_queue *per_cpu_queues;
 
-static int assembler_scan_index;
-static int assembler_scan_thresh = 1024;
+/*
+ * Per forwarding lcore assembler. Everything in here is only touched by
+ * the owning lcore: the enqueue, the assembly and the timeouts all run
+ * there, so neither the pool nor the ring nor the table needs a lock.
+ */
+struct fragment_assembler {
+    struct vr_fragment_queue fa_queue;
+    struct vr_fragment_pool *fa_pool;
+    struct fragment_index *fa_index;
+    struct fragment_entry *fa_entries;
+    /* free entries, linked through fe_wnext */
+    struct fragment_entry *fa_free;
+    struct fragment_entry *fa_wheel[VR_DPDK_FRAG_WHEEL_SLOTS];
+    /* next wheel tick to expire */
+    uint64_t fa_tick;
+    /* entries in use, i.e. datagrams with fragments waiting for the head */
+    unsigned int fa_nb_entries;
+};
+static struct fragment_assembler *assemblers;
+
+/* Length of a wheel tick in timer cycles */
+static uint64_t assembler_tick_cycles;
 
 /** @} */
 
@@ -33,102 +62,216 @@ static int assembler_scan_thresh = 1024;
  * @name Private functions
  * @{
  */
+static inline uint64_t
+dpdk_assembler_now(void)
+{
+    return rte_get_timer_cycles() / assembler_tick_cycles;
+}
+
+static inline struct fragment_assembler *
+dpdk_assembler_get(void)
+{
+    unsigned int cpu;
+
+    cpu = vr_get_cpu() - VR_DPDK_FWD_LCORE_ID;
+    assert(cpu >= 0 && cpu < (vr_num_cpus - VR_DPDK_FWD_LCORE_ID));
+
+    return &assemblers[cpu];
+}
+
+static struct fragment_entry *
+dpdk_assembler_lookup(struct fragment_assembler *fa,
+        struct vr_fragment_key *key, uint32_t hash)
+{
+    unsigned int i;
+    struct fragment_index *fi;
+    struct fragment_entry *fe;
+
+    /* the index is never more than half full, so the probe terminates */
+    for (i = hash & (VR_DPDK_FRAG_INDEX_SIZE - 1); ;
+            i = (i + 1) & (VR_DPDK_FRAG_INDEX_SIZE - 1)) {
+        fi = &fa->fa_index[i];
+        if (!fi->fi_entry)
+            return NULL;
+
+        if (fi->fi_hash != hash)
+            continue;
+
+        fe = &fa->fa_entries[fi->fi_entry - 1];
+        if (!memcmp(&fe->fe_frag.f_key, key, sizeof(*key)))
+            return fe;
+    }
+
+    return NULL;
+}
+
 static void
-dpdk_fragment_assemble_queue(void *arg)
+dpdk_assembler_wheel_unlink(struct fragment_entry *fe)
 {
-    struct per_cpu_fragment_queue *queue = (struct per_cpu_fragment_queue *)arg;
-    struct vr_fragment_queue *fq = &queue->queue;
-    vr_fragment_assemble_queue(fq);
+    if (!fe->fe_wpprev)
+        return;
+
+    *fe->fe_wpprev = fe->fe_wnext;
+    if (fe->fe_wnext)
+        fe->fe_wnext->fe_wpprev = fe->fe_wpprev;
+
+    fe->fe_wnext = NULL;
+    fe->fe_wpprev = NULL;
+    return;
 }
 
+/* (Re)arm the timeout of an entry. O(1), as the wheel is doubly linked */
 static void
-dpdk_assembler_table_exit(void)
+dpdk_assembler_wheel_arm(struct fragment_assembler *fa,
+        struct fragment_entry *fe, uint64_t now)
 {
-    int i;
+    struct fragment_entry **head;
 
-    vr_assembler_table_scan_exit();
+    dpdk_assembler_wheel_unlink(fe);
 
-    if (assembler_table) {
-        for (i = 0; i < vr_dpdk.nb_fwd_lcores; ++i) {
-            if (assembler_table[i] != NULL) {
-                vr_free(assembler_table[i], VR_ASSEMBLER_TABLE_OBJECT);
-                assembler_table[i] = NULL;
-            }
-        }
+    fe->fe_deadline = now + VR_DPDK_FRAG_WHEEL_TIMEOUT_TICKS;
+    head = &fa->fa_wheel[fe->fe_deadline & (VR_DPDK_FRAG_WHEEL_SLOTS - 1)];
+    fe->fe_wnext = *head;
+    if (*head)
+        (*head)->fe_wpprev = &fe->fe_wnext;
+    *head = fe;
+    fe->fe_wpprev = head;
 
-        vr_free(assembler_table, VR_ASSEMBLER_TABLE_OBJECT);
-        assembler_table = NULL;
+    return;
+}
+
+static struct fragment_entry *
+dpdk_assembler_entry_add(struct fragment_assembler *fa,
+        struct vr_fragment_key *key, uint32_t hash)
+{
+    unsigned int i;
+    struct fragment_entry *fe;
+
+    fe = fa->fa_free;
+    if (!fe)
+        return NULL;
+    fa->fa_free = fe->fe_wnext;
+    fe->fe_wnext = NULL;
+
+    memset(&fe->fe_frag, 0, sizeof(fe->fe_frag));
+    memcpy(&fe->fe_frag.f_key, key, sizeof(*key));
+    /* the head fragment has not arrived, so no valid port info yet */
+    fe->fe_frag.f_port_info_valid = false;
+    fe->fe_hash = hash;
+
+    for (i = hash & (VR_DPDK_FRAG_INDEX_SIZE - 1); fa->fa_index[i].fi_entry;
+            i = (i + 1) & (VR_DPDK_FRAG_INDEX_SIZE - 1))
+        ;
+
+    fa->fa_index[i].fi_hash = hash;
+    fa->fa_index[i].fi_entry = (fe - fa->fa_entries) + 1;
+    fa->fa_nb_entries++;
+
+    return fe;
+}
+
+/*
+ * Remove an entry from the index with backward shift deletion, which keeps
+ * the probe sequences intact without leaving tombstones behind, and return
+ * it to the free list.
+ */
+static void
+dpdk_assembler_entry_del(struct fragment_assembler *fa,
+        struct fragment_entry *fe)
+{
+    unsigned int i, j, home, id = (fe - fa->fa_entries) + 1;
+    const unsigned int mask = VR_DPDK_FRAG_INDEX_SIZE - 1;
+
+    dpdk_assembler_wheel_unlink(fe);
+    vr_fragment_drop_queued(&fe->fe_frag);
+
+    for (i = fe->fe_hash & mask; fa->fa_index[i].fi_entry != id;
+            i = (i + 1) & mask)
+        ;
+
+    for (j = (i + 1) & mask; fa->fa_index[j].fi_entry; j = (j + 1) & mask) {
+        home = fa->fa_index[j].fi_hash & mask;
+        /* the slot at j can fill the hole unless its home is in (i, j] */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            fa->fa_index[i] = fa->fa_index[j];
+            i = j;
+        }
     }
+    fa->fa_index[i].fi_entry = 0;
+
+    fe->fe_wnext = fa->fa_free;
+    fa->fa_free = fe;
+    fa->fa_nb_entries--;
 
     return;
 }
 
-static int
-dpdk_assembler_table_init(void)
+static void
+dpdk_fragment_assemble_queue(void *arg)
 {
-    unsigned int size;
-    int i;
+    struct vr_fragment_queue *fq = (struct vr_fragment_queue *)arg;
 
-    /* Allocate array of pointers to the assembler tables for each fwd lcore */
-    size = sizeof(struct fragment_bucket *) * vr_dpdk.nb_fwd_lcores;
-    assembler_table = vr_zalloc(size, VR_ASSEMBLER_TABLE_OBJECT);
-    if (!assembler_table) {
-        RTE_LOG(ERR, VROUTER, "%s:%d Allocation for %u failed\n",
-                __FUNCTION__, __LINE__, size);
-        return -ENOMEM;
-    }
+    vr_fragment_assemble_queue(fq);
+}
 
-    /* Now allocate the assembler tables for each fwd lcore */
-    size = sizeof(struct fragment_bucket) * VR_ASSEMBLER_BUCKET_COUNT;
-    for (i = 0; i < vr_dpdk.nb_fwd_lcores; ++i) {
-        assembler_table[i] = vr_zalloc(size, VR_ASSEMBLER_TABLE_OBJECT);
-        if (!assembler_table[i]) {
-            RTE_LOG(ERR, VROUTER, "%s:%d Allocation for %u failed\n",
-                    __FUNCTION__, __LINE__, size);
-            return -ENOMEM;
+static void
+dpdk_fragment_assembler_free(struct fragment_assembler *fa)
+{
+    unsigned int i;
+
+    vr_fragment_queue_free(&fa->fa_queue);
+
+    if (fa->fa_entries) {
+        for (i = 0; i < VR_DPDK_FRAG_MAX_ENTRIES; i++) {
+            if (fa->fa_entries[i].fe_wpprev)
+                dpdk_assembler_entry_del(fa, &fa->fa_entries[i]);
         }
+        vr_free(fa->fa_entries, VR_ASSEMBLER_TABLE_OBJECT);
+        fa->fa_entries = NULL;
     }
 
-    /* Intentionally the vr_assembler_table_scan_init() is not called here as
-     * it would set up timers on the timer lcore. For the timers the forwarding
-     * lcores are used, therefore allowing for complete lock elimination. */
+    if (fa->fa_index) {
+        vr_free(fa->fa_index, VR_ASSEMBLER_TABLE_OBJECT);
+        fa->fa_index = NULL;
+    }
 
-    return 0;
+    vr_fragment_pool_free(fa->fa_pool);
+    fa->fa_pool = NULL;
+
+    return;
 }
 
 static int
-dpdk_fragment_queue_init(void)
+dpdk_fragment_assembler_alloc(struct fragment_assembler *fa)
 {
-    unsigned int size;
+    unsigned int i, size;
 
-    size = sizeof(struct per_cpu_fragment_queue) * vr_dpdk.nb_fwd_lcores;
-    per_cpu_queues = vr_zalloc(size, VR_FRAGMENT_QUEUE_OBJECT);
+    fa->fa_pool = vr_fragment_pool_alloc(VR_DPDK_FRAG_POOL_SIZE);
+    if (!fa->fa_pool)
+        return -ENOMEM;
 
-    if (!per_cpu_queues) {
-        RTE_LOG(ERR, VROUTER, "%s: Error allocating fragmentation queues\n",
-                __func__);
+    if (vr_fragment_queue_ring_init(&fa->fa_queue, fa->fa_pool,
+                VR_MAX_FRAGMENTS_PER_CPU_QUEUE))
         return -ENOMEM;
-    }
 
-    return 0;
-}
+    size = sizeof(struct fragment_index) * VR_DPDK_FRAG_INDEX_SIZE;
+    fa->fa_index = vr_zalloc(size, VR_ASSEMBLER_TABLE_OBJECT);
+    if (!fa->fa_index)
+        return -ENOMEM;
 
-static void
-dpdk_fragment_queue_exit(void)
-{
-    int i;
+    size = sizeof(struct fragment_entry) * VR_DPDK_FRAG_MAX_ENTRIES;
+    fa->fa_entries = vr_zalloc(size, VR_ASSEMBLER_TABLE_OBJECT);
+    if (!fa->fa_entries)
+        return -ENOMEM;
 
-    if (!per_cpu_queues) {
-        return;
+    for (i = VR_DPDK_FRAG_MAX_ENTRIES; i > 0; i--) {
+        fa->fa_entries[i - 1].fe_wnext = fa->fa_free;
+        fa->fa_free = &fa->fa_entries[i - 1];
     }
 
-    for (i = 0; i < vr_dpdk.nb_fwd_lcores; ++i) {
-        if (per_cpu_queues[i].queue.vfq_tail != NULL)
-            vr_fragment_queue_free(&per_cpu_queues[i].queue);
-    }
+    fa->fa_tick = dpdk_assembler_now();
 
-    vr_free(per_cpu_queues, VR_FRAGMENT_QUEUE_OBJECT);
-    per_cpu_queues = NULL;
+    return 0;
 }
 
 /** @} */
@@ -140,7 +283,7 @@ dpdk_fragment_queue_exit(void)
 
 /**
  * Enqueue a packet to per cpu queue and schedule work to
- * enqueue/process it to assembler_table[]
+ * enqueue/process it to the assembler table
  *
  * Executed only from the forwarding lcores.
  */
@@ -151,6 +294,7 @@ dpdk_fragment_assembler_enqueue(struct vrouter *router, struct vr_packet *pkt,
     int ret;
     unsigned int cpu;
     struct vr_dpdk_lcore *lcore;
+    struct vr_fragment_queue *fq;
 
     cpu = vr_get_cpu();
     if (cpu >= vr_num_cpus || cpu < VR_DPDK_FWD_LCORE_ID) {
@@ -163,70 +307,131 @@ dpdk_fragment_assembler_enqueue(struct vrouter *router, struct vr_packet *pkt,
     }
 
     /* Enqueue the packet to per CPU queue */
-    ret = vr_fragment_enqueue(router,
-            &per_cpu_queues[cpu - VR_DPDK_FWD_LCORE_ID].queue, pkt, fmd);
+    fq = &assemblers[cpu - VR_DPDK_FWD_LCORE_ID].fa_queue;
+    ret = vr_fragment_enqueue(router, fq, pkt, fmd);
 
     if (!ret) {
         lcore = vr_dpdk.lcores[cpu];
         /* Schedule work to enqueue/process by the assembler */
         vr_dpdk_lcore_schedule_assembler_work(lcore,
-                dpdk_fragment_assemble_queue,
-                &per_cpu_queues[cpu - VR_DPDK_FWD_LCORE_ID].queue);
+                dpdk_fragment_assemble_queue, fq);
     }
 
     return 0;
 }
 
+/**
+ * Hand the head of a fragmented datagram over to the assembler without
+ * cloning it. The ports are already in the fragment metadata table, so
+ * fragments still in the per cpu queue will bypass the assembler. Only if
+ * fragments of the datagram are parked in this lcore's table, a head
+ * notification carrying just the key is queued to flush them, so in order
+ * fragments cost a lookup at most.
+ *
+ * Executed only from the forwarding lcores.
+ */
+int
+dpdk_fragment_assembler_enqueue_head(struct vrouter *router,
+        struct vr_packet *pkt, struct vr_forwarding_md *fmd)
+{
+    int ret;
+    unsigned int cpu;
+    struct fragment_assembler *fa;
+    struct vr_fragment_key key;
+
+    cpu = vr_get_cpu();
+    if (cpu >= vr_num_cpus || cpu < VR_DPDK_FWD_LCORE_ID)
+        return -EINVAL;
+
+    fa = &assemblers[cpu - VR_DPDK_FWD_LCORE_ID];
+    if (!fa->fa_nb_entries)
+        return 0;
+
+    vr_fragment_head_key(pkt, fmd, &key);
+    if (!dpdk_assembler_lookup(fa, &key, vr_hash(&key, sizeof(key), 0)))
+        return 0;
+
+    ret = vr_fragment_enqueue_head(router, &fa->fa_queue, &key);
+    if (ret) {
+        /* the parked fragments will time out */
+        return ret;
+    }
+
+    vr_dpdk_lcore_schedule_assembler_work(vr_dpdk.lcores[cpu],
+            dpdk_fragment_assemble_queue, &fa->fa_queue);
+
+    return 0;
+}
+
 /**
  * Assemble packet
  */
 void
 dpdk_fragment_sync_assemble(struct vr_fragment_queue_element *vfqe)
 {
-    uint32_t hash, index;
-    unsigned int cpu;
-    struct fragment_bucket *bucket;
+    bool frag_head;
+    uint32_t hash;
+    struct fragment_assembler *fa = dpdk_assembler_get();
+    struct fragment_entry *fe;
+    struct vr_fragment_key key;
+
+    frag_head = vr_fragment_assemble_key(vfqe, &key);
+    if (vr_fragment_assemble_bypass(vfqe, frag_head))
+        return;
 
-    cpu = vr_get_cpu() - VR_DPDK_FWD_LCORE_ID;
-    assert(cpu >= 0 && cpu < (vr_num_cpus - VR_DPDK_FWD_LCORE_ID));
+    hash = vr_hash(&key, sizeof(key), 0);
+    fe = dpdk_assembler_lookup(fa, &key, hash);
+    if (!fe) {
+        /* a head without an entry has nothing left to flush */
+        if (frag_head) {
+            vr_fragment_queue_element_free(vfqe, VP_DROP_CLONED_ORIGINAL);
+            return;
+        }
+
+        fe = dpdk_assembler_entry_add(fa, &key, hash);
+        if (!fe) {
+            vr_fragment_queue_element_free(vfqe, VP_DROP_FRAGMENT_QUEUE_FAIL);
+            return;
+        }
+    }
+
+    dpdk_assembler_wheel_arm(fa, fe, dpdk_assembler_now());
 
-    hash = vr_fragment_get_hash(&vfqe->fqe_pnode);
-    index = (hash % VR_ASSEMBLER_BUCKET_COUNT);
-    bucket = &assembler_table[cpu][index];
+    if (vr_fragment_assemble_entry(&fe->fe_frag, vfqe, frag_head))
+        dpdk_assembler_entry_del(fa, fe);
 
-    vr_fragment_assemble(&bucket->frag_list, vfqe);
+    return;
 }
 
 /**
  * A callback for timeouts.
- * - Clean stale entries in assembler_table[][]
+ * - Advance the timer wheel and drop the entries that timed out
  *
  * Called on forwarding lcores only.
  */
 void
 dpdk_fragment_assembler_table_scan(void *arg)
 {
-    unsigned int i, j, scanned = 0;
-    unsigned int cpu;
-    struct fragment_bucket *vfb;
-
-    cpu = vr_get_cpu() - VR_DPDK_FWD_LCORE_ID;
-    assert(cpu >= 0 && cpu < (vr_num_cpus - VR_DPDK_FWD_LCORE_ID));
-
-    i = assembler_scan_index;
-    for (j = 0; j < VR_ASSEMBLER_BUCKET_COUNT; j++) {
-        vfb = &assembler_table[cpu][(i + j) % VR_ASSEMBLER_BUCKET_COUNT];
-
-        if (vfb->frag_list)
-            scanned += vr_assembler_table_scan(&vfb->frag_list);
-
-        if (scanned > assembler_scan_thresh) {
-            j++;
-            break;
+    uint64_t now;
+    struct fragment_assembler *fa = dpdk_assembler_get();
+    struct fragment_entry *fe, *next;
+
+    now = dpdk_assembler_now();
+    /* after a long stall, one turn of the wheel covers everything */
+    if (now - fa->fa_tick > VR_DPDK_FRAG_WHEEL_SLOTS)
+        fa->fa_tick = now - VR_DPDK_FRAG_WHEEL_SLOTS;
+
+    for (; fa->fa_tick <= now; fa->fa_tick++) {
+        fe = fa->fa_wheel[fa->fa_tick & (VR_DPDK_FRAG_WHEEL_SLOTS - 1)];
+        while (fe) {
+            next = fe->fe_wnext;
+            /* the slot is shared with deadlines a full turn later */
+            if (fe->fe_deadline <= fa->fa_tick)
+                dpdk_assembler_entry_del(fa, fe);
+            fe = next;
         }
     }
 
-    assembler_scan_index = (i + j) % VR_ASSEMBLER_BUCKET_COUNT;
     return;
 }
 
@@ -239,12 +444,33 @@ int
 dpdk_fragment_assembler_init(void)
 {
     int ret;
+    unsigned int i, size;
 
-    if ((ret = dpdk_fragment_queue_init()))
-        return ret;
+    assembler_tick_cycles = rte_get_timer_hz() * VR_ASSEMBLER_TIMEOUT_SECS /
+        VR_DPDK_FRAG_WHEEL_TIMEOUT_TICKS;
+    if (!assembler_tick_cycles)
+        assembler_tick_cycles = 1;
 
-    if ((ret = dpdk_assembler_table_init()))
-        return ret;
+    size = sizeof(struct fragment_assembler) * vr_dpdk.nb_fwd_lcores;
+    assemblers = vr_zalloc(size, VR_ASSEMBLER_TABLE_OBJECT);
+    if (!assemblers) {
+        RTE_LOG(ERR, VROUTER, "%s:%d Allocation for %u failed\n",
+                __FUNCTION__, __LINE__, size);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < vr_dpdk.nb_fwd_lcores; ++i) {
+        ret = dpdk_fragment_assembler_alloc(&assemblers[i]);
+        if (ret) {
+            RTE_LOG(ERR, VROUTER, "%s: Error allocating fragment assembler"
+                    " for forwarding lcore %u\n", __func__, i);
+            return ret;
+        }
+    }
+
+    /* Intentionally the vr_assembler_table_scan_init() is not called here as
+     * it would set up timers on the timer lcore. For the timers the forwarding
+     * lcores are used, therefore allowing for complete lock elimination. */
 
     return 0;
 }
@@ -253,17 +479,25 @@ dpdk_fragment_assembler_init(void)
  * Exit the fragment assembler and clean up all related data.
  *
  * Called only once on the master lcore after the forwarding lcores exited.
- * Therefore we can securely free everything inside dpdk_fragment_queue_exit()
- * and dpdk_assembler_table_exit(). If someone adds call to this in other
+ * Therefore we can securely free everything inside
+ * dpdk_fragment_assembler_free(). If someone adds call to this in other
  * place, she/he has to take care of possible races between the master and
- * forwarding lcores as assembler tasks might be using the fragment table or
- * per cpu queues at the same time.
+ * forwarding lcores as assembler tasks might be using the assembler tables,
+ * pools or per cpu queues at the same time.
  */
 void
 dpdk_fragment_assembler_exit(void)
 {
-    dpdk_fragment_queue_exit();
-    dpdk_assembler_table_exit();
+    unsigned int i;
+
+    if (!assemblers)
+        return;
+
+    for (i = 0; i < vr_dpdk.nb_fwd_lcores; ++i)
+        dpdk_fragment_assembler_free(&assemblers[i]);
+
+    vr_free(assemblers, VR_ASSEMBLER_TABLE_OBJECT);
+    assemblers = NULL;
 }
 
 /** @} */
@@ -44,48 +44,79 @@
 #include <rte_tcp.h>
 #include <rte_eth_bond.h>
 
-#define GRO_TABLE_NAME_LEN 45
+/* IPv6 extension headers GRO walks over on the way to the TCP header */
+#define GRO_IP6_HOPOPTS     0
+#define GRO_IP6_ROUTING     43
+#define GRO_IP6_DSTOPTS     60
 
 int
 vr_dpdk_gro_init(unsigned lcore_id, struct vr_dpdk_lcore *lcore)
 {
-    /* Parameters used for hash tables. Name is set later. */
-    struct rte_hash_parameters gro_tbl_params_v4 = {
-        .entries = 1<<3,
-        .key_len = sizeof(struct vr_dpdk_gro_flow_key_v4),
-        .hash_func = rte_jhash,
-        .hash_func_init_val = 0,
-        .socket_id = 0, /* TODO */
-    };
-    struct rte_hash_parameters gro_tbl_params_v6 = {
-        .entries = 1<<3,
-        .key_len = sizeof(struct vr_dpdk_gro_flow_key_v6),
-        .hash_func = rte_jhash,
-        .hash_func_init_val = 0,
-        .socket_id = 0, /* TODO */
-    };
-
-    char gro_v4_tbl_name[GRO_TABLE_NAME_LEN], gro_v6_tbl_name[GRO_TABLE_NAME_LEN];
-
-    snprintf(gro_v4_tbl_name, sizeof(gro_v4_tbl_name), "GRO_Table_v4_lcore_%d", lcore_id);
-    gro_tbl_params_v4.name = gro_v4_tbl_name;
-    lcore->gro.gro_tbl_v4_handle = rte_hash_create(&gro_tbl_params_v4);
-    if (lcore->gro.gro_tbl_v4_handle == NULL) {
-        RTE_LOG(ERR, VROUTER, "Warning! %s: lcore:%d, Unable to allocate memory "
-                          "for IPv4 GRO table\n", __func__, lcore_id);
-        return -ENOMEM;
-    }
-    snprintf(gro_v6_tbl_name, sizeof(gro_v6_tbl_name), "GRO_Table_v6_lcore_%d", lcore_id);
-    gro_tbl_params_v6.name = gro_v6_tbl_name;
-    lcore->gro.gro_tbl_v6_handle = rte_hash_create(&gro_tbl_params_v6);
-    if (lcore->gro.gro_tbl_v6_handle == NULL) {
+    struct gro_table *gt;
+
+    gt = rte_zmalloc_socket("GRO_table", sizeof(*gt), RTE_CACHE_LINE_SIZE,
+            rte_lcore_to_socket_id(lcore_id));
+    if (gt == NULL) {
         RTE_LOG(ERR, VROUTER, "Warning! %s: lcore:%d, Unable to allocate memory "
-                          "for IPv6 GRO table\n", __func__, lcore_id);
+                          "for GRO table\n", __func__, lcore_id);
         return -ENOMEM;
     }
+    gt->gt_tailp = &gt->gt_head;
+    lcore->gro.gro_table = gt;
+
     return 0;
 }
 
+static inline struct gro_bucket *
+dpdk_gro_entry_bucket(struct gro_table *gt, struct gro_entry *entry,
+        unsigned int *slot)
+{
+    unsigned int i = entry - gt->gt_entries;
+
+    *slot = i % VR_DPDK_GRO_BUCKET_ENTRIES;
+    return &gt->gt_buckets[i / VR_DPDK_GRO_BUCKET_ENTRIES];
+}
+
+static struct gro_entry *
+dpdk_gro_lookup(struct gro_table *gt, struct vr_dpdk_gro_flow_key *key,
+        uint32_t sig)
+{
+    unsigned int i, b = sig & (VR_DPDK_GRO_BUCKETS - 1);
+    struct gro_bucket *bucket = &gt->gt_buckets[b];
+    struct gro_entry *entry;
+
+    for (i = 0; i < VR_DPDK_GRO_BUCKET_ENTRIES; i++) {
+        if (bucket->gb_sig[i] != sig)
+            continue;
+
+        entry = &gt->gt_entries[b * VR_DPDK_GRO_BUCKET_ENTRIES + i];
+        if (!memcmp(&entry->key, key, sizeof(*key)))
+            return entry;
+    }
+
+    return NULL;
+}
+
+/* Take a flow out of the table and the deadline list */
+static void
+dpdk_gro_entry_del(struct gro_ctrl *gro, struct gro_entry *entry)
+{
+    unsigned int slot;
+    struct gro_table *gt = gro->gro_table;
+    struct gro_bucket *bucket = dpdk_gro_entry_bucket(gt, entry, &slot);
+
+    bucket->gb_sig[slot] = 0;
+
+    *entry->pprev = entry->next;
+    if (entry->next)
+        entry->next->pprev = entry->pprev;
+    else
+        gt->gt_tailp = entry->pprev;
+    entry->next = NULL;
+    entry->pprev = NULL;
+
+    gro->gro_active--;
+}
 
 static uint16_t
 dpdk_gro_csum_tcph(struct vr_tcp *tcph)
@@ -109,9 +140,62 @@ dpdk_gro_csum_tcph(struct vr_tcp *tcph)
     return (ch & 0xffff);
 }
 
+/*
+ * Pseudo header checksum of a TCP segment of tcp_len bytes. Unlike
+ * rte_ipv6_phdr_cksum() it does not take the length and the protocol from
+ * the IPv6 header, which are off when there are extension headers.
+ */
 static uint16_t
-dpdk_gro_rx_csum_fixup(struct gro_entry *entry, uint8_t is_ipv6, void *nw_hdr,
-                    struct vr_tcp *tcph, uint16_t tcp_data_len, uint16_t csum)
+dpdk_gro_ip6_phdr_cksum(struct vr_ip6 *ip6, uint32_t tcp_len)
+{
+    uint32_t sum;
+    struct {
+        uint32_t len;
+        uint32_t proto;
+    } psd;
+
+    psd.len = rte_cpu_to_be_32(tcp_len);
+    psd.proto = rte_cpu_to_be_32(VR_IP_PROTO_TCP);
+
+    sum = __rte_raw_cksum(ip6->ip6_src, 2 * VR_IP6_ADDRESS_LEN, 0);
+    sum = __rte_raw_cksum(&psd, sizeof(psd), sum);
+
+    return __rte_raw_cksum_reduce(sum);
+}
+
+/*
+ * Verify the checksum of a TCP segment of tcp_len bytes, which may span
+ * chained mbufs. The header is left untouched.
+ */
+static bool
+dpdk_gro_csum_ok(struct rte_mbuf *m, void *nw_hdr, uint8_t is_ipv6,
+                    struct vr_tcp *tcph, uint16_t tcp_len)
+{
+    uint32_t sum;
+    uint16_t seg_sum;
+
+    if (!is_ipv6)
+        sum = rte_ipv4_phdr_cksum((const struct rte_ipv4_hdr *)nw_hdr, 0);
+    else
+        sum = dpdk_gro_ip6_phdr_cksum(nw_hdr, tcp_len);
+
+    if (m->nb_segs == 1) {
+        sum += rte_raw_cksum(tcph, tcp_len);
+    } else {
+        if (rte_raw_cksum_mbuf(m,
+                    (uint8_t *)tcph - rte_pktmbuf_mtod(m, uint8_t *),
+                    tcp_len, &seg_sum) < 0)
+            return false;
+        sum += seg_sum;
+    }
+    sum = (sum >> 16) + (sum & 0xffff);
+
+    return sum == 0xffff;
+}
+
+static uint16_t
+dpdk_gro_rx_csum_fixup(struct gro_entry *entry, void *nw_hdr,
+                    struct vr_tcp *tcph, uint16_t tcp_len, uint16_t csum)
 {
     uint32_t c;
     uint16_t cs;
@@ -121,18 +205,14 @@ dpdk_gro_rx_csum_fixup(struct gro_entry *entry, uint8_t is_ipv6, void *nw_hdr,
     /* For first packet, remove just the length from checksum
      * For subsequent packets, remove the checksum of full TCP header
      */
-    if (!is_ipv6) {
+    if (entry->mbuf_cnt == 1) {
+        cs = tcp_len;
+    } else if (!entry->is_ipv6) {
         struct vr_ip* ip4 = nw_hdr;
-        if (entry->mbuf_cnt == 1)
-            cs = rte_be_to_cpu_16(ip4->ip_len) - sizeof(*ip4);
-        else
-            cs = rte_be_to_cpu_16(rte_ipv4_phdr_cksum((const struct rte_ipv4_hdr*)ip4,0));
+        cs = rte_be_to_cpu_16(rte_ipv4_phdr_cksum((const struct rte_ipv4_hdr*)ip4,0));
     } else {
         struct vr_ip6* ip6 = nw_hdr;
-        if (entry->mbuf_cnt == 1)
-            cs = rte_be_to_cpu_16(ip6->ip6_plen);
-        else
-            cs = rte_be_to_cpu_16(rte_ipv6_phdr_cksum((const struct rte_ipv6_hdr*)ip6,0));
+        cs = rte_be_to_cpu_16(dpdk_gro_ip6_phdr_cksum(ip6, tcp_len));
     }
 
     cs = ~cs;
@@ -148,9 +228,8 @@ dpdk_gro_rx_csum_fixup(struct gro_entry *entry, uint8_t is_ipv6, void *nw_hdr,
 }
 
 static int
-dpdk_gro_flush(struct gro_ctrl *gro, void *key, struct gro_entry *entry)
+dpdk_gro_flush(struct gro_ctrl *gro, struct gro_entry *entry)
 {
-    int ret;
     struct vr_tcp *tcph = NULL;
     struct vr_interface *vif = NULL;
     struct vrouter *router = vrouter_get(0);
@@ -164,6 +243,7 @@ dpdk_gro_flush(struct gro_ctrl *gro, void *key, struct gro_entry *entry)
 
     if (entry->mbuf_cnt > 1) {
 
+        tcph = (struct vr_tcp *)((uint8_t *)entry->le_ip4 + entry->l4_off);
         if (!entry->is_ipv6) {
             /* Fix IP header checksum for new length. */
             struct vr_ip *ip4 = entry->le_ip4;
@@ -177,17 +257,15 @@ dpdk_gro_flush(struct gro_ctrl *gro, void *key, struct gro_entry *entry)
             ip4->ip_csum = rte_cpu_to_be_16(~c);
 
             entry->le_ip4->ip_len = rte_cpu_to_be_16(entry->p_len);
-            tcph = (struct vr_tcp *)(entry->le_ip4 + 1);
             m->ol_flags |= PKT_RX_GSO_TCP4;
         } else {
             struct vr_ip6 *ip6 = entry->le_ip6;
             ip6->ip6_plen = rte_cpu_to_be_16(entry->p_len - sizeof(struct vr_ip6));
-            tcph = (struct vr_tcp *)(entry->le_ip6 + 1);
             m->ol_flags |= PKT_RX_GSO_TCP6;
         }
         m->pkt_len =
                entry->p_len + pkt_get_network_header_off(pkt) - pkt_head_space(pkt);
-        m->nb_segs = entry->mbuf_cnt;
+        m->nb_segs = entry->nb_segs;
         m->tso_segsz = entry->seg_sz;
 
         /* Incorporate the latest ACK into the TCP header. */
@@ -203,10 +281,7 @@ dpdk_gro_flush(struct gro_ctrl *gro, void *key, struct gro_entry *entry)
         }
 
         /* Update the TCP header checksum. */
-        if (!entry->is_ipv6)
-            entry->ulp_csum += entry->p_len - sizeof(struct vr_ip);
-        else
-            entry->ulp_csum += entry->p_len - sizeof(struct vr_ip6);
+        entry->ulp_csum += entry->p_len - entry->l4_off;
 
         entry->ulp_csum += rte_cpu_to_be_16(dpdk_gro_csum_tcph(tcph));
         while (entry->ulp_csum > 0xffff)
@@ -219,12 +294,8 @@ dpdk_gro_flush(struct gro_ctrl *gro, void *key, struct gro_entry *entry)
     gro->gro_queued += entry->mbuf_cnt;
     gro->gro_flushed++;
 
-    /* Delete flow entry from hash table */
-    if (!entry->is_ipv6)
-        ret = rte_hash_del_key(gro->gro_tbl_v4_handle, key);
-    else
-        ret = rte_hash_del_key(gro->gro_tbl_v6_handle, key);
-    ASSERT(ret >= 0);
+    /* Take the flow out of the table, the entry stays valid till we return */
+    dpdk_gro_entry_del(gro, entry);
 
     nh = __vrouter_get_nexthop(router, entry->nh_id);
     if (!nh) {
@@ -309,104 +380,148 @@ dpdk_gro_flush(struct gro_ctrl *gro, void *key, struct gro_entry *entry)
 
     pkt->vp_flags |= VP_FLAG_FLOW_SET | VP_FLAG_GROED;
     nh_output(pkt, nh, &fmd);
-    rte_free(entry);
     return GRO_MERGED;
 
 drop:
     vr_dpdk_pfree(m, vif, drop_reason);
-    rte_free(entry);
     return 0;
 }
 
+/*
+ * Open a flow in its bucket. If the bucket is full, the flow closest to
+ * its deadline is flushed early to make room, so adding never fails.
+ */
+static struct gro_entry *
+dpdk_gro_entry_add(struct gro_ctrl *gro, struct vr_dpdk_gro_flow_key *key,
+        uint32_t sig)
+{
+    unsigned int i, b = sig & (VR_DPDK_GRO_BUCKETS - 1);
+    struct gro_table *gt = gro->gro_table;
+    struct gro_bucket *bucket = &gt->gt_buckets[b];
+    struct gro_entry *entry, *victim = NULL;
+
+    for (i = 0; i < VR_DPDK_GRO_BUCKET_ENTRIES; i++) {
+        if (!bucket->gb_sig[i])
+            break;
+
+        entry = &gt->gt_entries[b * VR_DPDK_GRO_BUCKET_ENTRIES + i];
+        if (!victim || entry->deadline < victim->deadline)
+            victim = entry;
+    }
+
+    if (i == VR_DPDK_GRO_BUCKET_ENTRIES) {
+        i = victim - &gt->gt_entries[b * VR_DPDK_GRO_BUCKET_ENTRIES];
+        dpdk_gro_flush(gro, victim);
+        gro->gro_flush_evicted++;
+    }
+
+    entry = &gt->gt_entries[b * VR_DPDK_GRO_BUCKET_ENTRIES + i];
+    memset(entry, 0, sizeof(*entry));
+    rte_memcpy(&entry->key, key, sizeof(*key));
+    entry->sig = sig;
+    bucket->gb_sig[i] = sig;
+
+    /* all flows live equally long, so the tail is the latest deadline */
+    entry->deadline = gro->gro_now + gro->gro_timeout;
+    entry->pprev = gt->gt_tailp;
+    *gt->gt_tailp = entry;
+    gt->gt_tailp = &entry->next;
+
+    gro->gro_active++;
+
+    return entry;
+}
+
 void
 dpdk_gro_free_all_flows(struct vr_dpdk_lcore *lcore)
 {
     struct gro_entry *entry;
-    uint32_t iter = 0;
-    void *next_key;
     struct gro_ctrl *gro = &lcore->gro;
-    if (gro->gro_tbl_v4_handle != NULL) {
-        while (rte_hash_iterate(gro->gro_tbl_v4_handle, (const void**)&next_key,
-                                                  (void**)&entry, &iter) >= 0) {
-            vr_dpdk_pfree(entry->mbuf_head, NULL, VP_DROP_DISCARD);
-            rte_free(entry);
-        }
-        rte_hash_reset(gro->gro_tbl_v4_handle);
-    }
-    iter = 0;
-    if (gro->gro_tbl_v6_handle != NULL) {
-        while (rte_hash_iterate(gro->gro_tbl_v6_handle, (const void**)&next_key,
-                                                  (void**)&entry, &iter) >= 0) {
-            vr_dpdk_pfree(entry->mbuf_head, NULL, VP_DROP_DISCARD);
-            rte_free(entry);
-        }
-        rte_hash_reset(gro->gro_tbl_v6_handle);
+
+    if (gro->gro_table == NULL)
+        return;
+
+    while ((entry = gro->gro_table->gt_head) != NULL) {
+        dpdk_gro_entry_del(gro, entry);
+        vr_dpdk_pfree(entry->mbuf_head, NULL, VP_DROP_DISCARD);
     }
 }
 
+/*
+ * dpdk_gro_flush_expired - flush the flows whose deadline has passed.
+ * Called once per forwarding loop, i.e. after the RX bursts of the loop
+ * went through GRO, so segments of a burst get merged before a flush.
+ * The flows are kept in deadline order, so the walk stops at the first
+ * flow that has not expired instead of scanning the table.
+ */
 void
-dpdk_gro_flush_all_inactive(struct vr_dpdk_lcore *lcore)
+dpdk_gro_flush_expired(struct vr_dpdk_lcore *lcore, uint64_t now)
 {
-    uint32_t iter = 0;
-    void *next_key;
     struct gro_entry *entry;
     struct gro_ctrl *gro = &lcore->gro;
-    uint64_t cur_cycles = 0, diff_cycles;
-    const uint64_t gro_flush_cycles = 100 * VR_DPDK_TX_FLUSH_LOOPS;
-
-    if (gro->gro_tbl_v4_handle != NULL) {
-        cur_cycles = lcore->lcore_fwd_loops;
-        /* Iterate through the hash table */
-        while (rte_hash_iterate(gro->gro_tbl_v4_handle, (const void**)&next_key,
-                                                  (void**)&entry, &iter) >= 0) {
-            diff_cycles = cur_cycles - entry->mtime;
-            if (unlikely(gro_flush_cycles < diff_cycles)) {
-                /* Flush flow */
-                dpdk_gro_flush(gro, next_key, entry);
-                lcore->gro.gro_flush_inactive_flows++;
-            }
-        }
+
+    gro->gro_now = now;
+    if (gro->gro_table == NULL)
+        return;
+
+    while ((entry = gro->gro_table->gt_head) != NULL &&
+            entry->deadline <= now) {
+        dpdk_gro_flush(gro, entry);
+        gro->gro_flush_inactive_flows++;
     }
+}
 
-    iter = 0;
-    if (gro->gro_tbl_v6_handle != NULL) {
-        cur_cycles = lcore->lcore_fwd_loops;
-        /* Iterate through the hash table */
-        while (rte_hash_iterate(gro->gro_tbl_v6_handle, (const void**)&next_key,
-                                                  (void**)&entry, &iter) >= 0) {
-            diff_cycles = cur_cycles - entry->mtime;
-            if (unlikely(gro_flush_cycles < diff_cycles)) {
-                /* Flush flow */
-                dpdk_gro_flush(gro, next_key, entry);
-                lcore->gro.gro_flush_inactive_flows++;
-            }
-        }
+/*
+ * Offset of the TCP header from the IPv6 header, walking over the hop by
+ * hop, routing and destination options headers that fit in room bytes.
+ * Returns -1 if the headers do not fit.
+ */
+static int
+dpdk_gro_ip6_l4_off(struct vr_ip6 *ip6, unsigned int room, uint8_t *proto)
+{
+    uint8_t *ext, nxt = ip6->ip6_nxt;
+    unsigned int off = sizeof(*ip6);
+
+    while (nxt == GRO_IP6_HOPOPTS || nxt == GRO_IP6_ROUTING ||
+            nxt == GRO_IP6_DSTOPTS) {
+        if (off + 2 > room)
+            return -1;
+        ext = (uint8_t *)ip6 + off;
+        nxt = ext[0];
+        off += (ext[1] + 1) << 3;
     }
+
+    if (off > room)
+        return -1;
+
+    *proto = nxt;
+    return off;
 }
 
 int
 dpdk_gro_process(struct vr_packet *pkt, struct vr_interface *vif, bool l2_pkt)
 {
-    struct vr_dpdk_gro_flow_key_v4 flow4;
-    struct vr_dpdk_gro_flow_key_v6 flow6;
+    struct vr_dpdk_gro_flow_key key;
     struct gro_entry *entry;
     struct rte_mbuf *m;
     void *nw_hdr;
     struct vr_tcp *tcph = NULL;
     uint16_t tcp_data_len, ip_pkt_len, l;
-    uint32_t *ts_ptr;
+    uint32_t *ts_ptr, sig, hdr_len;
     int32_t ret;
+    int l4_off;
+    unsigned int room;
     unsigned short csum;
     unsigned short src_vif_idx = 0;
     uint32_t nh_id = 0;
     unsigned lcore_id;
     struct vr_dpdk_lcore *lcore;
-    uint8_t is_ipv6 = 0, flush = 0;
-    void *key = NULL;
+    uint8_t is_ipv6 = 0, flush = 0, ip6_ext = 0, proto;
     struct vrouter *router;
     struct vr_interface *src_vif;
     struct vr_nexthop *nh;
     struct vr_gro *gro;
+    struct gro_ctrl *gro_ctrl;
 
 
     /* Normal processing for VMs if -
@@ -421,10 +536,10 @@ dpdk_gro_process(struct vr_packet *pkt, struct vr_interface *vif, bool l2_pkt)
 
     lcore_id = rte_lcore_id();
     lcore = vr_dpdk.lcores[lcore_id];
+    gro_ctrl = &lcore->gro;
 
     /* Packets arriving through non-Fwd cores - Normal processing */
-    if (unlikely((lcore->gro.gro_tbl_v4_handle == NULL) ||
-            (lcore->gro.gro_tbl_v6_handle == NULL))){
+    if (unlikely(gro_ctrl->gro_table == NULL)) {
         return 0;
     }
 
@@ -453,37 +568,31 @@ dpdk_gro_process(struct vr_packet *pkt, struct vr_interface *vif, bool l2_pkt)
         goto func_exit;
     }
 
-    /* Can't handle chained mbufs */
-    if (m->nb_segs > 1) {
-        flush = 1;
-    }
+    /* Headers have to be in the first segment, the payload need not */
+    room = rte_pktmbuf_mtod(m, uint8_t *) + rte_pktmbuf_data_len(m) -
+        (uint8_t *)nw_hdr;
+
+    memset(&key, 0, sizeof(key));
 
     /* Parse IP header */
     if (vr_ip_is_ip6(nw_hdr)) {
         struct vr_ip6 *ip6 = nw_hdr;
         is_ipv6 = 1;
-        flow6.proto = ip6->ip6_nxt;
+        l4_off = dpdk_gro_ip6_l4_off(ip6, room, &proto);
         /* For non TCP packets, no GRO */
-        if (flow6.proto != VR_IP_PROTO_TCP) {
+        if (l4_off < 0 || proto != VR_IP_PROTO_TCP) {
             ret = GRO_NOT_APPLICABLE;
             goto func_exit;
         }
-        rte_memcpy(&flow6.ip6_src, ip6->ip6_src, sizeof(flow6.ip6_src));
-        rte_memcpy(&flow6.ip6_dst, ip6->ip6_dst, sizeof(flow6.ip6_dst));
-        tcph = (struct vr_tcp *)(nw_hdr + sizeof(*ip6));
-        flow6.port_src = rte_be_to_cpu_16(tcph->tcp_sport);
-        flow6.port_dst = rte_be_to_cpu_16(tcph->tcp_dport);
-        flow6.vif_idx = vif->vif_idx;
+        ip6_ext = (l4_off != sizeof(*ip6));
+        rte_memcpy(key.ip_src, ip6->ip6_src, sizeof(key.ip_src));
+        rte_memcpy(key.ip_dst, ip6->ip6_dst, sizeof(key.ip_dst));
         ip_pkt_len = rte_be_to_cpu_16(ip6->ip6_plen) + sizeof(struct vr_ip6);
-        tcp_data_len = rte_be_to_cpu_16(ip6->ip6_plen);
-        key = &flow6;
     } else if (vr_ip_is_ip4(nw_hdr)) {
         struct vr_ip *ip4 = nw_hdr;
-        unsigned int hlen = 0;
-        hlen = ip4->ip_hl * 4;
-        flow4.proto = ip4->ip_proto;
+        l4_off = ip4->ip_hl * 4;
         /* For non TCP packets, no GRO */
-        if (flow4.proto != VR_IP_PROTO_TCP) {
+        if (ip4->ip_proto != VR_IP_PROTO_TCP) {
             ret = GRO_NOT_APPLICABLE;
             goto func_exit;
         }
@@ -492,22 +601,28 @@ dpdk_gro_process(struct vr_packet *pkt, struct vr_interface *vif, bool l2_pkt)
             flush = 1;
         }
         /* .. and there are no options. */
-        else if (hlen != sizeof (*ip4)) {
+        else if (l4_off != sizeof (*ip4)) {
             flush = 1;
         }
-        flow4.ip_src = ip4->ip_saddr;
-        flow4.ip_dst = ip4->ip_daddr;
-        tcph = (struct vr_tcp *)(nw_hdr + hlen);
-        flow4.port_src = rte_be_to_cpu_16(tcph->tcp_sport);
-        flow4.port_dst = rte_be_to_cpu_16(tcph->tcp_dport);
-        flow4.vif_idx = vif->vif_idx;
+        rte_memcpy(key.ip_src, &ip4->ip_saddr, sizeof(ip4->ip_saddr));
+        rte_memcpy(key.ip_dst, &ip4->ip_daddr, sizeof(ip4->ip_daddr));
         ip_pkt_len = rte_be_to_cpu_16(ip4->ip_len);
-        tcp_data_len = ip_pkt_len - (ip4->ip_hl << 2);
-        key = &flow4;
     } else {
         ret = GRO_NOT_APPLICABLE;
         goto func_exit;
     }
+
+    if ((unsigned int)l4_off + sizeof(*tcph) > room) {
+        ret = GRO_NOT_APPLICABLE;
+        goto func_exit;
+    }
+
+    tcph = (struct vr_tcp *)((uint8_t *)nw_hdr + l4_off);
+    key.port_src = tcph->tcp_sport;
+    key.port_dst = tcph->tcp_dport;
+    key.vif_idx = vif->vif_idx;
+    key.is_ipv6 = is_ipv6;
+    tcp_data_len = ip_pkt_len - l4_off;
     csum = rte_be_to_cpu_16(tcph->tcp_csum);
 
     /* Check TCP header constraints */
@@ -524,6 +639,7 @@ dpdk_gro_process(struct vr_packet *pkt, struct vr_interface *vif, bool l2_pkt)
      */
     l = VR_TCP_OFFSET(tcph->tcp_offset_r_flags) << 2;
     tcp_data_len -= l;
+    hdr_len = (uint8_t *)tcph - rte_pktmbuf_mtod(m, uint8_t *) + l;
     l -= sizeof(*tcph);
     ts_ptr = (uint32_t *)(tcph + 1);
     if (l != 0 && (unlikely(l != TCPOLEN_TSTAMP_APPA) ||
@@ -537,42 +653,43 @@ dpdk_gro_process(struct vr_packet *pkt, struct vr_interface *vif, bool l2_pkt)
         flush = 1;
     }
 
+    /*
+     * The headers must not span segments and the mbufs must hold just the
+     * segment, without any padding.
+     */
+    if (hdr_len > rte_pktmbuf_data_len(m) ||
+            rte_pktmbuf_pkt_len(m) != hdr_len + tcp_data_len) {
+        flush = 1;
+    }
+
     if (likely(flush == 0)) {
         /* Check TCP checksum */
-        tcph->tcp_csum = 0;
-        if (!is_ipv6)
-            tcph->tcp_csum = rte_ipv4_udptcp_cksum(nw_hdr, tcph);
-        else
-            tcph->tcp_csum = rte_ipv6_udptcp_cksum(nw_hdr, tcph);
-
-        if (tcph->tcp_csum == 0xffff)
-            tcph->tcp_csum = 0;
-
-        if (csum != rte_be_to_cpu_16(tcph->tcp_csum)) {
+        if (!dpdk_gro_csum_ok(m, nw_hdr, is_ipv6, tcph,
+                    ip_pkt_len - l4_off)) {
+            gro_ctrl->gro_bad_csum++;
             vr_dpdk_pfree(m, vif, VP_DROP_CKSUM_ERR);
             ret = GRO_MERGED;
             goto func_exit;
         }
     }
 
-    if (!is_ipv6)
-        ret = rte_hash_lookup_data(lcore->gro.gro_tbl_v4_handle, &flow4, (void*)&entry);
-    else
-        ret = rte_hash_lookup_data(lcore->gro.gro_tbl_v6_handle, &flow6, (void*)&entry);
-
-    if (ret >= 0) {
+    sig = rte_jhash(&key, sizeof(key), 0) | (1U << 31);
+    entry = dpdk_gro_lookup(gro_ctrl->gro_table, &key, sig);
+    if (entry) {
         /* Update flow */
 
         /* Check if packet needs to be flushed */
         if (flush) {
-            dpdk_gro_flush(&lcore->gro, key, entry);
+            dpdk_gro_flush(gro_ctrl, entry);
+            gro_ctrl->gro_flush_unmergeable++;
             ret = GRO_CANNOT;
             goto func_exit;
         }
 
         /* Flush now if appending will result in overflow. */
         if (entry->p_len > (65535 - tcp_data_len)) {
-            dpdk_gro_flush(&lcore->gro, key, entry);
+            dpdk_gro_flush(gro_ctrl, entry);
+            gro_ctrl->gro_flush_overflow++;
             goto create;
         }
 
@@ -580,7 +697,8 @@ dpdk_gro_process(struct vr_packet *pkt, struct vr_interface *vif, bool l2_pkt)
         if (unlikely(rte_be_to_cpu_32(tcph->tcp_seq) != entry->next_seq ||
            (tcp_data_len == 0))) {
             /* Out of order packet or duplicate ACK. */
-            dpdk_gro_flush(&lcore->gro, key, entry);
+            dpdk_gro_flush(gro_ctrl, entry);
+            gro_ctrl->gro_flush_unmergeable++;
             ret = GRO_CANNOT;
             goto func_exit;
         }
@@ -593,7 +711,8 @@ dpdk_gro_process(struct vr_packet *pkt, struct vr_interface *vif, bool l2_pkt)
              */
             if (unlikely(entry->tsval > tsval ||
                 rte_be_to_cpu_32(*(ts_ptr + 2)) == 0)) {
-                dpdk_gro_flush(&lcore->gro, key, entry);
+                dpdk_gro_flush(gro_ctrl, entry);
+                gro_ctrl->gro_flush_unmergeable++;
                 ret = GRO_CANNOT;
                 goto func_exit;
             }
@@ -605,34 +724,48 @@ dpdk_gro_process(struct vr_packet *pkt, struct vr_interface *vif, bool l2_pkt)
         entry->ack_seq = rte_be_to_cpu_32(tcph->tcp_ack);
         entry->window = rte_be_to_cpu_16(tcph->tcp_win);
         entry->mbuf_cnt++;
-        entry->ulp_csum += dpdk_gro_rx_csum_fixup(entry, is_ipv6, nw_hdr, tcph, tcp_data_len, ~csum);
+        entry->ulp_csum += dpdk_gro_rx_csum_fixup(entry, nw_hdr, tcph,
+                ip_pkt_len - l4_off, ~csum);
 
         entry->p_len += tcp_data_len;
 
+        if (m->nb_segs > 1)
+            gro_ctrl->gro_chained++;
+        if (ip6_ext)
+            gro_ctrl->gro_ipv6_ext++;
+
         /*
          * Adjust the mbuf so that rte_pktmbuf_mtod(m) points to the first byte of
          * the ULP payload.  Adjust the mbuf to avoid complications and
-         * append new segment to existing mbuf chain.
+         * append new segment to existing mbuf chain. A first segment left
+         * with headers only is dropped from the chain.
          */
-        rte_pktmbuf_adj(m, rte_pktmbuf_data_len(m) - tcp_data_len);
+        rte_pktmbuf_adj(m, hdr_len);
+        if (unlikely(rte_pktmbuf_data_len(m) == 0 && m->next != NULL)) {
+            struct rte_mbuf *seg = m->next;
+
+            seg->pkt_len = m->pkt_len;
+            seg->nb_segs = m->nb_segs - 1;
+            m->next = NULL;
+            m->nb_segs = 1;
+            rte_pktmbuf_free_seg(m);
+            m = seg;
+        }
 
         entry->mbuf_tail->next = m;
         entry->mbuf_tail = rte_pktmbuf_lastseg(m);
+        entry->nb_segs += m->nb_segs;
 
         /* If segment size is different, flush */
         if (entry->seg_sz != tcp_data_len) {
-            dpdk_gro_flush(&lcore->gro, key, entry);
+            dpdk_gro_flush(gro_ctrl, entry);
             ret = GRO_MERGED;
             goto func_exit;
         }
 
-        /* Save cycles */
-        entry->mtime = lcore->lcore_fwd_loops;
-
         ret = GRO_MERGED;
     } else {
         /* Create new flow */
-        struct gro_entry *entry;
 create:
         if (tcp_data_len == 0) {
             ret = GRO_CANNOT;
@@ -642,11 +775,7 @@ create:
             goto func_exit;
         }
 
-        entry = rte_zmalloc("GRO_entry", sizeof(*entry), RTE_CACHE_LINE_SIZE);
-        if (unlikely(entry == NULL)) {
-            ret = GRO_ERROR;
-            goto func_exit;
-        }
+        entry = dpdk_gro_entry_add(gro_ctrl, &key, sig);
         entry->is_ipv6 = is_ipv6;
         entry->src_vif_idx = src_vif_idx;
         if (likely(src_vif != NULL))
@@ -654,7 +783,7 @@ create:
         entry->dst_vif_idx = nh->nh_dev->vif_idx;
         entry->dst_vif_gen = nh->nh_dev->vif_gen;
         entry->nh_id = nh_id;
-        entry->mtime = lcore->lcore_fwd_loops;
+        entry->l4_off = l4_off;
         entry->p_len = ip_pkt_len;
         entry->next_seq = rte_be_to_cpu_32(tcph->tcp_seq) + tcp_data_len;
         entry->ack_seq = rte_be_to_cpu_32(tcph->tcp_ack);
@@ -672,26 +801,22 @@ create:
         }
         entry->mbuf_head = m;
         entry->mbuf_tail = rte_pktmbuf_lastseg(m);
+        entry->nb_segs = m->nb_segs;
 
-        entry->ulp_csum = dpdk_gro_rx_csum_fixup(entry, is_ipv6, nw_hdr, tcph, tcp_data_len, ~csum);
+        entry->ulp_csum = dpdk_gro_rx_csum_fixup(entry, nw_hdr, tcph,
+                ip_pkt_len - l4_off, ~csum);
         tcph->tcp_csum = rte_cpu_to_be_16(csum);/* Restore checksum on first packet. */
-        lcore->gro.gro_flows++;
+        gro_ctrl->gro_flows++;
 
-        if (!is_ipv6) {
-            ret = (rte_hash_add_key_data(lcore->gro.gro_tbl_v4_handle, &flow4, entry) < 0)?
-                                       GRO_ERROR : GRO_MERGED;
-        } else {
-            ret = (rte_hash_add_key_data(lcore->gro.gro_tbl_v6_handle, &flow6, entry) < 0)?
-                                       GRO_ERROR : GRO_MERGED;
-        }
+        if (m->nb_segs > 1)
+            gro_ctrl->gro_chained++;
+        if (ip6_ext)
+            gro_ctrl->gro_ipv6_ext++;
 
-        if (ret == GRO_MERGED) {
-            /* point mbuf to network header */
-            rte_pktmbuf_adj(m, pkt_get_network_header_off(pkt)- pkt_head_space(pkt));
-            pkt_pull(pkt, pkt_get_network_header_off(pkt)- pkt_head_space(pkt));
-        } else if (ret == GRO_ERROR) {
-            rte_free(entry);
-        }
+        /* point mbuf to network header */
+        rte_pktmbuf_adj(m, pkt_get_network_header_off(pkt)- pkt_head_space(pkt));
+        pkt_pull(pkt, pkt_get_network_header_off(pkt)- pkt_head_space(pkt));
+        ret = GRO_MERGED;
     }
 
 func_exit:
@@ -701,5 +826,3 @@ func_exit:
     }
     return (ret == GRO_MERGED)?1:0;
 }
-
-
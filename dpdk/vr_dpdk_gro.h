@@ -20,6 +20,17 @@
 #include <rte_hash.h>
 #include <rte_jhash.h>
 
+/* Flow key, IPv4 addresses take the first 4 bytes of the address fields */
+struct vr_dpdk_gro_flow_key {
+    uint8_t ip_src[16];
+    uint8_t ip_dst[16];
+    uint16_t port_src;
+    uint16_t port_dst;
+    unsigned short vif_idx;
+    uint8_t is_ipv6;
+    uint8_t pad;
+} __attribute__((packed));
+
 struct gro_entry {
     struct rte_mbuf     *mbuf_head;
     struct rte_mbuf     *mbuf_tail;
@@ -27,12 +38,21 @@ struct gro_entry {
         struct vr_ip   *ip4;
         struct vr_ip6  *ip6;
     } leip;
+    /* deadline ordered list of the open flows */
+    struct gro_entry    *next;
+    struct gro_entry    **pprev;
+    uint64_t        deadline;
+    struct vr_dpdk_gro_flow_key key;
+    uint32_t        sig;
     uint16_t        src_vif_idx;
     uint16_t        dst_vif_idx;
     uint32_t        src_vif_gen;
     uint32_t        dst_vif_gen; 
     uint32_t        nh_id; /* TODO: Add nh gen id */
     uint16_t        mbuf_cnt;
+    uint16_t        nb_segs;
+    /* offset of the TCP header from the IP header */
+    uint16_t        l4_off;
     uint32_t        p_len;      /* IP header payload length. */
     uint32_t        ulp_csum;   /* TCP, etc. checksum. */
     uint32_t        next_seq;   /* tcp_seq */
@@ -41,7 +61,6 @@ struct gro_entry {
     uint32_t        tsecr;
     uint16_t        window;
     uint16_t        timestamp;  /* flag, not a TCP hdr field. */
-    uint64_t        mtime;
     uint8_t         is_ipv6;
     uint32_t        seg_sz;
 };
@@ -49,25 +68,26 @@ struct gro_entry {
 #define le_ip4          leip.ip4
 #define le_ip6          leip.ip6
 
-/* IPv4 Flow key */
-struct vr_dpdk_gro_flow_key_v4 {
-    uint32_t ip_src;
-    uint32_t ip_dst;
-    uint16_t port_src;
-    uint16_t port_dst;
-    uint8_t proto;
-    unsigned short vif_idx;
-} __attribute__((packed));
+/*
+ * Bucket of the per lcore flow table. The signatures of a bucket share a
+ * cache line, so a lookup touches a single entry on a hit and none on a
+ * miss. A zero signature marks a free slot.
+ */
+struct gro_bucket {
+    uint32_t gb_sig[VR_DPDK_GRO_BUCKET_ENTRIES];
+} __rte_cache_aligned;
 
-/* IPv6 Flow key */
-struct vr_dpdk_gro_flow_key_v6 {
-    uint8_t ip6_src[16];
-    uint8_t ip6_dst[16];
-    uint16_t port_src;
-    uint16_t port_dst;
-    uint8_t proto;
-    unsigned short vif_idx;
-} __attribute__((packed));
+#define VR_DPDK_GRO_BUCKETS \
+    (VR_DPDK_GRO_FLOWS / VR_DPDK_GRO_BUCKET_ENTRIES)
+
+/* Per lcore flow table, slot i of bucket b is gt_entries[b * entries + i] */
+struct gro_table {
+    struct gro_bucket gt_buckets[VR_DPDK_GRO_BUCKETS];
+    struct gro_entry gt_entries[VR_DPDK_GRO_FLOWS];
+    /* open flows, oldest (and thus earliest deadline) first */
+    struct gro_entry *gt_head;
+    struct gro_entry **gt_tailp;
+};
 
 typedef enum
 {
@@ -42,30 +42,6 @@
 #include <rte_tcp.h>
 #include <rte_eth_bond.h>
 
-/*
- * Structure that contains the state during the TCP segmentation
- */
-struct dpdk_gso_state {
-   void    (*update)
-       (struct rte_mbuf*, struct dpdk_gso_state*);
-   void    (*internal)
-       (struct rte_mbuf*, struct dpdk_gso_state*);
-   union {
-       struct rte_ipv4_hdr *ip;
-       struct rte_ipv6_hdr *ip6;
-   };
-   struct rte_tcp_hdr *tcp;
-   int mac_hlen;
-   int ip_hlen;
-   int tcp_hlen;
-   int hlen;
-   int pay_len;
-   uint32_t tcp_seq;
-   uint16_t ip_id;
-   uint16_t ip_off;
-   int tx_cksum_offload;
-};
-
 /**
  * Process the IPv6 UDP or TCP checksum in a **chained** mbuf.
  *
@@ -155,300 +131,336 @@ dpdk_ipv4_udptcp_cksum(struct rte_mbuf *m,
     return cksum;
 }
 
-/* Split chained mbuf to individual mbufs and save the pointers in pkts_out */
-static int32_t
-dpdk_split_chained_mbuf(struct rte_mbuf *pkt_in, struct rte_mbuf **pkts_out,
-               uint16_t nb_pkts_out, uint16_t hdr_len, uint16_t frag_size)
-{
-    struct rte_mbuf *curr_pkt = pkt_in, *next_pkt;
-    uint32_t nb_segs = 0, total_segs = pkt_in->nb_segs, i = 0, j;
-    char *in_hdr = rte_pktmbuf_mtod(pkt_in, char*);
-    char *pkt_addr;
-
-    while (curr_pkt) {
-        next_pkt = curr_pkt->next;
-        curr_pkt->next = NULL;
-        curr_pkt->nb_segs = 1;
-        curr_pkt->pkt_len = curr_pkt->data_len;
-        /* 1st mbuf in the chain already has all the headers */
-        if (likely(nb_segs > 0)) {
-            pkt_addr = rte_pktmbuf_prepend(curr_pkt, hdr_len);
-            if (unlikely(pkt_addr == NULL)) {
-                /* pkts_out[0] will be freed in the caller
-                 * when -1 is returned
-                 */
-                for(j=1;j<i;j++)
-                    /* We cannot use dpdk_pfree() since the
-                     * fragments may not have vr_packet info
-                     */
-                    rte_pktmbuf_free(pkts_out[j]);
-                rte_pktmbuf_free(next_pkt);
-                return -1;
-            }
-            rte_memcpy(pkt_addr, in_hdr, hdr_len);
-        }
-        pkts_out[nb_segs++] = curr_pkt;
-        if ((nb_segs >= nb_pkts_out) || (i >= total_segs)) {
-            /* pkts_out[0] will be freed in the caller
-             * when -1 is returned
-             */
-            for(j=1;j<(i+1);j++)
-                /* We cannot use dpdk_pfree() since the
-                 * fragments may not have vr_packet info
-                 */
-                rte_pktmbuf_free(pkts_out[j]);
-            rte_pktmbuf_free(next_pkt);
-            return -1;
-        }
-        curr_pkt = next_pkt;
-        i++;
-    }
-    return nb_segs;
-}
-
 /*
- * Updates the pointers to TCP and IPv6 headers
+ * Header template of a super-packet: the outer headers, the inner IP
+ * header and the TCP header, as they come in the first segment of the
+ * super-packet. Every segment gets a copy of the template in a small
+ * direct mbuf, followed by indirect mbufs pointing to its share of the
+ * payload, so the payload is never copied. The fields that change from
+ * one segment to the next are patched in the copy, and the checksums
+ * covering them are updated incrementally from sums taken once over the
+ * template.
  */
-static inline void
-dpdk_gso_ipv6_tcp_update(struct rte_mbuf *m, struct dpdk_gso_state *state)
-{
-   state->ip6 = (struct rte_ipv6_hdr *)(rte_pktmbuf_mtod(m, uint8_t *) + state->mac_hlen);
-   state->tcp = (struct rte_tcp_hdr *)((uint8_t*)(state->ip6) + state->ip_hlen);
-   state->pay_len = m->pkt_len - state->hlen;
-}
+struct dpdk_gso_template {
+    uint8_t *hdr;
+    uint16_t hlen;
+    /* offsets into the template */
+    uint16_t outer_ip_off;
+    uint16_t outer_udp_off;
+    uint16_t ip_off;
+    uint16_t tcp_off;
+    uint8_t is_ipv6;
+    /* copy the inner IP id to the outer header */
+    uint8_t copy_ip_id;
+    uint16_t ip_id;
+    uint16_t mss;
+    uint32_t tcp_seq;
+    /* template sums with the checksum fields zeroed */
+    uint32_t outer_ip_sum;
+    uint32_t ip_sum;
+    uint32_t tcp_sum;
+    /* pseudo header sum without the length */
+    uint32_t phdr_sum;
+};
 
-/*
- * Update the pointers to TCP and IPv4 headers
- */
-static inline void
-dpdk_gso_ipv4_tcp_update(struct rte_mbuf *m, struct dpdk_gso_state *state)
+static inline uint16_t
+dpdk_gso_csum_fold(uint32_t sum)
 {
-   state->ip = (struct rte_ipv4_hdr *)(rte_pktmbuf_mtod(m, uint8_t *) + state->mac_hlen);
-   state->tcp = (struct rte_tcp_hdr *)((uint8_t*)(state->ip) + state->ip_hlen);
-   state->pay_len = m->pkt_len - state->hlen;
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+
+    return sum;
 }
 
 /*
- * Sets properly the TCP and IPv6 headers
+ * Add to a template sum the change of a 16 bit field (both values taken
+ * as they are in the packet). Ones complement subtraction of the old
+ * value is the addition of its complement.
  */
-static inline void
-dpdk_gso_ipv6_tcp_internal(struct rte_mbuf *m, struct dpdk_gso_state *state)
+static inline uint32_t
+dpdk_gso_csum_replace(uint32_t sum, uint16_t old, uint16_t new)
 {
-   state->ip6->payload_len = rte_cpu_to_be_16(m->pkt_len -
-                   state->mac_hlen - state->ip_hlen);
-
-    /* TCP Sequence number */
-   state->tcp->sent_seq = htonl(state->tcp_seq);
-
-   if (state->tx_cksum_offload) {
-       m->l2_len = state->mac_hlen;
-       m->l3_len = state->ip_hlen;
-       state->tcp->cksum = 0;
-       state->tcp->cksum = rte_ipv6_phdr_cksum((struct rte_ipv6_hdr *)state->ip6,
-                                                                     m->ol_flags);
-       m->ol_flags |= PKT_TX_IPV6;
-       m->ol_flags |= PKT_TX_TCP_CKSUM;
-   } else {
-       /* TCP Checksum */
-       state->tcp->cksum = 0;
-       state->tcp->cksum = rte_ipv6_udptcp_cksum((struct rte_ipv6_hdr *)state->ip6,
-                                                            (uint8_t*)state->tcp);
-   }
-   state->tcp_seq += state->pay_len;
+    return sum + (uint16_t)~old + new;
 }
 
-/*
- * Set properly the TCP and IPv4 headers
- */
-static inline void
-dpdk_gso_ipv4_tcp_internal(struct rte_mbuf *m, struct dpdk_gso_state *state)
+static inline uint32_t
+dpdk_gso_csum_replace32(uint32_t sum, uint32_t old, uint32_t new)
 {
-    /* Update IP header */
-   state->ip->packet_id = rte_cpu_to_be_16((state->ip_id)++);
-   state->ip->total_length = rte_cpu_to_be_16(m->pkt_len - state->mac_hlen);
-
-    /* TCP Sequence number */
-   state->tcp->sent_seq = htonl(state->tcp_seq);
-
-   if (state->tx_cksum_offload) {
-       m->l2_len = state->mac_hlen;
-       m->l3_len = state->ip_hlen;
-       state->ip->hdr_checksum = 0;
-       state->tcp->cksum = 0;
-       state->tcp->cksum = rte_ipv4_phdr_cksum((struct rte_ipv4_hdr *)state->ip,
-                                                                     m->ol_flags);
-       m->ol_flags |= PKT_TX_IP_CKSUM | PKT_TX_IPV4;
-       m->ol_flags |= PKT_TX_TCP_CKSUM;
-   } else {
-       /* TCP Checksum */
-       state->tcp->cksum = 0;
-       state->tcp->cksum = rte_ipv4_udptcp_cksum((struct rte_ipv4_hdr *)state->ip,
-                                                            (uint8_t*)state->tcp);
-       /* IP Checksum */
-       state->ip->hdr_checksum = 0;
-       state->ip->hdr_checksum = rte_ipv4_cksum(state->ip);
-   }
-   state->tcp_seq += state->pay_len;
+    sum = dpdk_gso_csum_replace(sum, old >> 16, new >> 16);
+    return dpdk_gso_csum_replace(sum, old & 0xffff, new & 0xffff);
 }
 
-/*
- * Init the state during the TCP segmentation
- */
-static int
-dpdk_gso_init_state(struct dpdk_gso_state *state,
-                   struct rte_mbuf *m, int mac_hlen, int isipv6, int hw_cksum)
+/* Sum of a header with its checksum field taken as zero */
+static inline uint32_t
+dpdk_gso_hdr_sum(const void *hdr, uint16_t len, const uint16_t *csum)
 {
-   uint32_t ip_hlen;
-
-   if (isipv6) {
-       ip_hlen = sizeof(struct rte_ipv6_hdr);
-       state->ip6 = (struct rte_ipv6_hdr *)(rte_pktmbuf_mtod(m, uint8_t *) + mac_hlen);
-       if (state->ip6->proto != VR_IP_PROTO_TCP)
-           return -1;
-       state->tcp = (struct rte_tcp_hdr *)((uint8_t*)(state->ip6) + ip_hlen);
-       state->update = dpdk_gso_ipv6_tcp_update;
-       state->internal = dpdk_gso_ipv6_tcp_internal;
-   } else {
-       state->ip = (struct rte_ipv4_hdr *)(rte_pktmbuf_mtod(m, uint8_t *) + mac_hlen);
-       state->ip_id = rte_be_to_cpu_16(state->ip->packet_id);
-       ip_hlen = ((state->ip->version_ihl) & 0xf) << 2;
-       if (state->ip->next_proto_id != VR_IP_PROTO_TCP)
-           return -1;
-       state->tcp = (struct rte_tcp_hdr *)((uint8_t*)state->ip + ip_hlen);
-       state->update = dpdk_gso_ipv4_tcp_update;
-       state->internal = dpdk_gso_ipv4_tcp_internal;
-   }
-
-   state->tx_cksum_offload = hw_cksum;
-   state->mac_hlen = mac_hlen;
-   state->ip_hlen = ip_hlen;
-   state->tcp_hlen = ((state->tcp->data_off & 0xf0) >> 4) << 2;
-   state->hlen = mac_hlen + ip_hlen + state->tcp_hlen;
-   state->tcp_seq = ntohl(state->tcp->sent_seq);
-   return 0;
+    return rte_raw_cksum(hdr, len) + (uint16_t)~*csum;
 }
 
-/*
- * GSO on TCP/IP (v4 or v6)
- */
 static int
-dpdk_gso_segment_ip_tcp(struct rte_mbuf *pkt_in,
-                        struct dpdk_gso_state *state,
-                        struct rte_mbuf **mbufs_out,
-                        const unsigned short nb_pkts_out,
-                        uint16_t mss_size)
+dpdk_gso_template_init(struct dpdk_gso_template *tmpl, struct rte_mbuf *m,
+        uint16_t outer_len, uint16_t mss, unsigned short vp_type)
 {
-    int i = 0, nsegs = 0;
-
-    /* Check that pkts_out is big enough to hold all segments */
-    if (unlikely(mss_size * nb_pkts_out <
-        (uint16_t)(pkt_in->pkt_len - state->hlen)))
-        return -EINVAL;
-
-    nsegs = dpdk_split_chained_mbuf(pkt_in, mbufs_out, nb_pkts_out,
-                  state->hlen, mss_size);
-
-    if (nsegs < 0)
-        goto err;
-
-    while (i < nsegs)
-    {
-        state->update(mbufs_out[i], state);
-
-        /* Update TCP flags -
-         * => Retain CWR only in the first segment and mask in the rest of
-         *  the segments
-         * => FIN and PSH flags are only applicable to the last segment
-         */
-        if (state->tcp) {
-            if (i > 0)
-                state->tcp->tcp_flags &= ~RTE_TCP_CWR_FLAG;
-            if (i < nsegs-1)
-                state->tcp->tcp_flags &= ~(RTE_TCP_FIN_FLAG | RTE_TCP_PSH_FLAG);
-        }
+    uint16_t ip_hlen, tcp_hlen;
+    struct vr_ip *outer_ip, *ip = NULL;
+    struct vr_ip6 *ip6 = NULL;
+    struct vr_tcp *tcp;
+
+    memset(tmpl, 0, sizeof(*tmpl));
+    tmpl->hdr = rte_pktmbuf_mtod(m, uint8_t *);
+    tmpl->ip_off = outer_len;
+    tmpl->mss = mss;
+    tmpl->is_ipv6 = (vp_type == VP_TYPE_IP6OIP);
+
+    if (tmpl->is_ipv6) {
+        ip6 = (struct vr_ip6 *)(tmpl->hdr + outer_len);
+        if (ip6->ip6_nxt != VR_IP_PROTO_TCP)
+            return -1;
+        ip_hlen = sizeof(struct vr_ip6);
+    } else {
+        ip = (struct vr_ip *)(tmpl->hdr + outer_len);
+        if (ip->ip_proto != VR_IP_PROTO_TCP)
+            return -1;
+        ip_hlen = ip->ip_hl << 2;
+    }
 
-        state->internal(mbufs_out[i], state);
+    tmpl->tcp_off = outer_len + ip_hlen;
+    tcp = (struct vr_tcp *)(tmpl->hdr + tmpl->tcp_off);
+    tcp_hlen = VR_TCP_OFFSET(tcp->tcp_offset_r_flags) << 2;
+    tmpl->hlen = tmpl->tcp_off + tcp_hlen;
+    /* the headers have to sit in the first segment */
+    if (tmpl->hlen > rte_pktmbuf_data_len(m))
+        return -1;
 
-        i++;
+    tmpl->outer_ip_off = dpdk_get_ether_header_len(tmpl->hdr);
+    outer_ip = (struct vr_ip *)(tmpl->hdr + tmpl->outer_ip_off);
+    if (outer_ip->ip_proto == VR_IP_PROTO_UDP)
+        tmpl->outer_udp_off = tmpl->outer_ip_off + (outer_ip->ip_hl << 2);
+    tmpl->outer_ip_sum = dpdk_gso_hdr_sum(outer_ip, outer_ip->ip_hl << 2,
+            &outer_ip->ip_csum);
+
+    tmpl->tcp_seq = rte_be_to_cpu_32(tcp->tcp_seq);
+    tmpl->tcp_sum = dpdk_gso_hdr_sum(tcp, tcp_hlen, &tcp->tcp_csum);
+
+    if (tmpl->is_ipv6) {
+        tmpl->phdr_sum = rte_raw_cksum(ip6->ip6_src, 2 * VR_IP6_ADDRESS_LEN);
+    } else {
+        /* Copy inner IP id to outer. Currently, the Agent diagnostics
+         * depends on that. */
+        tmpl->copy_ip_id = (vp_type == VP_TYPE_IPOIP);
+        tmpl->ip_id = rte_be_to_cpu_16(ip->ip_id);
+        tmpl->ip_sum = dpdk_gso_hdr_sum(ip, ip_hlen, &ip->ip_csum);
+        tmpl->phdr_sum = rte_raw_cksum(&ip->ip_saddr, 2 * sizeof(ip->ip_saddr));
     }
+    tmpl->phdr_sum += rte_cpu_to_be_16(VR_IP_PROTO_TCP);
 
-    return nsegs;
-
-err:
-    return -1;
+    return 0;
 }
 
-static void
-dpdk_adjust_outer_header(struct rte_mbuf *m, uint16_t outer_header_len)
+/*
+ * Build segment i of n, carrying pay_len bytes of payload from (src,
+ * src_off) on. The source position is advanced past the payload.
+ */
+static struct rte_mbuf *
+dpdk_gso_build_segment(struct dpdk_gso_template *tmpl, struct rte_mbuf *mbuf_in,
+        struct rte_mbuf **src, uint16_t *src_off, uint16_t pay_len,
+        int i, int n, int hw_cksum)
 {
-    struct vr_packet *pkt = vr_dpdk_mbuf_to_pkt(m);
-    struct vr_ip *inner_ip = NULL;
-
-    if (pkt->vp_type == VP_TYPE_IPOIP)
-        inner_ip = rte_pktmbuf_mtod(m, struct vr_ip *);
+    uint8_t *hdr;
+    uint16_t len, left, tcp_len, old, flags, payload_sum = 0;
+    uint32_t sum, seq;
+    struct rte_mbuf *m, *ind, *prev;
+    struct vr_ip *outer_ip, *ip;
+    struct vr_ip6 *ip6;
+    struct vr_udp *udp;
+    struct vr_tcp *tcp;
+
+    m = rte_pktmbuf_alloc(vr_dpdk.frag_direct_mempool);
+    if (unlikely(m == NULL))
+        return NULL;
+    if (unlikely(tmpl->hlen > m->buf_len)) {
+        rte_pktmbuf_free(m);
+        return NULL;
+    }
 
-    /* Outer header operations */
-    char *outer_header_ptr = rte_pktmbuf_prepend(m, outer_header_len);
+    /* headers at the end of the buffer leave all of it as headroom */
+    m->data_off = m->buf_len - tmpl->hlen;
+    m->data_len = tmpl->hlen;
+    hdr = rte_pktmbuf_mtod(m, uint8_t *);
+    rte_memcpy(hdr, tmpl->hdr, tmpl->hlen);
+
+    /* attach the payload */
+    prev = m;
+    for (left = pay_len; left; left -= len) {
+        ind = rte_pktmbuf_alloc(vr_dpdk.frag_indirect_mempool);
+        if (unlikely(ind == NULL)) {
+            rte_pktmbuf_free(m);
+            return NULL;
+        }
+        rte_pktmbuf_attach(ind, *src);
+        len = RTE_MIN(left, rte_pktmbuf_data_len(*src) - *src_off);
+        ind->data_off += *src_off;
+        ind->data_len = len;
+        ind->pkt_len = len;
+        prev->next = ind;
+        prev = ind;
+        m->nb_segs++;
+
+        *src_off += len;
+        if (*src_off == rte_pktmbuf_data_len(*src)) {
+            *src = (*src)->next;
+            *src_off = 0;
+        }
+    }
+    m->pkt_len = tmpl->hlen + pay_len;
+    tcp_len = m->pkt_len - tmpl->tcp_off;
+
+    /* TCP: sequence number and flags */
+    tcp = (struct vr_tcp *)(hdr + tmpl->tcp_off);
+    seq = rte_cpu_to_be_32(tmpl->tcp_seq);
+    tcp->tcp_seq = rte_cpu_to_be_32(tmpl->tcp_seq + (uint32_t)i * tmpl->mss);
+    sum = dpdk_gso_csum_replace32(tmpl->tcp_sum, seq, tcp->tcp_seq);
+    /*
+     * Retain CWR only in the first segment, FIN and PSH are only
+     * applicable to the last segment
+     */
+    old = tcp->tcp_offset_r_flags;
+    flags = rte_be_to_cpu_16(old);
+    if (i > 0)
+        flags &= ~RTE_TCP_CWR_FLAG;
+    if (i < n - 1)
+        flags &= ~(RTE_TCP_FIN_FLAG | RTE_TCP_PSH_FLAG);
+    tcp->tcp_offset_r_flags = rte_cpu_to_be_16(flags);
+    sum = dpdk_gso_csum_replace(sum, old, tcp->tcp_offset_r_flags);
+
+    /* inner IP */
+    if (tmpl->is_ipv6) {
+        ip6 = (struct vr_ip6 *)(hdr + tmpl->ip_off);
+        ip6->ip6_plen = rte_cpu_to_be_16(tcp_len);
+    } else {
+        ip = (struct vr_ip *)(hdr + tmpl->ip_off);
+        old = ip->ip_len;
+        ip->ip_len = rte_cpu_to_be_16(m->pkt_len - tmpl->ip_off);
+        ip->ip_id = rte_cpu_to_be_16(tmpl->ip_id + i);
+        if (hw_cksum) {
+            ip->ip_csum = 0;
+        } else {
+            ip->ip_csum = ~dpdk_gso_csum_fold(
+                    dpdk_gso_csum_replace(
+                        dpdk_gso_csum_replace(tmpl->ip_sum, old, ip->ip_len),
+                        rte_cpu_to_be_16(tmpl->ip_id), ip->ip_id));
+        }
+    }
 
-    uint16_t eth_hlen = dpdk_get_ether_header_len(outer_header_ptr);
-    struct vr_ip *outer_ip = (struct vr_ip *)(outer_header_ptr + eth_hlen);
-    outer_ip->ip_len = rte_cpu_to_be_16(rte_pktmbuf_pkt_len(m) - eth_hlen);
+    /* inner TCP checksum, over a payload that differs per segment */
+    if (hw_cksum) {
+        m->l2_len = tmpl->ip_off;
+        m->l3_len = tmpl->tcp_off - tmpl->ip_off;
+        tcp->tcp_csum = dpdk_gso_csum_fold(tmpl->phdr_sum +
+                rte_cpu_to_be_16(tcp_len));
+        m->ol_flags |= tmpl->is_ipv6 ? PKT_TX_IPV6 :
+            (PKT_TX_IP_CKSUM | PKT_TX_IPV4);
+        m->ol_flags |= PKT_TX_TCP_CKSUM;
+    } else {
+        if (pay_len && rte_raw_cksum_mbuf(m, tmpl->hlen, pay_len,
+                    &payload_sum) < 0) {
+            rte_pktmbuf_free(m);
+            return NULL;
+        }
+        sum += tmpl->phdr_sum + rte_cpu_to_be_16(tcp_len) + payload_sum;
+        tcp->tcp_csum = ~dpdk_gso_csum_fold(sum);
+        if (tcp->tcp_csum == 0)
+            tcp->tcp_csum = 0xffff;
+    }
 
-    /* Copy inner IP id to outer. Currently, the Agent diagnostics depends
-     * on that. */
-    if (inner_ip)
-        outer_ip->ip_id = inner_ip->ip_id;
+    /* outer IP and UDP */
+    outer_ip = (struct vr_ip *)(hdr + tmpl->outer_ip_off);
+    old = outer_ip->ip_len;
+    outer_ip->ip_len = rte_cpu_to_be_16(m->pkt_len - tmpl->outer_ip_off);
+    sum = dpdk_gso_csum_replace(tmpl->outer_ip_sum, old, outer_ip->ip_len);
+    old = outer_ip->ip_id;
+    if (tmpl->copy_ip_id)
+        outer_ip->ip_id = rte_cpu_to_be_16(tmpl->ip_id + i);
     else
         outer_ip->ip_id = rte_cpu_to_be_16(vr_generate_unique_ip_id());
+    sum = dpdk_gso_csum_replace(sum, old, outer_ip->ip_id);
+    outer_ip->ip_csum = ~dpdk_gso_csum_fold(sum);
 
-
-    /* Adjust UDP length to match IP segment size */
-    if (outer_ip->ip_proto == VR_IP_PROTO_UDP) {
-        unsigned header_len = outer_ip->ip_hl * 4;
-        struct vr_udp *udp = (struct vr_udp *)((char *)outer_ip +
-                header_len);
-        udp->udp_length = rte_cpu_to_be_16(
-                rte_be_to_cpu_16(outer_ip->ip_len) - header_len);
+    if (tmpl->outer_udp_off) {
+        /* Adjust UDP length to match IP segment size */
+        udp = (struct vr_udp *)(hdr + tmpl->outer_udp_off);
+        udp->udp_length = rte_cpu_to_be_16(m->pkt_len - tmpl->outer_udp_off);
     }
 
-    /* Calculate the outer header IP checksum */
-    outer_ip->ip_csum = vr_ip_csum(outer_ip);
+    m->vlan_tci = mbuf_in->vlan_tci;
+    m->ol_flags |= mbuf_in->ol_flags;
+
+    return m;
 }
 
+/*
+ * dpdk_segment_packet - software GSO of a tunneled TCP super-packet into
+ * segments of mss_size payload bytes, for NICs that can not segment
+ * tunneled packets themselves. The super-packet is left as it is, the
+ * segments only hold references to its payload, so the caller frees it
+ * once the segments are sent. Returns the number of segments or a
+ * negative error, in which case no segment is left behind.
+ */
 int
 dpdk_segment_packet(struct vr_packet *pkt, struct rte_mbuf *mbuf_in,
                  struct rte_mbuf **mbuf_out, const unsigned short out_num,
                  const unsigned short mss_size, bool do_outer_ip_csum)
 {
-    struct rte_mbuf *m;
-    struct dpdk_gso_state state;
-    int number_of_packets = 0, i;
-    uint16_t outer_header_len;
+    int i, nsegs;
+    uint16_t outer_header_len, pay_len, src_off;
+    uint32_t pay_total;
+    struct rte_mbuf *src;
+    struct dpdk_gso_template tmpl;
 
     outer_header_len = pkt_get_inner_network_header_off(pkt) -
             pkt_head_space(pkt);
 
-    if (dpdk_gso_init_state(&state, mbuf_in, outer_header_len,
-                (pkt->vp_type == VP_TYPE_IP6OIP), do_outer_ip_csum) < 0)
-        return -1;
+    if (unlikely(!mss_size))
+        return -EINVAL;
+
+    if (dpdk_gso_template_init(&tmpl, mbuf_in, outer_header_len, mss_size,
+                pkt->vp_type) < 0)
+        return -EINVAL;
+
+    pay_total = rte_pktmbuf_pkt_len(mbuf_in) - tmpl.hlen;
+    nsegs = (pay_total + mss_size - 1) / mss_size;
+    /* Check that mbuf_out is big enough to hold all segments */
+    if (unlikely(nsegs > out_num || nsegs == 0))
+        return -EINVAL;
 
-    number_of_packets = dpdk_gso_segment_ip_tcp(mbuf_in, &state, mbuf_out,
-                                                       out_num, mss_size);
-    if (number_of_packets < 0)
-        return number_of_packets;
-
-    /* Adjust outer and inner IP headers for each segmented packets */
-    for (i = 0; i < number_of_packets; i++)
-    {
-        m = mbuf_out[i];
-        /* Get into the inner IP header */
-        rte_pktmbuf_adj(m, outer_header_len);
-        dpdk_adjust_outer_header(m, outer_header_len);
-        m->l2_len = mbuf_in->l2_len;
-        m->l3_len = mbuf_in->l3_len;
-        m->vlan_tci = mbuf_in->vlan_tci;
-        m->ol_flags |= mbuf_in->ol_flags;
+    /* fits in a single segment, send the packet as it is */
+    if (nsegs == 1) {
+        mbuf_out[0] = mbuf_in;
+        return 1;
     }
 
-    return number_of_packets;
+    /* the payload starts right after the headers, in the first segment */
+    src = mbuf_in;
+    src_off = tmpl.hlen;
+    if (src_off == rte_pktmbuf_data_len(src)) {
+        src = src->next;
+        src_off = 0;
+    }
+
+    for (i = 0; i < nsegs; i++) {
+        pay_len = RTE_MIN(pay_total - (uint32_t)i * mss_size, mss_size);
+        mbuf_out[i] = dpdk_gso_build_segment(&tmpl, mbuf_in, &src, &src_off,
+                pay_len, i, nsegs, do_outer_ip_csum);
+        if (unlikely(mbuf_out[i] == NULL))
+            goto err;
+    }
+
+    return nsegs;
+
+err:
+    /* We cannot use dpdk_pfree() since the segments have no vr_packet */
+    while (--i >= 0)
+        rte_pktmbuf_free(mbuf_out[i]);
+
+    return -ENOMEM;
 }
@@ -15,6 +15,7 @@
  */
 
 #include "vr_dpdk.h"
+#include "vr_dpdk_capture.h"
 #include "vr_fragment.h"
 #include "vr_hash.h"
 #include "vr_proto.h"
@@ -173,9 +174,11 @@ dpdk_palloc(unsigned int size)
 
     /* in DPDK we have fixed-sized mbufs only */
     RTE_VERIFY(size <= vr_packet_sz);
-    m = rte_pktmbuf_alloc(vr_dpdk.rss_mempool);
-    if (!m)
+    m = rte_pktmbuf_alloc(vr_dpdk_rss_mempool_local());
+    if (!m) {
+        vr_dpdk_mempool_nombuf(VR_DPDK_MEMPOOL_RSS);
         return (NULL);
+    }
 
     return vr_dpdk_packet_get(m, NULL);
 }
@@ -201,6 +204,7 @@ dpdk_pfree(struct vr_packet *pkt, unsigned short reason)
     if (pkt) {
         /* Handle Vrouter statistics */
         pkt_drop_stats(pkt->vp_if, reason, rte_lcore_id());
+        vr_dpdk_capture_drop(pkt, reason);
 
         rte_pktmbuf_free(vr_dpdk_pkt_to_mbuf(pkt));
     }
@@ -347,8 +351,10 @@ vr_dpdk_pktmbuf_copy_mon(struct rte_mbuf *md, struct rte_mempool *mp)
     char *append_ptr;
     uint32_t append_len;
 
-    if (unlikely ((mc = rte_pktmbuf_alloc(mp)) == NULL))
+    if (unlikely ((mc = rte_pktmbuf_alloc(mp)) == NULL)) {
+        vr_dpdk_mempool_nombuf(VR_DPDK_MEMPOOL_COPY);
         return (NULL);
+    }
 
     dpdk_pktmbuf_data_copy(mc, md);
     mc->pkt_len = md->data_len;
@@ -381,9 +387,11 @@ dpdk_pclone(struct vr_packet *pkt)
 
     m = vr_dpdk_pkt_to_mbuf(pkt);
 
-    m_clone = rte_pktmbuf_clone(m, vr_dpdk.rss_mempool);
-    if (!m_clone)
+    m_clone = rte_pktmbuf_clone(m, vr_dpdk.clone_mempool);
+    if (!m_clone) {
+        vr_dpdk_mempool_nombuf(VR_DPDK_MEMPOOL_CLONE);
         return NULL;
+    }
 
     /* clone vr_packet data */
     pkt_clone = vr_dpdk_mbuf_to_pkt(m_clone);
@@ -806,8 +814,10 @@ dpdk_pcow(struct vr_packet **pktp, unsigned short head_room)
      * its data. Then free the original mbuf.
      */
     if (RTE_MBUF_CLONED(mbuf)) {
-        m_copy = vr_dpdk_pktmbuf_copy(mbuf, mbuf->pool);
+        /* the clone mempool has no buffers, so copy to the RSS mempool */
+        m_copy = vr_dpdk_pktmbuf_copy(mbuf, vr_dpdk_rss_mempool_local());
         if (!m_copy) {
+            vr_dpdk_mempool_nombuf(VR_DPDK_MEMPOOL_RSS);
             return -ENOMEM;
         }
 
@@ -824,8 +834,9 @@ dpdk_pcow(struct vr_packet **pktp, unsigned short head_room)
 
         /* When requested headroom is higher than configured pktmuf_headroom,
          * Create a new memory buffer and link to the old mbuf */
-        mbuf_new = rte_pktmbuf_alloc(vr_dpdk.rss_mempool);
+        mbuf_new = rte_pktmbuf_alloc(vr_dpdk_rss_mempool_local());
         if (!mbuf_new) {
+            vr_dpdk_mempool_nombuf(VR_DPDK_MEMPOOL_RSS);
             return -ENOMEM;
         }
 
@@ -846,6 +857,156 @@ dpdk_pcow(struct vr_packet **pktp, unsigned short head_room)
     return 0;
 }
 
+/*
+ * dpdk_pclone_hdr - clone a packet for replication, so the replica gets
+ * a private writable copy of the packet headers with at least head_room
+ * bytes of headroom, while the rest of the payload is shared with the
+ * original packet by reference (indirect mbufs).
+ *
+ * Unlike vr_pclone() followed by vr_pcow(), the payload is never copied,
+ * so N replicas cost N header copies.
+ *
+ * Returns the replica on success, NULL otherwise.
+ */
+static struct vr_packet *
+dpdk_pclone_hdr(struct vr_packet *pkt, unsigned short head_room)
+{
+    struct rte_mbuf *m, *m_hdr, *m_payload = NULL, *seg;
+    struct vr_packet *pkt_hdr;
+    unsigned short copy_start, copy_end;
+
+    m = vr_dpdk_pkt_to_mbuf(pkt);
+
+    /*
+     * Keep the same data offsets in the header mbuf, so the network header
+     * offsets of the vr_packet stay valid. Fall back to the full copy if
+     * the headroom is not enough.
+     */
+    if (unlikely(pkt->vp_data < head_room
+                || pkt->vp_tail > m->buf_len
+                || pkt->vp_data > pkt->vp_tail
+                || pkt->vp_data + VR_DPDK_MCAST_HDR_COPY_SZ >
+                        rte_pktmbuf_data_room_size(vr_dpdk.hdr_mempool))) {
+        pkt_hdr = dpdk_pclone(pkt);
+        if (pkt_hdr == NULL)
+            return NULL;
+        if (dpdk_pcow(&pkt_hdr, head_room)) {
+            dpdk_pfree(pkt_hdr, VP_DROP_PCOW_FAIL);
+            return NULL;
+        }
+        return pkt_hdr;
+    }
+
+    copy_start = RTE_MIN(m->data_off, pkt->vp_data);
+    copy_end = pkt->vp_tail;
+    if (pkt->vp_tail - pkt->vp_data > VR_DPDK_MCAST_HDR_COPY_SZ)
+        copy_end = pkt->vp_data + VR_DPDK_MCAST_HDR_COPY_SZ;
+
+    /* Share the rest of the first segment and all the other segments. */
+    if (copy_end < pkt->vp_tail) {
+        m_payload = rte_pktmbuf_clone(m, vr_dpdk.clone_mempool);
+        if (unlikely(m_payload == NULL)) {
+            vr_dpdk_mempool_nombuf(VR_DPDK_MEMPOOL_CLONE);
+            return NULL;
+        }
+        m_payload->data_off = copy_end;
+        m_payload->data_len = pkt->vp_tail - copy_end;
+    } else if (m->next != NULL) {
+        m_payload = rte_pktmbuf_clone(m->next, vr_dpdk.clone_mempool);
+        if (unlikely(m_payload == NULL)) {
+            vr_dpdk_mempool_nombuf(VR_DPDK_MEMPOOL_CLONE);
+            return NULL;
+        }
+    }
+
+    m_hdr = rte_pktmbuf_alloc(vr_dpdk.hdr_mempool);
+    if (unlikely(m_hdr == NULL)) {
+        vr_dpdk_mempool_nombuf(VR_DPDK_MEMPOOL_HDR);
+        rte_pktmbuf_free(m_payload);
+        return NULL;
+    }
+
+    m_hdr->port = m->port;
+    m_hdr->ol_flags = m->ol_flags;
+#ifdef IND_ATTACHED_MBUF
+    m_hdr->ol_flags &= (~IND_ATTACHED_MBUF);
+#endif
+    m_hdr->packet_type = m->packet_type;
+    m_hdr->vlan_tci = m->vlan_tci;
+    m_hdr->hash = m->hash;
+    m_hdr->tx_offload = m->tx_offload;
+    m_hdr->data_off = copy_start;
+    m_hdr->data_len = copy_end - copy_start;
+    rte_memcpy(rte_pktmbuf_mtod(m_hdr, void *),
+            (char *)m->buf_addr + copy_start, copy_end - copy_start);
+
+    m_hdr->next = m_payload;
+    m_hdr->nb_segs = 1;
+    m_hdr->pkt_len = m_hdr->data_len;
+    for (seg = m_payload; seg != NULL; seg = seg->next) {
+        m_hdr->nb_segs++;
+        m_hdr->pkt_len += seg->data_len;
+    }
+
+    /* clone vr_packet data */
+    pkt_hdr = vr_dpdk_mbuf_to_pkt(m_hdr);
+    *pkt_hdr = *pkt;
+    pkt_hdr->vp_head = m_hdr->buf_addr;
+    pkt_hdr->vp_tail = copy_end;
+    pkt_hdr->vp_len = copy_end - pkt->vp_data;
+    pkt_hdr->vp_end = m_hdr->buf_len;
+    pkt_hdr->vp_cpu = vr_get_cpu();
+
+    return pkt_hdr;
+}
+
+/*
+ * dpdk_ptrim - trim the packet to len bytes starting at the packet data.
+ * The segments past the length get freed, so the trimmed data is never
+ * copied by the following vr_pcow().
+ *
+ * Returns 0 on success, -EINVAL otherwise.
+ */
+static int
+dpdk_ptrim(struct vr_packet *pkt, unsigned int len)
+{
+    struct rte_mbuf *m, *seg;
+
+    if (len >= pkt_len(pkt))
+        return 0;
+
+    m = vr_dpdk_pkt_to_mbuf(pkt);
+    if (len <= pkt->vp_len) {
+        pkt->vp_len = len;
+        pkt->vp_tail = pkt->vp_data + len;
+        seg = m;
+    } else {
+        /* the first segment length is in vp_len */
+        len -= pkt->vp_len;
+        for (seg = m->next; seg != NULL; seg = seg->next) {
+            if (len <= seg->data_len)
+                break;
+            len -= seg->data_len;
+        }
+        if (unlikely(seg == NULL))
+            return -EINVAL;
+        seg->data_len = len;
+    }
+
+    rte_pktmbuf_free(seg->next);
+    seg->next = NULL;
+
+    /* the mbuf packet length is synced with vp_len on TX */
+    m->nb_segs = 1;
+    m->pkt_len = m->data_len;
+    for (seg = m->next; seg != NULL; seg = seg->next) {
+        m->nb_segs++;
+        m->pkt_len += seg->data_len;
+    }
+
+    return 0;
+}
+
 /*
  * dpdk_get_udp_src_port - return a source port for the outer UDP header.
  * The source port is based on a hash of the inner IP source/dest addresses,
@@ -1389,6 +1550,8 @@ struct host_os dpdk_host = {
     .hos_pfree                      =    dpdk_pfree,
     .hos_preset                     =    dpdk_preset,
     .hos_pclone                     =    dpdk_pclone,
+    .hos_pclone_hdr                 =    dpdk_pclone_hdr,
+    .hos_ptrim                      =    dpdk_ptrim,
     .hos_pcopy                      =    dpdk_pcopy,
     .hos_pfrag_len                  =    dpdk_pfrag_len,
     .hos_phead_len                  =    dpdk_phead_len,
@@ -1422,6 +1585,8 @@ struct host_os dpdk_host = {
     .hos_del_mpls                   =    dpdk_del_mpls, /* not implemented */
     .hos_enqueue_to_assembler       =    dpdk_fragment_assembler_enqueue,
     .hos_fragment_sync_assemble     =    dpdk_fragment_sync_assemble,
+    .hos_enqueue_head_to_assembler  =    dpdk_fragment_assembler_enqueue_head,
+    .hos_repl_enqueue               =    vr_dpdk_lcore_repl_enqueue,
     .hos_set_log_level              =    dpdk_set_log_level,
     .hos_set_log_type               =    dpdk_set_log_type,
     .hos_get_log_level              =    dpdk_get_log_level,
@@ -1618,6 +1783,10 @@ vr_dpdk_host_init(void)
         return ret;
     }
 
+    ret = vr_dpdk_stats_mem_init();
+    if (ret)
+        return ret;
+
     ret = vrouter_init();
     if (ret)
         return ret;
@@ -528,11 +528,37 @@ walk_cb(struct rte_mempool *mp, void *arg __rte_unused)
     return;
 }
 
+/* Names of the mempool purposes */
+static const char *mempool_purposes[VR_DPDK_MEMPOOL_MAX] = {
+    [VR_DPDK_MEMPOOL_RSS]   = "rss",
+    [VR_DPDK_MEMPOOL_CLONE] = "clone",
+    [VR_DPDK_MEMPOOL_HDR]   = "hdr",
+    [VR_DPDK_MEMPOOL_COPY]  = "copy",
+};
+
+/* Returns the mempool of the given purpose */
+static struct rte_mempool *
+dpdk_info_mempool_get(enum vr_dpdk_mempool_purpose purpose)
+{
+    switch (purpose) {
+    case VR_DPDK_MEMPOOL_RSS:
+        return vr_dpdk.rss_mempool;
+    case VR_DPDK_MEMPOOL_CLONE:
+        return vr_dpdk.clone_mempool;
+    case VR_DPDK_MEMPOOL_HDR:
+        return vr_dpdk.hdr_mempool;
+    case VR_DPDK_MEMPOOL_COPY:
+        return vr_dpdk.copy_mempool;
+    default:
+        return NULL;
+    }
+}
+
 int
 dpdk_info_get_mempool(VR_INFO_ARGS)
 {
-    int reqd_mempool = 0;
-    struct rte_mempool *mp = NULL;
+    int i, reqd_mempool = 0;
+    struct rte_mempool *mp = NULL, *purpose_mp;
     struct rte_mempool_memhdr *memhdr;
     unsigned lcore_id = 0, common_count = 0, cache_count = 0, count = 0;
     size_t mem_len = 0;
@@ -601,7 +627,14 @@ dpdk_info_get_mempool(VR_INFO_ARGS)
         if ((cache_count + common_count) > mp->size) {
             common_count = mp->size - cache_count;
         }
-        VI_PRINTF("common_pool_count=%u\n\n", common_count);
+        VI_PRINTF("common_pool_count=%u\n", common_count);
+        for (i = 0; i < VR_DPDK_MEMPOOL_MAX; i++) {
+            if (dpdk_info_mempool_get(i) == mp) {
+                VI_PRINTF("nombufs=%" PRId64 "\n",
+                    rte_atomic64_read(&vr_dpdk.mempool_nombufs[i]));
+            }
+        }
+        VI_PRINTF("\n");
         break;
 
     case 1:
@@ -612,6 +645,21 @@ dpdk_info_get_mempool(VR_INFO_ARGS)
         VI_PRINTF("%s\n", seperator);
         rte_mempool_walk(walk_cb, msg_req);
         VI_PRINTF("\n\n");
+
+        /* Mempool pressure per purpose */
+        VI_PRINTF("%s\n", seperator);
+        VI_PRINTF("Purpose\t\tName\t\t\tAvailable\tNombufs\n");
+        VI_PRINTF("%s\n", seperator);
+        for (i = 0; i < VR_DPDK_MEMPOOL_MAX; i++) {
+            purpose_mp = dpdk_info_mempool_get(i);
+            if (purpose_mp == NULL)
+                continue;
+            VI_PRINTF("%-8s\t%-20s\t%u\t\t%" PRId64 "\n",
+                mempool_purposes[i], purpose_mp->name,
+                rte_mempool_avail_count(purpose_mp),
+                rte_atomic64_read(&vr_dpdk.mempool_nombufs[i]));
+        }
+        VI_PRINTF("\n");
         break;
 
     }
@@ -1069,6 +1117,21 @@ dpdk_info_get_lcore(VR_INFO_ARGS)
     for (i = 0; i < vr_dpdk.nb_fwd_lcores; i++) {
         VI_PRINTF("Lcore %d: \n",  (VR_DPDK_FWD_LCORE_ID + i));
         lcore = vr_dpdk.lcores[VR_DPDK_FWD_LCORE_ID + i];
+        VI_PRINTF("\tSocket: %u, Remote mbufs: %" PRIu64 "\n",
+            rte_lcore_to_socket_id(VR_DPDK_FWD_LCORE_ID + i),
+            lcore->lcore_remote_mbufs);
+        VI_PRINTF("\tGRO: Open flows: %u, Flows: %" PRIu64
+            ", Segments: %" PRIu64 ", Bad checksum: %" PRIu64
+            ", Chained: %" PRIu64 ", IPv6 ext headers: %" PRIu64 "\n",
+            lcore->gro.gro_active, lcore->gro.gro_flows,
+            lcore->gro.gro_queued, lcore->gro.gro_bad_csum,
+            lcore->gro.gro_chained, lcore->gro.gro_ipv6_ext);
+        VI_PRINTF("\tGRO flushes: %" PRIu64 ", Timeout: %" PRIu64
+            ", Evicted: %" PRIu64 ", Overflow: %" PRIu64
+            ", Unmergeable: %" PRIu64 "\n",
+            lcore->gro.gro_flushed, lcore->gro.gro_flush_inactive_flows,
+            lcore->gro.gro_flush_evicted, lcore->gro.gro_flush_overflow,
+            lcore->gro.gro_flush_unmergeable);
         SLIST_FOREACH(rx_queue, &lcore->lcore_rx_head, q_next) {
             name = rx_queue->q_vif->vif_name;
             VI_PRINTF("\tInterface: %-20s", name);
@@ -1081,6 +1144,58 @@ dpdk_info_get_lcore(VR_INFO_ARGS)
     return 0;
 }
 
+int
+dpdk_info_get_qos(VR_INFO_ARGS)
+{
+    unsigned int i, tc, q;
+    struct vr_dpdk_qos_sched *sched;
+    struct vr_dpdk_qos_tc *tcp;
+    struct vr_dpdk_qos_queue *qp;
+
+    VR_INFO_BUF_INIT();
+
+    if (!vr_dpdk_qos_sched_rate) {
+        VI_PRINTF("Egress scheduler is disabled\n");
+        return 0;
+    }
+
+    VI_PRINTF("Egress scheduler rate: %u Mbps\n\n", vr_dpdk_qos_sched_rate);
+
+    for (i = 0; i < VR_DPDK_QOS_MAX_SCHEDS; i++) {
+        sched = vr_dpdk.qos_scheds[i];
+        if (!sched)
+            continue;
+
+        VI_PRINTF("Interface: %s, Lcore: %u, TX queue: %" PRIu16
+            ", Queued: %" PRIu32 "\n", sched->s_vif->vif_name,
+            sched->s_lcore_id, sched->s_queue_id, sched->s_nb_pkts);
+
+        for (tc = 0; tc < VR_QOS_SCHED_NUM_TC; tc++) {
+            tcp = &sched->s_tcs[tc];
+            if (tcp->tc_weight == VR_QOS_SCHED_STRICT) {
+                VI_PRINTF("\tTC %u: strict, ", tc);
+            } else {
+                VI_PRINTF("\tTC %u: weight %" PRIu8 ", ", tc, tcp->tc_weight);
+            }
+            VI_PRINTF("rate %" PRIu32 " Mbps\n", tcp->tc_mbps);
+
+            for (q = 0; q < VR_DPDK_QOS_NB_QUEUES; q++) {
+                qp = &tcp->tc_queues[q];
+                if (!qp->q_pkts && !qp->q_wred_drops && !qp->q_tail_drops)
+                    continue;
+                VI_PRINTF("\t\tQueue %u: Packets %" PRIu64 ", Bytes %" PRIu64
+                    ", WRED drops %" PRIu64 ", Tail drops %" PRIu64
+                    ", Depth %" PRIu32 "\n", q, qp->q_pkts, qp->q_bytes,
+                    qp->q_wred_drops, qp->q_tail_drops,
+                    qp->q_tail - qp->q_head);
+            }
+        }
+        VI_PRINTF("\n");
+    }
+
+    return 0;
+}
+
 int
 dpdk_info_get_app(VR_INFO_ARGS)
 {
@@ -1164,6 +1279,8 @@ dpdk_info_get_app(VR_INFO_ARGS)
         VI_PRINTF("Tapdev:\n");
         while (tapdev[k].tapdev_fd){
             VI_PRINTF("\tfd: %d", tapdev[k].tapdev_fd);
+            VI_PRINTF("\tqueues: %"PRIu16, tapdev[k].tapdev_nb_queues);
+            VI_PRINTF("\tvnet hdr: %"PRIu16, tapdev[k].tapdev_vnet_hdr_len);
             if(tapdev[k].tapdev_vif) {
                 VI_PRINTF("\tvif name: %s \n", tapdev[k].tapdev_vif->vif_name);
             }
@@ -15,6 +15,7 @@
  */
 
 #include "vr_dpdk.h"
+#include "vr_dpdk_capture.h"
 #include "vr_dpdk_netlink.h"
 #include "vr_dpdk_usocket.h"
 #include "vr_dpdk_virtio.h"
@@ -713,7 +714,8 @@ dpdk_af_packet_if_add(struct vr_interface *vif)
     }
 
     /* schedule RX/TX queues */
-    return vr_dpdk_lcore_if_schedule(vif, vr_dpdk_lcore_least_used_get(),
+    return vr_dpdk_lcore_if_schedule(vif,
+        vr_dpdk_lcore_least_used_socket_get(rte_eth_dev_socket_id(port_id)),
         ethdev->ethdev_nb_rss_queues, &vr_dpdk_ethdev_rx_queue_init,
         ethdev->ethdev_nb_tx_queues, &vr_dpdk_ethdev_tx_queue_init);
 }
@@ -875,7 +877,8 @@ dpdk_fabric_if_add(struct vr_interface *vif)
     dpdk_set_addr_vlan_filter_strip(port_id, vif);
 
     /* schedule RX/TX queues */
-    return vr_dpdk_lcore_if_schedule(vif, vr_dpdk_lcore_least_used_get(),
+    return vr_dpdk_lcore_if_schedule(vif,
+        vr_dpdk_lcore_least_used_socket_get(rte_eth_dev_socket_id(port_id)),
         ethdev->ethdev_nb_rss_queues, &vr_dpdk_ethdev_rx_queue_init,
         ethdev->ethdev_nb_tx_queues, &vr_dpdk_ethdev_tx_queue_init);
 }
@@ -980,9 +983,13 @@ dpdk_vhost_if_add(struct vr_interface *vif)
     /* We use few single-producer rings, so we assign TX queue to each lcore */
     nb_txqs = (uint16_t)-1;
 
-    /* Schedule the TAP interface with 1 RX queue and unlimited TX queues. */
+    /*
+     * Schedule the TAP interface with an RX queue per TAP queue and
+     * unlimited TX queues.
+     */
     ret = vr_dpdk_lcore_if_schedule(vif, vr_dpdk_lcore_least_used_get(),
-            1, &vr_dpdk_tapdev_rx_queue_init,
+            ((struct vr_dpdk_tapdev *)vif->vif_os)->tapdev_nb_queues,
+            &vr_dpdk_tapdev_rx_queue_init,
             nb_txqs, &vr_dpdk_tapdev_tx_queue_init);
 
     return ret;
@@ -1652,6 +1659,8 @@ dpdk_if_tx(struct vr_interface *vif, struct vr_packet *pkt)
     m->pkt_len = pkt_len(pkt);
     m->data_len = pkt_head_len(pkt);
 
+    vr_dpdk_capture_burst(vif, &m, 1, VR_DPDK_CAPTURE_OUT);
+
     if (unlikely(vif->vif_type == VIF_TYPE_AGENT)) {
         ret = rte_ring_mp_enqueue(vr_dpdk.packet_ring, m);
         if (likely(ret == 0)) {
@@ -1779,6 +1788,10 @@ dpdk_if_tx(struct vr_interface *vif, struct vr_packet *pkt)
     rte_pktmbuf_dump(stdout, m, 0x60);
 #endif
 
+    /* tag the packet with its traffic class for the egress scheduler */
+    if (unlikely(vr_dpdk_qos_sched_rate && vif_is_fabric(vif)))
+        vr_dpdk_qos_sched_mark(m, pkt);
+
     if (unlikely(will_segment)) {
         num_of_segs = dpdk_segment_packet(pkt, m, mbufs_segs_out,
                 VR_DPDK_FRAG_MAX_IP_SEGS, m->tso_segsz,
@@ -1803,13 +1816,20 @@ dpdk_if_tx(struct vr_interface *vif, struct vr_packet *pkt)
         }
     }
 
+    if (unlikely(vr_dpdk_qos_sched_rate && vif_is_fabric(vif))) {
+        for (i = 0; num_of_frags > 1 && i < num_of_frags; i++)
+            mbufs_frags_out[i]->hash.usr = m->hash.usr;
+        for (i = 0; num_of_segs > 1 && i < num_of_segs; i++)
+            mbufs_segs_out[i]->hash.usr = m->hash.usr;
+    }
+
     if (unlikely(vif->vif_flags & VIF_FLAG_MONITORED)) {
         monitoring_tx_queue = &lcore->lcore_tx_queues[vr_dpdk.monitorings[vif_idx]][0];
         if (likely(monitoring_tx_queue && monitoring_tx_queue->txq_ops.f_tx)) {
             if (num_of_frags > 1) {
                 int i;
                 for (i=0; i < num_of_frags; i++) {
-                    p_copy = vr_dpdk_pktmbuf_copy_mon(mbufs_frags_out[i], vr_dpdk.rss_mempool);
+                    p_copy = vr_dpdk_pktmbuf_copy_mon(mbufs_frags_out[i], vr_dpdk.copy_mempool);
                     if (likely(p_copy != NULL)) {
                         monitoring_tx_queue->txq_ops.f_tx(monitoring_tx_queue->q_queue_h,
                                         p_copy);
@@ -1818,14 +1838,14 @@ dpdk_if_tx(struct vr_interface *vif, struct vr_packet *pkt)
             } else if (num_of_segs > 1) {
                 int i;
                 for (i=0; i < num_of_segs; i++) {
-                    p_copy = vr_dpdk_pktmbuf_copy_mon(mbufs_segs_out[i], vr_dpdk.rss_mempool);
+                    p_copy = vr_dpdk_pktmbuf_copy_mon(mbufs_segs_out[i], vr_dpdk.copy_mempool);
                     if (likely(p_copy != NULL)) {
                         monitoring_tx_queue->txq_ops.f_tx(monitoring_tx_queue->q_queue_h,
                                         p_copy);
                     }
                 }
             } else {
-                p_copy = vr_dpdk_pktmbuf_copy_mon(m, vr_dpdk.rss_mempool);
+                p_copy = vr_dpdk_pktmbuf_copy_mon(m, vr_dpdk.copy_mempool);
                 if (likely(p_copy != NULL)) {
                     monitoring_tx_queue->txq_ops.f_tx(monitoring_tx_queue->q_queue_h,
                                     p_copy);
@@ -1883,6 +1903,9 @@ dpdk_if_tx(struct vr_interface *vif, struct vr_packet *pkt)
                 segs_sent += segs_to_send;
             }
 
+            /* The segments reference the payload of the original packet,
+             * so it is only freed now that they have been sent */
+            rte_pktmbuf_free(m);
         } else {
             RTE_LOG_DP(DEBUG, VROUTER,"%s: error TXing to interface %s: no queue "
                     "for lcore %u\n", __func__, vif->vif_name, lcore_id);
@@ -1931,11 +1954,13 @@ dpdk_if_rx(struct vr_interface *vif, struct vr_packet *pkt)
 
     m->pkt_len = pkt_len(pkt);
 
+    vr_dpdk_capture_burst(vif, &m, 1, VR_DPDK_CAPTURE_OUT);
+
     if (unlikely(vif->vif_flags & VIF_FLAG_MONITORED)) {
         monitoring_tx_queue =
             &lcore->lcore_tx_queues[vr_dpdk.monitorings[vif_idx]][0];
         if (likely(monitoring_tx_queue && monitoring_tx_queue->txq_ops.f_tx)) {
-            p_copy = vr_dpdk_pktmbuf_copy_mon(m, vr_dpdk.rss_mempool);;
+            p_copy = vr_dpdk_pktmbuf_copy_mon(m, vr_dpdk.copy_mempool);;
             if (likely(p_copy != NULL)) {
                 monitoring_tx_queue->txq_ops.f_tx(monitoring_tx_queue->q_queue_h,
                                 p_copy);
@@ -2410,7 +2435,8 @@ dpdk_dev_stats_update(struct vr_interface *vif, unsigned lcore_id)
             }
 
             queue = &lcore->lcore_tx_queues[vif->vif_idx][dpdk_queue_index];
-            if (queue && (queue->txq_ops.f_tx == rte_port_ethdev_writer_ops.f_tx)) {
+            if (queue && (queue->txq_ops.f_tx == rte_port_ethdev_writer_ops.f_tx ||
+                        queue->txq_ops.f_tx == vr_dpdk_qos_sched_ops.f_tx)) {
                 queue_params = &lcore->lcore_tx_queue_params[vif->vif_idx][queue_id];
                 queue_id = queue_params->qp_ethdev.queue_id;
                 if (queue_id < RTE_ETHDEV_QUEUE_STAT_CNTRS) {
@@ -15,6 +15,7 @@
  */
 
 #include "vr_dpdk.h"
+#include "vr_dpdk_capture.h"
 #include "vr_dpdk_lcore.h"
 #include "vr_dpdk_netlink.h"
 #include "vr_dpdk_usocket.h"
@@ -60,6 +61,42 @@ vr_dpdk_lcore_least_used_get(void)
     return least_used_id;
 }
 
+/*
+ * vr_dpdk_lcore_least_used_socket_get - get the least used forwarding lcore
+ * on the given NUMA node. Falls back to the least used lcore overall if the
+ * node is unknown or has no forwarding lcores.
+ * Returns lcore ID or VR_MAX_CPUS_DPDK.
+ */
+unsigned
+vr_dpdk_lcore_least_used_socket_get(int socket_id)
+{
+    unsigned lcore_id;
+    struct vr_dpdk_lcore *lcore;
+    unsigned least_used_id = VR_MAX_CPUS_DPDK;
+    uint16_t least_used_nb_queues = 2 * VR_MAX_INTERFACES;
+
+    if (socket_id == SOCKET_ID_ANY)
+        return vr_dpdk_lcore_least_used_get();
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        if (lcore_id < VR_DPDK_FWD_LCORE_ID ||
+                lcore_id == vr_dpdk.vf_lcore_id ||
+                rte_lcore_to_socket_id(lcore_id) != (unsigned)socket_id)
+            continue;
+        lcore = vr_dpdk.lcores[lcore_id];
+
+        if (lcore->lcore_nb_rx_queues < least_used_nb_queues) {
+            least_used_nb_queues = lcore->lcore_nb_rx_queues;
+            least_used_id = lcore_id;
+        }
+    }
+
+    if (least_used_id == VR_MAX_CPUS_DPDK)
+        return vr_dpdk_lcore_least_used_get();
+
+    return least_used_id;
+}
+
 /* Returns the least used IO lcore or VR_MAX_CPUS_DPDK */
 unsigned
 dpdk_lcore_least_used_io_get(void)
@@ -380,7 +417,7 @@ vr_dpdk_lcore_if_schedule(struct vr_interface *vif, unsigned least_used_id,
     uint16_t nb_tx_queues, vr_dpdk_queue_init_op tx_queue_init_op)
 {
     int16_t queue_id;
-    unsigned int lcore_id, usable_queues;
+    unsigned int lcore_id, usable_queues, socket_id, pass;
 
     struct vr_dpdk_queue *rx_queue;
     struct vr_dpdk_lcore *lcore;
@@ -423,44 +460,54 @@ vr_dpdk_lcore_if_schedule(struct vr_interface *vif, unsigned least_used_id,
         lcore = vr_dpdk.lcores[lcore_id];
         dpdk_lcore_queue_add(lcore_id, &lcore->lcore_rx_head, rx_queue);
     } else {
-        /* init RX queues starting with the least used lcore */
-        lcore_id = least_used_id;
+        /*
+         * Init RX queues starting with the least used lcore. The first pass
+         * places the queues on the lcores of the same NUMA node as the least
+         * used lcore (i.e. the node of the NIC), the second pass spills the
+         * rest of the queues over the remote lcores.
+         */
+        socket_id = rte_lcore_to_socket_id(least_used_id);
         queue_id = 0;
-        /* for all lcores */
-        do {
-            /* RX queues are just for forwarding lcores */
-            if (lcore_id >= VR_DPDK_FWD_LCORE_ID) {
-                /* init hardware queue */
-                if (queue_id < nb_rx_queues) {
-                    /* there is a hardware queue available */
-                    RTE_LOG(INFO, VROUTER, "    lcore %2u RX from HW queue %" PRIu16
-                            "\n", lcore_id, queue_id);
-                    rx_queue = (*rx_queue_init_op)(lcore_id, vif, queue_id);
-                    if (rx_queue == NULL)
-                        return -EFAULT;
-
-                    lcore = vr_dpdk.lcores[lcore_id];
-
-                    /*
-                     * For virtio interfaces, add the queue to the lcore only
-                     * for queue 0. The rest will be added by QEMU with
-                     * VHOST_USER_SET_VRING_ENABLE message.
-                     */
-                    if (!vif_is_virtual(vif) || queue_id == 0)
-                        dpdk_lcore_queue_add(lcore_id, &lcore->lcore_rx_head,
-                                             rx_queue);
-
-                    /* next queue */
-                    queue_id++;
-                } else {
-                    /* break if no more hardware queues left */
+        for (pass = 0; pass < 2 && queue_id < nb_rx_queues; pass++) {
+            lcore_id = least_used_id;
+            /* for all lcores */
+            do {
+                /* RX queues are just for forwarding lcores */
+                if (lcore_id < VR_DPDK_FWD_LCORE_ID ||
+                        (rte_lcore_to_socket_id(lcore_id) == socket_id) != (pass == 0))
+                    goto next_lcore;
+
+                /* break if no more hardware queues left */
+                if (queue_id >= nb_rx_queues)
                     break;
-                }
-            }
 
-            /* skip master lcore and wrap */
-            lcore_id = rte_get_next_lcore(lcore_id, 1, 1);
-        } while (lcore_id != least_used_id);
+                /* there is a hardware queue available */
+                RTE_LOG(INFO, VROUTER, "    lcore %2u (socket %u) RX from HW queue %"
+                        PRIu16 "\n", lcore_id, rte_lcore_to_socket_id(lcore_id),
+                        queue_id);
+                rx_queue = (*rx_queue_init_op)(lcore_id, vif, queue_id);
+                if (rx_queue == NULL)
+                    return -EFAULT;
+
+                lcore = vr_dpdk.lcores[lcore_id];
+
+                /*
+                 * For virtio interfaces, add the queue to the lcore only
+                 * for queue 0. The rest will be added by QEMU with
+                 * VHOST_USER_SET_VRING_ENABLE message.
+                 */
+                if (!vif_is_virtual(vif) || queue_id == 0)
+                    dpdk_lcore_queue_add(lcore_id, &lcore->lcore_rx_head,
+                                         rx_queue);
+
+                /* next queue */
+                queue_id++;
+
+next_lcore:
+                /* skip master lcore and wrap */
+                lcore_id = rte_get_next_lcore(lcore_id, 1, 1);
+            } while (lcore_id != least_used_id);
+        }
     }
 
     return 0;
@@ -782,6 +829,8 @@ vr_dpdk_lcore_vroute(struct vr_dpdk_lcore *lcore, struct vr_interface *vif,
     struct vr_packet *pkt;
     struct vr_dpdk_queue *monitoring_tx_queue;
     struct rte_mbuf *p_copy;
+    struct rte_mbuf *p_copies[VR_DPDK_RX_BURST_SZ];
+    uint32_t nb_copies = 0;
     struct vr_offload_flow *oflows[VR_DPDK_RX_BURST_SZ];
     struct vr_offload_flow **oflow = &oflows[0];
     unsigned short vlan_id = VLAN_ID_INVALID;
@@ -794,6 +843,12 @@ vr_dpdk_lcore_vroute(struct vr_dpdk_lcore *lcore, struct vr_interface *vif,
     if (offloads)
         dpdk_offload_flow_burst_prefetch(pkts, oflows, nb_pkts);
 
+    /* the whole burst normally comes from the same mempool */
+    if (unlikely(nb_pkts && pkts[0]->pool->socket_id != (int)rte_socket_id()))
+        lcore->lcore_remote_mbufs += nb_pkts;
+
+    vr_dpdk_capture_burst(vif, pkts, nb_pkts, VR_DPDK_CAPTURE_IN);
+
     if (unlikely(vif->vif_flags & VIF_FLAG_MONITORED)) {
         monitoring_tx_queue =
             &lcore->lcore_tx_queues[vr_dpdk.monitorings[vif->vif_idx]][0];
@@ -806,11 +861,19 @@ vr_dpdk_lcore_vroute(struct vr_dpdk_lcore *lcore, struct vr_interface *vif,
                  * dp-core changes the original packet, so clone does not work
                  * as expected here.
                  */
-                p_copy = vr_dpdk_pktmbuf_copy_mon(mbuf, vr_dpdk.rss_mempool);
-                if (likely(p_copy != NULL)) {
-                    monitoring_tx_queue->txq_ops.f_tx(monitoring_tx_queue->q_queue_h,
-                                                        p_copy);
-                }
+                p_copy = vr_dpdk_pktmbuf_copy_mon(mbuf, vr_dpdk.copy_mempool);
+                if (likely(p_copy != NULL))
+                    p_copies[nb_copies++] = p_copy;
+            }
+            /* pass the copies to the monitoring interface in one burst */
+            if (likely(nb_copies && monitoring_tx_queue->txq_ops.f_tx_bulk)) {
+                monitoring_tx_queue->txq_ops.f_tx_bulk(
+                        monitoring_tx_queue->q_queue_h, p_copies,
+                        RTE_LEN2MASK(nb_copies, uint64_t));
+            } else {
+                for (i = 0; i < nb_copies; i++)
+                    monitoring_tx_queue->txq_ops.f_tx(
+                            monitoring_tx_queue->q_queue_h, p_copies[i]);
             }
         }
     }
@@ -1080,6 +1143,177 @@ dpdk_lcore_rx_ring_vroute(struct vr_dpdk_lcore *lcore, struct rte_ring *ring)
     return total_pkts;
 }
 
+/*
+ * vr_dpdk_lcore_repl_enqueue - hand a multicast fan-out over to one of the
+ * replication lcores, so the forwarding of other packets on this lcore
+ * is not stalled by the replication.
+ *
+ * Returns 0 if the packet has been enqueued, -ENOSPC if the replication
+ * ring is full (i.e. the packet should be dropped), other -errno if the
+ * packet should be replicated inline.
+ */
+int
+vr_dpdk_lcore_repl_enqueue(struct vr_packet *pkt, struct vr_nexthop *nh,
+        struct vr_forwarding_md *fmd)
+{
+    const unsigned lcore_id = rte_lcore_id();
+    struct vr_dpdk_lcore *lcore, *dst_lcore;
+    struct vr_dpdk_repl_elem *elem;
+    struct rte_mbuf *mbuf;
+    uint32_t hashval;
+    unsigned dst_lcore_id;
+
+    if (likely(vr_dpdk.nb_repl_lcores == 0))
+        return -ENOTSUP;
+
+    if (nh->nh_component_cnt < VR_DPDK_REPL_MIN_COMPONENTS)
+        return -ENOTSUP;
+
+    if (lcore_id < VR_DPDK_FWD_LCORE_ID || lcore_id >= VR_MAX_CPUS_DPDK)
+        return -ENOTSUP;
+
+    /* do not re-enqueue the fan-outs we are replicating right now */
+    lcore = vr_dpdk.lcores[lcore_id];
+    if (lcore == NULL || lcore->lcore_repl_active)
+        return -ENOTSUP;
+
+    /* spread the fan-outs among the replication lcores */
+    mbuf = vr_dpdk_pkt_to_mbuf(pkt);
+    if (likely(mbuf->ol_flags & PKT_RX_RSS_HASH))
+        hashval = mbuf->hash.rss;
+    else
+        hashval = nh->nh_id;
+
+    dst_lcore_id = VR_DPDK_FWD_LCORE_ID + vr_dpdk.nb_fwd_lcores
+        - vr_dpdk.nb_repl_lcores + hashval % vr_dpdk.nb_repl_lcores;
+    dst_lcore = vr_dpdk.lcores[dst_lcore_id];
+    if (unlikely(dst_lcore == NULL || dst_lcore->lcore_repl_ring == NULL
+                || pkt->vp_if == NULL))
+        return -ENOTSUP;
+
+    if (unlikely(rte_mempool_get(vr_dpdk.repl_mempool, (void **)&elem) != 0))
+        return -ENOMEM;
+
+    elem->re_pkt = pkt;
+    elem->re_nh = nh;
+    elem->re_fmd = *fmd;
+    elem->re_vif_idx = pkt->vp_if->vif_idx;
+    elem->re_vif_gen = pkt->vp_if->vif_gen;
+    (void)vr_sync_add_and_fetch_32u(&nh->nh_users, 1);
+
+    if (unlikely(rte_ring_mp_enqueue(dst_lcore->lcore_repl_ring, elem) != 0)) {
+        RTE_LOG_DP(DEBUG, VROUTER,
+                "%s: lcore %u replication ring is full\n", __func__,
+                dst_lcore_id);
+        vrouter_put_nexthop(nh);
+        rte_mempool_put(vr_dpdk.repl_mempool, elem);
+        return -ENOSPC;
+    }
+
+    return 0;
+}
+
+/*
+ * dpdk_lcore_repl_ring_dequeue - dequeue the fan-outs the lcore may replicate
+ * now at vr_dpdk_repl_rate replicas per second.
+ *
+ * The token bucket is refilled from the TSC and holds up to
+ * VR_DPDK_REPL_RATE_BURST_MS worth of replicas. A fan-out is dequeued as long
+ * as there are tokens left and costs a token per component, so the bucket
+ * may go below zero and the debt is paid by the following refills. The
+ * fan-outs left in the ring wait, and those not fitting it are dropped.
+ *
+ * Returns the number of fan-outs dequeued.
+ */
+static inline uint32_t
+dpdk_lcore_repl_ring_dequeue(struct vr_dpdk_lcore *lcore,
+        struct vr_dpdk_repl_elem **elems)
+{
+    uint32_t nb_elems = 0;
+    uint64_t now, delta, hz;
+    int64_t burst;
+
+    if (likely(vr_dpdk_repl_rate == 0))
+        return rte_ring_sc_dequeue_burst(lcore->lcore_repl_ring,
+                (void **)elems, VR_DPDK_REPL_BURST_SZ, NULL);
+
+    if (rte_ring_empty(lcore->lcore_repl_ring))
+        return 0;
+
+    hz = rte_get_tsc_hz();
+    now = rte_rdtsc();
+    delta = now - lcore->lcore_repl_tsc;
+    /* do not overflow on the first call or after a long idle period */
+    if (delta > hz)
+        delta = hz;
+    lcore->lcore_repl_tsc = now;
+
+    burst = (int64_t)vr_dpdk_repl_rate * VR_DPDK_REPL_RATE_BURST_MS / 1000;
+    if (burst < VR_DPDK_REPL_MIN_COMPONENTS)
+        burst = VR_DPDK_REPL_MIN_COMPONENTS;
+    lcore->lcore_repl_tokens += delta * vr_dpdk_repl_rate / hz;
+    if (lcore->lcore_repl_tokens > burst)
+        lcore->lcore_repl_tokens = burst;
+
+    while (lcore->lcore_repl_tokens > 0 && nb_elems < VR_DPDK_REPL_BURST_SZ) {
+        if (rte_ring_sc_dequeue(lcore->lcore_repl_ring,
+                    (void **)&elems[nb_elems]) != 0)
+            break;
+        lcore->lcore_repl_tokens -= elems[nb_elems]->re_nh->nh_component_cnt;
+        nb_elems++;
+    }
+
+    return nb_elems;
+}
+
+/*
+ * Forwarding lcore replication ring handling.
+ * At most VR_DPDK_REPL_BURST_SZ fan-outs are replicated per forwarding loop,
+ * so the RX queues of the lcore are still polled under a multicast storm.
+ * With vr_dpdk_repl_rate set, the replicas are also limited to that rate.
+ */
+static inline uint64_t
+dpdk_lcore_repl_ring_vroute(struct vr_dpdk_lcore *lcore)
+{
+    const unsigned lcore_id = rte_lcore_id();
+    struct vr_dpdk_repl_elem *elems[VR_DPDK_REPL_BURST_SZ];
+    struct vr_dpdk_repl_elem *elem;
+    struct vr_packet *pkt;
+    struct vr_nexthop *nh;
+    struct vr_interface *vif;
+    struct vrouter *router = vrouter_get(0);
+    uint32_t i, nb_elems;
+
+    nb_elems = dpdk_lcore_repl_ring_dequeue(lcore, elems);
+    if (nb_elems == 0)
+        return 0;
+
+    lcore->lcore_repl_active = true;
+    for (i = 0; i < nb_elems; i++) {
+        elem = elems[i];
+        pkt = elem->re_pkt;
+        nh = elem->re_nh;
+
+        vif = __vrouter_get_interface(router, elem->re_vif_idx);
+        if (likely(vif != NULL) && vif->vif_gen == elem->re_vif_gen) {
+            /* account the replicas to this lcore */
+            pkt->vp_cpu = lcore_id;
+            pkt->vp_if = vif;
+            nh->nh_reach_nh(pkt, nh, &elem->re_fmd);
+        } else {
+            /* the vif is no longer available, just drop the packet */
+            vr_dpdk_pfree(vr_dpdk_pkt_to_mbuf(pkt), NULL,
+                    VP_DROP_INTERFACE_DROP);
+        }
+        vrouter_put_nexthop(nh);
+    }
+    lcore->lcore_repl_active = false;
+
+    rte_mempool_put_bulk(vr_dpdk.repl_mempool, (void **)elems, nb_elems);
+
+    return nb_elems;
+}
+
 /* Forwarding lcore push TX rings */
 static inline uint64_t
 dpdk_lcore_tx_rings_push(struct vr_dpdk_lcore *lcore)
@@ -1241,6 +1475,9 @@ dpdk_lcore_fwd_rxtx(struct vr_dpdk_lcore *lcore)
         /* Route packets from IO lcore. */
         total_pkts += dpdk_lcore_rx_ring_vroute(lcore, lcore->lcore_io_rx_ring);
     }
+    /* Replicate multicast fan-outs from other forwarding lcores. */
+    if (lcore->lcore_repl_ring)
+        total_pkts += dpdk_lcore_repl_ring_vroute(lcore);
     /* push TX rings */
     total_pkts += dpdk_lcore_tx_rings_push(lcore);
 
@@ -1396,6 +1633,24 @@ dpdk_lcore_fwd_init(unsigned lcore_id, struct vr_dpdk_lcore *lcore)
         }
     }
 
+    /*
+     * Allocate multi-producer single-consumer replication ring.
+     * The last forwarding lcores replicate multicast fan-outs of others.
+     */
+    if (vr_dpdk.nb_repl_lcores && lcore_id - VR_DPDK_FWD_LCORE_ID
+            >= vr_dpdk.nb_fwd_lcores - vr_dpdk.nb_repl_lcores) {
+        lcore->lcore_repl_ring = vr_dpdk_ring_allocate(lcore_id,
+                "lcore replication ring", VR_DPDK_REPL_RING_SZ, RING_F_SC_DEQ);
+        if (lcore->lcore_repl_ring == NULL) {
+            RTE_LOG(CRIT, VROUTER, "Error allocating lcore %u replication ring\n",
+                    lcore_id);
+            rte_free(lcore);
+            return -ENOMEM;
+        }
+        RTE_LOG(INFO, VROUTER, "Lcore %u: replicating multicast fan-outs\n",
+                lcore_id);
+    }
+
     if (vr_dpdk_gro_init(lcore_id, lcore) < 0) {
         RTE_LOG(CRIT, VROUTER, "Error initializing GRO tables on lcore %u\n", lcore_id);
     }
@@ -1488,6 +1743,7 @@ dpdk_lcore_exit(unsigned lcore_id)
         if (VR_DPDK_USE_IO_LCORES) {
             rte_free(lcore->lcore_io_rx_ring);
         }
+        rte_free(lcore->lcore_repl_ring);
     }
 
     /* free lcore context */
@@ -1640,15 +1896,15 @@ dpdk_lcore_fwd_loop(void)
     uint64_t cur_bond_cycles = 0;
     uint64_t cur_assembler_cycles = 0;
     uint64_t diff_cycles;
-    uint64_t last_tx_cycles = 0, last_gro_flush_cycles = 0;
+    uint64_t last_tx_cycles = 0;
     uint64_t last_bond_tx_cycles = 0;
     uint64_t last_assembler_cycles = 0;
     /* always calculate bond TX timeout in CPU cycles */
     const uint64_t bond_tx_cycles = (rte_get_timer_hz() + MS_PER_S - 1)
         * VR_DPDK_BOND_TX_MS / MS_PER_S;
-    /* timeout for IP fragment assembler */
+    /* IP fragment assembler timer wheel tick */
     const uint64_t assembler_cycles = (rte_get_timer_hz() + MS_PER_S - 1)
-        * (VR_ASSEMBLER_TIMEOUT_SECS * 1000) / VR_ASSEMBLER_BUCKET_COUNT
+        * (VR_ASSEMBLER_TIMEOUT_SECS * 1000) / VR_DPDK_FRAG_WHEEL_TIMEOUT_TICKS
         / MS_PER_S;
 #if VR_DPDK_USE_TIMER
     /* calculate timeouts in CPU cycles */
@@ -1662,6 +1918,9 @@ dpdk_lcore_fwd_loop(void)
 
     RTE_LOG_DP(DEBUG, VROUTER, "Hello from forwarding lcore %u\n", lcore_id);
 
+    /* GRO flows live that long before they get flushed */
+    lcore->gro.gro_timeout = gro_flush_cycles;
+
     while (1) {
         rte_prefetch0(lcore);
 
@@ -1692,12 +1951,10 @@ dpdk_lcore_fwd_loop(void)
             dpdk_fragment_assembler_table_scan(NULL);
         }
 
-        /* check if we need to flush TX queues and timeout GRO flows */
-        diff_cycles = cur_cycles - last_gro_flush_cycles;
-        if (unlikely(gro_flush_cycles < diff_cycles)) {
-            last_gro_flush_cycles = cur_cycles;
-            dpdk_gro_flush_all_inactive(lcore);
-        }
+        /* flush the GRO flows that are due, after the whole loop's bursts */
+        dpdk_gro_flush_expired(lcore, cur_cycles);
+
+        /* check if we need to flush TX queues */
         diff_cycles = cur_cycles - last_tx_cycles;
         if (unlikely(tx_flush_cycles < diff_cycles)) {
             /* update TX flush cycles */
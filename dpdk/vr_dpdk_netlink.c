@@ -5,7 +5,11 @@
  * All rights reserved
  */
 
+#include <limits.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <linux/genetlink.h>
@@ -16,6 +20,7 @@
 #include "vr_dpdk_usocket.h"
 #include "vr_message.h"
 #include "vr_genetlink.h"
+#include "vr_nl_shm.h"
 #include "vr_uvhost.h"
 #include "vr_uvhost_msg.h"
 
@@ -27,6 +32,84 @@ unsigned int dpdk_nl_message_len(struct vr_message *);
 int vr_usocket_message_write(struct vr_usocket *, struct vr_message *);
 int vr_nl_uvh_sock;
 
+/* shared memory rings a netlink client has its messages go through */
+struct dpdk_nl_shm {
+    struct vr_nl_shm_hdr *dns_hdr;
+    size_t dns_len;
+    uint32_t dns_ring_size;
+    /* responses waiting for room in the response ring */
+    struct vr_qhead dns_pending;
+    /*
+     * requests are copied out of the ring before they are parsed, so that
+     * the client cannot change them meanwhile
+     */
+    uint8_t *dns_req_buf;
+    uint32_t dns_req_buf_len;
+};
+
+static inline uint8_t *
+dpdk_nl_shm_req_data(struct dpdk_nl_shm *shm)
+{
+    return (uint8_t *)(shm->dns_hdr + 1);
+}
+
+static inline uint8_t *
+dpdk_nl_shm_resp_data(struct dpdk_nl_shm *shm)
+{
+    return (uint8_t *)(shm->dns_hdr + 1) + shm->dns_ring_size;
+}
+
+static int
+dpdk_nl_shm_put(struct dpdk_nl_shm *shm, struct vr_message *resp)
+{
+    return vr_nl_shm_put(&shm->dns_hdr->vns_resp, dpdk_nl_shm_resp_data(shm),
+            shm->dns_ring_size, dpdk_nl_message_hdr(resp),
+            dpdk_nl_message_len(resp));
+}
+
+/*
+ * dpdk_nl_shm_flush - move the responses waiting for room to the response
+ * ring. Returns true if none is left waiting.
+ */
+static bool
+dpdk_nl_shm_flush(struct dpdk_nl_shm *shm)
+{
+    struct vr_qelem *elem;
+    struct vr_message *resp;
+
+    while ((elem = shm->dns_pending.q_first)) {
+        resp = CONTAINER_OF(vr_message_queue, struct vr_message, elem);
+        if (dpdk_nl_shm_put(shm, resp) == -ENOSPC)
+            return false;
+
+        vr_queue_dequeue(&shm->dns_pending);
+        vr_message_free(resp);
+    }
+
+    return true;
+}
+
+static void
+dpdk_nl_shm_write(struct dpdk_nl_shm *shm, struct vr_message *resp)
+{
+    int ret;
+
+    if (vr_queue_empty(&shm->dns_pending)) {
+        ret = dpdk_nl_shm_put(shm, resp);
+        if (ret != -ENOSPC) {
+            if (ret)
+                RTE_LOG(ERR, VROUTER, "    error writing %u bytes response"
+                    " to NetLink shared memory: %d\n",
+                    dpdk_nl_message_len(resp), ret);
+            vr_message_free(resp);
+            return;
+        }
+    }
+
+    vr_queue_enqueue(&shm->dns_pending, &resp->vr_message_queue);
+    return;
+}
+
 void
 vr_dpdk_netlink_wakeup(void)
 {
@@ -83,6 +166,12 @@ dpdk_nl_process_response(void *usockp, struct nlmsghdr *nlh)
         resp_nla->nla_len = resp->vr_message_len;
         resp_nla->nla_type = NL_ATTR_VR_MESSAGE_PROTOCOL;
 
+        if (((struct vr_usocket *)usockp)->usock_nl_shm) {
+            dpdk_nl_shm_write(((struct vr_usocket *)usockp)->usock_nl_shm,
+                    resp);
+            continue;
+        }
+
         if (vr_usocket_message_write(usockp, resp) < 0) {
             write = false;
             vr_usocket_close(usockp);
@@ -92,12 +181,212 @@ dpdk_nl_process_response(void *usockp, struct nlmsghdr *nlh)
     return;
 }
 
+/*
+ * dpdk_nl_shm_attach - map the shared memory rings at path, which the
+ * client of usockp asked its messages go through, and mark them attached.
+ * Returns 0 and the rings in shmp, or -errno.
+ */
+static int
+dpdk_nl_shm_attach(struct vr_usocket *usockp, char *path, unsigned int len,
+        struct dpdk_nl_shm **shmp)
+{
+    int fd, ret;
+    uint32_t ring_size;
+    char file[PATH_MAX];
+    struct stat st;
+    struct vr_nl_shm_hdr *hdr;
+    struct dpdk_nl_shm *shm;
+
+    if (usockp->usock_nl_shm)
+        return -EEXIST;
+
+    len = strnlen(path, len);
+    if (!len || len >= sizeof(file) || !usockp->usock_parent)
+        return -EINVAL;
+
+    memcpy(file, path, len);
+    file[len] = '\0';
+
+    /* only files clients made in the socket directory */
+    if (strncmp(file, vr_socket_dir, strlen(vr_socket_dir)) ||
+            strstr(file, ".."))
+        return -EPERM;
+
+    fd = open(file, O_RDWR);
+    if (fd < 0)
+        return -errno;
+
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*hdr)) {
+        close(fd);
+        return -EINVAL;
+    }
+
+    hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ret = -errno;
+    close(fd);
+    if (hdr == MAP_FAILED)
+        return ret;
+
+    ring_size = hdr->vns_ring_size;
+    if (hdr->vns_magic != VR_NL_SHM_MAGIC ||
+            hdr->vns_version != VR_NL_SHM_VERSION ||
+            ring_size < NL_MSG_DEFAULT_SIZE ||
+            ring_size > VR_NL_SHM_MAX_RING_SIZE ||
+            (ring_size & (ring_size - 1)) ||
+            (size_t)st.st_size < vr_nl_shm_size(ring_size)) {
+        munmap(hdr, st.st_size);
+        return -EINVAL;
+    }
+
+    shm = vr_zalloc(sizeof(*shm), VR_USOCK_OBJECT);
+    if (!shm) {
+        munmap(hdr, st.st_size);
+        return -ENOMEM;
+    }
+
+    shm->dns_hdr = hdr;
+    shm->dns_len = st.st_size;
+    shm->dns_ring_size = ring_size;
+    vr_queue_init(&shm->dns_pending);
+    __atomic_store_n(&hdr->vns_state, VR_NL_SHM_STATE_ATTACHED,
+            __ATOMIC_RELEASE);
+
+    RTE_LOG(INFO, VROUTER, "NetLink client FD %d attached shared memory %s\n",
+            usockp->usock_fd, file);
+    *shmp = shm;
+
+    return 0;
+}
+
+void
+dpdk_netlink_shm_detach(void *usockp)
+{
+    struct vr_qelem *elem;
+    struct vr_usocket *usock = (struct vr_usocket *)usockp;
+    struct dpdk_nl_shm *shm = usock->usock_nl_shm;
+
+    if (!shm)
+        return;
+
+    while ((elem = vr_queue_dequeue(&shm->dns_pending)))
+        vr_message_free(CONTAINER_OF(vr_message_queue, struct vr_message,
+                    elem));
+
+    munmap(shm->dns_hdr, shm->dns_len);
+    if (shm->dns_req_buf)
+        vr_free(shm->dns_req_buf, VR_USOCK_BUF_OBJECT);
+    vr_free(shm, VR_USOCK_OBJECT);
+
+    usock->usock_nl_shm = NULL;
+    if (usock->usock_parent)
+        usock->usock_parent->usock_nl_shms--;
+
+    return;
+}
+
+/*
+ * dpdk_nl_shm_get - copy the oldest request in the request ring of shm to
+ * the private buffer of shm, growing it if need be. Returns 1 and the
+ * request length in len, 0 if there is none or no memory for it now, or
+ * -EINVAL if the client corrupted the ring.
+ */
+static int
+dpdk_nl_shm_get(struct dpdk_nl_shm *shm, uint32_t *len)
+{
+    int ret;
+    uint8_t *buf;
+
+    *len = shm->dns_req_buf_len;
+    ret = vr_nl_shm_get(&shm->dns_hdr->vns_req, dpdk_nl_shm_req_data(shm),
+            shm->dns_ring_size, shm->dns_req_buf, len);
+    if (ret != -EMSGSIZE)
+        return ret;
+
+    /* bounded by half the ring, which vr_nl_shm_get checked */
+    buf = vr_malloc(*len, VR_USOCK_BUF_OBJECT);
+    if (!buf)
+        return 0;
+
+    if (shm->dns_req_buf)
+        vr_free(shm->dns_req_buf, VR_USOCK_BUF_OBJECT);
+    shm->dns_req_buf = buf;
+    shm->dns_req_buf_len = *len;
+
+    return vr_nl_shm_get(&shm->dns_hdr->vns_req, dpdk_nl_shm_req_data(shm),
+            shm->dns_ring_size, shm->dns_req_buf, len);
+}
+
+/*
+ * dpdk_netlink_shm_poll - take the requests the clients of the netlink
+ * socket usockp put in their shared memory rings, as long as their
+ * response rings have room. A client that corrupted its request ring is
+ * detached and its socket shut down, which is how it learns about it.
+ * Returns the number of requests taken.
+ */
+int
+dpdk_netlink_shm_poll(void *usockp)
+{
+    int ret, taken = 0;
+    unsigned int i, n;
+    uint32_t len;
+    struct vr_usocket *child, *parent = (struct vr_usocket *)usockp;
+    struct dpdk_nl_shm *shm;
+
+    for (i = 1; i < parent->usock_max_cfds; i++) {
+        child = parent->usock_children[i];
+        if (!child || !child->usock_nl_shm)
+            continue;
+
+        shm = child->usock_nl_shm;
+        for (n = 0; n < VR_DPDK_NL_SHM_BURST; n++) {
+            if (!dpdk_nl_shm_flush(shm))
+                break;
+
+            ret = dpdk_nl_shm_get(shm, &len);
+            if (ret < 0) {
+                RTE_LOG(ERR, VROUTER, "NetLink client FD %d corrupted its"
+                        " shared memory, detaching\n", child->usock_fd);
+                dpdk_netlink_shm_detach(child);
+                shutdown(child->usock_fd, SHUT_RDWR);
+                break;
+            }
+
+            if (!ret)
+                break;
+
+            if (len >= HDR_LEN)
+                dpdk_netlink_receive(child, (char *)shm->dns_req_buf, len);
+            taken++;
+        }
+    }
+
+    return taken;
+}
+
 int
 dpdk_netlink_receive(void *usockp, char *nl_buf,
         unsigned int nl_len)
 {
     int ret;
     struct vr_message request;
+    struct genlmsghdr *genlh;
+    struct dpdk_nl_shm *shm = NULL;
+    struct vr_usocket *usock = (struct vr_usocket *)usockp;
+
+    genlh = (struct genlmsghdr *)(nl_buf + NLMSG_HDRLEN);
+    if (genlh->cmd == SANDESH_SHM_ATTACH) {
+        ret = dpdk_nl_shm_attach(usock, nl_buf + HDR_LEN, nl_len - HDR_LEN,
+                &shm);
+        /* answered on the socket, the rings are used from then on */
+        vr_send_response(ret);
+        dpdk_nl_process_response(usockp, (struct nlmsghdr *)nl_buf);
+        if (shm) {
+            usock->usock_nl_shm = shm;
+            usock->usock_parent->usock_nl_shms++;
+        }
+
+        return 0;
+    }
 
     memset(&request, 0, sizeof(request));
     request.vr_message_buf = nl_buf + HDR_LEN;
@@ -148,6 +437,8 @@ dpdk_nl_trans_alloc(unsigned int size)
 static struct vr_mtransport dpdk_nl_transport = {
     .mtrans_alloc       =       dpdk_nl_trans_alloc,
     .mtrans_free        =       dpdk_nl_trans_free,
+    .mtrans_headroom    =       HDR_LEN,
+    .mtrans_arena_slots =       VR_DPDK_NL_ARENA_SLOTS,
 };
 
 /*
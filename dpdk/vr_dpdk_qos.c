@@ -0,0 +1,533 @@
+/*
+ * vr_dpdk_qos.c -- software egress QoS scheduler for fabric interfaces
+ *
+ * The scheduler is a port -> traffic class -> per-interface queue
+ * hierarchy. Strict priority classes are served first (the highest class
+ * first), the rest share the port with deficit weighted round robin.
+ * The port and each class may be shaped with a token bucket, and each
+ * queue drops with WRED before it gets full.
+ *
+ * Each lcore sending to the interface has its own scheduler. The port and
+ * class rates are token pools shared by the schedulers of the interface,
+ * so an lcore can use the rate the other lcores leave idle.
+ *
+ * Copyright (c) 2026 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "vr_dpdk.h"
+
+#include <rte_cycles.h>
+#include <rte_malloc.h>
+#include <rte_random.h>
+
+/* WRED thresholds (in packets) */
+#define VR_DPDK_QOS_WRED_MIN_TH     (VR_DPDK_QOS_QUEUE_SZ / 4)
+#define VR_DPDK_QOS_WRED_MAX_TH     (VR_DPDK_QOS_QUEUE_SZ * 3 / 4)
+/* WRED drop probability at the max threshold is 1/N */
+#define VR_DPDK_QOS_WRED_MAXP_INV   10
+/* WRED average queue length weight is 1/2^N */
+#define VR_DPDK_QOS_WRED_WQ_LOG2    4
+/* Bytes a class may send per WRR round for each unit of weight */
+#define VR_DPDK_QOS_WRR_QUANTUM     1536
+/* Deficit a class may keep while it is held back by its shaper */
+#define VR_DPDK_QOS_WRR_MAX_CARRY   (16 * 1024)
+/* Token bucket size: this many ms of the rate, but at least MIN_SIZE */
+#define VR_DPDK_QOS_TB_DEPTH_MS     2
+#define VR_DPDK_QOS_TB_MIN_SIZE     (16 * 1024)
+/* Tokens an lcore takes from a shared pool at once, at least */
+#define VR_DPDK_QOS_TB_CHUNK        4096
+
+/* Port rate of the egress scheduler in Mbps (0 - scheduler disabled) */
+unsigned int vr_dpdk_qos_sched_rate = 0;
+
+static void
+dpdk_qos_pool_init(struct vr_dpdk_qos_pool *pool, uint64_t mbps)
+{
+    pool->p_rate = mbps * 1000 * 1000 / 8;
+    pool->p_size = RTE_MAX(pool->p_rate * VR_DPDK_QOS_TB_DEPTH_MS / MS_PER_S,
+            (uint64_t)VR_DPDK_QOS_TB_MIN_SIZE);
+    rte_atomic64_set(&pool->p_tokens, pool->p_size);
+    pool->p_last_cycles = rte_get_timer_cycles();
+}
+
+/*
+ * dpdk_qos_pool_refill - add the tokens accumulated since the last refill.
+ * The lcore that moves the refill time forward adds the tokens, the others
+ * leave the pool alone.
+ */
+static inline void
+dpdk_qos_pool_refill(struct vr_dpdk_qos_pool *pool, uint64_t cur_cycles,
+        uint64_t hz)
+{
+    int64_t tokens;
+    uint64_t last = pool->p_last_cycles, cycles, credit;
+
+    if (pool->p_rate == 0 || cur_cycles <= last)
+        return;
+
+    /* do not let a long idle period overflow */
+    cycles = cur_cycles - last;
+    if (cycles > hz / 100)
+        credit = pool->p_size;
+    else
+        credit = cycles * pool->p_rate / hz;
+    /* keep the cycles for the next refill, it may run every microsecond */
+    if (credit == 0)
+        return;
+
+    if (!rte_atomic64_cmpset(&pool->p_last_cycles, last, cur_cycles))
+        return;
+
+    tokens = rte_atomic64_add_return(&pool->p_tokens, credit);
+    while (tokens > (int64_t)pool->p_size) {
+        if (rte_atomic64_cmpset((volatile uint64_t *)&pool->p_tokens.cnt,
+                    tokens, pool->p_size))
+            break;
+        tokens = rte_atomic64_read(&pool->p_tokens);
+    }
+}
+
+/*
+ * dpdk_qos_tb_conform - check the bucket holds the tokens to send len
+ * bytes, taking more from the pool if it does not. The tokens are taken
+ * in chunks, so the lcores do not write the pool on every packet.
+ */
+static inline bool
+dpdk_qos_tb_conform(struct vr_dpdk_qos_tb *tb, uint32_t len)
+{
+    int64_t avail, take;
+    struct vr_dpdk_qos_pool *pool = tb->tb_pool;
+
+    if (pool->p_rate == 0 || tb->tb_tokens >= len)
+        return true;
+
+    do {
+        avail = rte_atomic64_read(&pool->p_tokens);
+        take = RTE_MAX((int64_t)(len - tb->tb_tokens),
+                (int64_t)VR_DPDK_QOS_TB_CHUNK);
+        if (take > avail)
+            take = avail;
+        if (take <= 0 || tb->tb_tokens + take < len)
+            return false;
+    } while (!rte_atomic64_cmpset((volatile uint64_t *)&pool->p_tokens.cnt,
+                avail, avail - take));
+
+    tb->tb_tokens += take;
+
+    return true;
+}
+
+static inline void
+dpdk_qos_tb_consume(struct vr_dpdk_qos_tb *tb, uint32_t len)
+{
+    if (tb->tb_pool->p_rate)
+        tb->tb_tokens -= len;
+}
+
+/*
+ * dpdk_qos_shared_config - set the class pools of the interface up for the
+ * rates of the given generation, unless another lcore has done it already
+ */
+static void
+dpdk_qos_shared_config(struct vr_dpdk_qos_shared *sh, unsigned int gen)
+{
+    unsigned int i;
+    uint32_t sh_gen = sh->sh_gen;
+    struct vrouter *router = vrouter_get(0);
+    struct vr_qos_sched_tc *conf;
+
+    if (sh_gen == gen || !rte_atomic32_cmpset(&sh->sh_gen, sh_gen, gen))
+        return;
+
+    for (i = 0; i < VR_QOS_SCHED_NUM_TC; i++) {
+        conf = vr_qos_sched_get(router, i);
+        if (sh->sh_tcs[i].p_rate != (uint64_t)conf->vqst_rate * 1000 * 1000 / 8)
+            dpdk_qos_pool_init(&sh->sh_tcs[i], conf->vqst_rate);
+    }
+}
+
+/*
+ * dpdk_qos_sched_config - (re)load the traffic class parameters configured
+ * through the forwarding class map.
+ */
+static void
+dpdk_qos_sched_config(struct vr_dpdk_qos_sched *sched)
+{
+    unsigned int i;
+    struct vrouter *router = vrouter_get(0);
+    struct vr_dpdk_qos_tc *tc;
+    struct vr_qos_sched_tc *conf;
+
+    sched->s_gen = router->vr_qos_sched_gen;
+    rte_rmb();
+
+    dpdk_qos_shared_config(sched->s_shared, sched->s_gen);
+    for (i = 0; i < VR_QOS_SCHED_NUM_TC; i++) {
+        tc = &sched->s_tcs[i];
+        conf = vr_qos_sched_get(router, i);
+
+        tc->tc_weight = conf->vqst_weight;
+        tc->tc_mbps = conf->vqst_rate;
+    }
+}
+
+/*
+ * dpdk_qos_wred_drop - update the average length of the queue and decide
+ * if the packet should be dropped early. Returns true to drop.
+ */
+static inline bool
+dpdk_qos_wred_drop(struct vr_dpdk_qos_queue *q, uint32_t qlen)
+{
+    uint32_t avg;
+
+    q->q_avg = q->q_avg - (q->q_avg >> VR_DPDK_QOS_WRED_WQ_LOG2) + qlen;
+    avg = q->q_avg >> VR_DPDK_QOS_WRED_WQ_LOG2;
+
+    if (likely(avg < VR_DPDK_QOS_WRED_MIN_TH))
+        return false;
+    if (avg >= VR_DPDK_QOS_WRED_MAX_TH)
+        return true;
+
+    /* the probability grows linearly up to 1/MAXP_INV at MAX_TH */
+    return (rte_rand() % ((VR_DPDK_QOS_WRED_MAX_TH - VR_DPDK_QOS_WRED_MIN_TH)
+                * VR_DPDK_QOS_WRED_MAXP_INV)) < (avg - VR_DPDK_QOS_WRED_MIN_TH);
+}
+
+/* Enqueue a packet to the scheduler */
+static int
+dpdk_qos_sched_tx(void *port, struct rte_mbuf *m)
+{
+    uint32_t tag = m->hash.usr, qlen;
+    struct vr_dpdk_qos_sched *sched = (struct vr_dpdk_qos_sched *)port;
+    struct vr_dpdk_qos_tc *tc = &sched->s_tcs[VR_DPDK_QOS_TAG_TC(tag)];
+    struct vr_dpdk_qos_queue *q = &tc->tc_queues[VR_DPDK_QOS_TAG_QUEUE(tag)];
+
+    qlen = q->q_tail - q->q_head;
+    if (unlikely(qlen >= VR_DPDK_QOS_QUEUE_SZ)) {
+        q->q_tail_drops++;
+        goto drop;
+    }
+
+    if (unlikely(dpdk_qos_wred_drop(q, qlen))) {
+        q->q_wred_drops++;
+        goto drop;
+    }
+
+    q->q_mbufs[q->q_tail++ & (VR_DPDK_QOS_QUEUE_SZ - 1)] = m;
+    tc->tc_nb_pkts++;
+    sched->s_nb_pkts++;
+
+    return 0;
+
+drop:
+    sched->s_drops++;
+    rte_pktmbuf_free(m);
+    return 0;
+}
+
+static int
+dpdk_qos_sched_tx_bulk(void *port, struct rte_mbuf **pkts, uint64_t pkts_mask)
+{
+    unsigned int i;
+
+    while (pkts_mask) {
+        i = __builtin_ctzll(pkts_mask);
+        pkts_mask &= ~(1ULL << i);
+        dpdk_qos_sched_tx(port, pkts[i]);
+    }
+
+    return 0;
+}
+
+/*
+ * dpdk_qos_tc_xmit - send the next packet of the class to the wrapped queue.
+ * The interface queues of the class are served round robin.
+ * Returns the packet length, 0 if the class may not send the packet
+ * (limit or class shaper) or -1 if the port is out of tokens.
+ */
+static int
+dpdk_qos_tc_xmit(struct vr_dpdk_qos_sched *sched, struct vr_dpdk_qos_tc *tc,
+        int32_t limit)
+{
+    unsigned int i, qi;
+    uint32_t len;
+    struct rte_mbuf *m;
+    struct vr_dpdk_qos_queue *q = NULL;
+
+    for (i = 0; i < VR_DPDK_QOS_NB_QUEUES; i++) {
+        qi = (tc->tc_next_queue + i) % VR_DPDK_QOS_NB_QUEUES;
+        if (tc->tc_queues[qi].q_tail != tc->tc_queues[qi].q_head) {
+            q = &tc->tc_queues[qi];
+            break;
+        }
+    }
+    if (unlikely(q == NULL))
+        return 0;
+
+    m = q->q_mbufs[q->q_head & (VR_DPDK_QOS_QUEUE_SZ - 1)];
+    len = rte_pktmbuf_pkt_len(m);
+    if (!dpdk_qos_tb_conform(&sched->s_tb, len))
+        return -1;
+    if ((int32_t)len > limit || !dpdk_qos_tb_conform(&tc->tc_tb, len))
+        return 0;
+
+    q->q_head++;
+    q->q_pkts++;
+    q->q_bytes += len;
+    tc->tc_next_queue = (qi + 1) % VR_DPDK_QOS_NB_QUEUES;
+    tc->tc_nb_pkts--;
+    sched->s_nb_pkts--;
+    dpdk_qos_tb_consume(&sched->s_tb, len);
+    dpdk_qos_tb_consume(&tc->tc_tb, len);
+
+    sched->s_ops.f_tx(sched->s_queue_h, m);
+
+    return len;
+}
+
+/* Dequeue packets from the scheduler to the wrapped queue */
+static void
+dpdk_qos_sched_run(struct vr_dpdk_qos_sched *sched)
+{
+    int ret;
+    unsigned int i, budget = VR_DPDK_QOS_DEQ_MAX, idle = 0, sent;
+    uint64_t cur_cycles;
+    const uint64_t hz = rte_get_timer_hz();
+    struct vr_dpdk_qos_tc *tc;
+    struct vr_dpdk_qos_shared *sh = sched->s_shared;
+
+    if (unlikely(sched->s_gen != vrouter_get(0)->vr_qos_sched_gen))
+        dpdk_qos_sched_config(sched);
+
+    if (likely(sched->s_nb_pkts == 0))
+        return;
+
+    /* idle lcores leave the refill to the busy ones */
+    cur_cycles = rte_get_timer_cycles();
+    dpdk_qos_pool_refill(&sh->sh_port, cur_cycles, hz);
+    for (i = 0; i < VR_QOS_SCHED_NUM_TC; i++)
+        dpdk_qos_pool_refill(&sh->sh_tcs[i], cur_cycles, hz);
+
+    /* strict priority classes, the highest class first */
+    for (i = VR_QOS_SCHED_NUM_TC; i-- > 0; ) {
+        tc = &sched->s_tcs[i];
+        if (tc->tc_weight != VR_QOS_SCHED_STRICT)
+            continue;
+
+        while (tc->tc_nb_pkts && budget) {
+            ret = dpdk_qos_tc_xmit(sched, tc, INT32_MAX);
+            if (ret < 0)
+                return;
+            if (ret == 0)
+                break;
+            budget--;
+        }
+    }
+
+    /* deficit weighted round robin among the other classes */
+    while (budget && sched->s_nb_pkts && idle < VR_QOS_SCHED_NUM_TC) {
+        tc = &sched->s_tcs[sched->s_wrr_next];
+        sent = 0;
+
+        if (tc->tc_weight != VR_QOS_SCHED_STRICT && tc->tc_nb_pkts) {
+            if (!tc->tc_in_service) {
+                tc->tc_deficit += tc->tc_weight * VR_DPDK_QOS_WRR_QUANTUM;
+                tc->tc_in_service = true;
+            }
+
+            while (tc->tc_nb_pkts && budget) {
+                ret = dpdk_qos_tc_xmit(sched, tc, tc->tc_deficit);
+                if (ret < 0)
+                    return;
+                if (ret == 0)
+                    break;
+                tc->tc_deficit -= ret;
+                budget--;
+                sent++;
+            }
+            /* out of budget: continue the class on the next flush */
+            if (tc->tc_nb_pkts && !budget)
+                return;
+
+            if (tc->tc_nb_pkts == 0)
+                tc->tc_deficit = 0;
+            else if (tc->tc_deficit > tc->tc_weight * VR_DPDK_QOS_WRR_QUANTUM
+                    + VR_DPDK_QOS_WRR_MAX_CARRY)
+                tc->tc_deficit = tc->tc_weight * VR_DPDK_QOS_WRR_QUANTUM
+                    + VR_DPDK_QOS_WRR_MAX_CARRY;
+            tc->tc_in_service = false;
+        }
+
+        idle = sent ? 0 : idle + 1;
+        sched->s_wrr_next = (sched->s_wrr_next + 1) % VR_QOS_SCHED_NUM_TC;
+    }
+}
+
+static int
+dpdk_qos_sched_flush(void *port)
+{
+    struct vr_dpdk_qos_sched *sched = (struct vr_dpdk_qos_sched *)port;
+
+    dpdk_qos_sched_run(sched);
+
+    return sched->s_ops.f_flush(sched->s_queue_h);
+}
+
+static int
+dpdk_qos_sched_free(void *port)
+{
+    int ret;
+    unsigned int i, j;
+    struct vr_dpdk_qos_sched *sched = (struct vr_dpdk_qos_sched *)port;
+    struct vr_dpdk_qos_queue *q;
+
+    for (i = 0; i < VR_DPDK_QOS_MAX_SCHEDS; i++) {
+        if (vr_dpdk.qos_scheds[i] == sched) {
+            vr_dpdk.qos_scheds[i] = NULL;
+            break;
+        }
+    }
+
+    for (i = 0; i < VR_QOS_SCHED_NUM_TC; i++) {
+        for (j = 0; j < VR_DPDK_QOS_NB_QUEUES; j++) {
+            q = &sched->s_tcs[i].tc_queues[j];
+            while (q->q_head != q->q_tail) {
+                rte_pktmbuf_free(
+                    q->q_mbufs[q->q_head++ & (VR_DPDK_QOS_QUEUE_SZ - 1)]);
+            }
+        }
+    }
+
+    if (--sched->s_shared->sh_refcnt == 0)
+        rte_free(sched->s_shared);
+
+    ret = sched->s_ops.f_free(sched->s_queue_h);
+    rte_free(sched);
+
+    return ret;
+}
+
+/* Wrapped queue stats plus the packets dropped by the scheduler */
+static int
+dpdk_qos_sched_stats_read(void *port, struct rte_port_out_stats *stats,
+        int clear)
+{
+    int ret = 0;
+    struct vr_dpdk_qos_sched *sched = (struct vr_dpdk_qos_sched *)port;
+
+    if (sched->s_ops.f_stats == NULL) {
+        memset(stats, 0, sizeof(*stats));
+    } else {
+        ret = sched->s_ops.f_stats(sched->s_queue_h, stats, clear);
+        if (ret)
+            return ret;
+    }
+
+    stats->n_pkts_in += sched->s_drops;
+    stats->n_pkts_drop += sched->s_drops;
+    if (clear)
+        sched->s_drops = 0;
+
+    return 0;
+}
+
+struct rte_port_out_ops vr_dpdk_qos_sched_ops = {
+    .f_create = NULL,
+    .f_free = dpdk_qos_sched_free,
+    .f_tx = dpdk_qos_sched_tx,
+    .f_tx_bulk = dpdk_qos_sched_tx_bulk,
+    .f_flush = dpdk_qos_sched_flush,
+    .f_stats = dpdk_qos_sched_stats_read,
+};
+
+/*
+ * dpdk_qos_shared_get - get the token pools of the interface, shared by the
+ * schedulers of its TX queues. Returns NULL if out of memory.
+ */
+static struct vr_dpdk_qos_shared *
+dpdk_qos_shared_get(struct vr_interface *vif, unsigned socket_id)
+{
+    unsigned int i;
+    struct vr_dpdk_qos_shared *sh;
+
+    for (i = 0; i < VR_DPDK_QOS_MAX_SCHEDS; i++) {
+        if (vr_dpdk.qos_scheds[i] && vr_dpdk.qos_scheds[i]->s_vif == vif) {
+            sh = vr_dpdk.qos_scheds[i]->s_shared;
+            sh->sh_refcnt++;
+            return sh;
+        }
+    }
+
+    sh = rte_zmalloc_socket("vr_dpdk_qos_shared", sizeof(*sh),
+            RTE_CACHE_LINE_SIZE, socket_id);
+    if (sh == NULL)
+        return NULL;
+
+    sh->sh_vif = vif;
+    sh->sh_refcnt = 1;
+    dpdk_qos_pool_init(&sh->sh_port, vr_dpdk_qos_sched_rate);
+    /* make the first scheduler set the class pools up */
+    sh->sh_gen = vrouter_get(0)->vr_qos_sched_gen - 1;
+
+    return sh;
+}
+
+/*
+ * vr_dpdk_qos_sched_attach - wrap a fabric TX queue with an egress
+ * scheduler. The schedulers of the TX queues of an interface draw from
+ * the same port and class token pools. Returns 0 on success or -errno.
+ */
+int
+vr_dpdk_qos_sched_attach(unsigned lcore_id, struct vr_dpdk_queue *tx_queue,
+    uint16_t queue_id)
+{
+    unsigned int i, tc;
+    struct vr_dpdk_qos_sched *sched;
+
+    for (i = 0; i < VR_DPDK_QOS_MAX_SCHEDS; i++) {
+        if (vr_dpdk.qos_scheds[i] == NULL)
+            break;
+    }
+    if (i == VR_DPDK_QOS_MAX_SCHEDS) {
+        RTE_LOG(ERR, VROUTER, "    error attaching egress scheduler: "
+                "too many schedulers\n");
+        return -ENOSPC;
+    }
+
+    sched = rte_zmalloc_socket("vr_dpdk_qos_sched", sizeof(*sched),
+            RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore_id));
+    if (sched == NULL) {
+        RTE_LOG(ERR, VROUTER, "    error allocating lcore %u egress "
+                "scheduler\n", lcore_id);
+        return -ENOMEM;
+    }
+
+    sched->s_shared = dpdk_qos_shared_get(tx_queue->q_vif,
+            rte_lcore_to_socket_id(lcore_id));
+    if (sched->s_shared == NULL) {
+        RTE_LOG(ERR, VROUTER, "    error allocating lcore %u egress "
+                "scheduler pools\n", lcore_id);
+        rte_free(sched);
+        return -ENOMEM;
+    }
+
+    sched->s_ops = tx_queue->txq_ops;
+    sched->s_queue_h = tx_queue->q_queue_h;
+    sched->s_vif = tx_queue->q_vif;
+    sched->s_lcore_id = lcore_id;
+    sched->s_queue_id = queue_id;
+    sched->s_tb.tb_pool = &sched->s_shared->sh_port;
+    for (tc = 0; tc < VR_QOS_SCHED_NUM_TC; tc++)
+        sched->s_tcs[tc].tc_tb.tb_pool = &sched->s_shared->sh_tcs[tc];
+    dpdk_qos_sched_config(sched);
+
+    tx_queue->txq_ops = vr_dpdk_qos_sched_ops;
+    tx_queue->q_queue_h = sched;
+    vr_dpdk.qos_scheds[i] = sched;
+
+    RTE_LOG(INFO, VROUTER, "    lcore %u TX queue %" PRIu16 ": egress "
+            "scheduler, %u Mbps shared by %u queues\n", lcore_id,
+            queue_id, vr_dpdk_qos_sched_rate, sched->s_shared->sh_refcnt);
+
+    return 0;
+}
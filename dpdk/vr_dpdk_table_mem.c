@@ -9,12 +9,16 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 #include "vr_dpdk.h"
+#include "vr_dpdk_usocket.h"
 #include "vr_btable.h"
 #include "vr_mem.h"
+#include "vr_stats.h"
+#include "vr_stats_shm.h"
 #include "nl_util.h"
 
 #include <rte_errno.h>
@@ -22,6 +26,31 @@
 #define MAX_LINE_SIZE   128
 #define HPI_MAX         16
 #define MOUNT_TABLE     "/proc/mounts"
+#define NUMA_NODE_PATH  "/sys/devices/system/node/node%u"
+/* from linux/mempolicy.h, which is not always installed */
+#define VR_MPOL_INTERLEAVE  3
+
+#define VR_TABLE_HDR_MAGIC      0x76727462  /* "vrtb" */
+#define VR_TABLE_HDR_VERSION    1
+
+/*
+ * The header is kept right after the overflow entries, so the table layout
+ * seen by dp-core and agent does not change. It describes the layout of the
+ * persisted entries and is checked before reattaching them on warm restart.
+ */
+struct vr_table_hdr {
+    uint32_t th_magic;
+    uint16_t th_version;
+    uint16_t th_table;
+    uint32_t th_entries;
+    uint32_t th_oentries;
+    uint32_t th_entry_size;
+    /*
+     * set on a clean exit only, so the entries of an instance that
+     * crashed in the middle of an update are not reattached
+     */
+    uint32_t th_ready;
+};
 
 struct vr_hugepage_info {
     char *mnt;
@@ -35,6 +64,8 @@ extern void *vr_bridge_table, *vr_bridge_otable;
 extern unsigned char *vr_flow_path, *vr_bridge_table_path;
 char flow_mem_file[VR_UNIX_PATH_MAX];
 char bridge_mem_file[VR_UNIX_PATH_MAX];
+static char stats_mem_file[VR_UNIX_PATH_MAX];
+static struct vr_table_hdr *flow_table_hdr, *bridge_table_hdr;
 
 static int
 vr_hugepage_info_init(void)
@@ -138,12 +169,75 @@ exit_func:
     return 0;
 }
 
+/*
+ * vr_table_mem_interleave - spread the table pages over all the NUMA nodes,
+ * so the table shared by the lcores of all the sockets does not end up
+ * on a single node. Must be called before the pages are touched.
+ * Errors are not fatal, the default policy is used in that case.
+ */
+static void
+vr_table_mem_interleave(void *addr, unsigned long size)
+{
+    unsigned int node, nb_nodes = 0;
+    unsigned long nodemask = 0;
+    char path[MAX_LINE_SIZE];
+    struct stat f_stat;
+
+    for (node = 0; node < sizeof(nodemask) * 8; node++) {
+        snprintf(path, sizeof(path), NUMA_NODE_PATH, node);
+        if (stat(path, &f_stat) == -1)
+            continue;
+        nodemask |= 1UL << node;
+        nb_nodes++;
+    }
+
+    if (nb_nodes < 2)
+        return;
+
+    if (syscall(__NR_mbind, addr, size, VR_MPOL_INTERLEAVE, &nodemask,
+                sizeof(nodemask) * 8, 0) == -1) {
+        RTE_LOG(INFO, VROUTER, "    NUMA interleave of the table failed: %s (%d)\n",
+            rte_strerror(errno), errno);
+        return;
+    }
+
+    RTE_LOG(INFO, VROUTER, "    table interleaved over %u NUMA nodes\n",
+        nb_nodes);
+}
+
+/*
+ * vr_table_hdr_valid - check the persisted table matches the configured one.
+ * Returns true if the entries can be reattached.
+ */
+static bool
+vr_table_hdr_valid(struct vr_table_hdr *hdr, unsigned int table,
+        unsigned int entries, unsigned int oentries, unsigned int entry_size)
+{
+    if (hdr->th_magic != VR_TABLE_HDR_MAGIC ||
+            hdr->th_version != VR_TABLE_HDR_VERSION || !hdr->th_ready)
+        return false;
+
+    if (hdr->th_table != table || hdr->th_entries != entries ||
+            hdr->th_oentries != oentries || hdr->th_entry_size != entry_size) {
+        RTE_LOG(INFO, VROUTER, "    persisted table layout %u/%u entries of"
+            " %u bytes does not match %u/%u entries of %u bytes\n",
+            hdr->th_entries, hdr->th_oentries, hdr->th_entry_size,
+            entries, oentries, entry_size);
+        return false;
+    }
+
+    return true;
+}
 
 int
 vr_dpdk_table_mem_init(unsigned int table, unsigned int entries,
         unsigned long size, unsigned int oentries, unsigned long osize)
 {
     int ret, i, fd;
+    bool *reattach;
+    unsigned int entry_size;
+    unsigned long tables_size;
+    struct vr_table_hdr *hdr, **hdr_p;
 
     void **table_p;
     char *shm_file;
@@ -154,12 +248,15 @@ vr_dpdk_table_mem_init(unsigned int table, unsigned int entries,
     struct stat f_stat;
     struct vr_hugepage_info *hpi;
 
+    entry_size = size / entries;
     if (!oentries) {
         oentries = (entries / 5 + 1023) & ~1023;
-        osize = (size / entries) * oentries;
+        osize = entry_size * oentries;
     }
 
     size += osize;
+    tables_size = size;
+    size += RTE_CACHE_LINE_ROUNDUP(sizeof(struct vr_table_hdr));
 
     switch (table) {
     case VR_MEM_FLOW_TABLE_OBJECT:
@@ -169,6 +266,8 @@ vr_dpdk_table_mem_init(unsigned int table, unsigned int entries,
         path = &vr_flow_path;
         vr_oflow_entries = oentries;
         shm_file = flow_mem_file;
+        reattach = &vr_flow_table_reattach;
+        hdr_p = &flow_table_hdr;
         break;
 
     case VR_MEM_BRIDGE_TABLE_OBJECT:
@@ -178,6 +277,8 @@ vr_dpdk_table_mem_init(unsigned int table, unsigned int entries,
         path = &vr_bridge_table_path;
         vr_bridge_oentries = oentries;
         shm_file = bridge_mem_file;
+        reattach = &vr_bridge_table_reattach;
+        hdr_p = &bridge_table_hdr;
         break;
 
     default:
@@ -249,13 +350,52 @@ vr_dpdk_table_mem_init(unsigned int table, unsigned int entries,
                 touse_file_name, rte_strerror(errno), errno);
             return -errno;
         }
-        memset(*table_p, 0, size);
+
+        hdr = (struct vr_table_hdr *)((char *)*table_p + tables_size);
+        if (vr_warm_restart &&
+                vr_table_hdr_valid(hdr, table, entries, oentries, entry_size)) {
+            RTE_LOG(INFO, VROUTER, "Reattaching %s table from %s\n",
+                hp_file_name, touse_file_name);
+            *reattach = true;
+        } else {
+            vr_table_mem_interleave(*table_p, size);
+            memset(*table_p, 0, size);
+            hdr->th_magic = VR_TABLE_HDR_MAGIC;
+            hdr->th_version = VR_TABLE_HDR_VERSION;
+            hdr->th_table = table;
+            hdr->th_entries = entries;
+            hdr->th_oentries = oentries;
+            hdr->th_entry_size = entry_size;
+        }
+        /* the entries are in flux until the next clean exit */
+        hdr->th_ready = 0;
+        *hdr_p = hdr;
         *path = (unsigned char *)touse_file_name;
     }
 
     return 0;
 }
 
+/*
+ * vr_dpdk_table_mem_exit - mark the persisted tables consistent, so the
+ * next instance can reattach them. Must be called once the lcores have
+ * stopped and vRouter has exited.
+ */
+void
+vr_dpdk_table_mem_exit(void)
+{
+    if (!vr_warm_restart)
+        return;
+
+    if (flow_table_hdr)
+        flow_table_hdr->th_ready = 1;
+    if (bridge_table_hdr)
+        bridge_table_hdr->th_ready = 1;
+    rte_wmb();
+
+    return;
+}
+
 int
 vr_dpdk_bridge_init(void)
 {
@@ -286,3 +426,121 @@ vr_dpdk_flow_init(void)
 
     return 0;
 }
+
+/*
+ * dpdk_stats_mem_retire - clear the magic of the stats file of a previous
+ * run, if any, so that a collector still mapping it knows to map the file
+ * again. The file itself is left alone, for it not to fault on a page
+ * that is no longer there.
+ */
+static void
+dpdk_stats_mem_retire(const char *file)
+{
+    int fd;
+    struct stat st;
+    struct vr_stats_shm_hdr *old;
+
+    fd = open(file, O_RDWR);
+    if (fd == -1)
+        return;
+
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(*old)) {
+        close(fd);
+        return;
+    }
+
+    old = mmap(NULL, sizeof(*old), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (old == MAP_FAILED)
+        return;
+
+    __atomic_store_n(&old->vss_magic, 0, __ATOMIC_RELEASE);
+    munmap(old, sizeof(*old));
+
+    return;
+}
+
+/*
+ * vr_dpdk_stats_mem_init - create the shared memory file the per-core
+ * interface, VRF and drop counters are kept in, if asked to, for
+ * collectors to map. The file is laid out under a temporary name and then
+ * renamed over the one of a previous run, which is never truncated under
+ * the collectors mapping it. Must be called once the number of cpus is
+ * known and before vrouter_init. Returns 0 or -errno.
+ */
+int
+vr_dpdk_stats_mem_init(void)
+{
+    int fd, ret;
+    uint64_t size;
+    char tmp_file[VR_UNIX_PATH_MAX];
+    struct vr_stats_shm_hdr layout, *hdr;
+
+    if (!vr_dpdk_stats_shm || vr_stats_shm)
+        return 0;
+
+    ret = snprintf(stats_mem_file, VR_UNIX_PATH_MAX, "%s/%s",
+            vr_socket_dir, VR_STATS_SHM_FILE);
+    if (ret >= VR_UNIX_PATH_MAX) {
+        RTE_LOG(ERR, VROUTER, "Error creating stats shared memory file\n");
+        return -ENOMEM;
+    }
+
+    ret = snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", stats_mem_file);
+    if (ret >= (int)sizeof(tmp_file)) {
+        RTE_LOG(ERR, VROUTER, "Error creating stats shared memory file\n");
+        return -ENOMEM;
+    }
+
+    size = vr_stats_shm_layout(&layout);
+
+    mkdir(vr_socket_dir, VR_DEF_SOCKET_DIR_MODE);
+    /* left over by a run that did not get as far as the rename */
+    unlink(tmp_file);
+    /* readable by the collectors, writable by the vrouter only */
+    fd = open(tmp_file, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR |
+            S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        RTE_LOG(ERR, VROUTER, "Error opening file \"%s\": %s (%d)\n",
+            tmp_file, rte_strerror(errno), errno);
+        return -errno;
+    }
+
+    if (ftruncate(fd, size) == -1) {
+        ret = -errno;
+        RTE_LOG(ERR, VROUTER, "Error truncating file %s: %s (%d)\n",
+            tmp_file, rte_strerror(-ret), -ret);
+        close(fd);
+        unlink(tmp_file);
+        return ret;
+    }
+
+    hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        ret = -errno;
+        RTE_LOG(ERR, VROUTER, "Error mmapping file %s: %s (%d)\n",
+            tmp_file, rte_strerror(-ret), -ret);
+        unlink(tmp_file);
+        return ret;
+    }
+
+    memcpy(hdr, &layout, sizeof(layout));
+    __atomic_store_n(&hdr->vss_magic, VR_STATS_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    dpdk_stats_mem_retire(stats_mem_file);
+    if (rename(tmp_file, stats_mem_file) == -1) {
+        ret = -errno;
+        RTE_LOG(ERR, VROUTER, "Error renaming file %s to %s: %s (%d)\n",
+            tmp_file, stats_mem_file, rte_strerror(-ret), -ret);
+        munmap(hdr, size);
+        unlink(tmp_file);
+        return ret;
+    }
+    vr_stats_shm = hdr;
+
+    RTE_LOG(INFO, VROUTER, "Exporting counters in %s (%lu bytes)\n",
+        stats_mem_file, (unsigned long)size);
+
+    return 0;
+}
@@ -26,25 +26,100 @@
 #include <fcntl.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
+#include <linux/virtio_net.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
+/*
+ * Maximum number of iovecs per packet: virtio_net_hdr, a private copy of
+ * the packet headers and the mbuf segments.
+ */
+#define DPDK_TAPDEV_MAX_IOVS    (VR_DPDK_FRAG_MAX_IP_SEGS + 2)
+/* Maximum length of the packet headers copied for a shared mbuf. */
+#define DPDK_TAPDEV_MAX_HDRS    256
+
+/*
+ * dpdk_tapdev_queue_open - open a TAP queue using specified interface flags.
+ *
+ * Returns queue file descriptor on success, < 0 otherwise.
+ */
+static int
+dpdk_tapdev_queue_open(struct vr_interface *vif, short flags)
+{
+    int fd, ret;
+    struct ifreq ifr;
+
+    /* Open TUN device. */
+    fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+    if (fd == -1) {
+        RTE_LOG(ERR, VROUTER, "    error opening TAP device %s: %s (%d)\n",
+            vif->vif_name, rte_strerror(errno), errno);
+        return -errno;
+    }
+
+    /* Create TAP interface or attach a new queue to it. */
+    memset(&ifr, 0, sizeof(ifr));
+    memcpy(ifr.ifr_name, (char *)vif->vif_name, sizeof(ifr.ifr_name) - 1);
+    ifr.ifr_flags = flags;
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+        ret = -errno;
+        RTE_LOG(ERR, VROUTER, "    error creating TAP interface %s: %s (%d)\n",
+            vif->vif_name, rte_strerror(errno), errno);
+        close(fd);
+        return ret;
+    }
+
+    return fd;
+}
+
+/*
+ * dpdk_tapdev_vnet_hdr_setup - set virtio_net_hdr size and offloads
+ * the kernel is allowed to use on a TAP queue.
+ */
+static void
+dpdk_tapdev_vnet_hdr_setup(struct vr_interface *vif, int fd)
+{
+    int len = sizeof(struct virtio_net_hdr);
+
+    if (ioctl(fd, TUNSETVNETHDRSZ, &len) < 0) {
+        RTE_LOG(ERR, VROUTER, "    error setting TAP %s vnet header size: %s (%d)\n",
+            vif->vif_name, rte_strerror(errno), errno);
+    }
+
+    /*
+     * Let the kernel pass us partially checksummed packets, so the checksum
+     * is calculated once in dpdk_tapdev_queue_rx_burst(). We do not enable TSO,
+     * since dp-core expects TCP super-packets to be chained by MSS (see
+     * dpdk_virtio_create_mss_sized_mbuf_chain()).
+     */
+    if (ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM) < 0) {
+        RTE_LOG(INFO, VROUTER, "    TAP %s checksum offload is not supported: %s (%d)\n",
+            vif->vif_name, rte_strerror(errno), errno);
+    }
+}
+
 /*
  * vr_dpdk_tapdev_init - initializes TAP device using specified Ethernet port.
  *
+ * For vhost0 the TAP device is created with IFF_VNET_HDR and IFF_MULTI_QUEUE,
+ * so each forwarding lcore reads and writes a TAP queue of its own and the
+ * host stack offload metadata is passed along with the packets.
+ *
  * Returns 0 on success, < 0 otherwise.
  */
 int
 vr_dpdk_tapdev_init(struct vr_interface *vif)
 {
-    int i, fd;
+    int i, fd = -1;
+    uint16_t q, nb_queues = 1;
+    short flags = IFF_TAP | IFF_NO_PI;
     struct vr_dpdk_tapdev *tapdev = NULL;
-    struct ifreq ifr;
     struct sockaddr_nl tap_nl_addr;
 
     RTE_LOG(INFO, VROUTER, "    creating TAP device %s\n", vif->vif_name);
@@ -78,27 +153,52 @@ vr_dpdk_tapdev_init(struct vr_interface *vif)
         return -ENOMEM;
     }
 
-    /* Open TUN device. */
-    fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
-    if (fd == -1) {
-        RTE_LOG(ERR, VROUTER, "    error opening TAP device %s: %s (%d)\n",
-            vif->vif_name, rte_strerror(errno), errno);
+    /* vhost0 gets offload metadata and a queue per forwarding lcore. */
+    if (vif_is_vhost(vif)) {
+        flags |= IFF_VNET_HDR;
+        nb_queues = RTE_MIN(vr_dpdk_tapdev_nb_queues, vr_dpdk.nb_fwd_lcores);
+        nb_queues = RTE_MIN(nb_queues, VR_DPDK_TAPDEV_MAX_QUEUES);
+        if (nb_queues > 1)
+            flags |= IFF_MULTI_QUEUE;
+        else
+            nb_queues = 1;
+    }
+
+    fd = dpdk_tapdev_queue_open(vif, flags);
+    if (fd < 0 && (flags & IFF_MULTI_QUEUE)) {
+        RTE_LOG(INFO, VROUTER, "    falling back to single queue TAP device %s\n",
+            vif->vif_name);
+        flags &= ~IFF_MULTI_QUEUE;
+        nb_queues = 1;
+        fd = dpdk_tapdev_queue_open(vif, flags);
+    }
+    if (fd < 0)
         goto error;
+
+    tapdev->tapdev_queue_fds[0] = fd;
+    for (q = 1; q < nb_queues; q++) {
+        tapdev->tapdev_queue_fds[q] = dpdk_tapdev_queue_open(vif, flags);
+        if (tapdev->tapdev_queue_fds[q] < 0) {
+            RTE_LOG(INFO, VROUTER, "    using %" PRIu16 " queue(s) for TAP device %s\n",
+                q, vif->vif_name);
+            nb_queues = q;
+            break;
+        }
+    }
+    tapdev->tapdev_nb_queues = nb_queues;
+
+    if (flags & IFF_VNET_HDR) {
+        tapdev->tapdev_vnet_hdr_len = sizeof(struct virtio_net_hdr);
+        for (q = 0; q < nb_queues; q++)
+            dpdk_tapdev_vnet_hdr_setup(vif, tapdev->tapdev_queue_fds[q]);
+    } else {
+        tapdev->tapdev_vnet_hdr_len = 0;
     }
 
-    /* Create TAP interface. */
-    memset(&ifr, 0, sizeof(ifr));
-    memcpy(ifr.ifr_name, (char *)vif->vif_name, sizeof(ifr.ifr_name) - 1);
     if (vif_is_vhost(vif))
         tapdev->tapdev_vhost_fd = fd;
     else
         tapdev->tapdev_vhost_fd = -1;
-    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
-    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
-        RTE_LOG(ERR, VROUTER, "    error creating TAP interface %s: %s (%d)\n",
-            vif->vif_name, rte_strerror(errno), errno);
-        goto error;
-    }
 
 enable_tap:
     /* Enable TAP device. */
@@ -110,6 +210,10 @@ enable_tap:
     synchronize_rcu();
     tapdev->tapdev_fd = fd;
 
+    RTE_LOG(INFO, VROUTER, "    TAP device %s: %" PRIu16 " queue(s), vnet header %s\n",
+        vif->vif_name, tapdev->tapdev_nb_queues,
+        tapdev->tapdev_vnet_hdr_len ? "enabled" : "disabled");
+
     /* Create tap netlink socket for link up/down mtu change notifications */
     if(vif_is_vhost(vif) && (vr_dpdk.tap_nl_fd <= 0)) {
         vr_dpdk.tap_nl_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
@@ -133,8 +237,17 @@ enable_tap:
 
 error:
     if (tapdev->tapdev_fd > 0) {
-        close(tapdev->tapdev_fd);
         tapdev->tapdev_fd = -1;
+        synchronize_rcu();
+    }
+
+    if (fd > 0) {
+        for (q = 0; q < tapdev->tapdev_nb_queues; q++) {
+            close(tapdev->tapdev_queue_fds[q]);
+            tapdev->tapdev_queue_fds[q] = -1;
+        }
+        tapdev->tapdev_nb_queues = 0;
+        tapdev->tapdev_vhost_fd = -1;
     }
 
     if (vr_dpdk.tap_nl_fd > 0) {
@@ -153,7 +266,7 @@ error:
 int
 vr_dpdk_tapdev_release(struct vr_interface *vif)
 {
-    unsigned lcore_id;
+    unsigned lcore_id, q;
     struct rte_mbuf *mbuf;
     struct vr_dpdk_tapdev *tapdev = vif->vif_os;
     int fd;
@@ -169,18 +282,23 @@ vr_dpdk_tapdev_release(struct vr_interface *vif)
     if (fd > 0) {
         tapdev->tapdev_fd = -1;
         synchronize_rcu();
-        if (tapdev->tapdev_vhost_fd < 0)
-            close(fd);
+        /* vhost0 queues are kept open to be reused by vr_dpdk_tapdev_init() */
+        if (tapdev->tapdev_vhost_fd < 0) {
+            for (q = 0; q < tapdev->tapdev_nb_queues; q++) {
+                close(tapdev->tapdev_queue_fds[q]);
+                tapdev->tapdev_queue_fds[q] = -1;
+            }
+        }
     }
 
     vif->vif_os = NULL;
     tapdev->tapdev_vif = NULL;
 
     /* Drop RX and TX mbufs. */
-    if (tapdev->tapdev_rx_ring) {
-        while (rte_ring_sc_dequeue(tapdev->tapdev_rx_ring,
-                    (void **)&mbuf) == 0) {
-            rte_pktmbuf_free(mbuf);
+    for (q = 0; q < VR_DPDK_TAPDEV_MAX_QUEUES; q++) {
+        while (tapdev->tapdev_nb_rx_mbufs[q] > 0) {
+            rte_pktmbuf_free(
+                tapdev->tapdev_rx_mbufs[q][--tapdev->tapdev_nb_rx_mbufs[q]]);
         }
     }
 
@@ -196,6 +314,508 @@ vr_dpdk_tapdev_release(struct vr_interface *vif)
     return 0;
 }
 
+/*
+ * dpdk_tapdev_csum_complete - complete the partial checksum left by the kernel
+ * for a packet with VIRTIO_NET_HDR_F_NEEDS_CSUM flag.
+ *
+ * Returns 0 on success, < 0 otherwise.
+ */
+static inline int
+dpdk_tapdev_csum_complete(struct rte_mbuf *mbuf,
+        const struct virtio_net_hdr *vnet_hdr)
+{
+    uint16_t csum;
+    uint8_t *data = rte_pktmbuf_mtod(mbuf, uint8_t *);
+    uint32_t start = vnet_hdr->csum_start;
+    uint32_t offset = start + vnet_hdr->csum_offset;
+
+    if (unlikely(offset + sizeof(csum) > rte_pktmbuf_data_len(mbuf)))
+        return -EINVAL;
+
+    csum = ~rte_raw_cksum(data + start, rte_pktmbuf_data_len(mbuf) - start);
+    if (csum == 0)
+        csum = 0xffff;
+    *(uint16_t *)(data + offset) = csum;
+
+    return 0;
+}
+
+/*
+ * dpdk_tapdev_vnet_hdr_fill - fill in the virtio_net_hdr for a packet sent
+ * to the kernel, so TCP super-packets (GRO or guest TSO) are passed to the
+ * host stack as is.
+ *
+ * The TCP checksum has to be replaced with the pseudo header checksum. If
+ * the mbuf data is shared with other packets, the headers are copied to hdrs
+ * and the checksum is written to the copy instead, and *hdrs_len is set to
+ * the number of bytes copied. Otherwise *hdrs_len is set to 0.
+ *
+ * Returns true if the offload metadata is set, false otherwise.
+ */
+static inline bool
+dpdk_tapdev_vnet_hdr_fill(struct rte_mbuf *mbuf,
+        struct virtio_net_hdr *vnet_hdr, uint8_t *hdrs, uint16_t *hdrs_len)
+{
+    uint8_t *data = rte_pktmbuf_mtod(mbuf, uint8_t *);
+    uint16_t tcp_hlen;
+    uint16_t l2_len, l3_len;
+    struct rte_ipv4_hdr *ipv4_hdr = NULL;
+    struct rte_ipv6_hdr *ipv6_hdr = NULL;
+    struct rte_tcp_hdr *tcp_hdr;
+
+    memset(vnet_hdr, 0, sizeof(*vnet_hdr));
+    *hdrs_len = 0;
+    if (likely(!(mbuf->ol_flags & (PKT_RX_GSO_TCP4 | PKT_RX_GSO_TCP6))
+                || mbuf->tso_segsz == 0))
+        return false;
+
+    l2_len = dpdk_get_ether_header_len(data);
+    if (mbuf->ol_flags & PKT_RX_GSO_TCP4) {
+        ipv4_hdr = (struct rte_ipv4_hdr *)(data + l2_len);
+        if (ipv4_hdr->next_proto_id != IPPROTO_TCP)
+            return false;
+        l3_len = (ipv4_hdr->version_ihl & RTE_IPV4_HDR_IHL_MASK)
+                        * RTE_IPV4_IHL_MULTIPLIER;
+        vnet_hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+    } else {
+        ipv6_hdr = (struct rte_ipv6_hdr *)(data + l2_len);
+        if (ipv6_hdr->proto != IPPROTO_TCP)
+            return false;
+        l3_len = sizeof(struct rte_ipv6_hdr);
+        vnet_hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+    }
+
+    if (unlikely(l2_len + l3_len + sizeof(struct rte_tcp_hdr)
+                > rte_pktmbuf_data_len(mbuf))) {
+        vnet_hdr->gso_type = VIRTIO_NET_HDR_GSO_NONE;
+        return false;
+    }
+
+    tcp_hdr = (struct rte_tcp_hdr *)(data + l2_len + l3_len);
+    tcp_hlen = (tcp_hdr->data_off & 0xf0) >> 2;
+    if (unlikely(l2_len + l3_len + tcp_hlen > rte_pktmbuf_data_len(mbuf))) {
+        vnet_hdr->gso_type = VIRTIO_NET_HDR_GSO_NONE;
+        return false;
+    }
+
+    /* Do not write to the data of other packets (e.g. mirrored or flooded). */
+    if (unlikely(RTE_MBUF_CLONED(mbuf) || rte_mbuf_refcnt_read(mbuf) > 1)) {
+        if (unlikely(l2_len + l3_len + tcp_hlen > DPDK_TAPDEV_MAX_HDRS)) {
+            vnet_hdr->gso_type = VIRTIO_NET_HDR_GSO_NONE;
+            return false;
+        }
+        *hdrs_len = l2_len + l3_len + tcp_hlen;
+        rte_memcpy(hdrs, data, *hdrs_len);
+        tcp_hdr = (struct rte_tcp_hdr *)(hdrs + l2_len + l3_len);
+    }
+
+    /* The kernel expects the pseudo header checksum for partial checksums. */
+    if (ipv4_hdr)
+        tcp_hdr->cksum = rte_ipv4_phdr_cksum(ipv4_hdr, 0);
+    else
+        tcp_hdr->cksum = rte_ipv6_phdr_cksum(ipv6_hdr, 0);
+
+    vnet_hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    vnet_hdr->gso_size = mbuf->tso_segsz;
+    vnet_hdr->hdr_len = l2_len + l3_len + tcp_hlen;
+    vnet_hdr->csum_start = l2_len + l3_len;
+    vnet_hdr->csum_offset = offsetof(struct rte_tcp_hdr, cksum);
+
+    return true;
+}
+
+/*
+ * dpdk_tapdev_queue_rx_burst - RX a burst of packets from a TAP queue.
+ *
+ * A TAP queue returns a single packet per read, so there is still one
+ * readv() of the virtio_net_hdr and the packet per packet received, until
+ * the queue is empty or the burst is full. The mbufs are allocated in bulk
+ * and stashed per queue, so there is no allocation if there is nothing to
+ * read. Each queue must be read by a single lcore, the one its RX queue is
+ * scheduled on.
+ *
+ * Returns number of actual packets received, or 0 otherwise.
+ */
+static unsigned
+dpdk_tapdev_queue_rx_burst(struct vr_dpdk_tapdev *tapdev, unsigned queue,
+        struct rte_mbuf **mbufs, unsigned num)
+{
+    int fd = tapdev->tapdev_queue_fds[queue];
+    unsigned ret = 0;
+    unsigned hdr_len = tapdev->tapdev_vnet_hdr_len;
+    struct rte_mbuf *mbuf;
+    struct rte_mbuf **stash = tapdev->tapdev_rx_mbufs[queue];
+    uint16_t *nb_stashed = &tapdev->tapdev_nb_rx_mbufs[queue];
+    struct vr_interface_stats *stats;
+    struct virtio_net_hdr vnet_hdr;
+    struct iovec iov[2];
+    /* Skip the virtio_net_hdr iovec if it is not used. */
+    struct iovec *iov_start = hdr_len ? &iov[0] : &iov[1];
+    int iov_cnt = hdr_len ? 2 : 1;
+    ssize_t len;
+
+    stats = vif_get_stats(tapdev->tapdev_vif, rte_lcore_id());
+
+    iov[0].iov_base = &vnet_hdr;
+    iov[0].iov_len = hdr_len;
+
+    while (ret < num) {
+        /* Refill the stash with a single bulk allocation. */
+        if (unlikely(*nb_stashed == 0)) {
+            if (unlikely(rte_pktmbuf_alloc_bulk(vr_dpdk_rss_mempool_local(), stash,
+                            VR_DPDK_RX_BURST_SZ) != 0)) {
+                stats->vis_dev_inombufs++;
+                vr_dpdk_mempool_nombuf(VR_DPDK_MEMPOOL_RSS);
+                break;
+            }
+            *nb_stashed = VR_DPDK_RX_BURST_SZ;
+        }
+        mbuf = stash[*nb_stashed - 1];
+
+        iov[1].iov_base = rte_pktmbuf_mtod(mbuf, void *);
+        iov[1].iov_len = mbuf->buf_len - rte_pktmbuf_headroom(mbuf);
+
+        stats->vis_port_isyscalls++;
+        len = readv(fd, iov_start, iov_cnt);
+        if (unlikely(len <= 0)) {
+            /* No packets to receive. */
+            break;
+        }
+        if (unlikely(len <= (ssize_t)hdr_len)) {
+            stats->vis_dev_ierrors++;
+            continue;
+        }
+
+        /* The mbuf is ours now. */
+        (*nb_stashed)--;
+        len -= hdr_len;
+        mbuf->pkt_len = mbuf->data_len = len;
+
+        if (hdr_len && (vnet_hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
+            if (unlikely(dpdk_tapdev_csum_complete(mbuf, &vnet_hdr) < 0)) {
+                stats->vis_dev_ierrors++;
+                rte_pktmbuf_free(mbuf);
+                continue;
+            }
+            stats->vis_port_ioffloads++;
+        }
+
+        stats->vis_dev_ibytes += len;
+        stats->vis_dev_ipackets++;
+        mbufs[ret++] = mbuf;
+    }
+
+    return ret;
+}
+
+/*
+ * dpdk_tapdev_queue_tx_burst - TX a burst of packets to a TAP queue.
+ *
+ * Each packet is sent with a single writev() of the virtio_net_hdr
+ * (if enabled) and all the mbuf segments. Sent packets are freed.
+ *
+ * Returns number of packets consumed, or 0 otherwise.
+ */
+static unsigned
+dpdk_tapdev_queue_tx_burst(struct vr_dpdk_tapdev *tapdev, unsigned queue,
+        struct rte_mbuf **mbufs, unsigned num)
+{
+    int fd = tapdev->tapdev_queue_fds[queue];
+    unsigned i, iov_cnt;
+    unsigned hdr_len = tapdev->tapdev_vnet_hdr_len;
+    struct rte_mbuf *mbuf, *seg;
+    struct vr_interface_stats *stats;
+    struct virtio_net_hdr vnet_hdr;
+    struct iovec iov[DPDK_TAPDEV_MAX_IOVS];
+    uint8_t hdrs[DPDK_TAPDEV_MAX_HDRS];
+    uint16_t hdrs_len = 0;
+    ssize_t len;
+
+    stats = vif_get_stats(tapdev->tapdev_vif, rte_lcore_id());
+
+    for (i = 0; i < num; i++) {
+        mbuf = mbufs[i];
+        iov_cnt = 0;
+
+        if (hdr_len) {
+            if (dpdk_tapdev_vnet_hdr_fill(mbuf, &vnet_hdr, hdrs, &hdrs_len))
+                stats->vis_port_ooffloads++;
+            iov[iov_cnt].iov_base = &vnet_hdr;
+            iov[iov_cnt].iov_len = hdr_len;
+            iov_cnt++;
+        }
+
+        /* The private copy of the headers replaces those in the mbuf. */
+        if (hdrs_len) {
+            iov[iov_cnt].iov_base = hdrs;
+            iov[iov_cnt].iov_len = hdrs_len;
+            iov_cnt++;
+        }
+
+        for (seg = mbuf; seg != NULL && iov_cnt < DPDK_TAPDEV_MAX_IOVS;
+                seg = seg->next) {
+            iov[iov_cnt].iov_base = rte_pktmbuf_mtod(seg, void *);
+            iov[iov_cnt].iov_len = rte_pktmbuf_data_len(seg);
+            if (seg == mbuf && hdrs_len) {
+                iov[iov_cnt].iov_base = (uint8_t *)iov[iov_cnt].iov_base +
+                    hdrs_len;
+                iov[iov_cnt].iov_len -= hdrs_len;
+            }
+            iov_cnt++;
+        }
+        if (unlikely(seg != NULL)) {
+            /* Too many segments. */
+            stats->vis_dev_oerrors++;
+            rte_pktmbuf_free(mbuf);
+            continue;
+        }
+
+        stats->vis_port_osyscalls++;
+        len = writev(fd, iov, iov_cnt);
+        if (unlikely(len != (ssize_t)(hdr_len + rte_pktmbuf_pkt_len(mbuf)))) {
+            /* Error sending packet. */
+            stats->vis_dev_oerrors++;
+            break;
+        }
+
+        stats->vis_dev_obytes += len - hdr_len;
+        stats->vis_dev_opackets++;
+        rte_pktmbuf_free(mbuf);
+    }
+
+    return i;
+}
+
+/*
+ * TAP reader, a DPDK port that reads one TAP queue.
+ */
+struct dpdk_tapdev_reader {
+    struct rte_port_in_stats stats;
+
+    struct vr_dpdk_tapdev *tapdev;
+    unsigned queue;
+};
+
+struct dpdk_tapdev_reader_params {
+    struct vr_dpdk_tapdev *tapdev;
+    unsigned queue;
+};
+
+static void *
+dpdk_tapdev_reader_create(void *params, int socket_id)
+{
+    struct dpdk_tapdev_reader_params *conf =
+            (struct dpdk_tapdev_reader_params *)params;
+    struct dpdk_tapdev_reader *port;
+
+    /* Check input parameters */
+    if (conf == NULL || conf->tapdev == NULL) {
+        RTE_LOG(ERR, PORT, "%s: Invalid input parameters\n", __func__);
+        return NULL;
+    }
+
+    /* Memory allocation */
+    port = rte_zmalloc_socket("PORT", sizeof(*port),
+            RTE_CACHE_LINE_SIZE, socket_id);
+    if (port == NULL) {
+        RTE_LOG(ERR, PORT, "%s: Failed to allocate port\n", __func__);
+        return NULL;
+    }
+
+    /* Initialization */
+    port->tapdev = conf->tapdev;
+    port->queue = conf->queue;
+
+    return port;
+}
+
+static int
+dpdk_tapdev_reader_free(void *port)
+{
+    if (port == NULL) {
+        RTE_LOG(ERR, PORT, "%s: port is NULL\n", __func__);
+        return -EINVAL;
+    }
+
+    rte_free(port);
+
+    return 0;
+}
+
+static int
+dpdk_tapdev_reader_rx(void *port, struct rte_mbuf **pkts, uint32_t n_pkts)
+{
+    unsigned nb_pkts;
+    struct dpdk_tapdev_reader *p = (struct dpdk_tapdev_reader *)port;
+
+    if (unlikely(p->tapdev->tapdev_fd <= 0))
+        return 0;
+
+    nb_pkts = dpdk_tapdev_queue_rx_burst(p->tapdev, p->queue, pkts, n_pkts);
+    p->stats.n_pkts_in += nb_pkts;
+
+    return nb_pkts;
+}
+
+static int
+dpdk_tapdev_reader_stats_read(void *port,
+    struct rte_port_in_stats *stats, int clear)
+{
+    struct dpdk_tapdev_reader *p = (struct dpdk_tapdev_reader *)port;
+
+    if (stats != NULL)
+        memcpy(stats, &p->stats, sizeof(p->stats));
+
+    if (clear)
+        memset(&p->stats, 0, sizeof(p->stats));
+
+    return 0;
+}
+
+static struct rte_port_in_ops dpdk_tapdev_reader_ops = {
+    .f_create = dpdk_tapdev_reader_create,
+    .f_free = dpdk_tapdev_reader_free,
+    .f_rx = dpdk_tapdev_reader_rx,
+    .f_stats = dpdk_tapdev_reader_stats_read
+};
+
+/*
+ * TAP writer, a DPDK port that buffers the packets of one lcore and
+ * writes them to a TAP queue a burst at a time.
+ */
+struct dpdk_tapdev_writer {
+    struct rte_port_out_stats stats;
+
+    struct vr_dpdk_tapdev *tapdev;
+    unsigned queue;
+    unsigned tx_burst_sz;
+    unsigned nb_mbufs;
+    struct rte_mbuf *mbufs[2 * VR_DPDK_TX_BURST_SZ];
+};
+
+struct dpdk_tapdev_writer_params {
+    struct vr_dpdk_tapdev *tapdev;
+    unsigned queue;
+    unsigned tx_burst_sz;
+};
+
+static void *
+dpdk_tapdev_writer_create(void *params, int socket_id)
+{
+    struct dpdk_tapdev_writer_params *conf =
+            (struct dpdk_tapdev_writer_params *)params;
+    struct dpdk_tapdev_writer *port;
+
+    /* Check input parameters */
+    if (conf == NULL || conf->tapdev == NULL || conf->tx_burst_sz == 0 ||
+            conf->tx_burst_sz > VR_DPDK_TX_BURST_SZ) {
+        RTE_LOG(ERR, PORT, "%s: Invalid input parameters\n", __func__);
+        return NULL;
+    }
+
+    /* Memory allocation */
+    port = rte_zmalloc_socket("PORT", sizeof(*port),
+            RTE_CACHE_LINE_SIZE, socket_id);
+    if (port == NULL) {
+        RTE_LOG(ERR, PORT, "%s: Failed to allocate port\n", __func__);
+        return NULL;
+    }
+
+    /* Initialization */
+    port->tapdev = conf->tapdev;
+    port->queue = conf->queue;
+    port->tx_burst_sz = conf->tx_burst_sz;
+
+    return port;
+}
+
+static int
+dpdk_tapdev_writer_flush(void *port)
+{
+    unsigned i, nb_sent = 0;
+    struct dpdk_tapdev_writer *p = (struct dpdk_tapdev_writer *)port;
+
+    if (p->nb_mbufs == 0)
+        return 0;
+
+    if (likely(p->tapdev->tapdev_fd > 0))
+        nb_sent = dpdk_tapdev_queue_tx_burst(p->tapdev, p->queue, p->mbufs,
+                p->nb_mbufs);
+
+    for (i = nb_sent; i < p->nb_mbufs; i++)
+        rte_pktmbuf_free(p->mbufs[i]);
+    p->stats.n_pkts_drop += p->nb_mbufs - nb_sent;
+    p->nb_mbufs = 0;
+
+    return 0;
+}
+
+static int
+dpdk_tapdev_writer_tx(void *port, struct rte_mbuf *pkt)
+{
+    struct dpdk_tapdev_writer *p = (struct dpdk_tapdev_writer *)port;
+
+    p->mbufs[p->nb_mbufs++] = pkt;
+    p->stats.n_pkts_in++;
+    if (p->nb_mbufs >= p->tx_burst_sz)
+        dpdk_tapdev_writer_flush(port);
+
+    return 0;
+}
+
+static int
+dpdk_tapdev_writer_tx_bulk(void *port, struct rte_mbuf **pkts,
+        uint64_t pkts_mask)
+{
+    unsigned i;
+
+    while (pkts_mask) {
+        i = __builtin_ctzll(pkts_mask);
+        pkts_mask &= ~(1ULL << i);
+        dpdk_tapdev_writer_tx(port, pkts[i]);
+    }
+
+    return 0;
+}
+
+static int
+dpdk_tapdev_writer_free(void *port)
+{
+    if (port == NULL) {
+        RTE_LOG(ERR, PORT, "%s: port is NULL\n", __func__);
+        return -EINVAL;
+    }
+
+    dpdk_tapdev_writer_flush(port);
+    rte_free(port);
+
+    return 0;
+}
+
+static int
+dpdk_tapdev_writer_stats_read(void *port,
+    struct rte_port_out_stats *stats, int clear)
+{
+    struct dpdk_tapdev_writer *p = (struct dpdk_tapdev_writer *)port;
+
+    if (stats != NULL)
+        memcpy(stats, &p->stats, sizeof(p->stats));
+
+    if (clear)
+        memset(&p->stats, 0, sizeof(p->stats));
+
+    return 0;
+}
+
+static struct rte_port_out_ops dpdk_tapdev_writer_ops = {
+    .f_create = dpdk_tapdev_writer_create,
+    .f_free = dpdk_tapdev_writer_free,
+    .f_tx = dpdk_tapdev_writer_tx,
+    .f_tx_bulk = dpdk_tapdev_writer_tx_bulk,
+    .f_flush = dpdk_tapdev_writer_flush,
+    .f_stats = dpdk_tapdev_writer_stats_read
+};
+
 /*
  * dpdk_tapdev_rx_queue_release - release TAP RX queue.
  */
@@ -225,6 +845,8 @@ dpdk_tapdev_rx_queue_release(unsigned lcore_id,
 /*
  * vr_dpdk_tapdev_rx_queue_init - init TAP RX queue.
  *
+ * The lcore the queue is scheduled on reads TAP queue queue_id itself.
+ *
  * Returns queue pointer on success, NULL otherwise.
  */
 struct vr_dpdk_queue *
@@ -240,22 +862,14 @@ vr_dpdk_tapdev_rx_queue_init(unsigned lcore_id, struct vr_interface *vif,
                     = &lcore->lcore_rx_queue_params[vif_idx];
 
     /* Init queue. */
-    rx_queue->rxq_ops = rte_port_ring_reader_ops;
+    rx_queue->rxq_ops = dpdk_tapdev_reader_ops;
     rx_queue->q_queue_h = NULL;
     rx_queue->q_vif = vrouter_get_interface(vif->vif_rid, vif_idx);
 
-    /* Allocate RX ring if needed. */
-    if (tapdev->tapdev_rx_ring == NULL) {
-        tapdev->tapdev_rx_ring = vr_dpdk_ring_allocate(lcore_id,
-            "tapdev_rx_ring", vr_dpdk_rx_ring_sz,
-            RING_F_SP_ENQ | RING_F_SC_DEQ);
-        if (tapdev->tapdev_rx_ring == NULL)
-            goto error;
-    }
-
     /* Create the queue. */
-    struct rte_port_ring_reader_params reader_params = {
-        .ring = tapdev->tapdev_rx_ring,
+    struct dpdk_tapdev_reader_params reader_params = {
+        .tapdev = tapdev,
+        .queue = queue_id % tapdev->tapdev_nb_queues,
     };
     rx_queue->q_queue_h = rx_queue->rxq_ops.f_create(&reader_params,
                                                         socket_id);
@@ -265,7 +879,6 @@ vr_dpdk_tapdev_rx_queue_init(unsigned lcore_id, struct vr_interface *vif,
     rx_queue->vring_queue_id = queue_id;
     /* Store queue params. */
     rx_queue_params->qp_release_op = &dpdk_tapdev_rx_queue_release;
-    rx_queue_params->qp_ring.ring_p = tapdev->tapdev_rx_ring;
 
     return rx_queue;
 
@@ -306,6 +919,10 @@ dpdk_tapdev_tx_queue_release(unsigned lcore_id, unsigned queue_index,
 /*
  * vr_dpdk_tapdev_tx_queue_init - init TAP TX queue.
  *
+ * Each lcore writes vhost0 packets to TAP queue lcore_id modulo the number
+ * of queues, so the packets of an lcore keep their order. The packets of
+ * the other TAP devices go through a ring to the TAP lcore.
+ *
  * Returns queue pointer on success, NULL otherwise.
  */
 struct vr_dpdk_queue *
@@ -320,11 +937,30 @@ vr_dpdk_tapdev_tx_queue_init(unsigned lcore_id, struct vr_interface *vif,
     struct vr_dpdk_queue_params *tx_queue_params
                     = &lcore->lcore_tx_queue_params[vif_idx][0];
 
-    /* Init queue. */
-    tx_queue->txq_ops = rte_port_ring_writer_ops;
     tx_queue->q_queue_h = NULL;
     tx_queue->q_vif = vrouter_get_interface(vif->vif_rid, vif_idx);
 
+    /* vhost0 packets are written to the TAP queue by the lcore itself. */
+    if (vif_is_vhost(vif)) {
+        struct dpdk_tapdev_writer_params tap_writer_params = {
+            .tapdev = tapdev,
+            .queue = lcore_id % tapdev->tapdev_nb_queues,
+            .tx_burst_sz = VR_DPDK_TX_BURST_SZ,
+        };
+
+        tx_queue->txq_ops = dpdk_tapdev_writer_ops;
+        tx_queue->q_queue_h = tx_queue->txq_ops.f_create(&tap_writer_params,
+                                                            socket_id);
+        if (tx_queue->q_queue_h == NULL)
+            goto error;
+
+        tx_queue_params->qp_release_op = &dpdk_tapdev_tx_queue_release;
+        return tx_queue;
+    }
+
+    /* Other TAP devices are written by the TAP lcore. */
+    tx_queue->txq_ops = rte_port_ring_writer_ops;
+
     /* Allocate TX ring if needed. */
     if (tapdev->tapdev_tx_rings[lcore_id] == NULL) {
         tapdev->tapdev_tx_rings[lcore_id] = vr_dpdk_ring_allocate(lcore_id,
@@ -365,73 +1001,13 @@ unsigned
 vr_dpdk_tapdev_rx_burst(struct vr_dpdk_tapdev *tapdev, struct rte_mbuf **mbufs,
     unsigned num, int datapath)
 {
-    int i, fd;
-    unsigned ret = 0;
-    struct rte_mbuf *mbuf;
-    struct vr_interface *vif;
-    struct vr_interface_stats *stats;
-    unsigned lcore_id = rte_lcore_id();
-    ssize_t len;
-
-    fd = tapdev->tapdev_fd;
-    if (unlikely(fd <= 0))
+    if (unlikely(tapdev->tapdev_fd <= 0))
         return 0;
 
-    for (i = 0; i < num; i++) {
-        vif = tapdev->tapdev_vif;
-
-        if (datapath && vif_is_vhost(vif))
-            continue;
-
-        stats = vif_get_stats(vif, lcore_id);
-
-        mbuf = rte_pktmbuf_alloc(vr_dpdk.rss_mempool);
-        if (unlikely(mbuf == NULL)) {
-            stats->vis_dev_inombufs++;
-            break;
-        }
-
-        /* TODO: need a separate syscall counter for devices. */
-        stats->vis_port_isyscalls++;
-        len = read(fd, rte_pktmbuf_mtod(mbuf, void *),
-                (mbuf->buf_len - rte_pktmbuf_headroom(mbuf)));
-        if (unlikely(len <= 0)) {
-            /* No packets to receive. */
-            rte_pktmbuf_free(mbuf);
-            break;
-        } else {
-            ret++;
-
-            mbuf->pkt_len = mbuf->data_len = len;
-            stats->vis_dev_ibytes += len;
-            stats->vis_dev_ipackets++;
-            mbufs[i] = mbuf;
-       }
-   }
-   return ret;
-}
-
-/*
- * vr_dpdk_tapdev_dequeue_burst - dequeue a burst of packets from the TAP device.
- *
- * Returns number of actual packets dequeued, or 0 otherwise.
- */
-unsigned
-vr_dpdk_tapdev_dequeue_burst(struct vr_dpdk_tapdev *tapdev, struct rte_mbuf **mbufs,
-    unsigned num)
-{
-    int fd;
-
-    fd = tapdev->tapdev_fd;
-    if (unlikely(fd <= 0))
+    if (datapath && vif_is_vhost(tapdev->tapdev_vif))
         return 0;
 
-    /* Try to RX from the TAP. */
-    if (likely(tapdev->tapdev_rx_ring != NULL)) {
-        return rte_ring_sc_dequeue_burst(tapdev->tapdev_rx_ring,
-                (void **)mbufs, num, NULL);
-    }
-    return 0;
+    return dpdk_tapdev_queue_rx_burst(tapdev, 0, mbufs, num);
 }
 
 /*
@@ -443,44 +1019,13 @@ unsigned
 vr_dpdk_tapdev_tx_burst(struct vr_dpdk_tapdev *tapdev, struct rte_mbuf **mbufs,
         unsigned num, int datapath)
 {
-    int i, fd;
-    unsigned ret = 0;
-    struct rte_mbuf *mbuf;
-    struct vr_interface *vif;
-    struct vr_interface_stats *stats;
-    unsigned lcore_id = rte_lcore_id();
-    ssize_t len;
-
-    fd = tapdev->tapdev_fd;
-    if (unlikely(fd <= 0))
+    if (unlikely(tapdev->tapdev_fd <= 0))
         return 0;
 
-    for (i = 0; i < num; i++) {
-        vif = tapdev->tapdev_vif;
-
-        if (datapath && vif_is_vhost(vif))
-            continue;
-
-        stats = vif_get_stats(vif, lcore_id);
-        mbuf = mbufs[i];
-
-        /* TODO: need a separate syscall counter for devices. */
-        stats->vis_port_osyscalls++;
-        len = write(fd, rte_pktmbuf_mtod(mbufs[i], void *),
-            rte_pktmbuf_data_len(mbuf));
-        if (unlikely(len != (ssize_t)rte_pktmbuf_data_len(mbufs[i]))) {
-            /* Error sending packet. */
-            stats->vis_dev_oerrors++;
-            break;
-        } else {
-            stats->vis_dev_obytes += len;
-            stats->vis_dev_opackets++;
-            ret++;
-        }
-        rte_pktmbuf_free(mbuf);
-    }
+    if (datapath && vif_is_vhost(tapdev->tapdev_vif))
+        return 0;
 
-   return ret;
+    return dpdk_tapdev_queue_tx_burst(tapdev, 0, mbufs, num);
 }
 
 /*
@@ -508,63 +1053,44 @@ vr_dpdk_tapdev_enqueue_burst(struct vr_dpdk_tapdev *tapdev, struct rte_mbuf **mb
 }
 
 /*
- * vr_dpdk_tapdev_rxtx -- RX/TX to/from all the TAP devices.
+ * vr_dpdk_tapdev_rxtx -- TX to all the TAP devices written through rings.
+ *
+ * vhost0 queues are read and written by the forwarding lcores themselves,
+ * so only the TX rings of the other TAP devices (e.g. monitoring) are left
+ * to the TAP lcore. The TX ring of each lcore is always written to the
+ * same TAP queue to keep the order.
  *
  * Returns total number of packets processed.
  */
 uint64_t
 vr_dpdk_tapdev_rxtx(void)
 {
-    int i, fd;
+    int i;
+    unsigned j, nb_pkts, nb_done;
     struct vr_dpdk_tapdev *tapdev;
-    struct rte_mbuf *mbuf;
-    struct vr_interface *vif;
-    struct vr_interface_stats *stats;
+    struct rte_mbuf *mbufs[VR_DPDK_TX_BURST_SZ];
     unsigned lcore_id;
     uint64_t total_pkts = 0;
-    unsigned nb_pkts;
 
     for (i = 0; i < VR_DPDK_MAX_TAP_INTERFACES; i++) {
         tapdev = &vr_dpdk.tapdevs[i];
 
-        fd = tapdev->tapdev_fd;
-        if (fd > 0) {
-            vif = tapdev->tapdev_vif;
-            stats = vif_get_stats(vif, rte_lcore_id());
-
-            /* Try to RX from the TAP. */
-            if (likely(tapdev->tapdev_rx_ring != NULL)) {
-                nb_pkts = vr_dpdk_tapdev_rx_burst(tapdev, &mbuf, 1,
-                                                  VR_DPDK_MGMTPATH);
-
-                if (likely(nb_pkts > 0)) {
-                    total_pkts++;
-                    if (unlikely(rte_ring_sp_enqueue(tapdev->tapdev_rx_ring,
-                        mbuf) != 0)) {
-                        rte_pktmbuf_free(mbuf);
-                        stats->vis_dev_ierrors++;
-                    }
-                }
-            }
-
-            /* Now try to TX to the TAP. */
+        if (tapdev->tapdev_fd > 0) {
             RTE_LCORE_FOREACH(lcore_id) {
-                if (likely(tapdev->tapdev_tx_rings[lcore_id] != NULL)) {
-                    if (likely(rte_ring_sc_dequeue(
-                        tapdev->tapdev_tx_rings[lcore_id],
-                        (void **)&mbuf) == 0))
-                    {
-                        total_pkts++;
-                        nb_pkts = vr_dpdk_tapdev_tx_burst(tapdev, &mbuf, 1,
-                                                          VR_DPDK_MGMTPATH);
-
-                        if (likely(nb_pkts > 0)) {
-                            total_pkts++;
-                        } else {
-                            rte_pktmbuf_free(mbuf);
-                        }
-                    }
-                } /* if TAP TX ring. */
+                if (likely(tapdev->tapdev_tx_rings[lcore_id] == NULL))
+                    continue;
+
+                nb_pkts = rte_ring_sc_dequeue_burst(
+                        tapdev->tapdev_tx_rings[lcore_id], (void **)mbufs,
+                        VR_DPDK_TX_BURST_SZ, NULL);
+                if (likely(nb_pkts == 0))
+                    continue;
+
+                total_pkts += nb_pkts;
+                nb_done = dpdk_tapdev_queue_tx_burst(tapdev,
+                        lcore_id % tapdev->tapdev_nb_queues, mbufs, nb_pkts);
+                for (j = nb_done; j < nb_pkts; j++)
+                    rte_pktmbuf_free(mbufs[j]);
             } /* for each lcore. */
         } /* if TAP FD. */
     } /* for all TAP devices. */
@@ -291,6 +291,8 @@ usock_close(struct vr_usocket *usockp)
         return;
 
     RTE_LOG_DP(DEBUG, USOCK, "%s[%lx]: FD %d\n", __func__, pthread_self(), usockp->usock_fd);
+    if (usockp->usock_nl_shm)
+        dpdk_netlink_shm_detach(usockp);
     usock_unbind(usockp);
     usock_deinit_poll(usockp);
 
@@ -1248,7 +1250,7 @@ int
 vr_usocket_io(void *transport)
 {
     int ret, i, processed;
-    int timeout;
+    int timeout, poll_timeout, shm_taken = 0;
     struct pollfd *pfd;
     struct vr_usocket *usockp = (struct vr_usocket *)transport;
     unsigned lcore_id = rte_lcore_id();
@@ -1287,9 +1289,17 @@ vr_usocket_io(void *transport)
                 break;
         }
 
+        /*
+         * shared memory rings of netlink clients are polled without a
+         * doorbell, so do not sleep in poll for long once they are attached
+         */
+        poll_timeout = timeout;
+        if (usockp->usock_nl_shms)
+            poll_timeout = shm_taken ? 0 : VR_DPDK_NL_SHM_POLL_MS;
+
         rcu_thread_offline();
         ret = poll(usockp->usock_pfds, usockp->usock_max_cfds,
-                timeout);
+                poll_timeout);
         if (ret < 0) {
             usock_set_error(usockp, ret);
             /* all other errors are fatal */
@@ -1331,6 +1341,10 @@ vr_usocket_io(void *transport)
             }
         }
 
+        shm_taken = 0;
+        if (usockp->usock_nl_shms)
+            shm_taken = dpdk_netlink_shm_poll(usockp);
+
         if (!timeout)
             return 0;
     }
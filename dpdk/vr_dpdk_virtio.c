@@ -850,7 +850,7 @@ dpdk_virtio_create_mss_sized_mbuf_chain(struct rte_mbuf *mbuf,
             rte_memcpy(tail_addr, append_addr, copy_len);
             pktlen_to_copy -= copy_len;
             append_addr += copy_len;
-            new_mbuf = rte_pktmbuf_alloc(vr_dpdk.rss_mempool);
+            new_mbuf = rte_pktmbuf_alloc(vr_dpdk_rss_mempool_local());
             if (unlikely(new_mbuf == NULL)) {
                 RTE_LOG_DP(DEBUG, VROUTER, "%s: mbuf alloc failed\n",__func__);
                 return -1;
@@ -889,7 +889,7 @@ dpdk_virtio_create_chained_mbuf(struct rte_mbuf *mbuf, char* pkt_addr, uint32_t
         rte_memcpy(tail_addr, append_addr, pkt_tailroom);
         append_len -= pkt_tailroom;
         append_addr += pkt_tailroom;
-        new_mbuf = rte_pktmbuf_alloc(vr_dpdk.rss_mempool);
+        new_mbuf = rte_pktmbuf_alloc(vr_dpdk_rss_mempool_local());
         if (unlikely(new_mbuf == NULL)) {
             RTE_LOG_DP(DEBUG, VROUTER, "%s: mbuf alloc failed\n",__func__);
             return -1;
@@ -918,6 +918,7 @@ dpdk_virtio_from_vm_rx(void *port, struct rte_mbuf **pkts, uint32_t max_pkts)
     struct vring_desc *desc;
     char *pkt_addr, *tail_addr;
     struct rte_mbuf *mbuf;
+    struct rte_mbuf *mbufs[VR_DPDK_RX_BURST_SZ];
     uint32_t pkt_len, nb_pkts = 0;
     vr_uvh_client_t *vru_cl;
 
@@ -936,24 +937,34 @@ dpdk_virtio_from_vm_rx(void *port, struct rte_mbuf **pkts, uint32_t max_pkts)
     /* Unsigned subtraction gives the right result even with wrap around. */
     avail_pkts = vq_hard_avail_idx - vq->vdv_last_used_idx;
     avail_pkts = RTE_MIN(avail_pkts, max_pkts);
+    avail_pkts = RTE_MIN(avail_pkts, VR_DPDK_RX_BURST_SZ);
     if (unlikely(avail_pkts == 0)) {
         DPDK_UDEBUG(VROUTER, &vq->vdv_hash, "%s: queue %p has no packets\n",
                     __func__, vq);
         return 0;
     }
 
-    DPDK_UDEBUG(VROUTER, &vq->vdv_hash, "%s: queue %p AVAILABLE %u packets\n",
-            __func__, vq, avail_pkts);
-    for (i = 0; i < avail_pkts; i++) {
-        uint32_t header_len = 0;
-        /* Allocate a mbuf. */
-        mbuf = rte_pktmbuf_alloc(vr_dpdk.rss_mempool);
-        if (unlikely(mbuf == NULL)) {
+    /*
+     * Allocate the mbufs for the whole burst at once. The bulk allocation
+     * is all or nothing, so shrink the burst under the mempool pressure.
+     */
+    while (unlikely(rte_pktmbuf_alloc_bulk(vr_dpdk_rss_mempool_local(), mbufs,
+                    avail_pkts) != 0)) {
+        avail_pkts /= 2;
+        if (avail_pkts == 0) {
             p->nb_nombufs++;
+            vr_dpdk_mempool_nombuf(VR_DPDK_MEMPOOL_RSS);
             DPDK_UDEBUG(VROUTER, &vq->vdv_hash, "%s: queue %p no_mbufs=%"PRIu64"\n",
                     __func__, vq, p->nb_nombufs);
-            break;
+            return 0;
         }
+    }
+
+    DPDK_UDEBUG(VROUTER, &vq->vdv_hash, "%s: queue %p AVAILABLE %u packets\n",
+            __func__, vq, avail_pkts);
+    for (i = 0; i < avail_pkts; i++) {
+        uint32_t header_len = 0;
+        mbuf = mbufs[i];
 
         next_avail_idx = (vq->vdv_last_used_idx + i) & (vq->vdv_size - 1);
         next_desc_idx = vq->vdv_avail->ring[next_avail_idx];
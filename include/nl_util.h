@@ -22,6 +22,14 @@ extern "C" {
 
 #define NL_RESP_DEFAULT_SIZE        512
 #define NL_MSG_DEFAULT_SIZE         4096
+/* busy polls of a shared memory ring before backing off in poll() */
+#define VR_NL_SHM_SPINS             (1 << 14)
+/* longest a client sleeps between polls of a busy shared memory ring */
+#define VR_NL_SHM_MAX_WAIT_MS       16
+/* environment variable asking for shared memory rings */
+#define VR_NL_SHM_ENV               "VROUTER_NL_SHM"
+/* room to encode one request of a bulk request in */
+#define VR_BULK_OBJECT_BUF_LEN      4096
 
 #define NL_MSG_TYPE_ERROR           0
 #define NL_MSG_TYPE_DONE            1
@@ -68,6 +76,9 @@ struct nl_client {
     uint8_t *cl_resp_buf;
     uint8_t *cl_attr;
     int (*cl_recvmsg)(struct nl_client *, bool);
+    /* shared memory rings the messages go through, if attached */
+    void *cl_shm;
+    size_t cl_shm_len;
 };
 
 
@@ -105,12 +116,15 @@ struct nl_sandesh_callbacks {
     void (*vr_flow_table_data_process)(void *);
     void (*vr_bridge_table_data_process)(void *);
     void (*vr_hugepage_config_process)(void *);
+    void (*vr_bulk_req_process)(void *);
 };
 
 extern struct nl_sandesh_callbacks nl_cb;
 
 /* Suppress NetLink error messages */
 extern bool vr_ignore_nl_errors;
+/* Carry messages to the DPDK vrouter through shared memory if it can */
+extern bool vr_nl_shm;
 extern char *vr_socket_dir;
 extern uint16_t vr_netlink_port;
 
@@ -135,6 +149,8 @@ extern struct nl_response *nl_set_resp_err(struct nl_client *, int);
 
 extern int nl_init_generic_client_req(struct nl_client *nl, int family);
 extern void nl_free(struct nl_client *nl);
+extern void nl_set_buf(struct nl_client *, char *, unsigned int);
+extern int nl_shm_attach(struct nl_client *);
 extern void nl_free_os_specific(struct nl_client *cl);
 extern void nl_reset_cl_sock(struct nl_client *cl);
 extern void nl_init_generic_client_resp(struct nl_client *cl, char *resp,
@@ -217,7 +233,8 @@ extern int vr_send_mirror_get(struct nl_client *, unsigned int, unsigned int);
 extern int vr_send_mirror_delete(struct nl_client *,
         unsigned int, unsigned int);
 extern int vr_send_mirror_add(struct nl_client *, unsigned int,
-        unsigned int, int, unsigned int, int);
+        unsigned int, int, unsigned int, int, unsigned int,
+        unsigned int, unsigned int);
 extern void vr_mirror_req_destroy(vr_mirror_req *);
 extern vr_mirror_req *vr_mirror_get_req_copy(vr_mirror_req *);
 
@@ -295,7 +312,8 @@ extern int vr_send_qos_map_add(struct nl_client *, unsigned int, unsigned int,
 extern int vr_send_fc_map_get(struct nl_client *, unsigned int, uint8_t);
 extern int vr_send_fc_map_dump(struct nl_client *, unsigned int, int);
 extern int vr_send_fc_map_add(struct nl_client *, unsigned int, int16_t *,
-        uint8_t, uint8_t *, uint8_t *, uint8_t *, uint8_t *);
+        uint8_t, uint8_t *, uint8_t *, uint8_t *, uint8_t *, uint8_t *,
+        int32_t *);
 
 
 extern int vr_send_set_dcb_state(struct nl_client *, uint8_t *, uint8_t);
@@ -325,7 +343,11 @@ extern int vr_pkt_drop_log_request(struct nl_client *, unsigned int, unsigned in
 
 extern int vr_send_qos_map_delete(struct nl_client *, unsigned int, unsigned int);
 
-extern int vr_send_get_bridge_table_data(struct nl_client *);
+extern int vr_send_get_bridge_table_data(struct nl_client *, unsigned int);
+extern int vr_bulk_add_object(vr_bulk_req *, void *, char *);
+extern void vr_bulk_free(vr_bulk_req *);
+extern int vr_send_bulk_request(struct nl_client *, unsigned int,
+        vr_bulk_req *);
 
 extern int vr_bridge_table_setup(struct nl_client *);
 
@@ -50,6 +50,20 @@
 
 #define VR_BE_INVALID_INDEX              ((unsigned int)-1)
 
+/* per-cpu queue of MAC learn requests, must be a power of 2 */
+#define VR_BRIDGE_LEARN_RING_SZ         256
+/* per-cpu filter of the MACs already queued, must be a power of 2 */
+#define VR_BRIDGE_LEARN_RECENT_SZ       64
+/* per-cpu cache of the bridge entry packet counters, must be a power of 2 */
+#define VR_BRIDGE_PKT_CACHE_SZ          64
+/* flush the cached packet counter to the entry every so many packets */
+#define VR_BRIDGE_PKT_CACHE_FLUSH       64
+/* the learner flushes all the cached packet counters every so many runs */
+#define VR_BRIDGE_PKT_FLUSH_TICKS       1000
+#define VR_BRIDGE_LEARN_INTERVAL_MSEC   1
+/* learnt entries looked at by the age scan on every learner run */
+#define VR_BRIDGE_AGE_SCAN_ENTRIES      256
+
 struct vr_bridge_entry;
 struct vr_forwarding_md;
 struct vr_packet;
@@ -86,6 +100,47 @@ struct vr_bridge_entry {
     unsigned char be_pack[VR_BRIDGE_ENTRY_PACK];
 } __attribute__packed__close__;
 
+struct vr_bridge_learn_req {
+    unsigned char blr_mac[VR_ETHER_ALEN];
+    unsigned short blr_vrf;
+    int blr_nh_id;
+    uint32_t blr_hash;
+    /* copy of the packet to trap to agent once the MAC is added */
+    struct vr_packet *blr_pkt;
+};
+
+#define VR_BPC_STATE(index, count)  (((uint64_t)(index) << 32) | (count))
+#define VR_BPC_INDEX(state)         ((unsigned int)((state) >> 32))
+#define VR_BPC_COUNT(state)         ((unsigned int)(state))
+
+/*
+ * Entry index and packet count in a single word, so that the learner can
+ * flush the counter of a cpu while the cpu keeps counting
+ */
+struct vr_bridge_pkt_counter {
+    uint64_t bpc_state;
+};
+
+/*
+ * The learn state of a cpu. The datapath of the cpu is the only producer
+ * of the ring and the learner is the only consumer, so no locks needed.
+ */
+struct vr_bridge_learn_cpu {
+    unsigned int blc_head;
+    uint32_t blc_recent[VR_BRIDGE_LEARN_RECENT_SZ];
+    struct vr_bridge_pkt_counter blc_pkts[VR_BRIDGE_PKT_CACHE_SZ];
+    struct vr_bridge_learn_req blc_ring[VR_BRIDGE_LEARN_RING_SZ];
+    /* written by the learner */
+    unsigned int blc_tail;
+};
+
+/* occupancy of the bridge table by a VRF */
+struct vr_bridge_vrf_stats {
+    unsigned int bvs_used;
+    /* least recently seen learnt entry found by the age scan */
+    unsigned int bvs_oldest;
+};
+
 typedef enum {
     MAC_LEARN_FAILURE,
     MAC_LEARNT,
@@ -96,6 +151,8 @@ typedef enum {
 
 
 extern unsigned int vr_bridge_entries, vr_bridge_oentries;
+extern unsigned int vr_bridge_vrf_entries, vr_bridge_age_secs;
+extern bool vr_bridge_table_reattach;
 #define VR_BRIDGE_TABLE_SIZE        (vr_bridge_entries *\
         sizeof(struct vr_bridge_entry))
 #define VR_BRIDGE_OFLOW_TABLE_SIZE  (vr_bridge_oentries *\
@@ -76,9 +76,14 @@ enum rt_type{
 #define VR_BE_L2_CONTROL_DATA_FLAG          0x10
 #define VR_BE_MAC_NEW_FLAG                  0x20
 #define VR_BE_EVPN_CONTROL_PROCESSING_FLAG  0x40
+/* reattached after a restart, the nexthop is not resolved yet */
+#define VR_BE_RESTORED_FLAG                 0x80
+/* learnt by the learner, the next packet is to be trapped to agent */
+#define VR_BE_LEARN_TRAP_FLAG               0x100
 
 #define VR_BRIDGE_FLAG_MASK(flags)  \
-    ((flags) & ~(VR_BE_VALID_FLAG | VR_BE_MAC_NEW_FLAG))
+    ((flags) & ~(VR_BE_VALID_FLAG | VR_BE_MAC_NEW_FLAG | \
+                 VR_BE_RESTORED_FLAG | VR_BE_LEARN_TRAP_FLAG))
 
 #define AGENT_PKT_HEAD_SPACE (sizeof(struct vr_eth) + \
         sizeof(struct agent_hdr))
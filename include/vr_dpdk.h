@@ -93,6 +93,12 @@ extern unsigned vr_packet_sz;
 #define VR_DPDK_DEF_LCORE_MASK      0xf
 /* Default memory size to allocate at startup (in MBs) */
 #define VR_DPDK_DEF_MEM             "1024"
+/* Netlink response buffers preallocated at startup */
+#define VR_DPDK_NL_ARENA_SLOTS      64
+/* Netlink requests to take from a shared memory ring at a time */
+#define VR_DPDK_NL_SHM_BURST        32
+/* Netlink poll timeout while shared memory rings are attached but idle */
+#define VR_DPDK_NL_SHM_POLL_MS      1
 /* Number of memory channels to use */
 #define VR_DPDK_MAX_MEMCHANNELS     "4"
 /* Use UDP source port hashing */
@@ -159,6 +165,8 @@ extern unsigned vr_packet_sz;
 #define VR_DPDK_TX_BURST_SZ         32
 /* Default Number of mbufs in RSS mempool */
 #define VR_DEF_MEMPOOL_SZ           (16 * 1024)
+/* Default number of mbufs in the RSS mempool of each other NUMA node */
+#define VR_DEF_NODE_MEMPOOL_SZ      (8 * 1024)
 /* How many objects (mbufs) to keep in per-lcore RSS mempool cache */
 #define VR_DPDK_RSS_MEMPOOL_CACHE_SZ    (VR_DPDK_RX_BURST_SZ*8)
 /* Number of mbufs in FRAG_DIRECT mempool */
@@ -169,6 +177,26 @@ extern unsigned vr_packet_sz;
 #define VR_DPDK_FRAG_INDIRECT_MEMPOOL_SZ     4096
 /* How many objects (mbufs) to keep in per-lcore FRAG_INDIRECT mempool cache */
 #define VR_DPDK_FRAG_INDIRECT_MEMPOOL_CACHE_SZ    (VR_DPDK_RX_BURST_SZ*8)
+/* Number of indirect mbufs in CLONE mempool (packet clones, mirroring) */
+#define VR_DPDK_CLONE_MEMPOOL_SZ    8192
+/* How many objects (mbufs) to keep in per-lcore CLONE mempool cache */
+#define VR_DPDK_CLONE_MEMPOOL_CACHE_SZ  (VR_DPDK_RX_BURST_SZ*8)
+/* Size of clone mbufs. They hold just a vr_packet and point to the data
+ * of other mbufs, so they don't need any buffer. */
+#define VR_DPDK_CLONE_MBUF_SZ       (sizeof(struct rte_mbuf)    \
+                                    + sizeof(struct vr_packet))
+/* Number of mbufs in HDR mempool (private headers of multicast replicas) */
+#define VR_DPDK_HDR_MEMPOOL_SZ      8192
+/* How many objects (mbufs) to keep in per-lcore HDR mempool cache */
+#define VR_DPDK_HDR_MEMPOOL_CACHE_SZ    (VR_DPDK_RX_BURST_SZ*8)
+/* Size of header mbufs. The headers are copied at the offsets of the original
+ * packet, so the buffer covers the headroom plus the copied headers. */
+#define VR_DPDK_HDR_MBUF_SZ         (VR_DPDK_MBUF_HDR_SZ            \
+                                    + 4*VR_DPDK_MCAST_HDR_COPY_SZ)
+/* Number of mbufs in COPY mempool (monitoring copies) */
+#define VR_DPDK_COPY_MEMPOOL_SZ     4096
+/* How many objects (mbufs) to keep in per-lcore COPY mempool cache */
+#define VR_DPDK_COPY_MEMPOOL_CACHE_SZ   (VR_DPDK_RX_BURST_SZ*4)
 /* Number of VM mempools */
 #define VR_DPDK_MAX_VM_MEMPOOLS     (VR_DPDK_MAX_NB_RX_QUEUES*2)
 /* Number of mbufs in VM mempool */
@@ -195,6 +223,14 @@ extern unsigned vr_packet_sz;
  */
 #define VR_DPDK_TX_IDLE_LOOPS       5
 #define VR_DPDK_TX_FLUSH_US         100
+/* Egress QoS scheduler: number of per-interface queues of a traffic class */
+#define VR_DPDK_QOS_NB_QUEUES       8
+/* Egress QoS scheduler queue size (must be power of 2) */
+#define VR_DPDK_QOS_QUEUE_SZ        256
+/* Max number of packets to dequeue from a scheduler on each TX flush */
+#define VR_DPDK_QOS_DEQ_MAX         256
+/* Max number of egress QoS schedulers (fabric TX queues) */
+#define VR_DPDK_QOS_MAX_SCHEDS      64
 /*
  * Bond TX timeout (in ms)
  * Receive and transmit functions must be invoked on bonded
@@ -227,6 +263,10 @@ extern unsigned vr_packet_sz;
 #define VR_DPDK_MAX_KNI_INTERFACES  16
 /* Maximum number of TAP devices (vhost0 + monitoring) */
 #define VR_DPDK_MAX_TAP_INTERFACES  16
+/* Maximum number of queues (IFF_MULTI_QUEUE) per TAP device */
+#define VR_DPDK_TAPDEV_MAX_QUEUES   8
+/* Default number of vhost0 TAP queues (limited by the nb of forwarding lcores) */
+#define VR_DPDK_TAPDEV_DEF_QUEUES   4
 /* String buffer size (for logs and EAL arguments) */
 #define VR_DPDK_STR_BUF_SZ          512
 /* Log timestamp format */
@@ -239,6 +279,21 @@ extern unsigned vr_packet_sz;
  * to 256, if the packet size is 64K.
  */
 #define VR_DPDK_FRAG_MAX_IP_SEGS    256
+/* Number of bytes copied to a private header mbuf of each multicast replica.
+ * The rest of the payload is shared among the replicas by reference. */
+#define VR_DPDK_MCAST_HDR_COPY_SZ   128
+/* Minimum number of composite components to offload to replication lcores */
+#define VR_DPDK_REPL_MIN_COMPONENTS 16
+/* Max number of fan-outs a replication lcore handles per forwarding loop */
+#define VR_DPDK_REPL_BURST_SZ       32
+/* Replication rate token bucket depth, in milliseconds at the rate */
+#define VR_DPDK_REPL_RATE_BURST_MS  10
+/* Number of fan-outs in the lcore replication ring */
+#define VR_DPDK_REPL_RING_SZ        1024
+/* Number of elements in the replication mempool */
+#define VR_DPDK_REPL_MEMPOOL_SZ     8192
+/* How many elements to keep in per-lcore replication mempool cache */
+#define VR_DPDK_REPL_MEMPOOL_CACHE_SZ   (VR_DPDK_REPL_BURST_SZ*4)
 #define VR_DPDK_VLAN_FWD_DEF_NAME   "vfw0"
 /*
  * Use IO lcores:
@@ -275,6 +330,20 @@ extern unsigned vr_packet_sz;
 #define VR_DPDK_MAX_FLOW_TABLE_HOLD_COUNT 1000
 /* Maximum number of mbufs in per CPU queues */
 #define VR_DPDK_MAX_FRAGMENT_ELEMENTS     1024ULL
+/* Pooled fragment queue elements per forwarding lcore */
+#define VR_DPDK_FRAG_POOL_SIZE            1024
+/* Assembler entries per forwarding lcore */
+#define VR_DPDK_FRAG_MAX_ENTRIES          1024
+/* Open addressed assembler index, a power of 2 above the entries */
+#define VR_DPDK_FRAG_INDEX_SIZE           (2 * VR_DPDK_FRAG_MAX_ENTRIES)
+/* Assembler timer wheel slots, a power of 2 above the timeout ticks */
+#define VR_DPDK_FRAG_WHEEL_SLOTS          128
+/* Assembler timeout in wheel ticks */
+#define VR_DPDK_FRAG_WHEEL_TIMEOUT_TICKS  64
+/* GRO flows per forwarding lcore, a power of 2 */
+#define VR_DPDK_GRO_FLOWS                 1024
+/* GRO flows per flow table bucket, i.e. signatures per cache line */
+#define VR_DPDK_GRO_BUCKET_ENTRIES        8
 /*
  * SR-IOV virtual function PMD name suffix.
  * Note: only rte_ixgbevf_pmd was tested.
@@ -446,6 +515,102 @@ struct vr_dpdk_queue_params {
     };
 };
 
+/*
+ * Egress QoS token pool. A pool is shared by the schedulers of all the TX
+ * queues of an interface, so the rate one lcore leaves idle is used by the
+ * others. Any lcore may refill the pool.
+ */
+struct vr_dpdk_qos_pool {
+    /* Rate in bytes per second (0 - not shaped) */
+    uint64_t p_rate;
+    /* Pool size in bytes */
+    uint64_t p_size;
+    rte_atomic64_t p_tokens;
+    volatile uint64_t p_last_cycles;
+} __rte_cache_aligned;
+
+/* Egress QoS scheduler token bucket: tokens taken from a pool, not used yet */
+struct vr_dpdk_qos_tb {
+    struct vr_dpdk_qos_pool *tb_pool;
+    uint64_t tb_tokens;
+};
+
+/* Port and class token pools of the egress schedulers of an interface */
+struct vr_dpdk_qos_shared {
+    struct vr_interface *sh_vif;
+    unsigned int sh_refcnt;
+    /* Generation of the class rates the pools are set up for */
+    volatile uint32_t sh_gen;
+    struct vr_dpdk_qos_pool sh_port;
+    struct vr_dpdk_qos_pool sh_tcs[VR_QOS_SCHED_NUM_TC];
+};
+
+/* Egress QoS scheduler queue */
+struct vr_dpdk_qos_queue {
+    uint32_t q_head;
+    uint32_t q_tail;
+    /* WRED average queue length (fixed point) */
+    uint32_t q_avg;
+    /* Stats */
+    uint64_t q_pkts;
+    uint64_t q_bytes;
+    uint64_t q_wred_drops;
+    uint64_t q_tail_drops;
+    struct rte_mbuf *q_mbufs[VR_DPDK_QOS_QUEUE_SZ];
+};
+
+/* Egress QoS scheduler traffic class */
+struct vr_dpdk_qos_tc {
+    struct vr_dpdk_qos_tb tc_tb;
+    /* Configured rate in Mbps */
+    uint32_t tc_mbps;
+    /* Number of queued packets */
+    uint32_t tc_nb_pkts;
+    /* WRR deficit in bytes */
+    int32_t tc_deficit;
+    /* WRR weight or VR_QOS_SCHED_STRICT */
+    uint8_t tc_weight;
+    /* Set while the class has got its WRR quantum for the round */
+    bool tc_in_service;
+    /* Next queue to serve (round robin among interfaces) */
+    uint16_t tc_next_queue;
+    struct vr_dpdk_qos_queue tc_queues[VR_DPDK_QOS_NB_QUEUES];
+};
+
+/*
+ * Egress QoS scheduler. The scheduler wraps an ethdev TX queue: packets
+ * are queued on TX and sent to the wrapped queue on TX flush.
+ */
+struct vr_dpdk_qos_sched {
+    /* Wrapped TX queue operators and handler */
+    struct rte_port_out_ops s_ops;
+    void *s_queue_h;
+    /* Port token bucket */
+    struct vr_dpdk_qos_tb s_tb;
+    /* Token pools shared with the other TX queues of the interface */
+    struct vr_dpdk_qos_shared *s_shared;
+    /* Number of queued packets */
+    uint32_t s_nb_pkts;
+    /* Next class to visit in the WRR round */
+    uint16_t s_wrr_next;
+    /* Generation of the scheduler parameters in use */
+    unsigned int s_gen;
+    /* Packets dropped by the scheduler (not read by f_stats yet) */
+    uint64_t s_drops;
+    struct vr_interface *s_vif;
+    unsigned s_lcore_id;
+    uint16_t s_queue_id;
+    struct vr_dpdk_qos_tc s_tcs[VR_QOS_SCHED_NUM_TC] __rte_cache_aligned;
+};
+
+/*
+ * Traffic class and source interface of a packet for the egress QoS
+ * scheduler. The tag is stored in mbuf->hash.usr on TX.
+ */
+#define VR_DPDK_QOS_TAG(tc, vif_idx)    (((tc) << 16) | ((vif_idx) & 0xffff))
+#define VR_DPDK_QOS_TAG_TC(tag)         (((tag) >> 16) % VR_QOS_SCHED_NUM_TC)
+#define VR_DPDK_QOS_TAG_QUEUE(tag)      (((tag) & 0xffff) % VR_DPDK_QOS_NB_QUEUES)
+
 struct vr_dpdk_ring_to_push {
     /* Ring pointer */
     struct rte_ring *rtp_tx_ring;
@@ -453,8 +618,34 @@ struct vr_dpdk_ring_to_push {
     struct vr_dpdk_queue *rtp_tx_queue;
 };
 
+/* Multicast fan-out handed over to a replication lcore */
+struct vr_dpdk_repl_elem {
+    /* Packet to replicate */
+    struct vr_packet *re_pkt;
+    /* Composite nexthop (referenced until the fan-out is done) */
+    struct vr_nexthop *re_nh;
+    /* Incoming interface index and generation, to detect a vif delete */
+    unsigned short re_vif_idx;
+    unsigned int re_vif_gen;
+    /* Forwarding metadata of the packet */
+    struct vr_forwarding_md re_fmd;
+};
+
 SLIST_HEAD(vr_dpdk_q_slist, vr_dpdk_queue);
 
+/* Purposes of the packet mempools, to account the mempool pressure */
+enum vr_dpdk_mempool_purpose {
+    /* RX and packets allocated by dp-core */
+    VR_DPDK_MEMPOOL_RSS = 0,
+    /* Packet clones (indirect mbufs) */
+    VR_DPDK_MEMPOOL_CLONE,
+    /* Private headers of multicast replicas */
+    VR_DPDK_MEMPOOL_HDR,
+    /* Monitoring copies */
+    VR_DPDK_MEMPOOL_COPY,
+    VR_DPDK_MEMPOOL_MAX
+};
+
 /* Lcore commands */
 enum vr_dpdk_lcore_cmd {
     /* No command */
@@ -475,16 +666,36 @@ enum vr_dpdk_lcore_cmd {
     VR_DPDK_LCORE_RX_QUEUE_SET_CMD,
 };
 
+struct gro_table;
+
 struct gro_ctrl {
-    int     gro_queued;
-    int     gro_flushed;
-    int     gro_bad_csum;
-    int     gro_cnt;
-    int     gro_flows;
-    int     gro_flush_inactive_flows;
-
-    struct rte_hash *gro_tbl_v4_handle;
-    struct rte_hash *gro_tbl_v6_handle;
+    /* segments handed out in flushed flows */
+    uint64_t gro_queued;
+    /* flows flushed */
+    uint64_t gro_flushed;
+    uint64_t gro_bad_csum;
+    uint64_t gro_cnt;
+    /* flows created */
+    uint64_t gro_flows;
+    /* flows flushed as their deadline passed */
+    uint64_t gro_flush_inactive_flows;
+    /* flows flushed to make room in a full bucket */
+    uint64_t gro_flush_evicted;
+    /* flows flushed as the next segment would overflow the IP length */
+    uint64_t gro_flush_overflow;
+    /* flows flushed by a segment that could not be merged */
+    uint64_t gro_flush_unmergeable;
+    /* segments merged that came in chained mbufs */
+    uint64_t gro_chained;
+    /* segments merged that had IPv6 extension headers */
+    uint64_t gro_ipv6_ext;
+    /* flows currently open */
+    uint32_t gro_active;
+
+    struct gro_table *gro_table;
+    /* time of the current forwarding loop and the flow lifetime */
+    uint64_t gro_now;
+    uint64_t gro_timeout;
 };
 
 struct vr_dpdk_lcore_rx_queue_remove_arg {
@@ -520,6 +731,16 @@ struct vr_dpdk_lcore {
     bool do_fragment_assembly;
     /* GRO ctrl structure */
     struct gro_ctrl gro;
+    /* Number of received mbufs allocated on a remote NUMA node */
+    uint64_t lcore_remote_mbufs;
+    /* Replication ring with multicast fan-outs from other lcores */
+    struct rte_ring *lcore_repl_ring;
+    /* Set while the lcore replicates a fan-out from the replication ring */
+    bool lcore_repl_active;
+    /* Replicas the lcore may still make at vr_dpdk_repl_rate (may be < 0) */
+    int64_t lcore_repl_tokens;
+    /* TSC of the last replication token bucket refill */
+    uint64_t lcore_repl_tsc;
 
     /**********************************************************************/
     /* Big and less frequently used fields */
@@ -617,13 +838,21 @@ struct vr_dpdk_ethdev {
 
 /* Tapdev configuration. */
 struct vr_dpdk_tapdev {
-    /* Tapdev file descriptor. */
+    /* Tapdev file descriptor (queue 0). */
     volatile int tapdev_fd;
     /* Tapdev file descriptor for vhost0. */
     int tapdev_vhost_fd;
-    /* RX ring. */
-    struct rte_ring *tapdev_rx_ring;
-    /* TX rings (single-producer single-consumer) */
+    /* Number of TAP queues (IFF_MULTI_QUEUE), 1 if not multi-queue. */
+    uint16_t tapdev_nb_queues;
+    /* Size of the virtio_net_hdr (IFF_VNET_HDR) or 0 if not used. */
+    uint16_t tapdev_vnet_hdr_len;
+    /* Queue file descriptors, the first one is the same as tapdev_fd. */
+    int tapdev_queue_fds[VR_DPDK_TAPDEV_MAX_QUEUES];
+    /* Preallocated RX mbufs (one stash per queue). */
+    struct rte_mbuf *tapdev_rx_mbufs[VR_DPDK_TAPDEV_MAX_QUEUES][VR_DPDK_RX_BURST_SZ];
+    /* Number of preallocated RX mbufs per queue. */
+    uint16_t tapdev_nb_rx_mbufs[VR_DPDK_TAPDEV_MAX_QUEUES];
+    /* TX rings (single-producer single-consumer), vhost0 has none. */
     struct rte_ring *tapdev_tx_rings[RTE_MAX_LCORE];
     /* Pointer to vif. */
     struct vr_interface *tapdev_vif;
@@ -680,6 +909,22 @@ struct vr_dpdk_global {
     struct rte_mempool *frag_direct_mempool;
     /* Pointer to IP fragmentation memory pool (indirect) */
     struct rte_mempool *frag_indirect_mempool;
+    /* Per NUMA node RSS memory pools (rss_mempool is the master's one) */
+    struct rte_mempool *rss_mempools[RTE_MAX_NUMA_NODES];
+    /* Pointer to packet clones memory pool (indirect mbufs) */
+    struct rte_mempool *clone_mempool;
+    /* Pointer to multicast replica headers memory pool */
+    struct rte_mempool *hdr_mempool;
+    /* Pointer to monitoring copies memory pool */
+    struct rte_mempool *copy_mempool;
+    /* Number of allocation failures per mempool purpose */
+    rte_atomic64_t mempool_nombufs[VR_DPDK_MEMPOOL_MAX];
+    /* Pointer to multicast replication elements memory pool */
+    struct rte_mempool *repl_mempool;
+    /* Number of forwarding lcores (the last ones) replicating multicast */
+    uint16_t nb_repl_lcores;
+    /* Table of egress QoS schedulers (for dpdkinfo) */
+    struct vr_dpdk_qos_sched *qos_scheds[VR_DPDK_QOS_MAX_SCHEDS];
     /* List of free memory pools */
     struct rte_mempool *free_mempools[VR_DPDK_MAX_VM_MEMPOOLS] __rte_cache_aligned;
     /* List of KNI interfaces to handle KNI requests */
@@ -714,6 +959,34 @@ struct vr_dpdk_global {
 extern struct vr_dpdk_global vr_dpdk;
 extern struct rte_eth_conf ethdev_conf;
 
+/*
+ * vr_dpdk_rss_mempool_get - return the RSS mempool of the NUMA node or
+ * the master's RSS mempool if there is no mempool on the node.
+ */
+static inline struct rte_mempool *
+vr_dpdk_rss_mempool_get(int socket_id)
+{
+    if (likely(socket_id >= 0 && socket_id < RTE_MAX_NUMA_NODES
+                && vr_dpdk.rss_mempools[socket_id] != NULL))
+        return vr_dpdk.rss_mempools[socket_id];
+
+    return vr_dpdk.rss_mempool;
+}
+
+/* Returns the RSS mempool local to the calling lcore */
+static inline struct rte_mempool *
+vr_dpdk_rss_mempool_local(void)
+{
+    return vr_dpdk_rss_mempool_get(rte_socket_id());
+}
+
+/* Account an mbuf allocation failure of the given mempool purpose */
+static inline void
+vr_dpdk_mempool_nombuf(enum vr_dpdk_mempool_purpose purpose)
+{
+    rte_atomic64_inc(&vr_dpdk.mempool_nombufs[purpose]);
+}
+
 /*
  * rte_mbuf <=> vr_packet conversion
  *
@@ -825,8 +1098,10 @@ void vr_dpdk_nl_send_bond_intf_state(struct vr_dpdk_bond_member_info *info,
 
 int vr_dpdk_table_mem_init(unsigned int, unsigned int, unsigned long,
         unsigned int, unsigned long);
+void vr_dpdk_table_mem_exit(void);
 int vr_dpdk_flow_init(void);
 int vr_dpdk_bridge_init(void);
+int vr_dpdk_stats_mem_init(void);
 
 extern uint32_t vr_dpdk_master_port_id;
 
@@ -919,9 +1194,6 @@ uint64_t vr_dpdk_tapdev_rxtx(void);
 /* RX a burst of packets from the TAP device. */
 unsigned vr_dpdk_tapdev_rx_burst(struct vr_dpdk_tapdev *, struct rte_mbuf **,
         unsigned num, int datapath);
-/* Dequeue a burst of packets from the TAP device. */
-unsigned vr_dpdk_tapdev_dequeue_burst(struct vr_dpdk_tapdev *, struct rte_mbuf **,
-        unsigned num);
 /* TX a burst of packets to the TAP device. */
 unsigned vr_dpdk_tapdev_tx_burst(struct vr_dpdk_tapdev *, struct rte_mbuf **,
         unsigned num, int datapath);
@@ -958,6 +1230,8 @@ int vr_dpdk_lcore_mpls_schedule(struct vr_interface *vif, unsigned dst_ip,
     unsigned mpls_label);
 /* Returns the least used lcore or VR_MAX_CPUS_DPDK */
 unsigned vr_dpdk_lcore_least_used_get(void);
+/* Returns the least used lcore on a NUMA node */
+unsigned vr_dpdk_lcore_least_used_socket_get(int socket_id);
 size_t vr_dpdk_lcore_free_lcore_get(void);
 /* Flush TX queues */
 static inline void
@@ -994,6 +1268,9 @@ void vr_dpdk_lcore_cmd_post_all(uint16_t cmd, uint64_t cmd_arg);
 void vr_dpdk_lcore_schedule_assembler_work(struct vr_dpdk_lcore *lcore,
         void (*fun)(void *arg), void *arg);
 void dpdk_lcore_exit(unsigned lcore_id);
+/* Hand a multicast fan-out over to a replication lcore */
+int vr_dpdk_lcore_repl_enqueue(struct vr_packet *pkt, struct vr_nexthop *nh,
+        struct vr_forwarding_md *fmd);
 /*
  * vr_dpdk_netlink.c
  */
@@ -1001,9 +1278,16 @@ void vr_dpdk_netlink_wakeup(void);
 void dpdk_netlink_exit(void);
 int dpdk_netlink_init(void);
 int dpdk_netlink_receive(void *usockp, char *nl_buf, unsigned int nl_len);
+int dpdk_netlink_shm_poll(void *usockp);
+void dpdk_netlink_shm_detach(void *usockp);
 
 extern unsigned int vr_dpdk_rx_ring_sz, vr_dpdk_tx_ring_sz;
 extern unsigned int vr_dpdk_yield_option;
+extern unsigned int vr_dpdk_tapdev_nb_queues;
+extern unsigned int vr_dpdk_repl_lcores;
+extern unsigned int vr_dpdk_repl_rate;
+extern bool vr_dpdk_stats_shm;
+extern unsigned int vr_dpdk_qos_sched_rate;
 
 /*
  * vr_dpdk_ringdev.c
@@ -1033,10 +1317,12 @@ int dpdk_fragment_assembler_init(void);
 void dpdk_fragment_assembler_exit(void);
 int dpdk_fragment_assembler_enqueue(struct vrouter *router,
         struct vr_packet *pkt, struct vr_forwarding_md *fmd);
+int dpdk_fragment_assembler_enqueue_head(struct vrouter *router,
+        struct vr_packet *pkt, struct vr_forwarding_md *fmd);
 void dpdk_fragment_sync_assemble(struct vr_fragment_queue_element *vfqe);
 void dpdk_fragment_assembler_table_scan(void *);
 void dpdk_gro_free_all_flows(struct vr_dpdk_lcore *lcore);
-void dpdk_gro_flush_all_inactive(struct vr_dpdk_lcore *lcore);
+void dpdk_gro_flush_expired(struct vr_dpdk_lcore *lcore, uint64_t now);
 int dpdk_gro_process(struct vr_packet *pkt, struct vr_interface *vif, bool l2_pkt);
 int dpdk_segment_packet(struct vr_packet *pkt, struct rte_mbuf *mbuf_in,
                 struct rte_mbuf **mbuf_out, const unsigned short out_num,
@@ -1049,6 +1335,26 @@ uint16_t dpdk_ipv6_udptcp_cksum(struct rte_mbuf *m,
                        uint8_t *l4_hdr);
 int dpdk_check_rx_mrgbuf_disable(void);
 
+/*
+ * vr_dpdk_qos.c
+ */
+extern struct rte_port_out_ops vr_dpdk_qos_sched_ops;
+/* Wrap a fabric TX queue with an egress QoS scheduler */
+int vr_dpdk_qos_sched_attach(unsigned lcore_id, struct vr_dpdk_queue *tx_queue,
+    uint16_t queue_id);
+
+/* Tag the mbuf with the packet traffic class for the egress scheduler */
+static inline void
+vr_dpdk_qos_sched_mark(struct rte_mbuf *m, struct vr_packet *pkt)
+{
+    unsigned int tc = 0;
+
+    if (pkt->vp_queue != VP_QUEUE_INVALID)
+        tc = pkt->vp_queue;
+
+    m->hash.usr = VR_DPDK_QOS_TAG(tc, pkt->vp_if ? pkt->vp_if->vif_idx : 0);
+}
+
 /*
  * vr_dpdk_cpuflags.c
  */
@@ -110,6 +110,10 @@ struct vr_usocket {
     unsigned int usock_write_len;
     unsigned char *usock_tx_buf;
     struct vr_qhead usock_nl_responses;
+    /* shared memory rings the netlink client asked its messages go through */
+    void *usock_nl_shm;
+    /* children of a netlink socket that have shared memory rings */
+    unsigned int usock_nl_shms;
 
     struct iovec *usock_iovec;
 
@@ -454,6 +454,7 @@ struct vr_flow_entry {
 #define VR_DEF_FLOW_ENTRIES   (512 * 1024)
 
 extern unsigned int vr_flow_entries, vr_oflow_entries;
+extern bool vr_flow_table_reattach;
 
 #define VR_FLOW_TABLE_SIZE   (vr_flow_entries * sizeof(struct vr_flow_entry))
 #define VR_OFLOW_TABLE_SIZE  (vr_oflow_entries * sizeof(struct vr_flow_entry))
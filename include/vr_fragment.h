@@ -44,15 +44,38 @@ struct vr_fragment_key {
     unsigned short fk_custom;
 } __attribute__packed__close__;
 
+struct vr_fragment_pool;
+
 struct vr_fragment_queue_element {
     struct vrouter *fqe_router;
     struct vr_fragment_queue_element *fqe_next;
+    /* pool the element belongs to, NULL if it was allocated */
+    struct vr_fragment_pool *fqe_pool;
     struct vr_packet_node fqe_pnode;
+    /* key of a head notification, which carries no packet */
+    struct vr_fragment_key fqe_key;
+};
+
+/* Fixed size element pool, owned by a single cpu */
+struct vr_fragment_pool {
+    struct vr_fragment_queue_element *vfp_free;
+    unsigned int vfp_size;
+    unsigned int vfp_used;
+    struct vr_fragment_queue_element vfp_elements[0];
 };
 
 struct vr_fragment_queue {
     uint64_t vfq_length;
     struct vr_fragment_queue_element *vfq_tail;
+    /*
+     * If set up, the queue is a single producer single consumer ring
+     * fed from vfq_pool, and the CAS list above is not used.
+     */
+    struct vr_fragment_pool *vfq_pool;
+    struct vr_fragment_queue_element **vfq_ring;
+    unsigned int vfq_ring_mask;
+    volatile unsigned int vfq_prod;
+    volatile unsigned int vfq_cons;
 };
 
 __attribute__packed__open__
@@ -93,12 +116,30 @@ void vr_fragment_del(vr_htable_t, struct vr_fragment *);
 uint32_t vr_fragment_get_hash(struct vr_packet_node *);
 int vr_fragment_assemble(struct vr_fragment **,
         struct vr_fragment_queue_element *);
+bool vr_fragment_assemble_key(struct vr_fragment_queue_element *,
+        struct vr_fragment_key *);
+bool vr_fragment_assemble_bypass(struct vr_fragment_queue_element *, bool);
+bool vr_fragment_assemble_entry(struct vr_fragment *,
+        struct vr_fragment_queue_element *, bool);
+void vr_fragment_drop_queued(struct vr_fragment *);
+void vr_fragment_queue_element_free(struct vr_fragment_queue_element *,
+        unsigned int);
 void vr_fragment_assemble_queue(struct vr_fragment_queue *);
 unsigned int vr_assembler_table_scan(struct vr_fragment **);
 int vr_fragment_enqueue(struct vrouter *, struct vr_fragment_queue *,
         struct vr_packet *, struct vr_forwarding_md *);
+void vr_fragment_head_key(struct vr_packet *, struct vr_forwarding_md *,
+        struct vr_fragment_key *);
+int vr_fragment_enqueue_head(struct vrouter *, struct vr_fragment_queue *,
+        struct vr_fragment_key *);
+int vr_fragment_head_to_assembler(struct vrouter *, struct vr_packet *,
+        struct vr_forwarding_md *);
 int vr_assembler_table_scan_init(void (*)(void *));
 void vr_assembler_table_scan_exit(void);
 void vr_fragment_queue_free(struct vr_fragment_queue *queue);
+struct vr_fragment_pool *vr_fragment_pool_alloc(unsigned int);
+void vr_fragment_pool_free(struct vr_fragment_pool *);
+int vr_fragment_queue_ring_init(struct vr_fragment_queue *,
+        struct vr_fragment_pool *, unsigned int);
 
 #endif /* __VR_FRAGMENT_H__ */
@@ -18,6 +18,9 @@ enum vnsw_nl_attrs {
 };
 
 #define SANDESH_REQUEST     1
+/* carry the messages of the client through shared memory rings, the
+ * path of which is in the NL_ATTR_VR_MESSAGE_PROTOCOL attribute */
+#define SANDESH_SHM_ATTACH  2
 
 #ifdef __cplusplus
 }
@@ -26,6 +26,7 @@ typedef vr_hentry_key (*get_hentry_key)(vr_htable_t, vr_hentry_t *,
         unsigned int *);
 typedef void (*htable_trav_cb)(vr_htable_t , vr_hentry_t *, unsigned int,
         void *);
+typedef bool (*htable_restore_cb)(vr_htable_t, vr_hentry_t *, void *);
 
 vr_htable_t vr_htable_create(struct vrouter *, unsigned int , unsigned int,
                                 unsigned int , unsigned int , unsigned int,
@@ -33,6 +34,9 @@ vr_htable_t vr_htable_create(struct vrouter *, unsigned int , unsigned int,
 vr_htable_t vr_htable_attach(struct vrouter *, unsigned int, void *,
         unsigned int, void *, unsigned int , unsigned int ,
         unsigned int , get_hentry_key);
+vr_htable_t vr_htable_reattach(struct vrouter *, unsigned int, void *,
+        unsigned int, void *, unsigned int , unsigned int ,
+        unsigned int , get_hentry_key, htable_restore_cb, void *);
 
 unsigned int vr_htable_used_oflow_entries(vr_htable_t);
 unsigned int vr_htable_used_total_entries(vr_htable_t);
@@ -10,8 +10,34 @@ typedef void (*vr_itable_del_cb_t)(unsigned int index, void *data);
 
 #define VR_ITABLE_ERR_PTR ((void *)-1)
 
+/*
+ * Lookup backends. The trie is always kept and is what vr_itable_set,
+ * vr_itable_del and vr_itable_trav work on. The other backends are a copy
+ * of it that vr_itable_get reads instead: a flat array indexed directly
+ * for dense index spaces, and a perfect hash for sparse ones. The copy is
+ * rebuilt in the control path when an index is added that it can not take
+ * in place, and swapped in for the old one, which is freed after an RCU
+ * period. A table whose copy can not be built is looked up in the trie
+ * until vr_itable_set_backend is called again.
+ */
+#define VR_ITABLE_BACKEND_TRIE      0
+#define VR_ITABLE_BACKEND_FLAT      1
+#define VR_ITABLE_BACKEND_PHASH     2
+/* flat if the indices in use are dense enough, perfect hash otherwise */
+#define VR_ITABLE_BACKEND_AUTO      3
+
+/* most entries a flat array can have */
+#define VR_ITABLE_FLAT_MAX          (1 << 16)
+/* a flat array may have this many slots per index in use */
+#define VR_ITABLE_FLAT_DENSITY      8
+
+struct vrouter;
+
 vr_itable_t vr_itable_create(unsigned int index_len, unsigned int stride_cnt, ...);
 void vr_itable_delete(vr_itable_t t, vr_itable_del_cb_t func);
+int vr_itable_set_backend(vr_itable_t t, struct vrouter *router,
+        unsigned int backend);
+unsigned int vr_itable_get_backend(vr_itable_t t);
 
 void *vr_itable_get(vr_itable_t t, unsigned int index);
 void *vr_itable_del(vr_itable_t t, unsigned int index);
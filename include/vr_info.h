@@ -28,6 +28,8 @@
     X(CONF_DEL_DDP, conf_del_ddp, DPDK) \
     X(CONF_LOG, conf_log, DPDK) \
     X(CONF_LOG_LIST, conf_log_list, DPDK) \
+    X(INFO_QOS, info_get_qos, DPDK) \
+    X(CONF_CAPTURE, conf_capture, DPDK) \
 
 /* Define all supported platforms.
  * When a new platforms added, define like below.
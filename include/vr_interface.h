@@ -202,9 +202,11 @@ struct vr_interface_stats {
     uint64_t vis_port_ierrors;
     uint64_t vis_port_isyscalls;
     uint64_t vis_port_inombufs;
+    uint64_t vis_port_ioffloads;
     uint64_t vis_port_opackets;
     uint64_t vis_port_oerrors;
     uint64_t vis_port_osyscalls;
+    uint64_t vis_port_ooffloads;
     /* device counters */
     uint64_t vis_dev_ibytes;
     uint64_t vis_dev_ipackets;
@@ -217,6 +219,83 @@ struct vr_interface_stats {
     uint64_t *vis_queue_ierrors_to_lcore;
 };
 
+/*
+ * per vif ingress policer and egress rate limiter. Each direction has a
+ * byte (bps) and a packet (pps) token bucket. The buckets are split per
+ * cpu so that the datapath never writes a shared cache line: the owning
+ * cpu only advances vvb_used/vvb_demand, in a cache line of its own, and
+ * the refill timer only advances vvg_grant, in a separate array that the
+ * cpus just read. Every VIF_POLICER_INTERVAL_MSEC the timer hands out the
+ * tokens of the last interval to the cpus in proportion to what they
+ * asked for, so a single busy lcore can use the whole rate.
+ */
+#define VIF_POLICER_IN                  0
+#define VIF_POLICER_OUT                 1
+#define VIF_POLICER_DIRS                2
+
+#define VIF_POLICER_BYTES               0
+#define VIF_POLICER_PKTS                1
+#define VIF_POLICER_UNITS               2
+
+#define VIF_POLICER_INTERVAL_MSEC       10
+/* burst, when not configured, covers this much time at the full rate */
+#define VIF_POLICER_DEF_BURST_MSEC      100
+/* smallest per cpu bucket, so that a GSO/GRO packet can still conform */
+#define VIF_POLICER_MIN_BURST_BYTES     65535
+#define VIF_POLICER_MIN_BURST_PKTS      1
+
+#define VIF_POLICER_ALIGN               64
+
+/* written only by the owning cpu */
+struct vr_vif_bucket {
+    uint64_t vvb_used;
+    uint64_t vvb_demand;
+};
+
+struct vr_vif_cpu_buckets {
+    struct vr_vif_bucket vcb_bucket[VIF_POLICER_UNITS];
+    uint8_t vcb_pad[VIF_POLICER_ALIGN -
+        ((VIF_POLICER_UNITS * sizeof(struct vr_vif_bucket)) %
+         VIF_POLICER_ALIGN)];
+};
+
+/* written only by the refill timer */
+struct vr_vif_grant {
+    uint64_t vvg_grant;
+    /* vvb_demand at the last tick and its delta */
+    uint64_t vvg_seen;
+    uint64_t vvg_delta;
+};
+
+struct vr_vif_tb {
+    /* units per second, 0 when the unit is not limited */
+    uint64_t vvt_rate;
+    uint64_t vvt_burst;
+    /* smallest per cpu bucket depth */
+    uint64_t vvt_floor;
+    /* sub unit refill remainder, in units * msec */
+    uint64_t vvt_frac;
+};
+
+struct vr_vif_policer {
+    /* configuration, as received from the agent */
+    uint64_t vvp_bps;
+    uint64_t vvp_pps;
+    uint64_t vvp_burst_bytes;
+    uint64_t vvp_burst_pkts;
+    struct vr_vif_tb vvp_tb[VIF_POLICER_UNITS];
+    /* vr_num_cpus entries, VIF_POLICER_ALIGN aligned, within vvp_mem */
+    struct vr_vif_cpu_buckets *vvp_cpu;
+    /* vr_num_cpus * VIF_POLICER_UNITS entries, within vvp_mem */
+    struct vr_vif_grant *vvp_grant;
+    uint8_t vvp_mem[0];
+};
+
+#define VIF_POLICER_BUCKET(pol, cpu, unit) \
+    (&(pol)->vvp_cpu[(cpu)].vcb_bucket[(unit)])
+#define VIF_POLICER_GRANT(pol, cpu, unit) \
+    (&(pol)->vvp_grant[((cpu) * VIF_POLICER_UNITS) + (unit)])
+
 struct vr_packet;
 
 struct agent_send_params {
@@ -381,6 +460,7 @@ struct vr_interface {
     unsigned char vif_mac[VR_ETHER_ALEN];
     uint8_t vif_transport;
     uint8_t vif_mirror_id;
+    struct vr_vif_policer *vif_policer[VIF_POLICER_DIRS];
 #ifdef __KERNEL__
 #if defined(__linux__)
     struct napi_struct vr_napi;
@@ -405,7 +485,6 @@ struct vr_interface {
     struct vr_interface **vif_sub_interfaces;
     struct vr_interface_driver *vif_driver;
     unsigned char *vif_src_mac;
-    uint8_t *vif_bridge_table_lock;
     vr_htable_t vif_btable;
     unsigned char vif_rewrite[VR_ETHER_HLEN];
     int16_t vif_qos_map_index;
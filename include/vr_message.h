@@ -39,6 +39,7 @@
 #define VR_PKT_DROP_LOG_OBJECT_ID       20
 #define VR_VRF_TABLE_OBJECT_ID          21
 #define VR_INFO_OBJECT_ID               22
+#define VR_BULK_OBJECT_ID               23
 
 #define VR_MESSAGE_PAGE_SIZE            (4096 - 128)
 
@@ -56,6 +57,32 @@ struct vr_mproto {
 struct vr_mtransport {
     char    *(*mtrans_alloc)(unsigned int);
     void    (*mtrans_free)(char *);
+    /* bytes the transport needs in front of a response buffer */
+    unsigned int mtrans_headroom;
+    /* response buffers to preallocate, 0 to allocate each response */
+    unsigned int mtrans_arena_slots;
+};
+
+/* bytes a response encoded into an arena buffer can take */
+#define VR_MESSAGE_ARENA_BUF_LEN        VR_MESSAGE_PAGE_SIZE
+/* arena buffers only error responses may take */
+#define VR_MESSAGE_ARENA_RESERVE        4
+
+/*
+ * Response buffers preallocated for a transport. Each slot holds the
+ * message, the headroom of the transport and an encode buffer, so that a
+ * response is encoded and queued without any allocation. When only the
+ * reserved slots are left, requests are answered with -ENOBUFS until the
+ * transport has written out and freed the responses it holds.
+ */
+struct vr_message_arena {
+    unsigned int va_slots;
+    unsigned int va_slot_len;
+    unsigned int va_headroom;
+    unsigned int va_free;
+    bool va_release;
+    unsigned int *va_free_slots;
+    char *va_mem;
 };
 
 struct vr_message {
@@ -73,10 +100,47 @@ struct vr_message_multi {
     void *vr_mm_object[VR_MESSAGE_MULTI_MAX_OBJECTS];
 };
 
+/* dumps whose cursors are kept at a time */
+#define VR_MESSAGE_DUMP_CURSORS         4
+#define VR_MESSAGE_DUMP_MARKER_LEN      16
+#define VR_MESSAGE_DUMP_STATE_LEN       256
+
+/*
+ * Where a dump stopped, kept from the request for one chunk of the dump to
+ * the request for the next one, so that the table walk resumes from there
+ * rather than from a search for the marker. A cursor is only used for the
+ * request carrying the marker it was saved with, and only if the table is
+ * of the same generation.
+ */
+struct vr_message_dump_cursor {
+    unsigned int dc_object;
+    unsigned int dc_gen;
+    uint64_t dc_key;
+    uint64_t dc_used;
+    unsigned int dc_marker_len;
+    uint8_t dc_marker[VR_MESSAGE_DUMP_MARKER_LEN];
+    uint64_t dc_state[VR_MESSAGE_DUMP_STATE_LEN / sizeof(uint64_t)];
+};
+
+/* objects a single bulk request may carry */
+#define VR_MESSAGE_BULK_MAX_OBJECTS     1024
+
+/*
+ * The item of a bulk request being applied. While a bulk request is being
+ * applied, the response to each item is folded into the status of the item
+ * instead of being queued. Broadcasts are sent as usual.
+ */
+struct vr_message_bulk {
+    bool vmb_responded;
+    int vmb_status;
+};
+
 struct vr_message_handler {
     struct vr_mproto *vm_proto;
     struct vr_mtransport *vm_trans;
     struct vr_qhead vm_response_queue;
+    struct vr_message_bulk *vm_bulk;
+    struct vr_message_arena *vm_arena;
 };
 
 struct vr_message_dumper {
@@ -97,6 +161,10 @@ int vr_message_proto_register(struct vr_mproto *);
 void vr_message_proto_unregister(struct vr_mproto *);
 struct vr_message_dumper *vr_message_dump_init(void *);
 void vr_message_dump_exit(void *, int);
+void *vr_message_dump_cursor_get(unsigned int, uint64_t, unsigned int,
+        void *, unsigned int);
+int vr_message_dump_cursor_save(unsigned int, uint64_t, unsigned int,
+        void *, unsigned int, void *, unsigned int);
 
 int vr_message_request(struct vr_message *);
 int vr_message_response(unsigned int, void *, int, bool);
@@ -104,6 +172,7 @@ int vr_message_multi_response(struct vr_message_multi *);
 int vr_message_make_request(unsigned int, void *);
 int vr_message_process_response(int (*)(void *, unsigned int, void *), void *);
 int vr_message_dump_object(void *, unsigned int, void *);
+unsigned int vr_bulk_req_get_size(void *);
 void *vr_mtrans_alloc(unsigned int);
 void vr_mtrans_free(void *);
 
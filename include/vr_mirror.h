@@ -30,12 +30,34 @@ typedef enum {
         VR_ETHER_HLEN)
 
 
+/* Per-cpu mirroring counters */
+struct vr_mirror_stats {
+    uint64_t mirs_packets;
+    uint64_t mirs_sampled;
+    uint64_t mirs_rate_limited;
+    uint64_t mirs_truncated;
+    /* Sampling counter (1-in-N) */
+    unsigned int mirs_sample_cnt;
+};
+
 struct vr_mirror_entry {
     unsigned int mir_rid;
     int mir_vni;
     uint16_t mir_vlan_id;
     uint16_t mir_flags;
     struct vr_nexthop *mir_nh;
+    /* Number of bytes of the packet to mirror (0 - the whole packet) */
+    unsigned int mir_snaplen;
+    /* Mirror 1 in mir_sample_rate packets (0 or 1 - all the packets) */
+    unsigned int mir_sample_rate;
+    /* Maximum number of mirrored packets per second (0 - no limit) */
+    unsigned int mir_rate_limit;
+    /*
+     * Rate limiting window (the second, in the upper 32 bits) and the
+     * packets mirrored in it (the lower 32 bits), updated together
+     */
+    uint64_t mir_rl_state;
+    struct vr_mirror_stats *mir_stats;
 };
 
 struct vr_mirror_meta_entry {
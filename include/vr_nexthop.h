@@ -71,6 +71,7 @@ enum nexthop_type {
 #define NH_FLAG_TUNNEL_MPLS_O_MPLS          0x04000000
 #define NH_FLAG_VALIDATE_MCAST_SRC          0x08000000
 #define NH_FLAG_TUNNEL_UNDERLAY_ECMP        0x10000000
+#define NH_FLAG_COMPOSITE_RESILIENT         0x20000000
 
 #define NH_SOURCE_INVALID                   0
 #define NH_SOURCE_VALID                     1
@@ -87,6 +88,18 @@ enum nexthop_type {
 
 #define NH_ECMP_PACKET_HELD                 (-2)
 
+/*
+ * A resilient ECMP composite hashes into a table of buckets, each naming
+ * a component, rather than taking the hash modulo the number of components.
+ * Buckets are handed to components in proportion to their weight and move
+ * only from components that leave or that hold more than their share, so
+ * that flows hashing to the other buckets keep their component.
+ */
+#define NH_ECMP_BUCKETS_MIN                 256
+#define NH_ECMP_BUCKETS_MAX                 (1 << 16)
+#define NH_ECMP_BUCKET_INVALID              0xffff
+#define NH_ECMP_WEIGHT_DEFAULT              1
+
 struct vr_packet;
 
 struct vr_forwarding_md;
@@ -94,14 +107,77 @@ struct vr_forwarding_md;
 struct vr_component_nh {
     int cnh_label;
     int cnh_ecmp_index;
+    /* share of the buckets of a resilient ECMP, 0 for a standby member */
+    unsigned short cnh_weight;
     struct vr_nexthop *cnh;
 };
 
+/*
+ * The outer IPv4 header of a tunnel nexthop, and the UDP or GRE header that
+ * follows it, built when the nexthop is added so that the transmit path
+ * copies it and patches only the length, id, tos, ttl and UDP source port.
+ * ntt_sum is the one's complement sum of the IP header words that never
+ * change, to which the patched words are added for the checksum.
+ */
+#define NH_TUN_TMPL_MAX_LEN                 28
+
+struct vr_nh_tun_tmpl {
+    unsigned int ntt_sum;
+    unsigned char ntt_len;
+    unsigned char ntt_hdr[NH_TUN_TMPL_MAX_LEN];
+};
+
+struct vr_nh_ecmp_buckets {
+    unsigned int neb_mask;
+    uint16_t neb_bucket[0];
+};
+
+/* Per-cpu replication counters of multicast composite nexthops */
+struct vr_nh_repl_stats {
+    uint64_t nrs_packets;
+    uint64_t nrs_replicas;
+    uint64_t nrs_deferred;
+    uint64_t nrs_drops;
+};
+
 typedef enum {
     NH_PROCESSING_COMPLETE,
     NH_PROCESSING_INCOMPLETE,
 } nh_processing_t;
 
+/*
+ * The flattened form of an ECMP member: the nexthop it resolves to and
+ * what nh_output would look up in that nexthop, so that the composite
+ * hands the packet to the member with a single cache line read. For an
+ * L3 encap member, the record also holds the egress vif and the rewrite,
+ * and the packet goes out without touching the member. A member that
+ * changes clears nf_reach_nh in the records of the composites it belongs
+ * to (nh_flat_users), and those composites get a new table, the old one
+ * being freed after an RCU period.
+ */
+#define NH_FLAT_ALIGN                       64
+
+struct vr_nh_flat {
+    nh_processing_t     (*nf_reach_nh)(struct vr_packet *,
+                                       struct vr_nexthop *,
+                                       struct vr_forwarding_md *);
+    struct vr_nexthop   *nf_nh;
+    /* set only for L3 encap members */
+    struct vr_interface *nf_dev;
+    uint8_t             *nf_data;
+    uint16_t            nf_encap_len;
+    int                 nf_label;
+    /* the member asks for a flow lookup of packets that had none */
+    bool                nf_flow_lookup;
+};
+
+struct vr_nh_flat_table {
+    unsigned int        nft_cnt;
+    /* NH_FLAT_ALIGN aligned, within nft_mem */
+    struct vr_nh_flat   *nft_flat;
+    uint8_t             nft_mem[0];
+};
+
 struct vr_nexthop {
     uint8_t         nh_type;
     /*
@@ -116,6 +192,10 @@ struct vr_nexthop {
     unsigned int    nh_id;
     unsigned int    nh_rid;
     unsigned int    nh_users;
+    /* the ECMP composites with a flattened table this nexthop is in */
+    unsigned short  nh_flat_users_cnt;
+    unsigned short  nh_flat_users_size;
+    struct vr_nexthop **nh_flat_users;
     union {
         struct {
             uint16_t        encap_len;
@@ -162,6 +242,8 @@ struct vr_nexthop {
             unsigned short ecmp_config_hash;
             struct vr_component_nh *component;
             struct vr_component_nh *ecmp_active;
+            struct vr_nh_ecmp_buckets *ecmp_buckets;
+            struct vr_nh_flat_table *flat;
         } nh_composite;
 
     } nh_u;
@@ -177,10 +259,12 @@ struct vr_nexthop {
                                        struct vr_forwarding_md *);
     struct vr_interface *nh_crypt_dev;
     void                (*nh_destructor)(struct vr_nexthop *);
+    struct vr_nh_repl_stats *nh_repl_stats;
     struct vr_interface *nh_dev_arr[VR_MAX_PHY_INF];
     uint8_t             nh_encap_valid[VR_MAX_PHY_INF];
     struct vr_interface *nh_valid_underlay_dev[VR_MAX_PHY_INF];
     int                 nh_valid_underlay_dev_count;
+    struct vr_nh_tun_tmpl nh_tun_tmpl;
     uint8_t             nh_data[0];
 };
 
@@ -212,6 +296,8 @@ struct vr_nexthop {
 #define nh_component_ecmp_cnt   nh_u.nh_composite.ecmp_cnt
 #define nh_component_ecmp       nh_u.nh_composite.ecmp_active
 #define nh_ecmp_config_hash     nh_u.nh_composite.ecmp_config_hash
+#define nh_ecmp_buckets         nh_u.nh_composite.ecmp_buckets
+#define nh_component_flat       nh_u.nh_composite.flat
 
 #define nh_pbb_mac         nh_u.nh_pbb_tun.tun_pbb_mac
 #define nh_pbb_label       nh_u.nh_pbb_tun.tun_pbb_label
@@ -240,6 +326,8 @@ extern int vr_ip_rcv(struct vrouter *, struct vr_packet *,
 extern int nh_output(struct vr_packet *,
         struct vr_nexthop *, struct vr_forwarding_md *);
 extern int vr_nexthop_add(vr_nexthop_req *);
+extern int vr_nh_ecmp_buckets_build(struct vr_nexthop *, unsigned int,
+        struct vr_component_nh *, unsigned int, struct vr_nh_ecmp_buckets **);
 extern int vr_nexthop_get(vr_nexthop_req *);
 extern int vr_nexthop_dump(vr_nexthop_req *);
 extern bool vr_gateway_nexthop(struct vr_nexthop *);
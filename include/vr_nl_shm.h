@@ -0,0 +1,196 @@
+/*
+ * vr_nl_shm.h -- shared memory rings carrying netlink messages between a
+ * client and the DPDK vrouter
+ *
+ * Copyright (c) 2014, Juniper Networks Private Inc.,
+ * All rights reserved
+ */
+#ifndef __VR_NL_SHM_H__
+#define __VR_NL_SHM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+
+/*
+ * A client of the DPDK vrouter that connected to the netlink unix socket
+ * may ask, with a SANDESH_SHM_ATTACH message carrying the path of a file
+ * it created and mapped, that the messages it sends and receives go
+ * through a request and a response ring in that file instead. The vrouter
+ * maps the file and sets vns_state to VR_NL_SHM_STATE_ATTACHED before it
+ * answers on the socket. A client that does not find the state set after
+ * the answer keeps using the socket.
+ *
+ * Each ring carries the very netlink messages that would have gone over
+ * the socket, each one behind its length. Both rings have one producer and
+ * one consumer and are polled, the vrouter polling the request ring from
+ * the netlink lcore, so that neither side makes a system call per message.
+ * The socket is kept open so that each side notices when the other goes.
+ */
+#define VR_NL_SHM_MAGIC             0x76724e4c
+#define VR_NL_SHM_VERSION           1
+#define VR_NL_SHM_RING_SIZE         (1 << 20)
+#define VR_NL_SHM_MAX_RING_SIZE     (1 << 26)
+#define VR_NL_SHM_FILE_PREFIX       "nl_shm"
+
+#define VR_NL_SHM_STATE_INIT        0
+#define VR_NL_SHM_STATE_ATTACHED    1
+
+/* record length marking that the ring continues from its start */
+#define VR_NL_SHM_WRAP              0xffffffffU
+#define VR_NL_SHM_REC_LEN(len)      (sizeof(uint32_t) + (((len) + 3) & ~3U))
+
+struct vr_nl_shm_ring {
+    /* written by the producer only */
+    uint32_t vnr_head;
+    uint8_t vnr_pad0[60];
+    /* written by the consumer only */
+    uint32_t vnr_tail;
+    uint8_t vnr_pad1[60];
+};
+
+struct vr_nl_shm_hdr {
+    uint32_t vns_magic;
+    uint32_t vns_version;
+    /* bytes of each ring, a power of 2 */
+    uint32_t vns_ring_size;
+    uint32_t vns_state;
+    uint8_t vns_pad[48];
+    struct vr_nl_shm_ring vns_req;
+    struct vr_nl_shm_ring vns_resp;
+    /* the request ring, then the response ring */
+};
+
+static inline size_t
+vr_nl_shm_size(uint32_t ring_size)
+{
+    return sizeof(struct vr_nl_shm_hdr) + 2 * (size_t)ring_size;
+}
+
+static inline uint8_t *
+vr_nl_shm_req_data(struct vr_nl_shm_hdr *hdr)
+{
+    return (uint8_t *)(hdr + 1);
+}
+
+static inline uint8_t *
+vr_nl_shm_resp_data(struct vr_nl_shm_hdr *hdr)
+{
+    return (uint8_t *)(hdr + 1) + hdr->vns_ring_size;
+}
+
+/*
+ * vr_nl_shm_put - copy the message of len bytes at buf to the ring whose
+ * data is at data. Returns 0, -EMSGSIZE if the message can never fit the
+ * ring, or -ENOSPC if it does not fit now.
+ */
+static inline int
+vr_nl_shm_put(struct vr_nl_shm_ring *ring, uint8_t *data, uint32_t size,
+        void *buf, uint32_t len)
+{
+    uint32_t head, tail, off, contig, need;
+
+    need = VR_NL_SHM_REC_LEN(len);
+    if (need > size / 2)
+        return -EMSGSIZE;
+
+    head = ring->vnr_head;
+    tail = __atomic_load_n(&ring->vnr_tail, __ATOMIC_ACQUIRE);
+    off = head & (size - 1);
+    contig = size - off;
+    if (contig < need) {
+        if (need + contig > size - (head - tail))
+            return -ENOSPC;
+
+        *(uint32_t *)(data + off) = VR_NL_SHM_WRAP;
+        head += contig;
+        off = 0;
+    } else if (need > size - (head - tail)) {
+        return -ENOSPC;
+    }
+
+    *(uint32_t *)(data + off) = len;
+    memcpy(data + off + sizeof(uint32_t), buf, len);
+    __atomic_store_n(&ring->vnr_head, head + need, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/*
+ * vr_nl_shm_get - copy the oldest message in the ring whose data is at data
+ * to buf, which has room for *len bytes, and take it off the ring. The
+ * other side may write the ring at any time, so the record is checked
+ * against what the producer published before anything is copied. Returns
+ * 1 and the message length in *len, 0 if the ring is empty, -EMSGSIZE and
+ * the message length in *len if it does not fit buf, the message being
+ * left in the ring, or -EINVAL if the record is corrupt.
+ */
+static inline int
+vr_nl_shm_get(struct vr_nl_shm_ring *ring, uint8_t *data, uint32_t size,
+        void *buf, uint32_t *len)
+{
+    uint32_t head, tail, off, avail, msg_len;
+
+    head = __atomic_load_n(&ring->vnr_head, __ATOMIC_ACQUIRE);
+    tail = ring->vnr_tail;
+    avail = head - tail;
+    if (!avail)
+        return 0;
+
+    off = tail & (size - 1);
+    if (avail > size || (tail & 3) || avail < sizeof(uint32_t))
+        return -EINVAL;
+
+    msg_len = __atomic_load_n((uint32_t *)(data + off), __ATOMIC_RELAXED);
+    if (msg_len == VR_NL_SHM_WRAP) {
+        if (avail < size - off)
+            return -EINVAL;
+
+        tail += size - off;
+        avail -= size - off;
+        __atomic_store_n(&ring->vnr_tail, tail, __ATOMIC_RELEASE);
+        if (!avail)
+            return 0;
+
+        off = 0;
+        msg_len = __atomic_load_n((uint32_t *)data, __ATOMIC_RELAXED);
+    }
+
+    if (msg_len > size / 2 || VR_NL_SHM_REC_LEN(msg_len) > avail ||
+            VR_NL_SHM_REC_LEN(msg_len) > size - off)
+        return -EINVAL;
+
+    if (msg_len > *len) {
+        *len = msg_len;
+        return -EMSGSIZE;
+    }
+
+    memcpy(buf, data + off + sizeof(uint32_t), msg_len);
+    __atomic_store_n(&ring->vnr_tail, tail + VR_NL_SHM_REC_LEN(msg_len),
+            __ATOMIC_RELEASE);
+    *len = msg_len;
+
+    return 1;
+}
+
+/*
+ * vr_nl_shm_skip - take the oldest message, of len bytes as told by
+ * vr_nl_shm_get, off the ring without copying it
+ */
+static inline void
+vr_nl_shm_skip(struct vr_nl_shm_ring *ring, uint32_t len)
+{
+    __atomic_store_n(&ring->vnr_tail, ring->vnr_tail + VR_NL_SHM_REC_LEN(len),
+            __ATOMIC_RELEASE);
+    return;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __VR_NL_SHM_H__ */
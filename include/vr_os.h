@@ -29,6 +29,7 @@
 #define vr_sync_bool_compare_and_swap_8u(a, b, c)       __sync_bool_compare_and_swap((a), (b), (c))
 #define vr_sync_bool_compare_and_swap_16u(a, b, c)      __sync_bool_compare_and_swap((a), (b), (c))
 #define vr_sync_bool_compare_and_swap_32u(a, b, c)      __sync_bool_compare_and_swap((a), (b), (c))
+#define vr_sync_bool_compare_and_swap_64u(a, b, c)      __sync_bool_compare_and_swap((a), (b), (c))
 #define vr_sync_bool_compare_and_swap_p(a, b, c)        __sync_bool_compare_and_swap((a), (b), (c))
 #define vr_sync_val_compare_and_swap_16u(a, b, c)       __sync_val_compare_and_swap((a), (b), (c))
 #define vr_sync_lock_test_and_set_8u(a, b)              __sync_lock_test_and_set((a), (b))
@@ -308,6 +308,9 @@ extern "C" {
     X(VP_DROP_ICMP_ERROR) \
     X(VP_DROP_CLONE_FAIL) \
     X(VP_DROP_INVALID_UNDERLAY_ECMP) \
+    X(VP_DROP_VIF_POLICER_IN) \
+    X(VP_DROP_VIF_POLICER_OUT) \
+    X(VP_DROP_REPL_RING_FULL) \
     X(VP_DROP_MAX)
 
 #define DROP_VP_TYPE_MAP(X) \
@@ -18,6 +18,15 @@
         VR_MPLS_QOS_ENTRIES + \
         VR_DOTONEP_QOS_ENTRIES)
 
+/*
+ * Egress scheduler traffic classes. The queue id of a forwarding class
+ * selects the traffic class (modulo the number of classes).
+ */
+#define VR_QOS_SCHED_NUM_TC         8
+#define VR_QOS_SCHED_DEF_WEIGHT     1
+/* weight of a strict priority traffic class */
+#define VR_QOS_SCHED_STRICT         0
+
 /*
  * We split the structure this way because flow structure has only
  * 3 bytes of space between hash entry and key. Adding any other
@@ -40,6 +49,15 @@ struct vr_forwarding_class {
     struct vr_forwarding_class_qos vfc_qos;
 } __attribute__packed__close__;
 
+/*
+ * Scheduling parameters of a traffic class. Weight 0 means strict
+ * priority (higher classes first), rate 0 means the class is not shaped.
+ */
+struct vr_qos_sched_tc {
+    uint32_t vqst_rate;     /* Mbps */
+    uint8_t vqst_weight;
+};
+
 /* for easy access */
 #define vfc_dscp        vfc_qos.vfcq_dscp
 #define vfc_mpls_qos    vfc_qos.vfcq_mpls_qos
@@ -57,5 +75,7 @@ extern void vr_qos_exit(struct vrouter *, bool);
 struct vr_forwarding_class_qos *vr_qos_get_forwarding_class(struct vrouter *,
         struct vr_packet *, struct vr_forwarding_md *);
 extern unsigned int vr_qos_map_req_get_size(void *);
+extern struct vr_qos_sched_tc *vr_qos_sched_get(struct vrouter *,
+        unsigned int);
 
 #endif /* __VR_QOS_H__ */
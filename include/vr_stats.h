@@ -13,6 +13,13 @@ extern "C" {
 extern void vr_malloc_stats(unsigned int, unsigned int);
 extern void vr_free_stats(unsigned int);
 
+struct vr_stats_shm_hdr;
+
+extern struct vr_stats_shm_hdr *vr_stats_shm;
+extern uint64_t vr_stats_shm_layout(struct vr_stats_shm_hdr *);
+extern void *vr_stats_shm_get(unsigned int, unsigned int);
+extern bool vr_stats_shm_put(unsigned int, void *);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,103 @@
+/*
+ * vr_stats_shm.h -- layout of the shared memory region the vrouter keeps
+ * its per-core interface, VRF and drop counters in
+ *
+ * Copyright (c) 2014, Juniper Networks Private Inc.,
+ * All rights reserved
+ */
+#ifndef __VR_STATS_SHM_H__
+#define __VR_STATS_SHM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if !defined(__KERNEL__) && !defined(_KERNEL)
+#include <stdint.h>
+#endif
+
+/*
+ * When asked to, the DPDK vrouter creates the region as a file and the
+ * datapath updates the per-core counter blocks in place there, so that a
+ * collector may map the file read only and add the counters up itself,
+ * without sending a single message to the vrouter.
+ *
+ * The region starts with the header below. vss_magic is written last, once
+ * the layout is in place. A vrouter that restarts lays out a new file and
+ * renames it over the old one, clearing the magic of the old one first: a
+ * collector that finds it changed maps the file again. Each section holds
+ * vsc_blocks blocks, vsc_copies of them for each interface or VRF index,
+ * the blocks of index i starting with block i * vsc_copies. Each block
+ * holds vss_cpus per-core counter sets vsc_cpu_stride bytes apart, the
+ * first vsc_counters 64 bit words of each set being the counters. A
+ * section also keeps a 32 bit generation per block, odd while the block
+ * belongs to an interface or VRF and bumped each time it is taken or
+ * given back, so that a collector reading the generation before and after
+ * the counters knows whether they were of one and the same owner.
+ *
+ * Interfaces have two copies, as an index may be added again while the
+ * interface it had is still waiting for the datapath to let go of its
+ * block. The block of the newest owner of an index is then the one with
+ * the higher odd generation.
+ */
+#define VR_STATS_SHM_MAGIC          0x76725354
+#define VR_STATS_SHM_VERSION        1
+#define VR_STATS_SHM_FILE           "stats.shmem"
+#define VR_STATS_SHM_ALIGN          64
+
+/* struct vr_interface_stats of each vif */
+#define VR_STATS_SHM_VIF            0
+/* the VP_DROP_* counters of each vif, with a single counter set */
+#define VR_STATS_SHM_VIF_DROP       1
+/* struct vr_vrf_stats of each VRF */
+#define VR_STATS_SHM_VRF            2
+/* the VP_DROP_* counters of the vrouter, in a single block */
+#define VR_STATS_SHM_DROP           3
+#define VR_STATS_SHM_MAX_SECTIONS   4
+
+struct vr_stats_shm_section {
+    /* from the start of the region */
+    uint64_t vsc_offset;
+    uint64_t vsc_gen_offset;
+    uint32_t vsc_blocks;
+    uint32_t vsc_block_size;
+    uint32_t vsc_cpus;
+    uint32_t vsc_cpu_stride;
+    uint32_t vsc_counters;
+    uint32_t vsc_copies;
+};
+
+struct vr_stats_shm_hdr {
+    uint32_t vss_magic;
+    uint32_t vss_version;
+    uint32_t vss_hdr_size;
+    uint32_t vss_cpus;
+    uint64_t vss_size;
+    uint32_t vss_sections;
+    uint32_t vss_pad;
+    struct vr_stats_shm_section vss_section[VR_STATS_SHM_MAX_SECTIONS];
+};
+
+static inline uint8_t *
+vr_stats_shm_block(struct vr_stats_shm_hdr *hdr, unsigned int section,
+        unsigned int block)
+{
+    struct vr_stats_shm_section *sec = &hdr->vss_section[section];
+
+    return (uint8_t *)hdr + sec->vsc_offset +
+        (uint64_t)block * sec->vsc_block_size;
+}
+
+static inline uint32_t *
+vr_stats_shm_gen(struct vr_stats_shm_hdr *hdr, unsigned int section,
+        unsigned int block)
+{
+    return (uint32_t *)((uint8_t *)hdr +
+            hdr->vss_section[section].vsc_gen_offset) + block;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __VR_STATS_SHM_H__ */
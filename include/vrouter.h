@@ -79,7 +79,6 @@ enum vr_malloc_objects_t {
     VR_HPACKET_POOL_OBJECT,
     VR_HTABLE_OBJECT,
     VR_INTERFACE_OBJECT,
-    VR_INTERFACE_BRIDGE_LOCK_OBJECT,
     VR_INTERFACE_FAT_FLOW_CONFIG_OBJECT,
     VR_INTERFACE_MAC_OBJECT,
     VR_INTERFACE_MIRROR_META_OBJECT,
@@ -134,6 +133,9 @@ enum vr_malloc_objects_t {
     VR_VRF_TABLE_ENTRY_OBJECT,
     VR_VRF_TABLE_OBJECT,
     VR_INFO_REQ_OBJECT,
+    VR_NEXTHOP_REPL_STATS_OBJECT,
+    VR_BRIDGE_LEARN_OBJECT,
+    VR_INTERFACE_POLICER_OBJECT,
     VR_VROUTER_MAX_OBJECT,
 };
 
@@ -187,6 +189,8 @@ struct host_os {
     struct vr_packet *(*hos_pexpand_head)(struct vr_packet *, unsigned int);
     void (*hos_pfree)(struct vr_packet *, unsigned short);
     struct vr_packet *(*hos_pclone)(struct vr_packet *);
+    struct vr_packet *(*hos_pclone_hdr)(struct vr_packet *, unsigned short);
+    int (*hos_ptrim)(struct vr_packet *, unsigned int);
     void (*hos_preset)(struct vr_packet *);
     int (*hos_pcopy)(unsigned char *, struct vr_packet *, unsigned int,
             unsigned int);
@@ -233,6 +237,10 @@ struct host_os {
     int (*hos_enqueue_to_assembler)(struct vrouter *, struct vr_packet *,
             struct vr_forwarding_md *);
     void (*hos_fragment_sync_assemble)(struct vr_fragment_queue_element *);
+    int (*hos_enqueue_head_to_assembler)(struct vrouter *, struct vr_packet *,
+            struct vr_forwarding_md *);
+    int (*hos_repl_enqueue)(struct vr_packet *, struct vr_nexthop *,
+            struct vr_forwarding_md *);
     void (*hos_set_log_level)(unsigned int vr_log_level);
     void (*hos_set_log_type)(unsigned int vr_log_type, int enable);
     unsigned int (*hos_get_log_level)(void);
@@ -274,6 +282,8 @@ FOREACH_VR_INFO_DECLARATION_COMMON()
 #define vr_pexpand_head                 vrouter_host->hos_pexpand_head
 #define vr_pfree                        vrouter_host->hos_pfree
 #define vr_pclone                       vrouter_host->hos_pclone
+#define vr_pclone_hdr                   vrouter_host->hos_pclone_hdr
+#define vr_ptrim                        vrouter_host->hos_ptrim
 #define vr_preset                       vrouter_host->hos_preset
 #define vr_pcopy                        vrouter_host->hos_pcopy
 #define vr_pfrag_len                    vrouter_host->hos_pfrag_len
@@ -304,6 +314,8 @@ FOREACH_VR_INFO_DECLARATION_COMMON()
 #define vr_gro_process                  vrouter_host->hos_gro_process
 #define vr_enqueue_to_assembler         vrouter_host->hos_enqueue_to_assembler
 #define vr_fragment_sync_assemble       vrouter_host->hos_fragment_sync_assemble
+#define vr_enqueue_head_to_assembler    vrouter_host->hos_enqueue_head_to_assembler
+#define vr_repl_enqueue                 vrouter_host->hos_repl_enqueue
 #define vr_set_log_level                vrouter_host->hos_set_log_level
 #define vr_set_log_type                 vrouter_host->hos_set_log_type
 #define vr_get_log_level                vrouter_host->hos_get_log_level
@@ -417,6 +429,9 @@ struct vrouter {
 
     struct vr_forwarding_class **vr_qos_map;
     struct vr_forwarding_class *vr_fc_table;
+    struct vr_qos_sched_tc vr_qos_sched[VR_QOS_SCHED_NUM_TC];
+    /* bumped on every scheduler parameter change */
+    unsigned int vr_qos_sched_gen;
 
     struct vr_interface *vr_agent_if;
     struct vr_interface *vr_host_if;
@@ -441,6 +456,7 @@ struct vr_defer_data {
 };
 
 extern volatile bool vr_not_ready;
+extern bool vr_warm_restart;
 
 extern struct vrouter *vrouter_get(unsigned int);
 extern unsigned int vrouter_generation_num_get(struct vrouter *router);
@@ -38,6 +38,8 @@ unsigned int vr_num_cpus = 1;
 
 extern unsigned int vr_bridge_entries;
 extern unsigned int vr_bridge_oentries;
+extern unsigned int vr_bridge_vrf_entries;
+extern unsigned int vr_bridge_age_secs;
 extern unsigned int vr_mpls_labels;
 extern unsigned int vr_nexthops;
 extern unsigned int vr_vrfs;
@@ -638,6 +640,52 @@ lh_pcow(struct vr_packet **pktp, unsigned short head_room)
     return 0;
 }
 
+/*
+ * lh_ptrim - trim the packet to len bytes starting at the packet data, so
+ * that the trimmed data is never copied by the following vr_pcow(). A
+ * cloned skb gets its own copy of the head only if it has paged data.
+ *
+ * Returns 0 on success, -errno otherwise.
+ */
+static int
+lh_ptrim(struct vr_packet *pkt, unsigned int len)
+{
+    unsigned int old_off, new_off;
+    int data_off;
+    struct sk_buff *skb = vp_os_packet(pkt);
+
+    if (len >= pkt_len(pkt))
+        return 0;
+
+    data_off = pkt->vp_data - (skb->data - skb->head);
+    if (data_off < 0 || (unsigned int)data_off > skb_headlen(skb))
+        return -EINVAL;
+
+#ifdef NET_SKBUFF_DATA_USES_OFFSET
+    old_off = skb->network_header;
+#else
+    old_off = skb->network_header - skb->head;
+#endif
+    if (pskb_trim(skb, data_off + len))
+        return -ENOMEM;
+
+    /* the head might have been reallocated */
+    pkt->vp_head = skb->head;
+    pkt->vp_data = skb->data - skb->head + data_off;
+    pkt->vp_tail = skb_tail_pointer(skb) - skb->head;
+    pkt->vp_end = skb_end_pointer(skb) - skb->head;
+    pkt->vp_len = pkt->vp_tail - pkt->vp_data;
+#ifdef NET_SKBUFF_DATA_USES_OFFSET
+    new_off = skb->network_header;
+#else
+    new_off = skb->network_header - skb->head;
+#endif
+    pkt->vp_network_h += new_off - old_off;
+    pkt->vp_inner_network_h += new_off - old_off;
+
+    return 0;
+}
+
 /*
  * lh_get_udp_src_port - return a source port for the outer UDP header.
  * The source port is based on a hash of the inner IP source/dest addresses,
@@ -2386,6 +2434,7 @@ struct host_os linux_host = {
     .hos_pheader_pointer            =       lh_pheader_pointer,
     .hos_pull_inner_headers         =       lh_pull_inner_headers,
     .hos_pcow                       =       lh_pcow,
+    .hos_ptrim                      =       lh_ptrim,
     .hos_pull_inner_headers_fast    =       lh_pull_inner_headers_fast,
     .hos_get_udp_src_port           =       lh_get_udp_src_port,
     .hos_pkt_from_vm_tcp_mss_adj    =       lh_pkt_from_vm_tcp_mss_adj,
@@ -2700,6 +2749,10 @@ module_param(vr_bridge_entries, uint, S_IRUGO);
 MODULE_PARM_DESC(vr_bridge_entries, "Number of entries in the bridge table. Default is "__stringify(VR_DEF_BRIDGE_ENTRIES));
 module_param(vr_bridge_oentries, uint, S_IRUGO);
 MODULE_PARM_DESC(vr_bridge_oentries, "Number of overflow entries in the bridge table.");
+module_param(vr_bridge_vrf_entries, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_bridge_vrf_entries, "Max entries a VRF can take in the bridge table. Default is no limit");
+module_param(vr_bridge_age_secs, uint, S_IRUGO);
+MODULE_PARM_DESC(vr_bridge_age_secs, "Age out learnt MACs not seen for so many seconds. Default is no aging");
 
 module_param(vif_bridge_entries, uint, S_IRUGO);
 MODULE_PARM_DESC(vif_bridge_entries, "Number of entries in the per interface bridge table. Default is "__stringify(VIF_BRIDGE_ENTRIES));
@@ -0,0 +1,91 @@
+#!/usr/bin/python
+
+import os
+import sys
+import pytest
+import subprocess
+import tempfile
+sys.path.append(os.getcwd())
+sys.path.append(os.getcwd() + '/lib/')
+from imports import *  # noqa
+
+# anything with *test* will be assumed by pytest as a test
+
+
+class TestRtBulk(unittest.TestCase):
+
+    @classmethod
+    def setup_class(cls):
+        ObjectBase.setUpClass()
+        ObjectBase.set_auto_features(cleanup=True)
+
+    @classmethod
+    def teardown_class(cls):
+        ObjectBase.tearDownClass()
+
+    def setup_method(self, method):
+        ObjectBase.setUp(method)
+
+        # Add tenant vif
+        self.vif = VirtualVif(
+            idx=4,
+            name="tape5053325-99",
+            ipv4_str="1.1.1.4",
+            mac_str="00:00:5e:00:01:00",
+            vrf=0,
+            mcast_vrf=0,
+            nh_idx=28)
+
+        # Add tenant vif encap nexthop
+        self.nh = EncapNextHop(
+            encap_oif_id=self.vif.idx(),
+            encap="02 e7 03 ea 67 f1 00 00 5e 00 01 00 08 00",
+            nh_vrf=0,
+            nh_idx=28)
+
+        ObjectBase.sync_all()
+
+    def teardown_method(self, method):
+        ObjectBase.tearDown()
+
+    def add_routes(self, lines):
+        rt_file = tempfile.NamedTemporaryFile(mode='w', delete=False)
+        rt_file.write('\n'.join(lines) + '\n')
+        rt_file.close()
+        try:
+            return ObjectBase.get_cli_output(
+                'rt --vrf 0 --family inet --file ' + rt_file.name)
+        except subprocess.CalledProcessError as err:
+            return err.output
+        finally:
+            os.unlink(rt_file.name)
+
+    # more routes than one bulk request carries, so that rt has to flush
+    # the bulk more than once
+    def test_rt_bulk_add(self):
+        lines = ['# bulk routes']
+        lines += ['10.1.{}.{}/32 28'.format(i // 256, i % 256)
+                  for i in range(1500)]
+        output = self.add_routes(lines)
+        print(output)
+        self.assertIn('1500 routes added, 0 failed', output)
+
+        routes = ObjectBase.get_cli_output('rt --dump 0 --family inet')
+        self.assertIn('10.1.0.0/32', routes)
+        self.assertIn('10.1.5.219/32', routes)
+
+    # a bad line fails on its own and does not stop the rest of the file
+    def test_rt_bulk_errors(self):
+        lines = ['10.2.0.1/32 28',
+                 '10.2.0.2/40 28',
+                 '10.2.0.3/32 4000000',
+                 '10.2.0.4/32 28 100']
+        output = self.add_routes(lines)
+        print(output)
+        self.assertIn(':2: invalid route', output)
+        self.assertIn(':3: ', output)
+        self.assertIn('2 routes added, 2 failed', output)
+
+        routes = ObjectBase.get_cli_output('rt --dump 0 --family inet')
+        self.assertIn('10.2.0.1/32', routes)
+        self.assertIn('10.2.0.4/32', routes)
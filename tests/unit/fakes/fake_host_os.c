@@ -0,0 +1,69 @@
+/*
+ * fake_host_os.c -- the host_os of the unit tests, over the C library
+ *
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <stdlib.h>
+
+#include <vr_os.h>
+#include <vrouter.h>
+
+#include "fake_host_os.h"
+
+unsigned int fake_host_zalloc_limit;
+unsigned int fake_host_failed_allocs;
+
+static void *
+fake_malloc(unsigned int size, unsigned int object)
+{
+    return malloc(size);
+}
+
+static void *
+fake_zalloc(unsigned int size, unsigned int object)
+{
+    if (fake_host_zalloc_limit && (size > fake_host_zalloc_limit)) {
+        fake_host_failed_allocs++;
+        return NULL;
+    }
+
+    return calloc(1, size);
+}
+
+static void
+fake_free(void *mem, unsigned int object)
+{
+    free(mem);
+}
+
+static void
+fake_delay_op(void)
+{
+    return;
+}
+
+/* there are no readers to wait for */
+static void
+fake_defer(struct vrouter *router, vr_defer_cb cb, void *data)
+{
+    cb(router, data);
+    free(data);
+}
+
+static void *
+fake_get_defer_data(unsigned int len)
+{
+    return calloc(1, len);
+}
+
+static struct host_os fake_host = {
+    .hos_malloc = fake_malloc,
+    .hos_zalloc = fake_zalloc,
+    .hos_free = fake_free,
+    .hos_delay_op = fake_delay_op,
+    .hos_defer = fake_defer,
+    .hos_get_defer_data = fake_get_defer_data,
+};
+
+struct host_os *vrouter_host = &fake_host;
@@ -0,0 +1,14 @@
+/*
+ * fake_host_os.h -- the host_os of the unit tests, over the C library
+ *
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+#ifndef __FAKE_HOST_OS_H__
+#define __FAKE_HOST_OS_H__
+
+/* zalloc of more than this many bytes fails, when not 0 */
+extern unsigned int fake_host_zalloc_limit;
+/* zallocs failed because of fake_host_zalloc_limit */
+extern unsigned int fake_host_failed_allocs;
+
+#endif /* __FAKE_HOST_OS_H__ */
@@ -0,0 +1,317 @@
+/*
+ * test_nl_shm_client.c -- unit tests of the netlink client side of the
+ * shared memory rings, against a fake vrouter at the other end of a
+ * socket pair
+ *
+ * Copyright (c) 2014, Juniper Networks Private Inc.,
+ * All rights reserved
+ */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+
+#include <nl_util.h>
+#include <vr_nl_shm.h>
+
+#include <cmocka.h>
+
+#define GROUP_NAME "nl_shm_client"
+
+#define TEST_PATH_OFF   (NLMSG_HDRLEN + GENL_HDRLEN + NLA_HDRLEN)
+#define TEST_MSG_LEN    3000
+/* enough round trips of TEST_MSG_LEN for the rings to wrap a few times */
+#define TEST_MSGS       (4 * VR_NL_SHM_RING_SIZE / TEST_MSG_LEN)
+
+enum fake_vrouter_mode {
+    /* a vrouter that does not know about shared memory */
+    FAKE_VROUTER_OLD,
+    /* maps the rings and echoes each request back as a response */
+    FAKE_VROUTER_ECHO,
+    /* maps the rings and goes away */
+    FAKE_VROUTER_GONE,
+};
+
+struct fake_vrouter {
+    enum fake_vrouter_mode fv_mode;
+    int fv_sock;
+    pthread_t fv_thread;
+};
+
+struct test_state {
+    struct nl_client *ts_cl;
+    struct fake_vrouter ts_vr;
+    char ts_dir[64];
+};
+
+static int
+fake_vrouter_recv(int sock, uint8_t *buf, unsigned int len)
+{
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+
+    if (recv(sock, buf, NLMSG_HDRLEN, MSG_WAITALL) != NLMSG_HDRLEN)
+        return -1;
+    if (nlh->nlmsg_len < NLMSG_HDRLEN || nlh->nlmsg_len > len)
+        return -1;
+    if (recv(sock, buf + NLMSG_HDRLEN, nlh->nlmsg_len - NLMSG_HDRLEN,
+                MSG_WAITALL) != (ssize_t)(nlh->nlmsg_len - NLMSG_HDRLEN))
+        return -1;
+
+    return nlh->nlmsg_len;
+}
+
+/* answer the attach request the way the vrouter does, with an error */
+static void
+fake_vrouter_answer(int sock, struct nlmsghdr *req, int error)
+{
+    uint8_t buf[NLMSG_SPACE(sizeof(struct nlmsgerr))];
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    struct nlmsgerr *err = NLMSG_DATA(nlh);
+
+    memset(buf, 0, sizeof(buf));
+    nlh->nlmsg_len = sizeof(buf);
+    nlh->nlmsg_type = NLMSG_ERROR;
+    nlh->nlmsg_seq = req->nlmsg_seq;
+    err->error = error;
+    err->msg = *req;
+    send(sock, buf, sizeof(buf), 0);
+}
+
+static void
+fake_vrouter_echo(int sock, struct vr_nl_shm_hdr *hdr)
+{
+    int ret;
+    uint32_t len;
+    unsigned int n = 0;
+    uint8_t buf[VR_NL_SHM_RING_SIZE / 2];
+
+    while (n < TEST_MSGS) {
+        len = sizeof(buf);
+        ret = vr_nl_shm_get(&hdr->vns_req, vr_nl_shm_req_data(hdr),
+                hdr->vns_ring_size, buf, &len);
+        if (ret < 0)
+            return;
+        if (!ret) {
+            /* the client went */
+            if (!recv(sock, buf, 1, MSG_PEEK | MSG_DONTWAIT))
+                return;
+            continue;
+        }
+
+        while (vr_nl_shm_put(&hdr->vns_resp, vr_nl_shm_resp_data(hdr),
+                    hdr->vns_ring_size, buf, len) == -ENOSPC)
+            ;
+        n++;
+    }
+}
+
+static void *
+fake_vrouter(void *arg)
+{
+    int fd, len;
+    uint8_t buf[NL_MSG_DEFAULT_SIZE];
+    struct stat st;
+    struct fake_vrouter *vr = arg;
+    struct vr_nl_shm_hdr *hdr = MAP_FAILED;
+
+    len = fake_vrouter_recv(vr->fv_sock, buf, sizeof(buf));
+    if (len <= TEST_PATH_OFF)
+        goto exit_vrouter;
+
+    if (vr->fv_mode == FAKE_VROUTER_OLD) {
+        fake_vrouter_answer(vr->fv_sock, (struct nlmsghdr *)buf, -EINVAL);
+        /* the client goes on with the socket */
+        len = fake_vrouter_recv(vr->fv_sock, buf, sizeof(buf));
+        if (len > 0)
+            send(vr->fv_sock, buf, len, 0);
+        goto exit_vrouter;
+    }
+
+    fd = open((char *)buf + TEST_PATH_OFF, O_RDWR);
+    if (fd < 0)
+        goto exit_vrouter;
+    if (!fstat(fd, &st))
+        hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+        goto exit_vrouter;
+
+    __atomic_store_n(&hdr->vns_state, VR_NL_SHM_STATE_ATTACHED,
+            __ATOMIC_RELEASE);
+    fake_vrouter_answer(vr->fv_sock, (struct nlmsghdr *)buf, 0);
+
+    if (vr->fv_mode == FAKE_VROUTER_ECHO)
+        fake_vrouter_echo(vr->fv_sock, hdr);
+
+    munmap(hdr, st.st_size);
+
+exit_vrouter:
+    shutdown(vr->fv_sock, SHUT_RDWR);
+    return NULL;
+}
+
+static int
+test_setup(void **state, enum fake_vrouter_mode mode)
+{
+    int sv[2];
+    struct test_state *ts;
+
+    ts = calloc(1, sizeof(*ts));
+    if (!ts)
+        return -1;
+
+    strcpy(ts->ts_dir, "/tmp/nl_shm_client.XXXXXX");
+    if (!mkdtemp(ts->ts_dir))
+        return -1;
+    vr_socket_dir = ts->ts_dir;
+
+    ts->ts_cl = nl_register_client();
+    if (!ts->ts_cl)
+        return -1;
+
+    if (nl_socket(ts->ts_cl, AF_UNIX, SOCK_STREAM, 0) < 0)
+        return -1;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        return -1;
+    dup2(sv[0], ts->ts_cl->cl_sock);
+    close(sv[0]);
+
+    ts->ts_vr.fv_mode = mode;
+    ts->ts_vr.fv_sock = sv[1];
+    if (pthread_create(&ts->ts_vr.fv_thread, NULL, fake_vrouter, &ts->ts_vr))
+        return -1;
+
+    *state = ts;
+    return 0;
+}
+
+static int
+test_setup_old(void **state)
+{
+    return test_setup(state, FAKE_VROUTER_OLD);
+}
+
+static int
+test_setup_echo(void **state)
+{
+    return test_setup(state, FAKE_VROUTER_ECHO);
+}
+
+static int
+test_setup_gone(void **state)
+{
+    return test_setup(state, FAKE_VROUTER_GONE);
+}
+
+static int
+test_teardown(void **state)
+{
+    struct test_state *ts = *state;
+
+    nl_free_client(ts->ts_cl);
+    pthread_join(ts->ts_vr.fv_thread, NULL);
+    close(ts->ts_vr.fv_sock);
+    rmdir(ts->ts_dir);
+    free(ts);
+
+    return 0;
+}
+
+static void
+test_put_msg(struct nl_client *cl, uint8_t fill, unsigned int len)
+{
+    struct nlmsghdr *nlh = (struct nlmsghdr *)cl->cl_buf;
+
+    memset(cl->cl_buf, fill, len);
+    nlh->nlmsg_len = len;
+    cl->cl_buf_offset = len;
+}
+
+static void
+test_check_msg(struct nl_client *cl, uint8_t fill, unsigned int len)
+{
+    unsigned int i;
+
+    assert_int_equal(cl->cl_recv_len, len);
+    for (i = NLMSG_HDRLEN; i < len; i++)
+        assert_int_equal((uint8_t)cl->cl_buf[i], fill);
+}
+
+/* an older vrouter answers with an error and the socket is kept */
+static void
+test_attach_falls_back_to_socket(void **state)
+{
+    struct test_state *ts = *state;
+    struct nl_client *cl = ts->ts_cl;
+
+    assert_int_equal(nl_shm_attach(cl), -EOPNOTSUPP);
+    assert_null(cl->cl_shm);
+
+    test_put_msg(cl, 0x5a, 100);
+    assert_int_equal(nl_sendmsg(cl), 100);
+    assert_true(nl_recvmsg(cl) > 0);
+    test_check_msg(cl, 0x5a, 100);
+}
+
+/* messages go through the rings, which wrap several times */
+static void
+test_attach_echo_through_rings(void **state)
+{
+    unsigned int i;
+    struct test_state *ts = *state;
+    struct nl_client *cl = ts->ts_cl;
+
+    assert_int_equal(nl_shm_attach(cl), 0);
+    assert_non_null(cl->cl_shm);
+
+    for (i = 0; i < TEST_MSGS; i++) {
+        test_put_msg(cl, i, TEST_MSG_LEN + (i & 7));
+        assert_int_equal(nl_sendmsg(cl), TEST_MSG_LEN + (i & 7));
+        assert_int_equal(nl_recvmsg(cl), TEST_MSG_LEN + (i & 7));
+        test_check_msg(cl, i, TEST_MSG_LEN + (i & 7));
+    }
+}
+
+/* the client learns that the vrouter went from the socket */
+static void
+test_recv_after_vrouter_went(void **state)
+{
+    struct test_state *ts = *state;
+    struct nl_client *cl = ts->ts_cl;
+
+    assert_int_equal(nl_shm_attach(cl), 0);
+
+    test_put_msg(cl, 1, 100);
+    assert_int_equal(nl_sendmsg(cl), 100);
+    errno = 0;
+    assert_int_equal(nl_recvmsg(cl), -1);
+    assert_int_equal(errno, ECONNRESET);
+}
+
+int
+main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_attach_falls_back_to_socket,
+                test_setup_old, test_teardown),
+        cmocka_unit_test_setup_teardown(test_attach_echo_through_rings,
+                test_setup_echo, test_teardown),
+        cmocka_unit_test_setup_teardown(test_recv_after_vrouter_went,
+                test_setup_gone, test_teardown),
+    };
+
+    return cmocka_run_group_tests_name(GROUP_NAME, tests, NULL, NULL);
+}
@@ -0,0 +1,249 @@
+/*
+ * test_vr_index_table.c -- unit tests of the flat array and perfect hash
+ * lookup copies of the index tables
+ *
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+
+#include <vr_os.h>
+#include <vrouter.h>
+#include <vr_index_table.h>
+
+#include <cmocka.h>
+
+#include "fakes/fake_host_os.h"
+
+#define GROUP_NAME "vr_index_table"
+
+/* a VXLAN table, 24 bit indices */
+#define TEST_INDEX_BITS     24
+#define TEST_INDEX(i)       (((i) * 13) & ((1 << TEST_INDEX_BITS) - 1))
+#define TEST_DATA(i)        ((void *)(unsigned long)(2 * (i) + 1))
+
+/* allocations bigger than this fail in test_failed_build_stays_on_trie */
+#define TEST_BIG_ALLOC      4096
+
+static struct vrouter test_router;
+
+static int
+test_setup(void **state)
+{
+    fake_host_zalloc_limit = 0;
+    fake_host_failed_allocs = 0;
+
+    *state = vr_itable_create(TEST_INDEX_BITS, 3, 8, 8, 8);
+    if (!*state)
+        return -1;
+
+    return 0;
+}
+
+static int
+test_teardown(void **state)
+{
+    fake_host_zalloc_limit = 0;
+    vr_itable_delete(*state, NULL);
+    return 0;
+}
+
+static void
+test_set(vr_itable_t t, unsigned int index, void *data)
+{
+    assert_true(vr_itable_set(t, index, data) != VR_ITABLE_ERR_PTR);
+}
+
+/* the sparse indices TEST_INDEX(first) to TEST_INDEX(last - 1) */
+static void
+test_set_sparse(vr_itable_t t, unsigned int first, unsigned int last)
+{
+    unsigned int i;
+
+    for (i = first; i < last; i++)
+        test_set(t, TEST_INDEX(i), TEST_DATA(i));
+}
+
+static void
+test_check_sparse(vr_itable_t t, unsigned int first, unsigned int last)
+{
+    unsigned int i;
+
+    for (i = first; i < last; i++)
+        assert_ptr_equal(vr_itable_get(t, TEST_INDEX(i)), TEST_DATA(i));
+}
+
+static void
+test_flat_get_set_del(void **state)
+{
+    unsigned int i;
+    vr_itable_t t = *state;
+
+    for (i = 100; i < 164; i++)
+        test_set(t, i, TEST_DATA(i));
+    assert_int_equal(vr_itable_set_backend(t, &test_router,
+                VR_ITABLE_BACKEND_FLAT), 0);
+    assert_int_equal(vr_itable_get_backend(t), VR_ITABLE_BACKEND_FLAT);
+
+    for (i = 100; i < 164; i++)
+        assert_ptr_equal(vr_itable_get(t, i), TEST_DATA(i));
+    assert_null(vr_itable_get(t, 99));
+    assert_null(vr_itable_get(t, 1 << 20));
+
+    /* in place */
+    assert_ptr_equal(vr_itable_del(t, 120), TEST_DATA(120));
+    assert_null(vr_itable_get(t, 120));
+    test_set(t, 120, TEST_DATA(1000));
+    assert_ptr_equal(vr_itable_get(t, 120), TEST_DATA(1000));
+    assert_int_equal(vr_itable_get_backend(t), VR_ITABLE_BACKEND_FLAT);
+}
+
+/* indices past the array wait in the trie until there are enough of them */
+static void
+test_flat_pending_overflow(void **state)
+{
+    unsigned int i;
+    vr_itable_t t = *state;
+
+    for (i = 0; i < 64; i++)
+        test_set(t, i, TEST_DATA(i));
+    assert_int_equal(vr_itable_set_backend(t, &test_router,
+                VR_ITABLE_BACKEND_FLAT), 0);
+
+    for (i = 1000; i < 1100; i++) {
+        test_set(t, i, TEST_DATA(i));
+        assert_ptr_equal(vr_itable_get(t, i), TEST_DATA(i));
+        assert_ptr_equal(vr_itable_get(t, 5), TEST_DATA(5));
+    }
+
+    for (i = 0; i < 64; i++)
+        assert_ptr_equal(vr_itable_get(t, i), TEST_DATA(i));
+    for (i = 1000; i < 1100; i++)
+        assert_ptr_equal(vr_itable_get(t, i), TEST_DATA(i));
+    assert_null(vr_itable_get(t, 500));
+
+    /* deleting one of those leaves it in neither */
+    assert_ptr_equal(vr_itable_del(t, 1099), TEST_DATA(1099));
+    assert_null(vr_itable_get(t, 1099));
+    assert_int_equal(vr_itable_get_backend(t), VR_ITABLE_BACKEND_FLAT);
+}
+
+static void
+test_phash_get_set_del(void **state)
+{
+    unsigned int i;
+    vr_itable_t t = *state;
+
+    test_set_sparse(t, 0, 1000);
+    assert_int_equal(vr_itable_set_backend(t, &test_router,
+                VR_ITABLE_BACKEND_PHASH), 0);
+    assert_int_equal(vr_itable_get_backend(t), VR_ITABLE_BACKEND_PHASH);
+
+    test_check_sparse(t, 0, 1000);
+    for (i = 1; i < 13; i++)
+        assert_null(vr_itable_get(t, i));
+
+    for (i = 0; i < 1000; i += 3)
+        assert_ptr_equal(vr_itable_del(t, TEST_INDEX(i)), TEST_DATA(i));
+    for (i = 0; i < 1000; i++) {
+        if (i % 3)
+            assert_ptr_equal(vr_itable_get(t, TEST_INDEX(i)), TEST_DATA(i));
+        else
+            assert_null(vr_itable_get(t, TEST_INDEX(i)));
+    }
+
+    test_set_sparse(t, 0, 1000);
+    test_check_sparse(t, 0, 1000);
+    assert_int_equal(vr_itable_get_backend(t), VR_ITABLE_BACKEND_PHASH);
+}
+
+/* new indices take free slots or wait in the trie, then get a rebuild */
+static void
+test_phash_pending_overflow(void **state)
+{
+    unsigned int i;
+    vr_itable_t t = *state;
+
+    test_set_sparse(t, 0, 200);
+    assert_int_equal(vr_itable_set_backend(t, &test_router,
+                VR_ITABLE_BACKEND_PHASH), 0);
+
+    for (i = 200; i < 1200; i++) {
+        test_set(t, TEST_INDEX(i), TEST_DATA(i));
+        assert_ptr_equal(vr_itable_get(t, TEST_INDEX(i)), TEST_DATA(i));
+    }
+
+    test_check_sparse(t, 0, 1200);
+    assert_null(vr_itable_get(t, TEST_INDEX(1200)));
+    assert_int_equal(vr_itable_get_backend(t), VR_ITABLE_BACKEND_PHASH);
+}
+
+/* enough keys for a hash with as many slots as keys to find no seed */
+static void
+test_phash_large(void **state)
+{
+    vr_itable_t t = *state;
+
+    test_set_sparse(t, 0, 1000000);
+    assert_int_equal(vr_itable_set_backend(t, &test_router,
+                VR_ITABLE_BACKEND_AUTO), 0);
+    assert_int_equal(vr_itable_get_backend(t), VR_ITABLE_BACKEND_PHASH);
+
+    test_check_sparse(t, 0, 1000000);
+    assert_null(vr_itable_get(t, 1));
+}
+
+/* a copy that can not be built is not tried again on every change */
+static void
+test_failed_build_stays_on_trie(void **state)
+{
+    unsigned int failed;
+    vr_itable_t t = *state;
+
+    test_set_sparse(t, 0, 1000);
+    fake_host_zalloc_limit = TEST_BIG_ALLOC;
+    assert_int_equal(vr_itable_set_backend(t, &test_router,
+                VR_ITABLE_BACKEND_PHASH), 0);
+    assert_int_equal(vr_itable_get_backend(t), VR_ITABLE_BACKEND_TRIE);
+    assert_true(fake_host_failed_allocs > 0);
+
+    failed = fake_host_failed_allocs;
+    test_set_sparse(t, 1000, 1100);
+    assert_ptr_equal(vr_itable_del(t, TEST_INDEX(5)), TEST_DATA(5));
+    assert_int_equal(fake_host_failed_allocs, failed);
+    test_check_sparse(t, 6, 1100);
+
+    fake_host_zalloc_limit = 0;
+    assert_int_equal(vr_itable_set_backend(t, &test_router,
+                VR_ITABLE_BACKEND_PHASH), 0);
+    assert_int_equal(vr_itable_get_backend(t), VR_ITABLE_BACKEND_PHASH);
+    test_check_sparse(t, 6, 1100);
+    assert_null(vr_itable_get(t, TEST_INDEX(5)));
+}
+
+int
+main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_flat_get_set_del,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_flat_pending_overflow,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_phash_get_set_del,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_phash_pending_overflow,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_phash_large,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_failed_build_stays_on_trie,
+                test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests_name(GROUP_NAME, tests, NULL, NULL);
+}
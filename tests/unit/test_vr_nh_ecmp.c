@@ -0,0 +1,290 @@
+/*
+ * test_vr_nh_ecmp.c -- unit tests of the bucket tables of resilient ECMP
+ * composite nexthops
+ *
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+
+#include <vr_os.h>
+#include <vr_types.h>
+#include <vr_packet.h>
+#include <vr_nexthop.h>
+
+#include <cmocka.h>
+
+#include "fakes/fake_host_os.h"
+
+#define GROUP_NAME "vr_nh_ecmp"
+
+#define TEST_MAX_NHS    16
+
+/* the members nexthops, and the composite with its current table */
+static struct vr_nexthop test_nhs[TEST_MAX_NHS];
+static struct vr_nexthop test_ecmp;
+/* the table before the last test_build, with its members */
+static uint16_t test_old_bucket[NH_ECMP_BUCKETS_MAX];
+static unsigned int test_old_size;
+static struct vr_component_nh test_old_cnh[TEST_MAX_NHS];
+
+static int
+test_setup(void **state)
+{
+    unsigned int i;
+
+    memset(test_nhs, 0, sizeof(test_nhs));
+    memset(&test_ecmp, 0, sizeof(test_ecmp));
+    for (i = 0; i < TEST_MAX_NHS; i++)
+        test_nhs[i].nh_id = 100 + i;
+
+    return 0;
+}
+
+static int
+test_teardown(void **state)
+{
+    if (test_ecmp.nh_ecmp_buckets)
+        free(test_ecmp.nh_ecmp_buckets);
+    if (test_ecmp.nh_component_nh)
+        free(test_ecmp.nh_component_nh);
+
+    return 0;
+}
+
+/*
+ * give the composite the members nhs[], with weights[] (all 1 if NULL),
+ * the way nh_composite_add does, keeping the old table for comparison
+ */
+static int
+test_build(const unsigned int *nhs, const unsigned int *weights,
+        unsigned int cnt, unsigned int want)
+{
+    int ret;
+    unsigned int i;
+    struct vr_component_nh *cnh;
+    struct vr_nh_ecmp_buckets *buckets;
+
+    cnh = calloc(cnt, sizeof(*cnh));
+    assert_non_null(cnh);
+    for (i = 0; i < cnt; i++) {
+        cnh[i].cnh = &test_nhs[nhs[i]];
+        cnh[i].cnh_weight = weights ? weights[i] : 1;
+        cnh[i].cnh_ecmp_index = i;
+    }
+
+    ret = vr_nh_ecmp_buckets_build(&test_ecmp, want, cnh, cnt, &buckets);
+    if (ret) {
+        free(cnh);
+        return ret;
+    }
+
+    test_old_size = 0;
+    if (test_ecmp.nh_ecmp_buckets) {
+        test_old_size = test_ecmp.nh_ecmp_buckets->neb_mask + 1;
+        memcpy(test_old_bucket, test_ecmp.nh_ecmp_buckets->neb_bucket,
+                test_old_size * sizeof(uint16_t));
+        memcpy(test_old_cnh, test_ecmp.nh_component_nh,
+                test_ecmp.nh_component_cnt * sizeof(*cnh));
+        free(test_ecmp.nh_ecmp_buckets);
+    }
+    if (test_ecmp.nh_component_nh)
+        free(test_ecmp.nh_component_nh);
+
+    test_ecmp.nh_component_nh = cnh;
+    test_ecmp.nh_component_cnt = cnt;
+    test_ecmp.nh_ecmp_buckets = buckets;
+
+    return 0;
+}
+
+static unsigned int
+test_size(void)
+{
+    return test_ecmp.nh_ecmp_buckets->neb_mask + 1;
+}
+
+/* the member nexthop a bucket of the current table sends to */
+static struct vr_nexthop *
+test_bucket_nh(unsigned int b)
+{
+    uint16_t i = test_ecmp.nh_ecmp_buckets->neb_bucket[b];
+
+    assert_true(i < test_ecmp.nh_component_cnt);
+    return test_ecmp.nh_component_nh[i].cnh;
+}
+
+static struct vr_nexthop *
+test_old_bucket_nh(unsigned int b)
+{
+    return test_old_cnh[test_old_bucket[b & (test_old_size - 1)]].cnh;
+}
+
+static unsigned int
+test_buckets_of(unsigned int nh)
+{
+    unsigned int b, n = 0;
+
+    for (b = 0; b < test_size(); b++)
+        if (test_bucket_nh(b) == &test_nhs[nh])
+            n++;
+
+    return n;
+}
+
+/* buckets that send elsewhere than before the last test_build */
+static unsigned int
+test_moved(void)
+{
+    unsigned int b, n = 0;
+
+    for (b = 0; b < test_size(); b++)
+        if (test_bucket_nh(b) != test_old_bucket_nh(b))
+            n++;
+
+    return n;
+}
+
+static void
+test_shares_follow_weights(void **state)
+{
+    unsigned int nhs[] = { 0, 1, 2 }, weights[] = { 1, 2, 5 };
+
+    assert_int_equal(test_build(nhs, weights, 3, 0), 0);
+    assert_int_equal(test_size(), NH_ECMP_BUCKETS_MIN);
+    assert_in_range(test_buckets_of(0), 32, 33);
+    assert_in_range(test_buckets_of(1), 64, 65);
+    assert_in_range(test_buckets_of(2), 160, 161);
+}
+
+static void
+test_size_follows_request(void **state)
+{
+    unsigned int nhs[] = { 0, 1, 2 };
+
+    assert_int_equal(test_build(nhs, NULL, 3, 1000), 0);
+    assert_int_equal(test_size(), 1024);
+
+    /* a table the user did not size does not shrink */
+    assert_int_equal(test_build(nhs, NULL, 2, 0), 0);
+    assert_int_equal(test_size(), 1024);
+
+    assert_int_equal(test_build(nhs, NULL, 3, 4 * NH_ECMP_BUCKETS_MAX), 0);
+    assert_int_equal(test_size(), NH_ECMP_BUCKETS_MAX);
+}
+
+static void
+test_no_active_member_has_no_table(void **state)
+{
+    unsigned int nhs[] = { 0, 1 }, weights[] = { 0, 0 };
+
+    assert_int_equal(test_build(nhs, weights, 2, 0), 0);
+    assert_null(test_ecmp.nh_ecmp_buckets);
+}
+
+/* a new member takes its share, and only that, from the others */
+static void
+test_add_member_moves_only_its_share(void **state)
+{
+    unsigned int b, nhs[] = { 0, 1, 2, 3, 4 };
+
+    assert_int_equal(test_build(nhs, NULL, 4, 0), 0);
+    assert_int_equal(test_build(nhs, NULL, 5, 0), 0);
+
+    assert_in_range(test_buckets_of(4), 51, 52);
+    assert_int_equal(test_moved(), test_buckets_of(4));
+    for (b = 0; b < test_size(); b++)
+        if (test_bucket_nh(b) != test_old_bucket_nh(b))
+            assert_ptr_equal(test_bucket_nh(b), &test_nhs[4]);
+}
+
+/* the buckets of a member that goes are the only ones to move */
+static void
+test_remove_member_moves_only_its_buckets(void **state)
+{
+    unsigned int b, nhs[] = { 0, 1, 2, 3 }, after[] = { 0, 1, 3 };
+
+    assert_int_equal(test_build(nhs, NULL, 4, 0), 0);
+    assert_int_equal(test_build(after, NULL, 3, 0), 0);
+
+    assert_int_equal(test_buckets_of(2), 0);
+    for (b = 0; b < test_size(); b++) {
+        if (test_old_bucket_nh(b) != &test_nhs[2])
+            assert_ptr_equal(test_bucket_nh(b), test_old_bucket_nh(b));
+    }
+    assert_int_equal(test_moved(), NH_ECMP_BUCKETS_MIN / 4);
+}
+
+/* a member whose weight grows takes buckets, and the others keep theirs */
+static void
+test_weight_change_moves_only_the_difference(void **state)
+{
+    unsigned int b, nhs[] = { 0, 1, 2, 3 };
+    unsigned int weights[] = { 1, 1, 1, 1 }, heavier[] = { 1, 1, 1, 5 };
+
+    assert_int_equal(test_build(nhs, weights, 4, 0), 0);
+    assert_int_equal(test_build(nhs, heavier, 4, 0), 0);
+
+    assert_in_range(test_buckets_of(3), 160, 161);
+    assert_int_equal(test_moved(), test_buckets_of(3) - 64);
+    for (b = 0; b < test_size(); b++)
+        if (test_bucket_nh(b) != test_old_bucket_nh(b))
+            assert_ptr_equal(test_bucket_nh(b), &test_nhs[3]);
+
+    /* and back, only the buckets it gave up move */
+    assert_int_equal(test_build(nhs, weights, 4, 0), 0);
+    assert_int_equal(test_buckets_of(3), 64);
+    assert_int_equal(test_moved(), 96);
+    for (b = 0; b < test_size(); b++)
+        if (test_bucket_nh(b) != test_old_bucket_nh(b))
+            assert_ptr_equal(test_old_bucket_nh(b), &test_nhs[3]);
+}
+
+/*
+ * reordering the members keeps the flows, and so does resizing the table
+ * but for the rounding of the new shares
+ */
+static void
+test_reorder_and_grow_keep_buckets(void **state)
+{
+    unsigned int nhs[] = { 0, 1, 2 }, reordered[] = { 2, 0, 1 };
+
+    assert_int_equal(test_build(nhs, NULL, 3, 0), 0);
+    assert_int_equal(test_build(reordered, NULL, 3, 0), 0);
+    assert_int_equal(test_moved(), 0);
+
+    assert_int_equal(test_build(reordered, NULL, 3, 512), 0);
+    assert_int_equal(test_size(), 512);
+    assert_in_range(test_moved(), 0, 1);
+}
+
+int
+main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_shares_follow_weights,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_size_follows_request,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_no_active_member_has_no_table,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_add_member_moves_only_its_share,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(
+                test_remove_member_moves_only_its_buckets,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(
+                test_weight_change_moves_only_the_difference,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_reorder_and_grow_keep_buckets,
+                test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests_name(GROUP_NAME, tests, NULL, NULL);
+}
@@ -0,0 +1,255 @@
+/*
+ * test_vr_nl_shm.c -- unit tests of the shared memory rings carrying
+ * netlink messages between a client and the DPDK vrouter
+ *
+ * Copyright (c) 2014, Juniper Networks Private Inc.,
+ * All rights reserved
+ */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+
+#include <vr_nl_shm.h>
+
+#include <cmocka.h>
+
+#define GROUP_NAME "vr_nl_shm"
+
+#define TEST_RING_SIZE  4096
+
+struct test_ring {
+    struct vr_nl_shm_ring ring;
+    uint8_t data[TEST_RING_SIZE];
+};
+
+static int
+test_ring_setup(void **state)
+{
+    *state = calloc(1, sizeof(struct test_ring));
+    if (!*state)
+        return -1;
+
+    return 0;
+}
+
+static int
+test_ring_teardown(void **state)
+{
+    free(*state);
+    return 0;
+}
+
+static int
+test_put(struct test_ring *tr, uint8_t fill, uint32_t len)
+{
+    uint8_t msg[TEST_RING_SIZE];
+
+    memset(msg, fill, len);
+    return vr_nl_shm_put(&tr->ring, tr->data, TEST_RING_SIZE, msg, len);
+}
+
+static void
+test_get(struct test_ring *tr, uint8_t fill, uint32_t len)
+{
+    uint32_t i, got_len = TEST_RING_SIZE;
+    uint8_t msg[TEST_RING_SIZE];
+
+    assert_int_equal(vr_nl_shm_get(&tr->ring, tr->data, TEST_RING_SIZE,
+                msg, &got_len), 1);
+    assert_int_equal(got_len, len);
+    for (i = 0; i < len; i++)
+        assert_int_equal(msg[i], fill);
+}
+
+static void
+test_get_empty_ring(void **state)
+{
+    uint8_t msg[16];
+    uint32_t len = sizeof(msg);
+    struct test_ring *tr = *state;
+
+    assert_int_equal(vr_nl_shm_get(&tr->ring, tr->data, TEST_RING_SIZE,
+                msg, &len), 0);
+}
+
+static void
+test_put_get_in_order(void **state)
+{
+    struct test_ring *tr = *state;
+
+    assert_int_equal(test_put(tr, 1, 100), 0);
+    assert_int_equal(test_put(tr, 2, 1), 0);
+    assert_int_equal(test_put(tr, 3, 200), 0);
+
+    test_get(tr, 1, 100);
+    test_get(tr, 2, 1);
+    test_get(tr, 3, 200);
+    assert_int_equal(tr->ring.vnr_head, tr->ring.vnr_tail);
+}
+
+static void
+test_put_larger_than_half_ring_fails(void **state)
+{
+    struct test_ring *tr = *state;
+
+    assert_int_equal(test_put(tr, 1, TEST_RING_SIZE / 2), -EMSGSIZE);
+    assert_int_equal(tr->ring.vnr_head, 0);
+}
+
+static void
+test_put_full_ring_fails_until_consumed(void **state)
+{
+    struct test_ring *tr = *state;
+
+    assert_int_equal(test_put(tr, 1, 1500), 0);
+    assert_int_equal(test_put(tr, 2, 1500), 0);
+    assert_int_equal(test_put(tr, 3, 1500), -ENOSPC);
+
+    test_get(tr, 1, 1500);
+    assert_int_equal(test_put(tr, 3, 1500), 0);
+    test_get(tr, 2, 1500);
+    test_get(tr, 3, 1500);
+}
+
+/* a message that does not fit the end of the ring continues from its start */
+static void
+test_ring_wraps(void **state)
+{
+    unsigned int i;
+    struct test_ring *tr = *state;
+
+    for (i = 0; i < 64; i++) {
+        assert_int_equal(test_put(tr, i, 1000 + i), 0);
+        test_get(tr, i, 1000 + i);
+    }
+
+    assert_true(tr->ring.vnr_head > 8 * TEST_RING_SIZE);
+    assert_int_equal(tr->ring.vnr_head, tr->ring.vnr_tail);
+}
+
+/* the wrap marker alone does not count as a message */
+static void
+test_ring_wrap_marker_only(void **state)
+{
+    uint8_t msg[16];
+    uint32_t len = sizeof(msg);
+    struct test_ring *tr = *state;
+
+    tr->ring.vnr_tail = TEST_RING_SIZE - 8;
+    *(uint32_t *)(tr->data + TEST_RING_SIZE - 8) = VR_NL_SHM_WRAP;
+    tr->ring.vnr_head = TEST_RING_SIZE;
+
+    assert_int_equal(vr_nl_shm_get(&tr->ring, tr->data, TEST_RING_SIZE,
+                msg, &len), 0);
+    assert_int_equal(tr->ring.vnr_tail, TEST_RING_SIZE);
+}
+
+static void
+test_get_small_buffer_leaves_message(void **state)
+{
+    uint8_t msg[64];
+    uint32_t len = sizeof(msg);
+    struct test_ring *tr = *state;
+
+    assert_int_equal(test_put(tr, 1, 100), 0);
+    assert_int_equal(test_put(tr, 2, 10), 0);
+
+    assert_int_equal(vr_nl_shm_get(&tr->ring, tr->data, TEST_RING_SIZE,
+                msg, &len), -EMSGSIZE);
+    assert_int_equal(len, 100);
+    test_get(tr, 1, 100);
+
+    assert_int_equal(test_put(tr, 3, 100), 0);
+    len = sizeof(msg);
+    test_get(tr, 2, 10);
+    assert_int_equal(vr_nl_shm_get(&tr->ring, tr->data, TEST_RING_SIZE,
+                msg, &len), -EMSGSIZE);
+    vr_nl_shm_skip(&tr->ring, len);
+    assert_int_equal(tr->ring.vnr_head, tr->ring.vnr_tail);
+}
+
+/* a record claiming more than the producer published */
+static void
+test_get_rejects_length_past_head(void **state)
+{
+    uint8_t msg[TEST_RING_SIZE];
+    uint32_t len = sizeof(msg);
+    struct test_ring *tr = *state;
+
+    assert_int_equal(test_put(tr, 1, 100), 0);
+    *(uint32_t *)tr->data = 200;
+
+    assert_int_equal(vr_nl_shm_get(&tr->ring, tr->data, TEST_RING_SIZE,
+                msg, &len), -EINVAL);
+    assert_int_equal(tr->ring.vnr_tail, 0);
+}
+
+/* a record running off the end of the ring */
+static void
+test_get_rejects_length_past_ring_end(void **state)
+{
+    uint8_t msg[TEST_RING_SIZE];
+    uint32_t len = sizeof(msg);
+    struct test_ring *tr = *state;
+
+    tr->ring.vnr_tail = TEST_RING_SIZE - 64;
+    tr->ring.vnr_head = TEST_RING_SIZE + 1024;
+    *(uint32_t *)(tr->data + TEST_RING_SIZE - 64) = 1000;
+
+    assert_int_equal(vr_nl_shm_get(&tr->ring, tr->data, TEST_RING_SIZE,
+                msg, &len), -EINVAL);
+}
+
+static void
+test_get_rejects_bad_indexes(void **state)
+{
+    uint8_t msg[TEST_RING_SIZE];
+    uint32_t len = sizeof(msg);
+    struct test_ring *tr = *state;
+
+    /* more published than the ring holds */
+    tr->ring.vnr_head = 2 * TEST_RING_SIZE;
+    assert_int_equal(vr_nl_shm_get(&tr->ring, tr->data, TEST_RING_SIZE,
+                msg, &len), -EINVAL);
+
+    /* a wrap marker with less published than the rest of the ring */
+    tr->ring.vnr_tail = TEST_RING_SIZE - 64;
+    tr->ring.vnr_head = TEST_RING_SIZE - 32;
+    *(uint32_t *)(tr->data + TEST_RING_SIZE - 64) = VR_NL_SHM_WRAP;
+    assert_int_equal(vr_nl_shm_get(&tr->ring, tr->data, TEST_RING_SIZE,
+                msg, &len), -EINVAL);
+}
+
+int
+main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_get_empty_ring,
+                test_ring_setup, test_ring_teardown),
+        cmocka_unit_test_setup_teardown(test_put_get_in_order,
+                test_ring_setup, test_ring_teardown),
+        cmocka_unit_test_setup_teardown(test_put_larger_than_half_ring_fails,
+                test_ring_setup, test_ring_teardown),
+        cmocka_unit_test_setup_teardown(test_put_full_ring_fails_until_consumed,
+                test_ring_setup, test_ring_teardown),
+        cmocka_unit_test_setup_teardown(test_ring_wraps,
+                test_ring_setup, test_ring_teardown),
+        cmocka_unit_test_setup_teardown(test_ring_wrap_marker_only,
+                test_ring_setup, test_ring_teardown),
+        cmocka_unit_test_setup_teardown(test_get_small_buffer_leaves_message,
+                test_ring_setup, test_ring_teardown),
+        cmocka_unit_test_setup_teardown(test_get_rejects_length_past_head,
+                test_ring_setup, test_ring_teardown),
+        cmocka_unit_test_setup_teardown(test_get_rejects_length_past_ring_end,
+                test_ring_setup, test_ring_teardown),
+        cmocka_unit_test_setup_teardown(test_get_rejects_bad_indexes,
+                test_ring_setup, test_ring_teardown),
+    };
+
+    return cmocka_run_group_tests_name(GROUP_NAME, tests, NULL, NULL);
+}
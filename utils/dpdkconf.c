@@ -52,6 +52,7 @@
 #include "ini_parser.h"
 
 #define BUF_LENGTH 256
+#define CAPTURE_BUF_LENGTH 512
 
 static int platform;
 static void Usage(void);
@@ -60,6 +61,7 @@ static vr_info_msg_en msginfo;
 static int sock_dir_set;
 static bool dump_pending = false;
 static char log_send[BUF_LENGTH];
+static char capture_send[CAPTURE_BUF_LENGTH];
 static uint8_t *vr_info_inbuf;
 
 enum opt_index {
@@ -67,6 +69,7 @@ enum opt_index {
     LOG_OPT_INDEX,
     HELP_OPT_INDEX,
     SOCK_DIR_OPT_INDEX,
+    CAPTURE_OPT_INDEX,
     MAX_OPT_INDEX
 };
 
@@ -75,6 +78,7 @@ static struct option long_options[] = {
     [LOG_OPT_INDEX]          =    {"log",      required_argument,  NULL,        'l'},
     [HELP_OPT_INDEX]        =   {"help",       no_argument,        NULL,        'h'},
     [SOCK_DIR_OPT_INDEX]    =   {"sock-dir",   required_argument,  NULL,        's'},
+    [CAPTURE_OPT_INDEX]     =   {"capture",    required_argument,  NULL,        'c'},
     [MAX_OPT_INDEX]         =   { NULL,        0,                  NULL,        0},
 };
 
@@ -86,6 +90,14 @@ Usage()
     printf("\t   [--log list]\n");
     printf("\t   [--log <LOGTYPE-id> <1-8 LOG-LEVEL INT>]\n");
     printf("\t   [--log global <1-8 LOG-LEVEL INT>]\n");
+    printf("\t   [--capture start file=<pcapng file> [vif=<vif>] [vrf=<vrf>]\n");
+    printf("\t              [proto=<tcp|udp|icmp|number>] [src=<IPv4>] [dst=<IPv4>]\n");
+    printf("\t              [sport=<port>] [dport=<port>] [snaplen=<bytes>]\n");
+    printf("\t              [dir=<in,out,drop|all>]]\n");
+    printf("\t              file is a new file name in the socket dir\n");
+    printf("\t              vrf is the VRF of the vif the packet is on\n");
+    printf("\t              the 5-tuple is that of the outer, tunnel, header\n");
+    printf("\t   [--capture stop|show]\n");
     printf("\t   [--help]\n");
 
     exit(0);
@@ -126,6 +138,12 @@ parse_long_opts(int option_index, char *opt_arg)
             else {
                 Usage();
             }
+            break;
+
+        case CAPTURE_OPT_INDEX:
+            msginfo = CONF_CAPTURE;
+            vr_info_inbuf = (uint8_t *)opt_arg;
+            break;
 
         default:
             break;
@@ -176,14 +194,14 @@ int
 main(int argc, char *argv[])
 {
     int ret, opt, option_index;
-    unsigned int i = 0;
+    unsigned int i = 0, len;
     char *space_fill=" ";
     unsigned int sock_proto = NETLINK_GENERIC;
     dpdkconf_fill_nl_callbacks();
     parse_ini_file();
     platform = get_platform();
 
-    while ((opt = getopt_long(argc, argv, "hd:s:l:",
+    while ((opt = getopt_long(argc, argv, "hd:s:l:c:",
                     long_options, &option_index)) >= 0) {
         switch (opt) {
             case 'd':
@@ -211,6 +229,17 @@ main(int argc, char *argv[])
                     break;
                 }
 
+            case 'c':
+                /* the filter follows the command as separate arguments */
+                len = snprintf(capture_send, sizeof(capture_send), "%s",
+                        optarg);
+                while (optind < argc && argv[optind][0] != '-' &&
+                        len < sizeof(capture_send))
+                    len += snprintf(capture_send + len,
+                            sizeof(capture_send) - len, " %s", argv[optind++]);
+                parse_long_opts(CAPTURE_OPT_INDEX, capture_send);
+                break;
+
             case 0:
                 parse_long_opts(option_index, optarg);
                 break;
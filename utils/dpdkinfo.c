@@ -39,7 +39,8 @@ static int dump_marker = -1;
 static int buff_table_id, buffsz;
 
 static int help_set, ver_set, bond_set, lacp_set, mempool_set, stats_set,
-             xstats_set, lcore_set, app_set, ddp_set, sock_dir_set, link_set;
+             xstats_set, lcore_set, app_set, ddp_set, sock_dir_set, link_set,
+             qos_set;
 static unsigned int core = (unsigned)-1;
 static unsigned int stats_index = 0;
 /* For few  CLI, Inbuf has to send to vrouter for processing(i.e kind of filter
@@ -62,6 +63,7 @@ enum opt_index {
     DDP_OPT_INDEX,
     SOCK_DIR_OPT_INDEX,
     LINK_OPT_INDEX,
+    QOS_OPT_INDEX,
     MAX_OPT_INDEX,
 };
 
@@ -79,6 +81,7 @@ static struct option long_options[] = {
     [BUFFSZ_OPT_INDEX]  =   {"buffsz",  required_argument,  &buffsz,        1},
     [SOCK_DIR_OPT_INDEX]  = {"sock-dir", required_argument, &sock_dir_set,  1},
     [LINK_OPT_INDEX]    =   {"link", required_argument, &link_set,  1},
+    [QOS_OPT_INDEX]    =   {"qos",    no_argument,        &qos_set,      1},
     [MAX_OPT_INDEX]     =   {NULL,    0,                  0,              0},
 };
 
@@ -104,6 +107,8 @@ Usage()
                                                           Show App information\n");
     printf("                 --ddp|-d      <list>\
 						   Show DDP information for X710 NIC\n");
+    printf("                 --qos|-q\
+                                                          Show egress scheduler information\n");
     printf("       Optional: --buffsz      <value>\
                                              Send output buffer size (less than 1000Mb)\n");
     exit(-EINVAL);
@@ -113,7 +118,8 @@ static void
 validate_options(void)
 {
     if(!(ver_set || bond_set || lacp_set || mempool_set ||
-        stats_set || xstats_set || lcore_set || app_set|| ddp_set || link_set))
+        stats_set || xstats_set || lcore_set || app_set|| ddp_set || link_set ||
+        qos_set))
         Usage();
 
     return;
@@ -214,6 +220,10 @@ parse_long_opts(int opt_index, char *opt_arg)
         msginfo = INFO_APP;
         break;
 
+    case QOS_OPT_INDEX:
+        msginfo = INFO_QOS;
+        break;
+
     case DDP_OPT_INDEX:
         msginfo = INFO_DDP;
         if (!strcmp(opt_arg, "list")){
@@ -285,7 +295,7 @@ main(int argc, char *argv[])
 
     parse_ini_file();
 
-    while (((opt = getopt_long(argc, argv, "-:hvbl:m:sn:p:d:cax::",
+    while (((opt = getopt_long(argc, argv, "-:hvbl:m:sn:p:d:caqx::",
                         long_options, &option_index)) >= 0)) {
         switch (opt) {
         case 'v':
@@ -337,6 +347,11 @@ main(int argc, char *argv[])
             msginfo = INFO_APP;
             break;
 
+        case 'q':
+            qos_set = 1;
+            msginfo = INFO_QOS;
+            break;
+
         case 'p':
             link_set = 1;
             msginfo = INFO_LINK;
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <inttypes.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -31,8 +32,10 @@ static int dump_marker = -1;
 static int create_set, delete_set, dump_set, sock_dir_set;
 static int get_set, nh_set, mirror_set;
 static int dynamic_set, help_set, cmd_set, vni_set;
+static int snaplen_set, sample_set, rate_set;
 static int mirror_op = -1, mirror_nh;
 static int mirror_index = -1, mirror_flags, vni_id = -1;
+static unsigned int mirror_snaplen, mirror_sample_rate, mirror_rate_limit;
 
 static void
 mirror_req_process(void *s_req)
@@ -56,6 +59,18 @@ mirror_req_process(void *s_req)
     printf("    %4d", req->mirr_vlan);
     printf("\n");
 
+    if (req->mirr_snaplen || req->mirr_sample_rate || req->mirr_rate_limit)
+        printf("         Snaplen %d, Sample 1/%d, Rate limit %d pps\n",
+                req->mirr_snaplen,
+                req->mirr_sample_rate ? req->mirr_sample_rate : 1,
+                req->mirr_rate_limit);
+
+    if (req->mirr_packets || req->mirr_sampled || req->mirr_rate_limited)
+        printf("         Mirrored %" PRId64 ", Sampled out %" PRId64
+                ", Rate limited %" PRId64 ", Truncated %" PRId64 "\n",
+                req->mirr_packets, req->mirr_sampled,
+                req->mirr_rate_limited, req->mirr_truncated);
+
     if (mirror_op == SANDESH_OP_DUMP)
         dump_marker = req->mirr_index;
 
@@ -86,7 +101,8 @@ op_retry:
     switch (mirror_op) {
     case SANDESH_OP_ADD:
         ret = vr_send_mirror_add(cl, 0, mirror_index,
-                mirror_nh, mirror_flags, vni_id);
+                mirror_nh, mirror_flags, vni_id, mirror_snaplen,
+                mirror_sample_rate, mirror_rate_limit);
         break;
 
     case SANDESH_OP_DEL:
@@ -130,6 +146,9 @@ enum opt_mirror_index {
     NEXTHOP_OPT_INDEX,
     DYNAMIC_OPT_INDEX,
     VNI_OPT_INDEX,
+    SNAPLEN_OPT_INDEX,
+    SAMPLE_OPT_INDEX,
+    RATE_OPT_INDEX,
     SOCK_DIR_OPT_INDEX,
     MAX_OPT_INDEX
 };
@@ -144,6 +163,9 @@ static struct option long_options[] = {
     [NEXTHOP_OPT_INDEX]     =       {"nh",      required_argument,  &nh_set,        1},
     [DYNAMIC_OPT_INDEX]     =       {"dyn",     no_argument,        &dynamic_set,   1},
     [VNI_OPT_INDEX]         =       {"vni",     required_argument,  &vni_set,       1},
+    [SNAPLEN_OPT_INDEX]     =       {"snaplen", required_argument,  &snaplen_set,   1},
+    [SAMPLE_OPT_INDEX]      =       {"sample",  required_argument,  &sample_set,    1},
+    [RATE_OPT_INDEX]        =       {"rate",    required_argument,  &rate_set,      1},
     [SOCK_DIR_OPT_INDEX]    =       {"sock-dir", required_argument, &sock_dir_set,  1},
     [MAX_OPT_INDEX]         =       { NULL,     0,                  0,              0},
 };
@@ -152,10 +174,14 @@ static void
 usage_internal()
 {
     printf("Usage:      mirror --create <index> --nh <nh index> --vni <vxlan id> --dyn\n");
+    printf("                   [--snaplen <bytes>] [--sample <N>] [--rate <pps>]\n");
     printf("            mirror --delete <index>\n");
     printf("\n");
     printf("--create    Create a mirror entry for <index> with nexthop set to <nh index>\n");
     printf("--delete    Delete the entry corresponding to <index>\n");
+    printf("--snaplen   Mirror only the first <bytes> of the packets\n");
+    printf("--sample    Mirror 1 in <N> packets\n");
+    printf("--rate      Mirror at most <pps> packets per second\n");
 
     exit(1);
 }
@@ -230,6 +256,21 @@ parse_long_opts(int opt_index, char *opt_arg)
         if (errno)
             usage_internal();
         break;
+    case SNAPLEN_OPT_INDEX:
+        mirror_snaplen = strtoul(opt_arg, NULL, 0);
+        if (errno)
+            usage_internal();
+        break;
+    case SAMPLE_OPT_INDEX:
+        mirror_sample_rate = strtoul(opt_arg, NULL, 0);
+        if (errno)
+            usage_internal();
+        break;
+    case RATE_OPT_INDEX:
+        mirror_rate_limit = strtoul(opt_arg, NULL, 0);
+        if (errno)
+            usage_internal();
+        break;
 
     case SOCK_DIR_OPT_INDEX:
         vr_socket_dir = opt_arg;
@@ -5,6 +5,7 @@
  */
 
 #include <stdio.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -199,6 +200,11 @@ nh_flags(uint32_t flags, uint8_t type, char *ptr)
                 strcat(ptr, "Encap, ");
             break;
 
+        case NH_FLAG_COMPOSITE_RESILIENT:
+            if (type == NH_COMPOSITE)
+                strcat(ptr, "Resilient, ");
+            break;
+
         case NH_FLAG_MCAST:
             strcat(ptr, "Multicast, ");
             break;
@@ -389,6 +395,21 @@ nexthop_req_process(void *s_req)
                 nh_ecmp_config_hash_str(req->nhr_ecmp_config_hash, flags_mem);
                 printf("Valid Hash Key Parameters: %s", flags_mem);
             }
+
+            if (req->nhr_ecmp_buckets) {
+                nh_print_newline_header();
+                printf("Buckets:%d Weights:", req->nhr_ecmp_buckets);
+                for (i = 0; i < req->nhr_weight_list_size; i++)
+                    printf(" %d", req->nhr_weight_list[i]);
+            }
+        }
+        if ((req->nhr_flags & NH_FLAG_MCAST) && (req->nhr_repl_packets ||
+                    req->nhr_repl_deferred || req->nhr_repl_drops)) {
+            nh_print_newline_header();
+            printf("Replicated:%" PRId64 " Replicas:%" PRId64
+                    " Deferred:%" PRId64 " Drops:%" PRId64,
+                    req->nhr_repl_packets, req->nhr_repl_replicas,
+                    req->nhr_repl_deferred, req->nhr_repl_drops);
         }
         nh_print_newline_header();
         printf("Sub NH(label):");
@@ -215,6 +215,14 @@ vr_hugepage_config_process(void *s_req)
     }
 }
 
+void
+vr_bulk_req_process(void *s_req)
+{
+    if (nl_cb.vr_bulk_req_process) {
+        nl_cb.vr_bulk_req_process(s_req);
+    }
+}
+
 struct nl_response *
 nl_parse_gen_ctrl(struct nl_client *cl)
 {
@@ -405,7 +405,10 @@ VP_DROP_NO_FRAG_ENTRY = 50
 VP_DROP_ICMP_ERROR = 51
 VP_DROP_CLONE_FAIL = 52
 VP_DROP_INVALID_UNDERLAY_ECMP = 53
-VP_DROP_MAX = 54
+VP_DROP_VIF_POLICER_IN = 54
+VP_DROP_VIF_POLICER_OUT = 55
+VP_DROP_REPL_RING_FULL = 56
+VP_DROP_MAX = 57
 
 VP_QUEUE_INVALID = 0xFF
 VP_PRIORITY_INVALID = 0xF
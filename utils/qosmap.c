@@ -57,8 +57,11 @@ static unsigned int get_qos_set, set_qos_set, delete_qos_set;
 static unsigned int dscp_set, mpls_qos_set, dotonep_set, queue_set;
 static unsigned int set_queue_set, pg_set, pg_bw_set, strict_set;
 static unsigned int get_queue_set, tc_set, dcbx_set, default_tc;
+static unsigned int weight_set, rate_set;
 
 static uint8_t dotonep, dscp, mpls_qos, fc, queue;
+static uint8_t sched_weight = VR_QOS_SCHED_DEF_WEIGHT;
+static int32_t sched_rate;
 static uint8_t dcbx_mode, dcb_enable;
 static unsigned int qos_index, if_index;
 static uint8_t ifname[IFNAMSIZ];
@@ -139,13 +142,21 @@ fc_map_req_process(void *s)
 
     if (marker == -1) {
         printf("Forwarding Class Map %d\n", req->fmr_rid);
-        printf(" FC            DSCP  EXP  .1p    Queue\n");
+        printf(" FC            DSCP  EXP  .1p    Queue  Weight  Rate(Mbps)\n");
     }
 
     for (i = 0; i < req->fmr_id_size; i++) {
-        printf("%3u        %8u  %3u  %3u %8u\n",
+        printf("%3u        %8u  %3u  %3u %8u",
                 req->fmr_id[i], req->fmr_dscp[i], req->fmr_mpls_qos[i],
                 req->fmr_dotonep[i], req->fmr_queue_id[i]);
+        if (i < req->fmr_sched_weight_size && i < req->fmr_sched_rate_size) {
+            if (req->fmr_sched_weight[i] == VR_QOS_SCHED_STRICT)
+                printf("  strict");
+            else
+                printf("  %6u", req->fmr_sched_weight[i]);
+            printf("  %10u", req->fmr_sched_rate[i]);
+        }
+        printf("\n");
     }
 
     if (i > 0) {
@@ -226,7 +237,9 @@ op_retry:
         ret = vr_send_fc_map_get(cl, 0, qos_index);
     } else if (set_fc_set) {
         ret = vr_send_fc_map_add(cl, 0, (int16_t *)&qos_index, 1,
-                &dscp, &mpls_qos, &dotonep, &queue);
+                &dscp, &mpls_qos, &dotonep, &queue,
+                (weight_set || rate_set) ? &sched_weight : NULL,
+                (weight_set || rate_set) ? &sched_rate : NULL);
     } else if (dump_fc_set) {
         dump = true;
         ret = vr_send_fc_map_dump(cl, 0, marker);
@@ -376,6 +389,8 @@ enum opt_qos_index {
     SET_QUEUE_OPT_INDEX,
     STRICT_OPT_INDEX,
     TC_OPT_INDEX,
+    WEIGHT_OPT_INDEX,
+    RATE_OPT_INDEX,
     HELP_OPT_INDEX,
     MAX_OPT_INDEX
 };
@@ -523,6 +538,8 @@ static struct option long_options[] = {
     [SET_QUEUE_OPT_INDEX]           = {"set-queue",     required_argument,  &set_queue_set,     1},
     [STRICT_OPT_INDEX]              = {"strict",        required_argument,  &strict_set,        1},
     [TC_OPT_INDEX]                  = {"tc",            required_argument,  &tc_set,            1},
+    [WEIGHT_OPT_INDEX]              = {"weight",        required_argument,  &weight_set,        1},
+    [RATE_OPT_INDEX]                = {"rate",          required_argument,  &rate_set,          1},
     [HELP_OPT_INDEX]                = {"help",          no_argument,        &help_set,          1},
     [MAX_OPT_INDEX]                 = { NULL,           0,                  0,                  0}
 };
@@ -533,6 +550,7 @@ Usage(void)
 {
     printf("qosmap --get-fc <fc-id>\n");
     printf("       --set-fc <fc-id> <--dscp | --mpls_qos | --dotonep | --queue> <value>\n");
+    printf("                [--weight <0 (strict) - 255>] [--rate <Mbps>]\n");
     printf("       --get-qos <index>\n");
     printf("       --set-qos <index> <--dscp | --mpls_qos | --dotonep> <value> --fc <fc-id>\n");
     printf("       --set-queue <ifname> --dcbx <cee | ieee> --pg 0,1,2.. --bw 10,20,.. --strict 101..\n");
@@ -613,6 +631,11 @@ validate_options(void)
         goto exit_options;
     }
 
+    if ((weight_set || rate_set) && !set_fc_set) {
+        printf("--weight and --rate are valid only with --set-fc\n");
+        goto exit_options;
+    }
+
     if (get_fc_set) {
         if (fc_set || set) {
             printf("Invalid arguments for --get-fc\n");
@@ -765,6 +788,19 @@ parse_long_opts(int opt_index, char *opt_arg)
         }
         break;
 
+    case WEIGHT_OPT_INDEX:
+        i = strtoul(opt_arg, NULL, 0);
+        if (i > 255) {
+            printf("Invalid scheduling weight %u\n", i);
+            Usage();
+        }
+        sched_weight = i;
+        break;
+
+    case RATE_OPT_INDEX:
+        sched_rate = strtoul(opt_arg, NULL, 0);
+        break;
+
     case HELP_OPT_INDEX:
     default:
         Usage();
@@ -38,6 +38,7 @@
 #include "vr_os.h"
 #include "ini_parser.h"
 #include "vr_mem.h"
+#include "vr_message.h"
 #include "vrouter.h"
 
 static struct nl_client *cl;
@@ -51,7 +52,7 @@ static bool cmd_flood_set = false;
 static bool cmd_macip_learnt_set = false;
 
 static int cmd_set, dump_set, get_set, monitor_set;
-static int family_set, help_set, vrf_set, sock_dir_set;
+static int family_set, help_set, vrf_set, sock_dir_set, file_set;
 static int cust_flags;
 
 static int cmd_prefix_set;
@@ -68,6 +69,10 @@ static int32_t cmd_label;
 static uint32_t cmd_replace_plen = 0xFFFFFFFF;
 static char cmd_dst_mac[6];
 static bool dump_pending;
+static char *cmd_file;
+/* the file line of each route in the bulk request in flight */
+static unsigned int bulk_lines[VR_MESSAGE_BULK_MAX_OBJECTS];
+static unsigned int bulk_added, bulk_failed;
 
 static int monitor = 0;
 extern int genetlink_group_id;
@@ -86,6 +91,13 @@ static struct bridge_table {
     unsigned int bt_size;
     unsigned int bt_num_entries;
     struct vr_bridge_entry *bt_entries;
+    unsigned int bt_used;
+    unsigned int bt_vrf_entries;
+    unsigned int bt_vrf_limit;
+    unsigned int bt_age_secs;
+    uint64_t bt_evicted;
+    uint64_t bt_aged;
+    uint64_t bt_limit_drops;
 } vr_bridge_table;
 
 
@@ -353,10 +365,31 @@ response_process(void *s)
     return;
 }
 
+static void
+bulk_req_process(void *s_req)
+{
+    unsigned int i;
+    vr_bulk_req *resp = (vr_bulk_req *)s_req;
+
+    for (i = 0; i < resp->vbr_status_size; i++) {
+        if (resp->vbr_status[i] >= 0) {
+            bulk_added++;
+            continue;
+        }
+
+        bulk_failed++;
+        printf("%s:%u: %s (%d)\n", cmd_file, bulk_lines[i],
+                strerror(-resp->vbr_status[i]), -resp->vbr_status[i]);
+    }
+
+    return;
+}
+
 static void
 rt_fill_nl_callbacks()
 {
     nl_cb.vr_response_process = response_process;
+    nl_cb.vr_bulk_req_process = bulk_req_process;
     nl_cb.vr_route_req_process = route_req_process;
     nl_cb.vr_bridge_table_data_process = bridge_table_data_process;
     nl_cb.vrouter_ops_process = rt_monitor_group_process;
@@ -381,6 +414,16 @@ vr_print_rtable_header(unsigned int family, unsigned int vrf)
 
     case AF_BRIDGE:
         printf("vRouter bridge table %d/%d\n", 0, cmd_vrf_id);
+        if (cmd_op == SANDESH_OP_DUMP) {
+            printf("VRF entries %u, limit %u, table entries used %u\n",
+                    vr_bridge_table.bt_vrf_entries,
+                    vr_bridge_table.bt_vrf_limit, vr_bridge_table.bt_used);
+            printf("Aging %u secs, aged %" PRIu64 ", evicted %" PRIu64
+                    ", learning refused %" PRIu64 "\n\n",
+                    vr_bridge_table.bt_age_secs, vr_bridge_table.bt_aged,
+                    vr_bridge_table.bt_evicted,
+                    vr_bridge_table.bt_limit_drops);
+        }
         printf("Index       DestMac                  Flags           "
                 "Label/VNID      Nexthop           Stats\n");
         break;
@@ -410,6 +453,120 @@ vr_bridge_table_dump(unsigned int vrf)
     return;
 }
 
+static int
+vr_route_bulk_flush(vr_bulk_req *bulk)
+{
+    int ret;
+
+    if (!bulk->vbr_lens_size)
+        return 0;
+
+    ret = vr_send_bulk_request(cl, 0, bulk);
+    if (ret >= 0)
+        ret = vr_recvmsg(cl, false);
+    vr_bulk_free(bulk);
+
+    return ret;
+}
+
+/*
+ * vr_route_bulk_add - add the routes listed in cmd_file, one
+ * "<prefix>[/<plen>] <nh_id> [<label>]" per line ("<mac> <nh_id> [<label>]"
+ * for bridge), with as few messages as the bulk request size allows
+ */
+static int
+vr_route_bulk_add(void)
+{
+    int ret = 0;
+    FILE *fp;
+    char line[256], *prefix, *plen, *nh, *label;
+    unsigned int line_no = 0;
+    uint8_t addr[16];
+    struct ether_addr *eth;
+    vr_route_req req;
+    vr_bulk_req bulk;
+
+    fp = fopen(cmd_file, "r");
+    if (!fp) {
+        printf("%s: %s\n", cmd_file, strerror(errno));
+        return -errno;
+    }
+
+    memset(&bulk, 0, sizeof(bulk));
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+        prefix = strtok(line, " \t\n");
+        if (!prefix || prefix[0] == '#')
+            continue;
+        nh = strtok(NULL, " \t\n");
+        label = strtok(NULL, " \t\n");
+
+        memset(&req, 0, sizeof(req));
+        req.h_op = SANDESH_OP_ADD;
+        req.rtr_vrf_id = cmd_vrf_id;
+        req.rtr_family = cmd_family_id;
+        req.rtr_replace_plen = cmd_replace_plen;
+        req.rtr_label = label ? strtol(label, NULL, 0) : -1;
+        if (label)
+            req.rtr_label_flags |= VR_RT_LABEL_VALID_FLAG;
+
+        if (cmd_family_id == AF_BRIDGE) {
+            eth = ether_aton(prefix);
+            if (!eth)
+                goto bad_line;
+            memcpy(addr, eth, VR_ETHER_ALEN);
+            req.rtr_mac = addr;
+            req.rtr_mac_size = VR_ETHER_ALEN;
+            req.rtr_index = VR_BE_INVALID_INDEX;
+        } else {
+            plen = strchr(prefix, '/');
+            if (plen)
+                *plen++ = '\0';
+            if (inet_pton(cmd_family_id, prefix, addr) != 1)
+                goto bad_line;
+            req.rtr_prefix = addr;
+            req.rtr_prefix_size = RT_IP_ADDR_SIZE(cmd_family_id);
+            req.rtr_prefix_len = plen ? strtoul(plen, NULL, 0) :
+                req.rtr_prefix_size * 8;
+            if (req.rtr_prefix_len > req.rtr_prefix_size * 8)
+                goto bad_line;
+            address_mask(addr, req.rtr_prefix_len, cmd_family_id);
+        }
+
+        if (!nh)
+            goto bad_line;
+        req.rtr_nh_id = strtoul(nh, NULL, 0);
+
+        bulk_lines[bulk.vbr_lens_size] = line_no;
+        ret = vr_bulk_add_object(&bulk, &req, "vr_route_req");
+        if (ret < 0)
+            break;
+
+        if (bulk.vbr_lens_size == VR_MESSAGE_BULK_MAX_OBJECTS) {
+            ret = vr_route_bulk_flush(&bulk);
+            if (ret < 0)
+                break;
+        }
+        continue;
+
+bad_line:
+        printf("%s:%u: invalid route\n", cmd_file, line_no);
+        bulk_failed++;
+    }
+
+    if (ret >= 0)
+        ret = vr_route_bulk_flush(&bulk);
+    vr_bulk_free(&bulk);
+    fclose(fp);
+
+    printf("%u routes added, %u failed\n", bulk_added, bulk_failed);
+
+    if (ret < 0)
+        return ret;
+
+    return bulk_failed ? -EINVAL : 0;
+}
+
 static int
 vr_route_op(struct nl_client *cl)
 {
@@ -496,6 +653,13 @@ bridge_table_map(vr_bridge_table_data *table)
     vr_bridge_table.bt_size = table->btable_size;
     vr_bridge_table.bt_num_entries =
         table->btable_size / sizeof(struct vr_bridge_entry);
+    vr_bridge_table.bt_used = table->btable_used;
+    vr_bridge_table.bt_vrf_entries = table->btable_vrf_entries;
+    vr_bridge_table.bt_vrf_limit = table->btable_vrf_limit;
+    vr_bridge_table.bt_age_secs = table->btable_age_secs;
+    vr_bridge_table.bt_evicted = table->btable_evicted;
+    vr_bridge_table.bt_aged = table->btable_aged;
+    vr_bridge_table.bt_limit_drops = table->btable_limit_drops;
 
     mmap_error_msg = vr_table_map(table->btable_dev, VR_MEM_BRIDGE_TABLE_OBJECT,
         table->btable_file_path, table->btable_size, (void **)&vr_bridge_table.bt_entries);
@@ -523,7 +687,7 @@ vr_bridge_table_setup(struct nl_client *cl)
 {
     int ret;
 
-    ret = vr_send_get_bridge_table_data(cl);
+    ret = vr_send_get_bridge_table_data(cl, cmd_vrf_id);
     if (!ret)
         return ret;
 
@@ -613,7 +777,10 @@ validate_options(void)
         break;
 
     case SANDESH_OP_ADD:
-        if ((cmd_family_id == AF_INET) || (cmd_family_id == AF_INET6)) {
+        if (cmd_file) {
+            if (cmd_vrf_id < 0)
+                goto usage;
+        } else if ((cmd_family_id == AF_INET) || (cmd_family_id == AF_INET6)) {
             if (!cmd_prefix_set || cmd_plen < 0 || cmd_nh_id  < 0 || cmd_vrf_id < 0)
                 goto usage_internal;
         } else if (cmd_family_id == AF_BRIDGE) {
@@ -701,6 +868,7 @@ enum opt_flow_index {
     VRF_OPT_INDEX,
     HELP_OPT_INDEX,
     SOCK_DIR_OPT_INDEX,
+    FILE_OPT_INDEX,
     MAX_OPT_INDEX,
 };
 
@@ -713,6 +881,7 @@ static struct option long_options[] = {
     [VRF_OPT_INDEX]           = {"vrf",     required_argument, &vrf_set,     1},
     [HELP_OPT_INDEX]          = {"help",    no_argument,       &help_set,    1},
     [SOCK_DIR_OPT_INDEX]      = {"sock-dir", required_argument, &sock_dir_set, 1},
+    [FILE_OPT_INDEX]          = {"file",    required_argument, &file_set,    1},
     [MAX_OPT_INDEX]           = { NULL,     0,                 0,            0},
 };
 
@@ -721,12 +890,16 @@ Usage(void)
 {
     printf("Usage:    rt --dump <vrf_id> [--family <inet|inet6|bridge>]>\n");
     printf("          rt --get <address/plen> --vrf <id> [--family <inet|inet6>]\n");
+    printf("          rt --file <path> --vrf <id> [--family <inet|inet6|bridge>]\n");
     printf("          rt --monitor\n");
     printf("          rt --help\n");
     printf("\n");
     printf("--dump    Dumps the routing table corresponding to vrf_id\n");
     printf("--family  Optional family specification to --dump command\n");
     printf("          Specification should be one of \"inet\" or \"bridge\"\n");
+    printf("--file    Adds the routes listed in the file, one per line:\n");
+    printf("          <prefix>[/<plen>] <nh_id> [<label>], or\n");
+    printf("          <mac> <nh_id> [<label>] for bridge\n");
     printf("--monitor Watch for netlink broadcasted messages\n");
     printf("--sock-dir <netlink sock dir>\n");
     printf("--help    Prints this help message\n");
@@ -782,6 +955,11 @@ parse_long_opts(int opt_flow_index, char *opt_arg)
         vr_socket_dir = opt_arg;
         break;
 
+    case FILE_OPT_INDEX:
+        cmd_op = SANDESH_OP_ADD;
+        cmd_file = opt_arg;
+        break;
+
     case HELP_OPT_INDEX:
     default:
         Usage();
@@ -961,6 +1139,11 @@ main(int argc, char *argv[])
         }
     }
 
+    if (cmd_file) {
+        ret = vr_route_bulk_add();
+        return ret ? 1 : 0;
+    }
+
     vr_route_op(cl);
     return 0;
 }
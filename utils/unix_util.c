@@ -1,6 +1,10 @@
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <fcntl.h>
 #include <sys/types.h>
@@ -26,6 +30,8 @@
 #include <vr_mem.h>
 #include <nl_util.h>
 #include <ini_parser.h>
+#include <vr_genetlink.h>
+#include <vr_nl_shm.h>
 
 /* This is defined in linux kernel headers (linux/socket.h) */
 #if !defined(SOL_NETLINK)
@@ -285,12 +291,195 @@ nl_client_stream_recvmsg(struct nl_client *cl, bool msg_wait) {
     return ret;
 }
 
+/*
+ * nl_client_shm_wait - called each time the ring of cl was found busy.
+ * Polls the ring again right away VR_NL_SHM_SPINS times, then backs off,
+ * sleeping in poll() on the socket for *wait_ms, which doubles up to
+ * VR_NL_SHM_MAX_WAIT_MS. The socket turning readable is how a client of
+ * shared memory rings learns that the vrouter went. Returns 0, or -1 and
+ * errno set to ECONNRESET if it did, the caller then looking at the ring
+ * one last time for what the vrouter put there before it went.
+ */
+static int
+nl_client_shm_wait(struct nl_client *cl, unsigned int *spins, int *wait_ms)
+{
+    struct pollfd pfd;
+
+    if (*spins < VR_NL_SHM_SPINS) {
+        (*spins)++;
+        return 0;
+    }
+
+    pfd.fd = cl->cl_sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, *wait_ms) > 0) {
+        errno = ECONNRESET;
+        return -1;
+    }
+
+    if (*wait_ms < VR_NL_SHM_MAX_WAIT_MS)
+        *wait_ms *= 2;
+
+    return 0;
+}
+
+static int
+nl_client_shm_sendmsg(struct nl_client *cl)
+{
+    int ret, gone = 0, wait_ms = 1;
+    unsigned int spins = 0, len = cl->cl_buf_offset;
+    struct vr_nl_shm_hdr *hdr = (struct vr_nl_shm_hdr *)cl->cl_shm;
+
+    cl->cl_buf_offset = 0;
+    while ((ret = vr_nl_shm_put(&hdr->vns_req, vr_nl_shm_req_data(hdr),
+                    hdr->vns_ring_size, cl->cl_buf, len)) == -ENOSPC) {
+        if (gone)
+            return -1;
+        gone = nl_client_shm_wait(cl, &spins, &wait_ms);
+    }
+
+    if (ret) {
+        errno = -ret;
+        return -1;
+    }
+
+    return len;
+}
+
+static int
+nl_client_shm_recvmsg(struct nl_client *cl, bool msg_wait)
+{
+    int ret, gone = 0, wait_ms = 1;
+    uint32_t len;
+    unsigned int spins = 0;
+    struct vr_nl_shm_hdr *hdr = (struct vr_nl_shm_hdr *)cl->cl_shm;
+
+    cl->cl_buf_offset = 0;
+    /* like the stream socket, wait for the response either way */
+    while (true) {
+        len = cl->cl_buf_len;
+        ret = vr_nl_shm_get(&hdr->vns_resp, vr_nl_shm_resp_data(hdr),
+                hdr->vns_ring_size, cl->cl_buf, &len);
+        if (ret)
+            break;
+
+        if (gone)
+            return -1;
+        gone = nl_client_shm_wait(cl, &spins, &wait_ms);
+    }
+
+    if (ret == -EMSGSIZE) {
+        /* no room for it, drop it so that the next one can be read */
+        vr_nl_shm_skip(&hdr->vns_resp, len);
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+
+    cl->cl_recv_len = len;
+
+    return len;
+}
+
+/*
+ * nl_shm_attach - ask the DPDK vrouter that the messages of cl go through
+ * shared memory rings from now on rather than through the socket. Returns
+ * 0 if they do, or -errno, cl then going on with the socket.
+ */
+int
+nl_shm_attach(struct nl_client *cl)
+{
+    int fd, ret, attr_len;
+    unsigned int path_len;
+    size_t len;
+    char path[PATH_MAX];
+    struct vr_nl_shm_hdr *hdr = MAP_FAILED;
+
+    if (cl->cl_socket_domain != AF_UNIX || cl->cl_shm)
+        return -EINVAL;
+
+    snprintf(path, sizeof(path), "%s/%s.%d.%d", vr_socket_dir,
+            VR_NL_SHM_FILE_PREFIX, getpid(), cl->cl_sock);
+    path_len = strlen(path) + 1;
+
+    len = vr_nl_shm_size(VR_NL_SHM_RING_SIZE);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return -errno;
+
+    if (ftruncate(fd, len) < 0) {
+        ret = -errno;
+        close(fd);
+        goto exit_attach;
+    }
+
+    hdr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ret = -errno;
+    close(fd);
+    if (hdr == MAP_FAILED)
+        goto exit_attach;
+
+    hdr->vns_magic = VR_NL_SHM_MAGIC;
+    hdr->vns_version = VR_NL_SHM_VERSION;
+    hdr->vns_ring_size = VR_NL_SHM_RING_SIZE;
+    hdr->vns_state = VR_NL_SHM_STATE_INIT;
+
+    ret = nl_build_nlh(cl, cl->cl_genl_family_id, NLM_F_REQUEST);
+    if (!ret)
+        ret = nl_build_genlh(cl, SANDESH_SHM_ATTACH, 0);
+    if (ret)
+        goto exit_attach;
+
+    attr_len = nl_get_attr_hdr_size();
+    if (path_len + attr_len > nl_get_buf_len(cl)) {
+        ret = -ENOSPC;
+        goto exit_attach;
+    }
+
+    memcpy(nl_get_buf_ptr(cl) + attr_len, path, path_len);
+    nl_build_attr(cl, path_len, NL_ATTR_VR_MESSAGE_PROTOCOL);
+    nl_update_nlh(cl);
+
+    /* a vrouter that does not know the request answers with an error */
+    if (nl_sendmsg(cl) <= 0 || nl_recvmsg(cl) <= 0) {
+        ret = -errno;
+        goto exit_attach;
+    }
+
+    if (__atomic_load_n(&hdr->vns_state, __ATOMIC_ACQUIRE) !=
+            VR_NL_SHM_STATE_ATTACHED) {
+        ret = -EOPNOTSUPP;
+        goto exit_attach;
+    }
+
+    cl->cl_shm = hdr;
+    cl->cl_shm_len = len;
+    cl->cl_recvmsg = nl_client_shm_recvmsg;
+    ret = 0;
+
+exit_attach:
+    /* the file is not needed once both sides have it mapped */
+    unlink(path);
+    if (ret && hdr != MAP_FAILED)
+        munmap(hdr, len);
+
+    return ret;
+}
+
 int
 nl_sendmsg(struct nl_client *cl)
 {
     struct msghdr msg;
     struct iovec iov;
 
+    if (cl->cl_shm)
+        return nl_client_shm_sendmsg(cl);
+
     memset(&msg, 0, sizeof(msg));
 #if defined (__linux__)
     if (cl->cl_socket_domain != AF_UNIX) {
@@ -313,6 +502,12 @@ nl_sendmsg(struct nl_client *cl)
 void
 nl_free_os_specific(struct nl_client *cl)
 {
+    if (cl->cl_shm) {
+        munmap(cl->cl_shm, cl->cl_shm_len);
+        cl->cl_shm = NULL;
+        cl->cl_shm_len = 0;
+    }
+
     if (cl->cl_sock >= 0) {
         close(cl->cl_sock);
         cl->cl_sock = -1;
@@ -393,7 +393,7 @@ vr_interface_pbem_counters_print(const char *title, bool print_always,
 static void
 vr_interface_pesm_counters_print(const char *title, bool print_always,
             uint64_t packets, uint64_t errors, uint64_t syscalls,
-            uint64_t nombufs)
+            uint64_t offloads, uint64_t nombufs)
 {
     if (print_always || packets || errors) {
         vr_interface_print_head_space();
@@ -402,6 +402,8 @@ vr_interface_pesm_counters_print(const char *title, bool print_always,
                 title, packets, errors);
         if (syscalls)
             printf(" syscalls:%" PRId64, syscalls);
+        if (offloads)
+            printf(" offloads:%" PRId64, offloads);
         vr_interface_nombufs_print(nombufs);
     }
 }
@@ -594,7 +596,8 @@ list_get_print(vr_interface_req *req)
                 req->vifr_dev_ierrors, req->vifr_dev_inombufs);
         vr_interface_pesm_counters_print("RX port  ", print_zero,
                 req->vifr_port_ipackets, req->vifr_port_ierrors,
-                req->vifr_port_isyscalls, req->vifr_port_inombufs);
+                req->vifr_port_isyscalls, req->vifr_port_ioffloads,
+                req->vifr_port_inombufs);
         vr_interface_pe_counters_print("RX queue ", print_zero,
                 req->vifr_queue_ipackets, req->vifr_queue_ierrors);
 
@@ -620,6 +623,22 @@ list_get_print(vr_interface_req *req)
     vr_interface_print_head_space();
     printf("Drops:%" PRIu64 "\n", req->vifr_dpackets);
 
+    if (req->vifr_in_bps || req->vifr_in_pps) {
+        vr_interface_print_head_space();
+        printf("Ingress Policer: %" PRIu64 " bps %" PRIu64 " pps"
+                " Burst: %" PRIu64 " bytes %" PRIu64 " packets\n",
+                req->vifr_in_bps, req->vifr_in_pps,
+                req->vifr_in_burst_bytes, req->vifr_in_burst_pkts);
+    }
+
+    if (req->vifr_out_bps || req->vifr_out_pps) {
+        vr_interface_print_head_space();
+        printf("Egress Rate Limit: %" PRIu64 " bps %" PRIu64 " pps"
+                " Burst: %" PRIu64 " bytes %" PRIu64 " packets\n",
+                req->vifr_out_bps, req->vifr_out_pps,
+                req->vifr_out_burst_bytes, req->vifr_out_burst_pkts);
+    }
+
 
     if (req->vifr_in_mirror_md_size) {
         printed = vr_interface_print_head_space();
@@ -659,7 +678,7 @@ list_get_print(vr_interface_req *req)
                 req->vifr_queue_opackets, req->vifr_queue_oerrors);
         vr_interface_pesm_counters_print("TX port  ", print_zero,
                 req->vifr_port_opackets, req->vifr_port_oerrors,
-                req->vifr_port_osyscalls, 0);
+                req->vifr_port_osyscalls, req->vifr_port_ooffloads, 0);
         vr_interface_pbem_counters_print("TX device", print_zero,
                 req->vifr_dev_opackets, req->vifr_dev_obytes,
                 req->vifr_dev_oerrors, 0);
@@ -1639,6 +1658,7 @@ rate_stats_diff(vr_interface_req *req, vr_interface_req *prev_req)
     COMPUTE_DIFFERENCE(req, prev_req, vifr_port_ipackets, diff_ms);
     COMPUTE_DIFFERENCE(req, prev_req, vifr_port_ierrors, diff_ms);
     COMPUTE_DIFFERENCE(req, prev_req, vifr_port_inombufs, diff_ms);
+    COMPUTE_DIFFERENCE(req, prev_req, vifr_port_ioffloads, diff_ms);
 
     COMPUTE_DIFFERENCE(req, prev_req, vifr_queue_ierrors, diff_ms);
     COMPUTE_DIFFERENCE(req, prev_req, vifr_queue_ipackets, diff_ms);
@@ -1662,6 +1682,7 @@ rate_stats_diff(vr_interface_req *req, vr_interface_req *prev_req)
     COMPUTE_DIFFERENCE(req, prev_req, vifr_port_osyscalls, diff_ms);
     COMPUTE_DIFFERENCE(req, prev_req, vifr_port_opackets, diff_ms);
     COMPUTE_DIFFERENCE(req, prev_req, vifr_port_oerrors, diff_ms);
+    COMPUTE_DIFFERENCE(req, prev_req, vifr_port_ooffloads, diff_ms);
 
     COMPUTE_DIFFERENCE(req, prev_req, vifr_dev_obytes, diff_ms);
     COMPUTE_DIFFERENCE(req, prev_req, vifr_dev_opackets, diff_ms);
@@ -46,6 +46,7 @@
 
 /* Suppress NetLink error messages */
 bool vr_ignore_nl_errors = false;
+bool vr_nl_shm = false;
 int genetlink_group_id = 0;
 static bool vr_header_include = 0;
 
@@ -318,6 +319,12 @@ vr_get_nl_client(int proto)
             (vrouter_obtain_family_id(cl) <= 0))
         goto fail;
 
+    /* the socket is kept if the vrouter cannot do shared memory */
+    if ((proto == VR_NETLINK_PROTO_DEFAULT) &&
+            (cl->cl_socket_domain == AF_UNIX) &&
+            (vr_nl_shm || getenv(VR_NL_SHM_ENV)))
+        nl_shm_attach(cl);
+
     return cl;
 
 fail:
@@ -328,7 +335,7 @@ fail:
 }
 
 int
-vr_send_get_bridge_table_data(struct nl_client *cl)
+vr_send_get_bridge_table_data(struct nl_client *cl, unsigned int vrf)
 {
     int ret;
     vr_bridge_table_data req;
@@ -336,10 +343,88 @@ vr_send_get_bridge_table_data(struct nl_client *cl)
     memset(&req, 0, sizeof(req));
     req.btable_op = SANDESH_OP_GET;
     req.btable_rid = 0;
+    req.btable_vrf = vrf;
 
     return vr_sendmsg(cl, &req, "vr_bridge_table_data");
 }
 
+/*
+ * vr_bulk_add_object - encode request, a sandesh request of type
+ * request_string, at the end of the objects of the bulk request req.
+ * Returns 0 or -errno.
+ */
+int
+vr_bulk_add_object(vr_bulk_req *req, void *request, char *request_string)
+{
+    int ret, error = 0;
+    int8_t *objects;
+    int32_t *lens;
+
+    if (req->vbr_lens_size >= VR_MESSAGE_BULK_MAX_OBJECTS)
+        return -ENOSPC;
+
+    objects = realloc(req->vbr_objects,
+            req->vbr_objects_size + VR_BULK_OBJECT_BUF_LEN);
+    if (!objects)
+        return -ENOMEM;
+    req->vbr_objects = objects;
+
+    lens = realloc(req->vbr_lens, (req->vbr_lens_size + 1) * sizeof(*lens));
+    if (!lens)
+        return -ENOMEM;
+    req->vbr_lens = lens;
+
+    ret = sandesh_encode(request, request_string, vr_find_sandesh_info,
+            (unsigned char *)objects + req->vbr_objects_size,
+            VR_BULK_OBJECT_BUF_LEN, &error);
+    if (ret <= 0)
+        return -EINVAL;
+
+    req->vbr_objects_size += ret;
+    req->vbr_lens[req->vbr_lens_size++] = ret;
+
+    return 0;
+}
+
+/*
+ * vr_bulk_free - release what vr_bulk_add_object allocated for req
+ */
+void
+vr_bulk_free(vr_bulk_req *req)
+{
+    free(req->vbr_objects);
+    free(req->vbr_lens);
+    req->vbr_objects = NULL;
+    req->vbr_objects_size = 0;
+    req->vbr_lens = NULL;
+    req->vbr_lens_size = 0;
+
+    return;
+}
+
+int
+vr_send_bulk_request(struct nl_client *cl, unsigned int router_id,
+        vr_bulk_req *req)
+{
+    char *buf;
+    unsigned int len;
+
+    req->h_op = SANDESH_OP_ADD;
+    req->vbr_rid = router_id;
+
+    /* a bulk request does not have to fit the default message size */
+    len = NL_MSG_DEFAULT_SIZE + req->vbr_objects_size +
+        2 * req->vbr_lens_size * sizeof(*req->vbr_lens);
+    if (cl->cl_buf_len < len) {
+        buf = calloc(len, 1);
+        if (!buf)
+            return -ENOMEM;
+        nl_set_buf(cl, buf, len);
+    }
+
+    return vr_sendmsg(cl, req, "vr_bulk_req");
+}
+
 int
 vr_send_set_dcb_state(struct nl_client *cl, uint8_t *ifname, uint8_t state)
 {
@@ -542,6 +627,9 @@ vr_print_drop_stats(vr_drop_stats_req *stats, int core)
     PRINT_DROP_STAT("ICMP errors", stats->vds_icmp_error);
     PRINT_DROP_STAT("Clone Failures", stats->vds_clone_fail);
     PRINT_DROP_STAT("Invalid underlay ECMP", stats->vds_invalid_underlay_ecmp);
+    PRINT_DROP_STAT("Vif Ingress Policer", stats->vds_vif_policer_in);
+    PRINT_DROP_STAT("Vif Egress Rate Limit", stats->vds_vif_policer_out);
+    PRINT_DROP_STAT("Replication Ring Full", stats->vds_repl_ring_full);
 
     if (platform == DPDK_PLATFORM)
     {
@@ -686,6 +774,12 @@ vr_pkt_droplog_rsn(unsigned short drop_reason)
         return "Clone Failures";
     case VP_DROP_INVALID_UNDERLAY_ECMP:
         return "Invalid underlay ECMP";
+    case VP_DROP_VIF_POLICER_IN:
+        return "Vif Ingress Policer";
+    case VP_DROP_VIF_POLICER_OUT:
+        return "Vif Egress Rate Limit";
+    case VP_DROP_REPL_RING_FULL:
+        return "Replication Ring Full";
     default:
         return "Unknow";
     }
@@ -878,6 +972,9 @@ vr_sum_drop_stats(vr_drop_stats_req *req)
     sum += req->vds_pkt_loop;
     sum += req->vds_no_crypt_path;
     sum += req->vds_invalid_underlay_ecmp;
+    sum += req->vds_vif_policer_in;
+    sum += req->vds_vif_policer_out;
+    sum += req->vds_repl_ring_full;
 
     return sum;
 }
@@ -1548,7 +1645,8 @@ vr_send_mirror_delete(struct nl_client *cl, unsigned int router_id,
 int
 vr_send_mirror_add(struct nl_client *cl, unsigned int router_id,
         unsigned int mirror_index, int mirror_nh_index,
-        unsigned int mirror_flags, int vni_id)
+        unsigned int mirror_flags, int vni_id, unsigned int snaplen,
+        unsigned int sample_rate, unsigned int rate_limit)
 {
     vr_mirror_req req;
 
@@ -1560,6 +1658,9 @@ vr_send_mirror_add(struct nl_client *cl, unsigned int router_id,
     req.mirr_nhid = mirror_nh_index;
     req.mirr_flags = mirror_flags;
     req.mirr_vni = vni_id;
+    req.mirr_snaplen = snaplen;
+    req.mirr_sample_rate = sample_rate;
+    req.mirr_rate_limit = rate_limit;
 
     return vr_sendmsg(cl, &req, "vr_mirror_req");
 }
@@ -1771,6 +1872,12 @@ vr_nexthop_req_destroy(vr_nexthop_req *req)
         req->nhr_label_list_size = 0;
     }
 
+    if (req->nhr_weight_list_size && req->nhr_weight_list) {
+        free(req->nhr_weight_list);
+        req->nhr_weight_list = NULL;
+        req->nhr_weight_list_size = 0;
+    }
+
     if (req->nhr_tun_sip6_size && req->nhr_tun_sip6) {
         free(req->nhr_tun_sip6);
         req->nhr_tun_sip6 = NULL;
@@ -1818,6 +1925,8 @@ vr_nexthop_req_get_copy(vr_nexthop_req *src)
     dst->nhr_nh_list_size = 0;
     dst->nhr_label_list = NULL;
     dst->nhr_label_list_size = 0;
+    dst->nhr_weight_list = NULL;
+    dst->nhr_weight_list_size = 0;
     dst->nhr_tun_sip6 = NULL;
     dst->nhr_tun_sip6_size = 0;
     dst->nhr_tun_dip6 = NULL;
@@ -1856,6 +1965,16 @@ vr_nexthop_req_get_copy(vr_nexthop_req *src)
         dst->nhr_label_list_size = src->nhr_label_list_size;
     }
 
+    /* weight list */
+    if (src->nhr_weight_list_size && src->nhr_weight_list) {
+        dst->nhr_weight_list = malloc(src->nhr_weight_list_size * sizeof(int16_t));
+        if (!dst->nhr_weight_list)
+            goto free_nh;
+        memcpy(dst->nhr_weight_list, src->nhr_weight_list,
+                src->nhr_weight_list_size * sizeof(int16_t));
+        dst->nhr_weight_list_size = src->nhr_weight_list_size;
+    }
+
     /* ipv6 tunnel source */
     if (src->nhr_tun_sip6_size && src->nhr_tun_sip6) {
         dst->nhr_tun_sip6 = malloc(src->nhr_tun_sip6_size);
@@ -2623,7 +2742,8 @@ vr_send_fc_map_delete(struct nl_client *cl, unsigned int router_id,
 int
 vr_send_fc_map_add(struct nl_client *cl, unsigned int router_id,
         int16_t *fc_id, uint8_t fc_id_size,
-        uint8_t *dscp, uint8_t *mpls_qos, uint8_t *dotonep, uint8_t *queue)
+        uint8_t *dscp, uint8_t *mpls_qos, uint8_t *dotonep, uint8_t *queue,
+        uint8_t *sched_weight, int32_t *sched_rate)
 {
     vr_fc_map_req req;
 
@@ -2640,6 +2760,12 @@ vr_send_fc_map_add(struct nl_client *cl, unsigned int router_id,
     req.fmr_dotonep_size = fc_id_size;
     req.fmr_queue_id = queue;
     req.fmr_queue_id_size = fc_id_size;
+    if (sched_weight && sched_rate) {
+        req.fmr_sched_weight = sched_weight;
+        req.fmr_sched_weight_size = fc_id_size;
+        req.fmr_sched_rate = sched_rate;
+        req.fmr_sched_rate_size = fc_id_size;
+    }
 
     return vr_sendmsg(cl, &req, "vr_fc_map_req");
 }
@@ -81,8 +81,6 @@ mem_stats_req_process(void *s_req)
             stats->vms_htable_object);
     printf("Interface                       %" PRIu64 "\n",
             stats->vms_interface_object);
-    printf("Interface Bridge Lock           %" PRIu64 "\n",
-            stats->vms_interface_bridge_lock_object);
     printf("Interface Fat Flow Config       %" PRIu64 "\n",
             stats->vms_interface_fat_flow_config_object);
     printf("Interface MAC                   %" PRIu64 "\n",
@@ -173,6 +171,12 @@ mem_stats_req_process(void *s_req)
             stats->vms_interface_fat_flow_ipv4_exclude_list_object);
     printf("Fatflow v6 exclude list object  %" PRIu64 "\n",
             stats->vms_interface_fat_flow_ipv6_exclude_list_object);
+    printf("NextHop Replication Stats       %" PRIu64 "\n",
+            stats->vms_nexthop_repl_stats_object);
+    printf("Bridge Learn                    %" PRIu64 "\n",
+            stats->vms_bridge_learn_object);
+    printf("Interface Policer               %" PRIu64 "\n",
+            stats->vms_interface_policer_object);
     return;
 }
 